@@ -0,0 +1,155 @@
+//
+// Per-job memory arena for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include <stddef.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_ARENA_ALIGN _Alignof(max_align_t)
+                                        // Alignment of allocations
+#define BRF_ARENA_BLOCK 4096            // Default size of a block
+
+// Local types...
+
+typedef struct brf_arena_block_s        // Block of arena memory
+{
+  struct brf_arena_block_s *next;       // Previously filled block
+  size_t size,                          // Usable size of block
+      used;                             // Bytes used in block
+  max_align_t data[];                   // Memory
+} brf_arena_block_t;
+
+struct brf_arena_s                      // Arena
+{
+  brf_arena_block_t *blocks;            // Current block, then older ones
+  size_t block_size;                    // Size of new blocks
+};
+
+// Local functions...
+
+static brf_arena_block_t *brf_arena_add_block(brf_arena_t *arena, size_t size);
+
+// 'brf_ArenaAlloc()' - Allocate zeroed memory from an arena.
+//
+// The memory stays valid until the arena is deleted.
+
+void *                                  // O - Memory or `NULL` on error
+brf_ArenaAlloc(brf_arena_t *arena,      // I - Arena
+               size_t size)             // I - Number of bytes
+{
+  brf_arena_block_t *block = arena->blocks;
+                                        // Current block
+  void *ptr;                            // Allocated memory
+
+  size = (size + BRF_ARENA_ALIGN - 1) & ~(BRF_ARENA_ALIGN - 1);
+
+  if (!block || block->size - block->used < size)
+  {
+    // Large allocations get a block of their own behind the current one
+    if (size > arena->block_size / 4 && block)
+    {
+      brf_arena_block_t *large;         // Block for this allocation
+
+      if ((large = (brf_arena_block_t *)calloc(1, sizeof(brf_arena_block_t) + size)) == NULL)
+        return (NULL);
+
+      large->size = large->used = size;
+      large->next = block->next;
+      block->next = large;
+
+      return (large->data);
+    }
+
+    if ((block = brf_arena_add_block(arena, size)) == NULL)
+      return (NULL);
+  }
+
+  ptr = (char *)block->data + block->used;
+  block->used += size;
+
+  return (ptr);
+}
+
+// 'brf_ArenaCreate()' - Create a memory arena.
+
+brf_arena_t *                           // O - Arena or `NULL` on error
+brf_ArenaCreate(size_t block_size)      // I - Size of blocks or 0 for default
+{
+  brf_arena_t *arena;                   // Arena
+
+  if ((arena = (brf_arena_t *)calloc(1, sizeof(brf_arena_t))) == NULL)
+    return (NULL);
+
+  arena->block_size = block_size > 0 ? block_size : BRF_ARENA_BLOCK;
+
+  return (arena);
+}
+
+// 'brf_ArenaDelete()' - Free an arena and all memory allocated from it.
+
+void
+brf_ArenaDelete(brf_arena_t *arena)     // I - Arena
+{
+  brf_arena_block_t *block,             // Current block
+      *next;                            // Next block
+
+  if (!arena)
+    return;
+
+  for (block = arena->blocks; block; block = next)
+  {
+    next = block->next;
+    free(block);
+  }
+
+  free(arena);
+}
+
+// 'brf_ArenaStrdup()' - Copy a string into an arena.
+
+char *                                  // O - Copy or `NULL` on error
+brf_ArenaStrdup(brf_arena_t *arena,     // I - Arena
+                const char *s)          // I - String or `NULL`
+{
+  size_t len;                           // Length of string
+  char *copy;                           // Copy of string
+
+  if (!s)
+    return (NULL);
+
+  len = strlen(s) + 1;
+
+  if ((copy = (char *)brf_ArenaAlloc(arena, len)) != NULL)
+    memcpy(copy, s, len);
+
+  return (copy);
+}
+
+// 'brf_arena_add_block()' - Start a new block with room for `size` bytes.
+
+static brf_arena_block_t *              // O - New block or `NULL` on error
+brf_arena_add_block(brf_arena_t *arena, // I - Arena
+                    size_t size)        // I - Bytes needed
+{
+  brf_arena_block_t *block;             // New block
+
+  if (size < arena->block_size)
+    size = arena->block_size;
+
+  if ((block = (brf_arena_block_t *)calloc(1, sizeof(brf_arena_block_t) + size)) == NULL)
+    return (NULL);
+
+  block->size   = size;
+  block->next   = arena->blocks;
+  arena->blocks = block;
+
+  return (block);
+}
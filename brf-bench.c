@@ -0,0 +1,1033 @@
+//
+// Benchmarks for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+// Usage:
+//
+//   ./brf-bench [-n ITERATIONS] TEST [FILES]
+//
+// Tests:
+//
+//   device    Send BRF volumes of 4 to 64 MiB to a device, buffered and
+//             zero-copy
+//   image     Time Canny edges against ordered and diffusion halftoning for
+//             each image file
+//   jobs      Print thousands of jobs on a server and check that its memory
+//             use does not grow (default file "print-test/test.txt")
+//   mime      Time the built-in signatures against libmagic for each file
+//   raster    Time the raster line kernels at A4 and legal size, 200 dpi
+//   scaling   Time Canny edge detection of a large image on 1 to N threads
+//             (N defaults to the number of CPUs)
+//
+
+// The application, driver and image filter are built in with main() renamed,
+// so the benchmarks can call the same functions as the print path...
+#define main brf_app_main
+#include "brf-printer-app.c"
+#undef main
+#undef brf_TESTPAGE_MIMETYPE
+#include "generic-brf.c"
+#include "brf-image.c"
+
+#include <ftw.h>
+#include <magic.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+// Local constants...
+
+#define BRF_BENCH_HEADER 8192           // Bytes of a document used for detection
+#define BRF_BENCH_IMAGE_SIZE 4096       // Width and height of the large image
+#define BRF_BENCH_JOBS_BATCH 100        // Jobs queued before waiting for them
+#define BRF_BENCH_JOBS_GROWTH 256       // Largest memory growth per job in bytes
+#define BRF_BENCH_JOBS_WARMUP 1000      // Jobs printed before measuring
+#define BRF_BENCH_RESOLUTION 200        // Raster resolution of the driver
+
+// Local types...
+
+typedef struct brf_bench_feed_s         // Input pipe fed from a file
+{
+  int srcfd,                            // File to copy
+      pipefd;                           // Write end of pipe
+} brf_bench_feed_t;
+
+// Local functions...
+
+static int brf_bench_device(int iterations);
+static void *brf_bench_drain(void *data);
+static void *brf_bench_feed(void *data);
+static int brf_bench_image(int iterations, int num_files, char *files[]);
+static int brf_bench_jobs(int iterations, const char *filename);
+static int brf_bench_mime(int iterations, int num_files, char *files[]);
+static int brf_bench_raster(int iterations);
+static size_t brf_bench_read(const char *filename, unsigned char *buffer, size_t bufsize);
+static int brf_bench_remove(const char *path, const struct stat *info, int type, struct FTW *ftw);
+static long brf_bench_rss(pid_t pid);
+static int brf_bench_scaling(int iterations, int max_threads);
+static double brf_bench_send(const char *filename, bool from_pipe, bool zero_copy);
+static int brf_bench_usage(void);
+static bool brf_bench_volume(const char *filename, size_t size);
+static bool brf_bench_wait(http_t *http, const char *uri, const char *resource, pid_t pid);
+
+// 'main()' - Run a benchmark.
+
+int                                     // O - Exit status
+main(int argc,                          // I - Number of command-line arguments
+     char *argv[])                      // I - Command-line arguments
+{
+  int i,                                // Looping var
+      iterations = 0;                   // Number of iterations
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i ++)
+  {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc)
+    {
+      if ((iterations = atoi(argv[++ i])) <= 0)
+        return (brf_bench_usage());
+    }
+    else
+      return (brf_bench_usage());
+  }
+
+  if (i >= argc)
+    return (brf_bench_usage());
+
+  if (!strcmp(argv[i], "device"))
+    return (brf_bench_device(iterations > 0 ? iterations : 5));
+  else if (!strcmp(argv[i], "image"))
+    return (brf_bench_image(iterations > 0 ? iterations : 20, argc - i - 1, argv + i + 1));
+  else if (!strcmp(argv[i], "jobs"))
+    return (brf_bench_jobs(iterations > 0 ? iterations : 5000, i + 1 < argc ? argv[i + 1] : "print-test/test.txt"));
+  else if (!strcmp(argv[i], "mime"))
+    return (brf_bench_mime(iterations > 0 ? iterations : 1000, argc - i - 1, argv + i + 1));
+  else if (!strcmp(argv[i], "raster"))
+    return (brf_bench_raster(iterations > 0 ? iterations : 1000));
+  else if (!strcmp(argv[i], "scaling"))
+    return (brf_bench_scaling(iterations > 0 ? iterations : 3, i + 1 < argc ? atoi(argv[i + 1]) : (int)sysconf(_SC_NPROCESSORS_ONLN)));
+
+  return (brf_bench_usage());
+}
+
+// 'brf_bench_device()' - Time sending BRF volumes to a device.
+//
+// The device is a pipe drained by another thread, like the pipe into a CUPS
+// backend that brf_print_filter_function() writes to directly.  Volumes are
+// sent from a spool file and from a pipe, like the output of a filter chain,
+// once through a 64 KiB buffer and once with brf_print_zero_copy().
+
+static int                              // O - Exit status
+brf_bench_device(int iterations)        // I - Number of runs per volume
+{
+  static const size_t sizes[] =         // Volume sizes in MiB
+  {
+    4, 16, 64
+  };
+  char filename[1024];                  // Volume file
+  const char *tmpdir;                   // Temporary directory
+  size_t i;                             // Looping var
+  int run,                              // Current run
+      mode;                             // Input and copy mode
+  double elapsed[4];                    // Time for each mode
+
+  if ((tmpdir = getenv("TMPDIR")) == NULL)
+    tmpdir = "/tmp";
+
+  snprintf(filename, sizeof(filename), "%s/brf-bench-%d.brf", tmpdir, (int)getpid());
+
+  printf("device: best of %d runs per volume, MB/s\n\n", iterations);
+  printf("%-8s %12s %12s %12s %12s\n", "Volume", "File/buffer", "File/zero", "Pipe/buffer", "Pipe/zero");
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i ++)
+  {
+    if (!brf_bench_volume(filename, sizes[i] * 1048576))
+    {
+      fprintf(stderr, "brf-bench: Unable to create '%s': %s\n", filename, strerror(errno));
+      unlink(filename);
+      return (1);
+    }
+
+    for (mode = 0; mode < 4; mode ++)
+    {
+      for (run = 0, elapsed[mode] = 0.0; run < iterations; run ++)
+      {
+        double t = brf_bench_send(filename, mode >= 2, mode & 1);
+                                        // Time for this run
+
+        if (t < 0.0)
+        {
+          fprintf(stderr, "brf-bench: Unable to send '%s': %s\n", filename, strerror(errno));
+          unlink(filename);
+          return (1);
+        }
+
+        if (run == 0 || t < elapsed[mode])
+          elapsed[mode] = t;
+      }
+    }
+
+    printf("%4u MiB %12.0f %12.0f %12.0f %12.0f\n", (unsigned)sizes[i], sizes[i] * 1.048576 / elapsed[0], sizes[i] * 1.048576 / elapsed[1], sizes[i] * 1.048576 / elapsed[2], sizes[i] * 1.048576 / elapsed[3]);
+  }
+
+  unlink(filename);
+
+  return (0);
+}
+
+// 'brf_bench_drain()' - Read a device pipe until it is closed.
+
+static void *                           // O - Thread exit status
+brf_bench_drain(void *data)             // I - Read end of pipe
+{
+  int fd = *(int *)data;                // Read end of pipe
+  char buffer[65536];                   // Read buffer
+  ssize_t bytes;                        // Bytes read
+
+  while ((bytes = read(fd, buffer, sizeof(buffer))) != 0)
+  {
+    if (bytes < 0 && errno != EINTR && errno != EAGAIN)
+      break;
+  }
+
+  return (NULL);
+}
+
+// 'brf_bench_feed()' - Copy a file into a pipe and close it.
+
+static void *                           // O - Thread exit status
+brf_bench_feed(void *data)              // I - Input pipe
+{
+  brf_bench_feed_t *feed = (brf_bench_feed_t *)data;
+                                        // Input pipe
+  char buffer[65536];                   // Copy buffer
+  ssize_t bytes;                        // Bytes read
+
+  while ((bytes = read(feed->srcfd, buffer, sizeof(buffer))) > 0)
+  {
+    if (brf_WriteAll(feed->pipefd, buffer, (size_t)bytes) < 0)
+      break;
+  }
+
+  close(feed->pipefd);
+
+  return (NULL);
+}
+
+// 'brf_bench_image()' - Time the image filter with each rendering mode.
+//
+// The whole filter runs as it does for a job with only "Edge" set, from
+// decoding the file to writing the BRF page to a temporary file.  The raised
+// dots of the page show how much of the tactile graphic each mode fills.
+
+static int                              // O - Exit status
+brf_bench_image(int iterations,         // I - Number of pages per mode
+                int num_files,          // I - Number of files
+                char *files[])          // I - Image files
+{
+  static const char * const modes[] =   // Rendering modes
+  {
+    "Canny",
+    "Ordered",
+    "Diffusion"
+  };
+  cups_option_t option;                 // "Edge" option
+  cf_filter_data_t data;                // Filter data
+  int infd,                             // Image file
+      outfd,                            // BRF page
+      i, j, k,                          // Looping vars
+      dots;                             // Raised dots
+  char outname[] = "/tmp/brf-benchXXXXXX",
+                                        // Name of BRF page
+      page[65536],                      // BRF page
+      *ptr;                             // Pointer into page
+  const char *cell;                     // Cell in dot order
+  ssize_t bytes;                        // Bytes in page
+  double start,                         // Start time
+      elapsed;                          // Time per page
+
+  if (num_files < 1)
+    return (brf_bench_usage());
+
+  if ((outfd = mkstemp(outname)) < 0)
+  {
+    fprintf(stderr, "brf-bench: Unable to create temporary file: %s\n", strerror(errno));
+    return (1);
+  }
+
+  unlink(outname);
+
+  memset(&data, 0, sizeof(data));
+  data.num_options = 1;
+  data.options     = &option;
+  option.name      = (char *)"Edge";
+
+  printf("image: %d pages per mode\n\n", iterations);
+  printf("%-24s %-10s %10s %10s %8s\n", "File", "Edge", "ms/page", "Pages/s", "Dots");
+
+  for (i = 0; i < num_files; i ++)
+  {
+    if ((infd = open(files[i], O_RDONLY | O_CLOEXEC)) < 0)
+    {
+      fprintf(stderr, "brf-bench: Unable to open '%s': %s\n", files[i], strerror(errno));
+      continue;
+    }
+
+    for (j = 0; j < (int)(sizeof(modes) / sizeof(modes[0])); j ++)
+    {
+      option.value = (char *)modes[j];
+
+      start = brf_GetTime();
+
+      for (k = 0; k < iterations; k ++)
+      {
+        lseek(infd, 0, SEEK_SET);
+        lseek(outfd, 0, SEEK_SET);
+
+        if (ftruncate(outfd, 0) || brf_ImageFilter(infd, outfd, 1, &data, NULL))
+          break;
+      }
+
+      elapsed = (brf_GetTime() - start) / iterations;
+
+      if (k < iterations)
+      {
+        fprintf(stderr, "brf-bench: Unable to convert '%s' with Edge=%s.\n", files[i], modes[j]);
+        break;
+      }
+
+      // Count the raised dots of the last page...
+      lseek(outfd, 0, SEEK_SET);
+
+      if ((bytes = read(outfd, page, sizeof(page))) < 0)
+        bytes = 0;
+
+      for (ptr = page, dots = 0; ptr < (page + bytes); ptr ++)
+      {
+        if (*ptr && (cell = strchr(brf_image_ascii, toupper(*ptr & 255))) != NULL)
+          dots += __builtin_popcount((unsigned)(cell - brf_image_ascii));
+      }
+
+      printf("%-24s %-10s %10.3f %10.1f %8d\n", files[i], modes[j], elapsed * 1000.0, elapsed > 0.0 ? 1.0 / elapsed : 0.0, dots);
+    }
+
+    close(infd);
+  }
+
+  close(outfd);
+
+  return (0);
+}
+
+// 'brf_bench_jobs()' - Print jobs on a server and check its memory use.
+//
+// The server runs in a child process with its own port, spool directory and
+// state file, and prints to "file:///dev/null".  The resident memory of the
+// server is read after a warm-up, when the job history and caches are full,
+// and again after every batch of jobs.  The test fails when it grew by more
+// than BRF_BENCH_JOBS_GROWTH bytes per job, like it did when the filter chain
+// state of every job was leaked.
+
+static int                              // O - Exit status
+brf_bench_jobs(int iterations,          // I - Number of jobs to measure
+               const char *filename)    // I - File to print
+{
+  char tempdir[] = "/tmp/brf-benchXXXXXX",
+                                        // Spool and state directory
+      portopt[64],                      // server-port option
+      spoolopt[1024],                   // spool-directory option
+      logopt[1024],                     // log-file option
+      uri[1024],                        // Printer or system URI
+      resource[256];                    // Printer resource
+  char *server_argv[] =                 // Server command-line
+  {
+    (char *)"brf-bench",
+    (char *)"server",
+    (char *)"-o",
+    portopt,
+    (char *)"-o",
+    spoolopt,
+    (char *)"-o",
+    logopt,
+    (char *)"-o",
+    (char *)"log-level=warn",
+    NULL
+  };
+  struct sockaddr_in addr;              // Address of a free port
+  socklen_t addrlen = sizeof(addr);     // Length of address
+  int sock,                             // Socket to find a free port
+      port,                             // Server port
+      i, j,                             // Looping vars
+      status = 1;                       // Exit status
+  pid_t pid;                            // Server process
+  http_t *http = NULL;                  // Connection to the server
+  ipp_t *request,                       // IPP request
+      *response;                        // IPP response
+  long base_rss,                        // Memory use after warm-up
+      rss = 0;                          // Current memory use
+  double growth;                        // Memory growth per job in bytes
+
+  if (access(filename, R_OK))
+  {
+    fprintf(stderr, "brf-bench: Unable to open '%s': %s\n", filename, strerror(errno));
+    return (1);
+  }
+
+  // Find a free port for the server...
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) || getsockname(sock, (struct sockaddr *)&addr, &addrlen))
+  {
+    fprintf(stderr, "brf-bench: Unable to find a free port: %s\n", strerror(errno));
+    if (sock >= 0)
+      close(sock);
+    return (1);
+  }
+
+  port = ntohs(addr.sin_port);
+  close(sock);
+
+  if (!mkdtemp(tempdir))
+  {
+    fprintf(stderr, "brf-bench: Unable to create temporary directory: %s\n", strerror(errno));
+    return (1);
+  }
+
+  snprintf(portopt, sizeof(portopt), "server-port=%d", port);
+  snprintf(spoolopt, sizeof(spoolopt), "spool-directory=%s", tempdir);
+  snprintf(logopt, sizeof(logopt), "log-file=%s/log", tempdir);
+
+  // Start the server with the state file in the temporary directory...
+  if ((pid = fork()) == 0)
+  {
+    char output[1024];                  // Server output file
+    int fd;                             // Server output
+
+    snprintf(output, sizeof(output), "%s/output", tempdir);
+
+    if ((fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0600)) >= 0)
+    {
+      dup2(fd, 1);
+      dup2(fd, 2);
+      close(fd);
+    }
+
+    setenv("XDG_DATA_HOME", tempdir, 1);
+    _exit(brf_app_main((int)(sizeof(server_argv) / sizeof(server_argv[0])) - 1, server_argv));
+  }
+  else if (pid < 0)
+  {
+    fprintf(stderr, "brf-bench: Unable to start server: %s\n", strerror(errno));
+    goto finish;
+  }
+
+  for (i = 0; i < 300 && (http = httpConnect2("localhost", port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED, 1, 30000, NULL)) == NULL; i ++)
+  {
+    if (waitpid(pid, NULL, WNOHANG) == pid)
+    {
+      pid = 0;
+      break;
+    }
+
+    usleep(100000);
+  }
+
+  if (!http)
+  {
+    fprintf(stderr, "brf-bench: Unable to connect to server on port %d.\n", port);
+    goto finish;
+  }
+
+  // Add a printer that discards its output...
+  httpAssembleURI(HTTP_URI_CODING_ALL, uri, sizeof(uri), "ipp", NULL, "localhost", port, "/ipp/system");
+
+  request = ippNewRequest(IPP_OP_CREATE_PRINTER);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "system-uri", NULL, uri);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "printer-service-type", NULL, "print");
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "smi55357-driver", NULL, "gen_brf");
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "smi55357-device-uri", NULL, "file:///dev/null");
+  ippAddString(request, IPP_TAG_PRINTER, IPP_TAG_NAME, "printer-name", NULL, "brf-bench");
+
+  ippDelete(cupsDoRequest(http, request, "/ipp/system"));
+
+  if (cupsLastError() >= IPP_STATUS_ERROR_BAD_REQUEST)
+  {
+    fprintf(stderr, "brf-bench: Unable to add printer: %s\n", cupsLastErrorString());
+    goto finish;
+  }
+
+  httpAssembleURI(HTTP_URI_CODING_ALL, uri, sizeof(uri), "ipp", NULL, "localhost", port, "/ipp/print/brf-bench");
+  papplCopyString(resource, "/ipp/print/brf-bench", sizeof(resource));
+
+  printf("jobs: %d jobs of '%s' after %d to warm up\n\n", iterations, filename, BRF_BENCH_JOBS_WARMUP);
+  printf("%8s %12s\n", "Jobs", "RSS (KiB)");
+
+  // Print the jobs in batches, measuring after the warm-up and each batch...
+  for (i = -BRF_BENCH_JOBS_WARMUP, base_rss = 0; i < iterations; i += BRF_BENCH_JOBS_BATCH)
+  {
+    for (j = 0; j < BRF_BENCH_JOBS_BATCH; j ++)
+    {
+      request = ippNewRequest(IPP_OP_PRINT_JOB);
+      ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, uri);
+      ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+      ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name", NULL, "brf-bench");
+      ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, "application/octet-stream");
+
+      response = cupsDoFileRequest(http, request, resource, filename);
+      ippDelete(response);
+
+      if (cupsLastError() >= IPP_STATUS_ERROR_BAD_REQUEST)
+      {
+        fprintf(stderr, "brf-bench: Unable to print '%s': %s\n", filename, cupsLastErrorString());
+        goto finish;
+      }
+    }
+
+    if (!brf_bench_wait(http, uri, resource, pid) || (rss = brf_bench_rss(pid)) < 0)
+      goto finish;
+
+    if (i + BRF_BENCH_JOBS_BATCH == 0)
+      base_rss = rss;
+
+    if (i + BRF_BENCH_JOBS_BATCH >= 0 && (((i + BRF_BENCH_JOBS_BATCH) % 1000) == 0 || i + BRF_BENCH_JOBS_BATCH >= iterations))
+      printf("%8d %12ld\n", i + BRF_BENCH_JOBS_BATCH, rss);
+  }
+
+  growth = (rss - base_rss) * 1024.0 / i;
+
+  printf("\nGrowth: %.0f bytes per job (limit %d): %s\n", growth, BRF_BENCH_JOBS_GROWTH, growth > BRF_BENCH_JOBS_GROWTH ? "FAIL" : "PASS");
+
+  status = growth > BRF_BENCH_JOBS_GROWTH;
+
+  finish:
+
+  httpClose(http);
+
+  if (pid > 0)
+  {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+  }
+
+  // Keep the log and output of the server when something went wrong...
+  if (status)
+    fprintf(stderr, "brf-bench: Server log and output are in '%s'.\n", tempdir);
+  else
+    nftw(tempdir, brf_bench_remove, 16, FTW_DEPTH | FTW_PHYS);
+
+  return (status);
+}
+
+// 'brf_bench_mime()' - Time the built-in signatures against libmagic.
+//
+// Both look at the same header of each file.  libmagic is loaded once up
+// front, like the handles brf_MimeDetect() keeps, so only the lookups are
+// timed.
+
+static int                              // O - Exit status
+brf_bench_mime(int iterations,          // I - Number of lookups per file
+               int num_files,           // I - Number of files
+               char *files[])           // I - Files
+{
+  magic_t magic;                        // libmagic cookie
+  unsigned char header[BRF_BENCH_HEADER];
+                                        // Header of file
+  size_t headersize;                    // Bytes in header
+  const char *sniffed,                  // Type from the built-in signatures
+      *detected;                        // Type from libmagic
+  char detected_copy[256];              // Copy of libmagic's type
+  double start,                         // Start time
+      sniff_time,                       // Time for the signatures
+      magic_time;                       // Time for libmagic
+  int i, j;                             // Looping vars
+
+  if (num_files < 1)
+    return (brf_bench_usage());
+
+  brf_MimeInit(NULL, converts);
+
+  start = brf_GetTime();
+
+  if ((magic = magic_open(MAGIC_MIME_TYPE)) == NULL || magic_load(magic, NULL))
+  {
+    fprintf(stderr, "brf-bench: Unable to load the magic database.\n");
+    return (1);
+  }
+
+  printf("mime: %d lookups per file, magic database loaded in %.3fms\n\n", iterations, (brf_GetTime() - start) * 1000.0);
+  printf("%-24s %-26s %10s  %-26s %10s %8s\n", "File", "Signatures", "us/lookup", "libmagic", "us/lookup", "Speedup");
+
+  for (i = 0; i < num_files; i ++)
+  {
+    if ((headersize = brf_bench_read(files[i], header, sizeof(header))) == 0)
+      continue;
+
+    start = brf_GetTime();
+    for (j = 0, sniffed = NULL; j < iterations; j ++)
+      sniffed = brf_MimeSniff(header, headersize);
+    sniff_time = (brf_GetTime() - start) / iterations;
+
+    start = brf_GetTime();
+    for (j = 0, detected = NULL; j < iterations; j ++)
+      detected = magic_buffer(magic, header, headersize);
+    magic_time = (brf_GetTime() - start) / iterations;
+
+    papplCopyString(detected_copy, detected ? detected : "(none)", sizeof(detected_copy));
+
+    printf("%-24s %-26s %10.2f  %-26s %10.2f %7.0fx\n", files[i], sniffed ? sniffed : "(libmagic)", sniff_time * 1000000.0, detected_copy, magic_time * 1000000.0, sniff_time > 0.0 ? magic_time / sniff_time : 0.0);
+  }
+
+  magic_close(magic);
+  brf_MimeShutdown();
+
+  return (0);
+}
+
+// 'brf_bench_raster()' - Time the raster line kernels.
+//
+// Every kernel inverts and blank-tests the lines of a page the size of the
+// full media at the driver's resolution, a quarter of them blank like the
+// margins and line gaps of a tactile graphic.
+
+static int                              // O - Exit status
+brf_bench_raster(int iterations)        // I - Number of pages per kernel
+{
+  static const struct
+  {
+    const char *name;                   // Media size
+    double width,                       // Width in inches
+        length;                         // Length in inches
+  } sizes[] =
+  {
+    { "A4", 210.0 / 25.4, 297.0 / 25.4 },
+    { "Legal", 8.5, 14.0 }
+  };
+  struct
+  {
+    const char *name;                   // Kernel
+    brf_gen_invert_cb_t cb;             // Kernel function
+  } kernels[3];                         // Kernels of this CPU
+  int num_kernels = 0,                  // Number of kernels
+      i, k,                             // Looping vars
+      page,                             // Current page
+      dots;                             // Lines with dots
+  size_t bytes,                         // Bytes per line
+      lines,                            // Lines per page
+      y;                                // Current line
+  unsigned char *raster,                // Page of raster lines
+      *buffer;                          // Inverted line
+  double start,                         // Start time
+      elapsed;                          // Time for all pages
+
+  kernels[num_kernels].name = "scalar";
+  kernels[num_kernels ++].cb = brf_gen_invert;
+#ifdef BRF_GEN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+  {
+    kernels[num_kernels].name = "sse2";
+    kernels[num_kernels ++].cb = brf_gen_invert_sse2;
+  }
+  if (__builtin_cpu_supports("avx2"))
+  {
+    kernels[num_kernels].name = "avx2";
+    kernels[num_kernels ++].cb = brf_gen_invert_avx2;
+  }
+#endif // BRF_GEN_X86
+
+  printf("raster: %d pages per kernel at %d dpi, lines/s\n\n", iterations, BRF_BENCH_RESOLUTION);
+  printf("%-6s %10s %8s", "Media", "Bytes/line", "Lines");
+  for (k = 0; k < num_kernels; k ++)
+    printf(" %12s", kernels[k].name);
+  putchar('\n');
+
+  for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i ++)
+  {
+    bytes = (size_t)(sizes[i].width * BRF_BENCH_RESOLUTION + 7) / 8;
+    lines = (size_t)(sizes[i].length * BRF_BENCH_RESOLUTION);
+
+    if ((raster = (unsigned char *)calloc(lines, bytes)) == NULL || (buffer = (unsigned char *)malloc(bytes)) == NULL)
+    {
+      free(raster);
+      return (1);
+    }
+
+    for (y = 0; y < lines; y ++)
+    {
+      if (y % 4)
+        raster[y * bytes + (y * 7) % bytes] = (unsigned char)(1 << (y % 8));
+    }
+
+    printf("%-6s %10u %8u", sizes[i].name, (unsigned)bytes, (unsigned)lines);
+
+    for (k = 0; k < num_kernels; k ++)
+    {
+      start = brf_GetTime();
+
+      for (page = 0, dots = 0; page < iterations; page ++)
+      {
+        for (y = 0; y < lines; y ++)
+          dots += (kernels[k].cb)(raster + y * bytes, buffer, bytes);
+      }
+
+      elapsed = brf_GetTime() - start;
+
+      if (dots != iterations * (int)(lines - (lines + 3) / 4))
+        fprintf(stderr, "brf-bench: The %s kernel found %d lines with dots.\n", kernels[k].name, dots);
+
+      printf(" %12.0f", elapsed > 0.0 ? iterations * lines / elapsed : 0.0);
+    }
+
+    putchar('\n');
+
+    free(raster);
+    free(buffer);
+  }
+
+  return (0);
+}
+
+// 'brf_bench_read()' - Read the start of a file.
+
+static size_t                           // O - Bytes read or 0 on error
+brf_bench_read(const char *filename,    // I - File
+               unsigned char *buffer,   // I - Buffer
+               size_t bufsize)          // I - Size of buffer
+{
+  int fd;                               // File
+  ssize_t bytes;                        // Bytes read
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+  {
+    fprintf(stderr, "brf-bench: Unable to open '%s': %s\n", filename, strerror(errno));
+    return (0);
+  }
+
+  if ((bytes = read(fd, buffer, bufsize)) <= 0)
+  {
+    fprintf(stderr, "brf-bench: Unable to read '%s': %s\n", filename, bytes < 0 ? strerror(errno) : "Empty file");
+    bytes = 0;
+  }
+
+  close(fd);
+
+  return ((size_t)bytes);
+}
+
+// 'brf_bench_remove()' - Remove a file or directory of a tree.
+
+static int                              // O - 0 to continue
+brf_bench_remove(const char *path,      // I - File or directory
+                 const struct stat *info, // I - File information (unused)
+                 int type,              // I - Type of entry (unused)
+                 struct FTW *ftw)       // I - Position in tree (unused)
+{
+  (void)info;
+  (void)type;
+  (void)ftw;
+
+  remove(path);
+
+  return (0);
+}
+
+// 'brf_bench_rss()' - Get the resident memory of a process.
+
+static long                             // O - Resident memory in KiB or -1 on error
+brf_bench_rss(pid_t pid)                // I - Process ID
+{
+  char filename[256],                   // /proc status file
+      line[256];                        // Line from file
+  FILE *fp;                             // Status file
+  long rss = -1;                        // Resident memory
+
+  snprintf(filename, sizeof(filename), "/proc/%d/status", (int)pid);
+
+  if ((fp = fopen(filename, "r")) == NULL)
+  {
+    fprintf(stderr, "brf-bench: Unable to open '%s': %s\n", filename, strerror(errno));
+    return (-1);
+  }
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    if (!strncmp(line, "VmRSS:", 6))
+    {
+      rss = atol(line + 6);
+      break;
+    }
+  }
+
+  fclose(fp);
+
+  return (rss);
+}
+
+// 'brf_bench_scaling()' - Time edge detection on 1 to N threads.
+//
+// The image is a large drawing of rings and squares, like a scanned poster.
+// The thread count is set with BRF_IMAGE_THREADS, and the edges found with
+// each count are compared to those found on one thread.
+
+static int                              // O - Exit status
+brf_bench_scaling(int iterations,       // I - Runs per thread count
+                  int max_threads)      // I - Largest thread count
+{
+  brf_image_t image;                    // Drawing
+  unsigned char *edges,                 // Edges with this thread count
+      *reference;                       // Edges found on one thread
+  int x, y,                             // Looping vars
+      threads,                          // Current thread count
+      run;                              // Current run
+  char value[16];                       // BRF_IMAGE_THREADS value
+  double start,                         // Start time
+      elapsed,                          // Time for this run
+      best,                             // Best time for this thread count
+      single = 0.0;                     // Best time on one thread
+  size_t size = (size_t)BRF_BENCH_IMAGE_SIZE * BRF_BENCH_IMAGE_SIZE;
+                                        // Pixels in image
+
+  if (max_threads < 1 || max_threads > BRF_IMAGE_MAX_THREADS)
+    return (brf_bench_usage());
+
+  image.width  = BRF_BENCH_IMAGE_SIZE;
+  image.height = BRF_BENCH_IMAGE_SIZE;
+
+  if ((image.pixels = (unsigned char *)malloc(size)) == NULL || (edges = (unsigned char *)malloc(size)) == NULL || (reference = (unsigned char *)malloc(size)) == NULL)
+  {
+    fprintf(stderr, "brf-bench: Unable to allocate a %dx%d image.\n", BRF_BENCH_IMAGE_SIZE, BRF_BENCH_IMAGE_SIZE);
+    return (1);
+  }
+
+  for (y = 0; y < BRF_BENCH_IMAGE_SIZE; y ++)
+  {
+    for (x = 0; x < BRF_BENCH_IMAGE_SIZE; x ++)
+    {
+      int dx = x - BRF_BENCH_IMAGE_SIZE / 2,
+          dy = y - BRF_BENCH_IMAGE_SIZE / 2;
+                                        // Offset from the center
+
+      image.pixels[(size_t)y * BRF_BENCH_IMAGE_SIZE + x] = (unsigned char)(((int)sqrt((double)(dx * dx + dy * dy)) / 160 + (x / 512 + y / 512)) & 1 ? 40 : 220);
+    }
+  }
+
+  printf("scaling: %dx%d image, best of %d runs, %ld CPUs online\n\n", BRF_BENCH_IMAGE_SIZE, BRF_BENCH_IMAGE_SIZE, iterations, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%-7s %10s %12s %8s  %s\n", "Threads", "Seconds", "Mpixels/s", "Speedup", "Edges");
+
+  for (threads = 1; threads <= max_threads; threads ++)
+  {
+    snprintf(value, sizeof(value), "%d", threads);
+    setenv("BRF_IMAGE_THREADS", value, 1);
+
+    for (run = 0, best = 0.0; run < iterations; run ++)
+    {
+      start = brf_GetTime();
+
+      if (!brf_image_canny(&image, 0, 1.0, 10, 30, threads == 1 ? reference : edges))
+      {
+        fprintf(stderr, "brf-bench: Unable to allocate edge detection buffers.\n");
+        return (1);
+      }
+
+      elapsed = brf_GetTime() - start;
+
+      if (run == 0 || elapsed < best)
+        best = elapsed;
+    }
+
+    if (threads == 1)
+      single = best;
+
+    printf("%7d %10.3f %12.1f %7.2fx  %s\n", threads, best, size / best / 1000000.0, single / best, threads == 1 || !memcmp(edges, reference, size) ? "identical" : "DIFFERENT");
+  }
+
+  unsetenv("BRF_IMAGE_THREADS");
+
+  free(image.pixels);
+  free(edges);
+  free(reference);
+
+  return (0);
+}
+
+// 'brf_bench_send()' - Send a volume to a device pipe.
+//
+// Returns the time until the device has read all of the data, or -1.0 on
+// error.
+
+static double                           // O - Seconds or -1.0 on error
+brf_bench_send(const char *filename,    // I - Volume
+               bool from_pipe,          // I - Read the volume from a pipe?
+               bool zero_copy)          // I - Use brf_print_zero_copy()?
+{
+  int fd,                               // Volume file
+      inputfd,                          // Input of the copy
+      devicefds[2],                     // Device pipe
+      inputfds[2];                      // Input pipe
+  brf_bench_feed_t feed;                // Input pipe feed
+  pthread_t drain_thread,               // Device reader
+      feed_thread;                      // Input writer
+  char buffer[65536];                   // Copy buffer
+  ssize_t bytes;                        // Bytes read
+  double start,                         // Start time
+      elapsed;                          // Time to send the volume
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+    return (-1.0);
+
+  if (pipe2(devicefds, O_CLOEXEC))
+  {
+    close(fd);
+    return (-1.0);
+  }
+
+  start = brf_GetTime();
+
+  pthread_create(&drain_thread, NULL, brf_bench_drain, devicefds + 0);
+
+  if (from_pipe && !pipe2(inputfds, O_CLOEXEC))
+  {
+    feed.srcfd  = fd;
+    feed.pipefd = inputfds[1];
+    inputfd     = inputfds[0];
+
+    pthread_create(&feed_thread, NULL, brf_bench_feed, &feed);
+  }
+  else
+  {
+    from_pipe = false;
+    inputfd   = fd;
+  }
+
+  // Copy the rest like brf_print_filter_function() when zero-copy stops...
+  if (zero_copy)
+    brf_print_zero_copy(inputfd, devicefds[1]);
+
+  while ((bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
+  {
+    if (brf_WriteAll(devicefds[1], buffer, (size_t)bytes) < 0)
+      break;
+  }
+
+  close(devicefds[1]);
+  pthread_join(drain_thread, NULL);
+
+  elapsed = brf_GetTime() - start;
+
+  if (from_pipe)
+  {
+    pthread_join(feed_thread, NULL);
+    close(inputfds[0]);
+  }
+
+  close(devicefds[0]);
+  close(fd);
+
+  return (bytes < 0 ? -1.0 : elapsed);
+}
+
+// 'brf_bench_usage()' - Show program usage.
+
+static int                              // O - Exit status
+brf_bench_usage(void)
+{
+  puts("Usage: ./brf-bench [-n ITERATIONS] TEST [FILES]");
+  puts("Tests:");
+  puts("  device    Send BRF volumes of 4 to 64 MiB to a device, buffered and zero-copy");
+  puts("  image     Time Canny edges against ordered and diffusion halftoning for each image file");
+  puts("  jobs [FILE]");
+  puts("            Print thousands of jobs on a server and check that its memory use does not grow");
+  puts("  mime      Time the built-in signatures against libmagic for each file");
+  puts("  raster    Time the raster line kernels at A4 and legal size, 200 dpi");
+  puts("  scaling [MAX-THREADS]");
+  puts("            Time Canny edge detection of a large image on 1 to N threads");
+
+  return (1);
+}
+
+// 'brf_bench_wait()' - Wait for the jobs of a printer to finish.
+
+static bool                             // O - `true` when the queue is empty
+brf_bench_wait(http_t *http,            // I - Connection to the server
+               const char *uri,         // I - Printer URI
+               const char *resource,    // I - Printer resource
+               pid_t pid)               // I - Server process
+{
+  ipp_t *request,                       // Get-Printer-Attributes request
+      *response;                        // Get-Printer-Attributes response
+  int queued;                           // Queued jobs
+
+  do
+  {
+    if (waitpid(pid, NULL, WNOHANG) == pid)
+    {
+      fprintf(stderr, "brf-bench: Server stopped.\n");
+      return (false);
+    }
+
+    request = ippNewRequest(IPP_OP_GET_PRINTER_ATTRIBUTES);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, uri);
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+    ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", NULL, "queued-job-count");
+
+    response = cupsDoRequest(http, request, resource);
+    queued   = ippGetInteger(ippFindAttribute(response, "queued-job-count", IPP_TAG_INTEGER), 0);
+
+    ippDelete(response);
+
+    if (cupsLastError() >= IPP_STATUS_ERROR_BAD_REQUEST)
+    {
+      fprintf(stderr, "brf-bench: Unable to get queued jobs: %s\n", cupsLastErrorString());
+      return (false);
+    }
+
+    if (queued > 0)
+      usleep(10000);
+  }
+  while (queued > 0);
+
+  return (true);
+}
+
+// 'brf_bench_volume()' - Write a BRF volume of 40x25 cell pages.
+
+static bool                             // O - `true` on success
+brf_bench_volume(const char *filename,  // I - Volume file
+                 size_t size)           // I - Size in bytes
+{
+  int fd;                               // Volume file
+  char page[25 * 41 + 1],               // One page
+      *ptr;                             // Pointer into page
+  int line, cell;                       // Looping vars
+  size_t bytes;                         // Bytes in this write
+  bool ret = true;                      // Return value
+
+  for (ptr = page, line = 0; line < 25; line ++)
+  {
+    for (cell = 0; cell < 40; cell ++)
+      *ptr++ = (char)(' ' + (line * 40 + cell) % 64);
+
+    *ptr++ = '\n';
+  }
+
+  *ptr++ = '\f';
+
+  if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+    return (false);
+
+  for (; size > 0 && ret; size -= bytes)
+  {
+    bytes = size < sizeof(page) ? size : sizeof(page);
+    ret   = brf_WriteAll(fd, page, bytes) >= 0;
+  }
+
+  return (!close(fd) && ret);
+}
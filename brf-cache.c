@@ -0,0 +1,637 @@
+//
+// Translation result cache for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_CACHE_MAX_MEMORY_ENTRY (256 * 1024)
+                                        // Largest result kept in memory
+
+// Local types...
+
+typedef struct brf_cache_entry_s        // Cached conversion result
+{
+  char key[65];                         // SHA-256 of input and options
+  size_t size;                          // Size of result
+  unsigned char *data;                  // Result in memory or `NULL`
+  struct brf_cache_entry_s *prev,       // Previous (more recently used) entry
+      *next;                            // Next (less recently used) entry
+} brf_cache_entry_t;
+
+typedef struct brf_cache_file_s         // Existing cache file
+{
+  char key[65];                         // Cache key
+  off_t size;                           // Size of file
+  time_t mtime;                         // Last use
+} brf_cache_file_t;
+
+typedef struct brf_cache_tee_s          // Parameters of the tee filter
+{
+  char filename[1024];                  // Temporary result file
+} brf_cache_tee_t;
+
+// Local globals...
+
+static pthread_mutex_t brf_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+                                        // Mutex for the cache
+static pappl_system_t *brf_cache_system = NULL;
+                                        // System for logging
+static char brf_cache_directory[1024] = "";
+                                        // Cache directory
+static size_t brf_cache_max_bytes = 0,  // Disk budget
+    brf_cache_max_memory = 0;           // Memory budget
+static cups_array_t *brf_cache_entries = NULL;
+                                        // Entries sorted by key
+static brf_cache_entry_t *brf_cache_first = NULL,
+                                        // Most recently used entry
+    *brf_cache_last = NULL;             // Least recently used entry
+static brf_cache_stats_t brf_cache_stats;
+                                        // Cache statistics
+
+// Local functions...
+
+static int brf_cache_compare(brf_cache_entry_t *a, brf_cache_entry_t *b, void *data);
+static int brf_cache_compare_mtime(const void *a, const void *b);
+static int brf_cache_compare_option(const void *a, const void *b);
+static void brf_cache_evict(void);
+static void brf_cache_filename(const char *key, char *filename, size_t filesize);
+static void brf_cache_insert(brf_cache_entry_t *entry);
+static void brf_cache_touch(brf_cache_entry_t *entry);
+static void brf_cache_unlink(brf_cache_entry_t *entry);
+
+// 'brf_CacheAbort()' - Discard a result that was not completed.
+
+void
+brf_CacheAbort(void *tee)               // I - Tee parameters from brf_CacheBegin()
+{
+  brf_cache_tee_t *params = (brf_cache_tee_t *)tee;
+                                        // Tee parameters
+
+  if (!params)
+    return;
+
+  unlink(params->filename);
+  free(params);
+}
+
+// 'brf_CacheBegin()' - Prepare a filter that copies a result into the cache.
+//
+// The returned filter goes in front of the print filter.  It runs in a forked
+// process, so it writes the result to a temporary file that is committed by
+// the server process with brf_CacheCommit() once the chain succeeded.
+
+bool                                    // O - `true` on success
+brf_CacheBegin(const char *key,         // I - Cache key
+               int job_id,              // I - Job ID
+               cf_filter_filter_in_chain_t *filter) // O - Tee filter
+{
+  brf_cache_tee_t *params;              // Tee parameters
+
+  if (!brf_cache_directory[0])
+    return (false);
+
+  if ((params = (brf_cache_tee_t *)calloc(1, sizeof(brf_cache_tee_t))) == NULL)
+    return (false);
+
+  snprintf(params->filename, sizeof(params->filename), "%s/%s.%d.tmp", brf_cache_directory, key, job_id);
+
+  filter->function   = brf_CacheTeeFilter;
+  filter->parameters = params;
+  filter->name       = "cache";
+
+  return (true);
+}
+
+// 'brf_CacheCommit()' - Add a completed result to the cache.
+
+void
+brf_CacheCommit(const char *key,        // I - Cache key
+                void *tee)              // I - Tee parameters from brf_CacheBegin()
+{
+  brf_cache_tee_t *params = (brf_cache_tee_t *)tee;
+                                        // Tee parameters
+  brf_cache_entry_t *entry;             // New entry
+  char filename[1024];                  // Cache file
+  struct stat fileinfo;                 // Result information
+  int fd;                               // Result file
+
+  if (!params)
+    return;
+
+  brf_cache_filename(key, filename, sizeof(filename));
+
+  if (stat(params->filename, &fileinfo) || (size_t)fileinfo.st_size > brf_cache_max_bytes || (entry = (brf_cache_entry_t *)calloc(1, sizeof(brf_cache_entry_t))) == NULL)
+  {
+    brf_CacheAbort(tee);
+    return;
+  }
+
+  papplCopyString(entry->key, key, sizeof(entry->key));
+  entry->size = (size_t)fileinfo.st_size;
+
+  // Keep small results in memory as well...
+  if (entry->size <= BRF_CACHE_MAX_MEMORY_ENTRY && entry->size <= brf_cache_max_memory && (entry->data = (unsigned char *)malloc(entry->size + 1)) != NULL)
+  {
+    if ((fd = open(params->filename, O_RDONLY)) < 0 || read(fd, entry->data, entry->size) != (ssize_t)entry->size)
+    {
+      free(entry->data);
+      entry->data = NULL;
+    }
+
+    if (fd >= 0)
+      close(fd);
+  }
+
+  if (rename(params->filename, filename))
+  {
+    brf_CacheAbort(tee);
+    free(entry->data);
+    free(entry);
+    return;
+  }
+
+  free(params);
+
+  pthread_mutex_lock(&brf_cache_mutex);
+
+  if (cupsArrayFind(brf_cache_entries, entry))
+  {
+    // Another job with the same input finished first...
+    free(entry->data);
+    free(entry);
+  }
+  else
+  {
+    brf_cache_insert(entry);
+    brf_cache_evict();
+  }
+
+  pthread_mutex_unlock(&brf_cache_mutex);
+}
+
+// 'brf_CacheGetStats()' - Get a copy of the cache statistics.
+
+void
+brf_CacheGetStats(brf_cache_stats_t *stats) // O - Statistics
+{
+  pthread_mutex_lock(&brf_cache_mutex);
+  *stats = brf_cache_stats;
+  pthread_mutex_unlock(&brf_cache_mutex);
+}
+
+// 'brf_CacheInit()' - Set up the result cache and load existing entries.
+
+bool                                    // O - `true` on success
+brf_CacheInit(pappl_system_t *system,   // I - System
+              const char *directory,    // I - Cache directory
+              size_t max_bytes,         // I - Disk budget in bytes
+              size_t max_memory)        // I - Memory budget in bytes
+{
+  DIR *dir;                             // Cache directory
+  struct dirent *dent;                  // Directory entry
+  char filename[1024];                  // Cache file
+  struct stat fileinfo;                 // File information
+  brf_cache_entry_t *entry;             // Current entry
+  int i,                                // Looping var
+      num_files = 0,                    // Number of cache files
+      alloc_files = 0;                  // Allocated cache files
+  brf_cache_file_t *files = NULL,       // Existing cache files
+      *temp;                            // New cache file array
+
+  brf_cache_system     = system;
+  brf_cache_max_bytes  = max_bytes;
+  brf_cache_max_memory = max_memory;
+  brf_cache_entries    = cupsArrayNew((cups_array_func_t)brf_cache_compare, NULL);
+
+  if (max_bytes == 0)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_INFO, "Translation result cache is disabled.");
+    return (true);
+  }
+
+  if (mkdir(directory, 0700) && errno != EEXIST)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to create cache directory '%s': %s", directory, strerror(errno));
+    return (false);
+  }
+
+  papplCopyString(brf_cache_directory, directory, sizeof(brf_cache_directory));
+
+  // Load the results left by a previous run, least recently used first...
+  if ((dir = opendir(directory)) != NULL)
+  {
+    while ((dent = readdir(dir)) != NULL)
+    {
+      size_t namelen = strlen(dent->d_name);
+
+      snprintf(filename, sizeof(filename), "%s/%s", directory, dent->d_name);
+
+      if (namelen > 4 && !strcmp(dent->d_name + namelen - 4, ".tmp"))
+      {
+        unlink(filename);
+        continue;
+      }
+      else if (namelen != 68 || strcmp(dent->d_name + 64, ".brf") || stat(filename, &fileinfo))
+        continue;
+
+      if (num_files >= alloc_files)
+      {
+        alloc_files += 64;
+        if ((temp = realloc(files, (size_t)alloc_files * sizeof(brf_cache_file_t))) == NULL)
+          break;
+        files = temp;
+      }
+
+      memcpy(files[num_files].key, dent->d_name, 64);
+      files[num_files].key[64] = '\0';
+      files[num_files].size    = fileinfo.st_size;
+      files[num_files].mtime   = fileinfo.st_mtime;
+      num_files ++;
+    }
+
+    closedir(dir);
+  }
+
+  if (num_files > 0)
+    qsort(files, (size_t)num_files, sizeof(brf_cache_file_t), brf_cache_compare_mtime);
+
+  pthread_mutex_lock(&brf_cache_mutex);
+
+  for (i = 0; i < num_files; i ++)
+  {
+    if ((entry = (brf_cache_entry_t *)calloc(1, sizeof(brf_cache_entry_t))) == NULL)
+      break;
+
+    papplCopyString(entry->key, files[i].key, sizeof(entry->key));
+    entry->size = (size_t)files[i].size;
+
+    brf_cache_insert(entry);
+  }
+
+  brf_cache_evict();
+
+  pthread_mutex_unlock(&brf_cache_mutex);
+
+  free(files);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Translation result cache '%s' has %d entries using %lu of %lu KiB.", directory, brf_cache_stats.num_entries, (unsigned long)(brf_cache_stats.bytes / 1024), (unsigned long)(max_bytes / 1024));
+
+  return (true);
+}
+
+// 'brf_CacheKey()' - Compute the cache key for a document and its options.
+//
+// The key is the SHA-256 of the document contents, the input format and the
+// job options sorted by name, so the same handout printed with the same
+// settings always gets the same key.
+
+bool                                    // O - `true` on success
+brf_CacheKey(int fd,                    // I - Document file
+             const char *format,        // I - Document format
+             int num_options,           // I - Number of options
+             cups_option_t *options,    // I - Options
+             char *key,                 // O - Cache key
+             size_t keysize)            // I - Size of key buffer
+{
+  struct stat fileinfo;                 // Document information
+  void *mapped = NULL;                  // Mapped document
+  unsigned char digest[32];             // SHA-256 digest
+  char *buffer,                         // Key material
+      *bufptr;                          // Pointer into key material
+  size_t bufsize;                       // Size of key material
+  int i;                                // Looping var
+  cups_option_t *sorted;                // Sorted options
+  bool ret = false;                     // Return value
+
+  if (!brf_cache_directory[0] || keysize < 65 || fstat(fd, &fileinfo) || !S_ISREG(fileinfo.st_mode))
+    return (false);
+
+  if (fileinfo.st_size > 0 && (mapped = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    return (false);
+
+  if (cupsHashData("sha-256", mapped ? mapped : "", (size_t)fileinfo.st_size, digest, sizeof(digest)) < 0)
+    goto done;
+
+  // Hash the document digest together with the normalized options...
+  bufsize = 2 * sizeof(digest) + strlen(format) + 2;
+  for (i = 0; i < num_options; i ++)
+    bufsize += strlen(options[i].name) + strlen(options[i].value) + 2;
+
+  if ((buffer = (char *)malloc(bufsize)) == NULL || (sorted = (cups_option_t *)malloc((size_t)(num_options > 0 ? num_options : 1) * sizeof(cups_option_t))) == NULL)
+  {
+    free(buffer);
+    goto done;
+  }
+
+  memcpy(sorted, options, (size_t)num_options * sizeof(cups_option_t));
+  qsort(sorted, (size_t)num_options, sizeof(cups_option_t), brf_cache_compare_option);
+
+  cupsHashString(digest, sizeof(digest), buffer, bufsize);
+  bufptr = buffer + strlen(buffer);
+  bufptr += snprintf(bufptr, bufsize - (size_t)(bufptr - buffer), "\n%s", format);
+
+  for (i = 0; i < num_options; i ++)
+    bufptr += snprintf(bufptr, bufsize - (size_t)(bufptr - buffer), "\n%s=%s", sorted[i].name, sorted[i].value);
+
+  if (cupsHashData("sha-256", buffer, (size_t)(bufptr - buffer), digest, sizeof(digest)) >= 0)
+  {
+    cupsHashString(digest, sizeof(digest), key, keysize);
+    ret = true;
+  }
+
+  free(sorted);
+  free(buffer);
+
+  done:
+
+  if (mapped)
+    munmap(mapped, (size_t)fileinfo.st_size);
+
+  return (ret);
+}
+
+// 'brf_CacheOpen()' - Open a cached result.
+//
+// Results kept in memory are handed out through an anonymous memory file, the
+// others are opened from the cache directory.
+
+int                                     // O - File descriptor or -1 on a miss
+brf_CacheOpen(const char *key)          // I - Cache key
+{
+  brf_cache_entry_t search,             // Search key
+      *entry;                           // Cache entry
+  char filename[1024];                  // Cache file
+  int fd = -1;                          // File descriptor
+
+  papplCopyString(search.key, key, sizeof(search.key));
+
+  pthread_mutex_lock(&brf_cache_mutex);
+
+  if ((entry = (brf_cache_entry_t *)cupsArrayFind(brf_cache_entries, &search)) != NULL)
+  {
+    if (entry->data && (fd = memfd_create("brf-cache", MFD_CLOEXEC)) >= 0)
+    {
+      if (brf_WriteAll(fd, entry->data, entry->size) < 0 || lseek(fd, 0, SEEK_SET) < 0)
+      {
+        close(fd);
+        fd = -1;
+      }
+      else
+        brf_cache_stats.memory_hits ++;
+    }
+
+    if (fd < 0)
+    {
+      brf_cache_filename(key, filename, sizeof(filename));
+
+      if ((fd = open(filename, O_RDONLY)) >= 0)
+      {
+        brf_cache_stats.disk_hits ++;
+        utimensat(AT_FDCWD, filename, NULL, 0);
+      }
+      else
+      {
+        // Somebody removed the file, forget about it...
+        brf_cache_unlink(entry);
+      }
+    }
+
+    if (fd >= 0)
+      brf_cache_touch(entry);
+  }
+
+  if (fd < 0)
+    brf_cache_stats.misses ++;
+
+  pthread_mutex_unlock(&brf_cache_mutex);
+
+  return (fd);
+}
+
+// 'brf_CacheTeeFilter()' - Copy the converted document into a cache file.
+
+int                                     // O - Exit status
+brf_CacheTeeFilter(
+    int inputfd,                        // I - Input file descriptor
+    int outputfd,                       // I - Output file descriptor
+    int inputseekable,                  // I - Is input seekable? (unused)
+    cf_filter_data_t *data,             // I - Job and printer data
+    void *parameters)                   // I - Tee parameters
+{
+  brf_cache_tee_t *params = (brf_cache_tee_t *)parameters;
+                                        // Tee parameters
+  char buffer[65536];                   // Copy buffer
+  ssize_t bytes;                        // Bytes read
+  int cachefd;                          // Cache file
+
+  (void)inputseekable;
+
+  if ((cachefd = open(params->filename, O_WRONLY | O_CREAT | O_TRUNC | O_EXCL, 0600)) < 0 && data->logfunc)
+    (data->logfunc)(data->logdata, CF_LOGLEVEL_WARN, "Unable to create cache file '%s': %s", params->filename, strerror(errno));
+
+  while ((bytes = read(inputfd, buffer, sizeof(buffer))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      break;
+    }
+
+    if (brf_WriteAll(outputfd, buffer, (size_t)bytes) < 0)
+    {
+      bytes = -1;
+      break;
+    }
+
+    if (cachefd >= 0 && brf_WriteAll(cachefd, buffer, (size_t)bytes) < 0)
+    {
+      // Out of space or similar, just stop caching this result...
+      close(cachefd);
+      cachefd = -1;
+      unlink(params->filename);
+    }
+  }
+
+  if (cachefd >= 0)
+    close(cachefd);
+
+  if (bytes < 0)
+  {
+    unlink(params->filename);
+    return (1);
+  }
+
+  close(outputfd);
+
+  return (0);
+}
+
+// 'brf_cache_compare()' - Compare two cache entries.
+
+static int                              // O - Result of comparison
+brf_cache_compare(brf_cache_entry_t *a, // I - First entry
+                  brf_cache_entry_t *b, // I - Second entry
+                  void *data)           // I - Callback data (unused)
+{
+  (void)data;
+
+  return (strcmp(a->key, b->key));
+}
+
+// 'brf_cache_compare_mtime()' - Compare cache files by last use, oldest first.
+
+static int                              // O - Result of comparison
+brf_cache_compare_mtime(const void *a,  // I - First file
+                        const void *b)  // I - Second file
+{
+  time_t amtime = ((const brf_cache_file_t *)a)->mtime,
+                                        // First time
+      bmtime = ((const brf_cache_file_t *)b)->mtime;
+                                        // Second time
+
+  return (amtime < bmtime ? -1 : amtime > bmtime);
+}
+
+// 'brf_cache_compare_option()' - Compare two options by name.
+
+static int                              // O - Result of comparison
+brf_cache_compare_option(const void *a, // I - First option
+                         const void *b) // I - Second option
+{
+  return (strcmp(((const cups_option_t *)a)->name, ((const cups_option_t *)b)->name));
+}
+
+// 'brf_cache_evict()' - Remove least recently used entries to fit the budgets.
+//
+// The caller must hold the cache mutex.
+
+static void
+brf_cache_evict(void)
+{
+  brf_cache_entry_t *entry;             // Current entry
+
+  // Memory budget, drop the in-memory copies first...
+  for (entry = brf_cache_last; entry && brf_cache_stats.memory_bytes > brf_cache_max_memory; entry = entry->prev)
+  {
+    if (entry->data)
+    {
+      free(entry->data);
+      entry->data = NULL;
+      brf_cache_stats.memory_bytes -= entry->size;
+    }
+  }
+
+  // Then the disk budget...
+  while ((entry = brf_cache_last) != NULL && brf_cache_stats.bytes > brf_cache_max_bytes)
+  {
+    brf_cache_stats.evictions ++;
+    brf_cache_unlink(entry);
+  }
+}
+
+// 'brf_cache_filename()' - Get the cache file for a key.
+
+static void
+brf_cache_filename(const char *key,     // I - Cache key
+                   char *filename,      // I - Filename buffer
+                   size_t filesize)     // I - Size of filename buffer
+{
+  snprintf(filename, filesize, "%s/%s.brf", brf_cache_directory, key);
+}
+
+// 'brf_cache_insert()' - Add an entry as the most recently used one.
+//
+// The caller must hold the cache mutex.
+
+static void
+brf_cache_insert(brf_cache_entry_t *entry) // I - Entry
+{
+  cupsArrayAdd(brf_cache_entries, entry);
+
+  entry->prev = NULL;
+  entry->next = brf_cache_first;
+
+  if (brf_cache_first)
+    brf_cache_first->prev = entry;
+  else
+    brf_cache_last = entry;
+
+  brf_cache_first = entry;
+
+  brf_cache_stats.num_entries ++;
+  brf_cache_stats.bytes += entry->size;
+  if (entry->data)
+    brf_cache_stats.memory_bytes += entry->size;
+}
+
+// 'brf_cache_touch()' - Make an entry the most recently used one.
+//
+// The caller must hold the cache mutex.
+
+static void
+brf_cache_touch(brf_cache_entry_t *entry) // I - Entry
+{
+  if (entry == brf_cache_first)
+    return;
+
+  // Unlink...
+  entry->prev->next = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    brf_cache_last = entry->prev;
+
+  // And put it back in front...
+  entry->prev = NULL;
+  entry->next = brf_cache_first;
+  brf_cache_first->prev = entry;
+  brf_cache_first = entry;
+}
+
+// 'brf_cache_unlink()' - Remove an entry and its file.
+//
+// The caller must hold the cache mutex.
+
+static void
+brf_cache_unlink(brf_cache_entry_t *entry) // I - Entry
+{
+  char filename[1024];                  // Cache file
+
+  brf_cache_filename(entry->key, filename, sizeof(filename));
+  unlink(filename);
+
+  cupsArrayRemove(brf_cache_entries, entry);
+
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    brf_cache_first = entry->next;
+
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    brf_cache_last = entry->prev;
+
+  brf_cache_stats.num_entries --;
+  brf_cache_stats.bytes -= entry->size;
+  if (entry->data)
+    brf_cache_stats.memory_bytes -= entry->size;
+
+  free(entry->data);
+  free(entry);
+}
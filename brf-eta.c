@@ -0,0 +1,709 @@
+//
+// Job time estimates for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_ETA_INTERVAL 10             // Seconds between updates of the estimates
+#define BRF_ETA_MAX_FORMATS 32          // Maximum number of measured formats
+#define BRF_ETA_MAX_PRINTERS 64         // Maximum number of measured printers
+#define BRF_ETA_PAGE_CHARS 1000.0       // Assumed characters per page (40x25)
+#define BRF_ETA_RESOURCE "/brf-estimates"
+                                        // Estimates page of the web interface
+#define BRF_ETA_SMOOTHING 0.3           // Weight of the latest job
+
+// Local types...
+
+typedef struct brf_eta_format_s         // Measured document format
+{
+  char format[128];                     // MIME media type
+  unsigned long jobs;                   // Measured jobs
+  double bytes_per_page;                // Smoothed document bytes per page
+} brf_eta_format_t;
+
+typedef struct brf_eta_printer_s        // Measured printer
+{
+  char device_uri[256];                 // Device URI
+  unsigned long jobs,                   // Measured jobs
+      page_jobs;                        // Measured jobs with a page count
+  double cps,                           // Smoothed characters per second
+      ppm,                              // Smoothed pages per minute
+      cpp;                              // Smoothed characters per page
+} brf_eta_printer_t;
+
+typedef struct brf_eta_shared_s         // Measurements shared with filters
+{
+  pthread_mutex_t mutex;                // Mutex for measurements
+  unsigned long changes;                // Number of recorded jobs
+  int num_printers,                     // Number of measured printers
+      num_formats;                      // Number of measured formats
+  brf_eta_printer_t printers[BRF_ETA_MAX_PRINTERS];
+                                        // Measured printers
+  brf_eta_format_t formats[BRF_ETA_MAX_FORMATS];
+                                        // Measured formats
+} brf_eta_shared_t;
+
+typedef struct brf_eta_printers_s       // Printers of the system
+{
+  int num_printers;                     // Number of printers
+  pappl_printer_t *printers[BRF_ETA_MAX_PRINTERS];
+                                        // Printers
+} brf_eta_printers_t;
+
+typedef struct brf_eta_queue_s          // Estimate of a printer's queue
+{
+  brf_eta_printer_t printer;            // Copy of the measurements
+  pappl_client_t *client;               // Client to list the jobs to or `NULL`
+  time_t now;                           // Time of the estimate
+  double finish;                        // Seconds until the queue is empty
+  int jobs;                             // Active jobs
+} brf_eta_queue_t;
+
+// Local globals...
+
+static char brf_eta_filename[1024] = "";// File with the measurements
+static unsigned long brf_eta_saved = 0; // Recorded jobs when last saved
+static brf_eta_shared_t *brf_eta_shared = NULL;
+                                        // Measurements
+
+// Local functions...
+
+static void brf_eta_add_printer(pappl_printer_t *printer, void *data);
+static int brf_eta_count_pages(const char *filename);
+static brf_eta_format_t *brf_eta_format(const char *format, bool create);
+static void brf_eta_job(pappl_job_t *job, void *data);
+static void brf_eta_load(void);
+static void brf_eta_lock(void);
+static brf_eta_printer_t *brf_eta_printer(const char *device_uri, bool create);
+static bool brf_eta_queue(pappl_printer_t *printer, pappl_client_t *client, brf_eta_queue_t *queue);
+static void brf_eta_save(void);
+static void brf_eta_strtime(time_t t, time_t now, char *buffer, size_t bufsize);
+static bool brf_eta_timer(pappl_system_t *system, void *data);
+static void brf_eta_update(pappl_printer_t *printer, void *data);
+static bool brf_eta_web(pappl_client_t *client, void *data);
+
+// 'brf_EtaEstimatePages()' - Estimate the number of pages of a job.
+//
+// BRF documents are counted exactly.  Other documents are divided by the
+// bytes per page measured for their format; text that was never measured
+// is assumed to fill pages like the printer's earlier jobs.
+
+int                                     // O - Estimated pages (at least 1)
+brf_EtaEstimatePages(pappl_job_t *job)  // I - Job
+{
+  const char *format = papplJobGetFormat(job),
+                                        // Document format
+      *filename = papplJobGetFilename(job);
+                                        // Document
+  struct stat fileinfo;                 // Document information
+  brf_eta_format_t *measured;           // Measured format
+  brf_eta_printer_t *printer;           // Measured printer
+  double bytes_per_page = 0.0;          // Document bytes per page
+  int pages;                            // Estimated pages
+
+  if (!format || !filename || stat(filename, &fileinfo) || fileinfo.st_size == 0)
+    return (1);
+
+  if (!strcmp(format, "application/vnd.cups-brf") || !strcmp(format, BRF_PAGINATE_FORMAT))
+    return (brf_eta_count_pages(filename));
+
+  if (!brf_eta_shared)
+    return (1);
+
+  brf_eta_lock();
+
+  if ((measured = brf_eta_format(format, false)) != NULL && measured->jobs > 0)
+    bytes_per_page = measured->bytes_per_page;
+  else if (!strncmp(format, "text/", 5))
+    bytes_per_page = (printer = brf_eta_printer(papplPrinterGetDeviceURI(papplJobGetPrinter(job)), false)) != NULL && printer->page_jobs > 0 ? printer->cpp : BRF_ETA_PAGE_CHARS;
+
+  pthread_mutex_unlock(&brf_eta_shared->mutex);
+
+  if (bytes_per_page <= 0.0)
+    return (1);
+
+  pages = (int)((double)fileinfo.st_size / bytes_per_page + 0.999);
+
+  return (pages > 0 ? pages : 1);
+}
+
+// 'brf_EtaGetPPM()' - Get the measured pages per minute of a printer.
+
+int                                     // O - Pages per minute (at least 1)
+brf_EtaGetPPM(const char *device_uri)   // I - Device URI
+{
+  brf_eta_printer_t *printer;           // Measured printer
+  double ppm = 0.0;                     // Pages per minute
+
+  if (!brf_eta_shared || !device_uri)
+    return (1);
+
+  brf_eta_lock();
+  if ((printer = brf_eta_printer(device_uri, false)) != NULL && printer->page_jobs > 0)
+    ppm = printer->ppm;
+  pthread_mutex_unlock(&brf_eta_shared->mutex);
+
+  return (ppm >= 1.5 ? (int)(ppm + 0.5) : 1);
+}
+
+// 'brf_EtaInit()' - Load the measurements and start updating job estimates.
+//
+// The measurements are kept in "estimates" in the spool directory so that
+// a restarted server does not have to learn the printers again.
+
+bool                                    // O - `true` on success
+brf_EtaInit(pappl_system_t *system,     // I - System
+            const char *spool_dir)      // I - Spool directory
+{
+  pthread_mutexattr_t mattr;            // Shared mutex attributes
+
+  // Jobs are measured by the forked print filter, so the measurements need
+  // to live in shared memory...
+  if ((brf_eta_shared = (brf_eta_shared_t *)brf_SharedAlloc(sizeof(brf_eta_shared_t))) == NULL)
+    return (false);
+
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&brf_eta_shared->mutex, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+
+  snprintf(brf_eta_filename, sizeof(brf_eta_filename), "%s/estimates", spool_dir);
+  brf_eta_load();
+
+  papplSystemAddTimerCallback(system, 0, BRF_ETA_INTERVAL, brf_eta_timer, NULL);
+
+  papplSystemAddResourceCallback(system, BRF_ETA_RESOURCE, "text/html", brf_eta_web, system);
+  papplSystemAddLink(system, "Job Estimates", BRF_ETA_RESOURCE, PAPPL_LOPTIONS_NAVIGATION | PAPPL_LOPTIONS_STATUS);
+
+  return (true);
+}
+
+// 'brf_EtaRecord()' - Record the speed of a printer for a finished job.
+//
+// Also called from the forked print filter, so it only uses the shared
+// measurements and job accessors that take no locks.
+
+void
+brf_EtaRecord(pappl_job_t *job,         // I - Finished job
+              const char *device_uri,   // I - Device URI of the printer
+              size_t chars,             // I - Characters sent to the printer
+              int pages,                // I - Pages sent or 0 if unknown
+              double seconds)           // I - Time from job start to finish
+{
+  const char *format = papplJobGetFormat(job),
+                                        // Document format
+      *filename = papplJobGetFilename(job);
+                                        // Document
+  struct stat fileinfo;                 // Document information
+  brf_eta_printer_t *printer;           // Measured printer
+  brf_eta_format_t *measured;           // Measured format
+  double cps,                           // Characters per second of this job
+      ppm,                              // Pages per minute of this job
+      cpp;                              // Characters per page of this job
+
+  if (!brf_eta_shared || !device_uri || chars == 0 || seconds <= 0.0)
+    return;
+
+  cps = (double)chars / seconds;
+
+  brf_eta_lock();
+
+  if ((printer = brf_eta_printer(device_uri, true)) != NULL)
+  {
+    printer->cps = printer->jobs ? printer->cps + BRF_ETA_SMOOTHING * (cps - printer->cps) : cps;
+    printer->jobs ++;
+
+    if (pages > 0)
+    {
+      ppm = 60.0 * pages / seconds;
+      cpp = (double)chars / pages;
+
+      printer->ppm = printer->page_jobs ? printer->ppm + BRF_ETA_SMOOTHING * (ppm - printer->ppm) : ppm;
+      printer->cpp = printer->page_jobs ? printer->cpp + BRF_ETA_SMOOTHING * (cpp - printer->cpp) : cpp;
+      printer->page_jobs ++;
+    }
+  }
+
+  // BRF documents are counted, the others are estimated from their size
+  if (pages > 0 && format && strcmp(format, "application/vnd.cups-brf") && strcmp(format, BRF_PAGINATE_FORMAT) && filename && !stat(filename, &fileinfo) && fileinfo.st_size > 0 && (measured = brf_eta_format(format, true)) != NULL)
+  {
+    double bytes_per_page = (double)fileinfo.st_size / pages;
+                                        // Document bytes per page of this job
+
+    measured->bytes_per_page = measured->jobs ? measured->bytes_per_page + BRF_ETA_SMOOTHING * (bytes_per_page - measured->bytes_per_page) : bytes_per_page;
+    measured->jobs ++;
+  }
+
+  brf_eta_shared->changes ++;
+
+  pthread_mutex_unlock(&brf_eta_shared->mutex);
+}
+
+// 'brf_eta_add_printer()' - Collect the printers of the system.
+
+static void
+brf_eta_add_printer(
+    pappl_printer_t *printer,           // I - Printer
+    void *data)                         // I - Printers
+{
+  brf_eta_printers_t *printers = (brf_eta_printers_t *)data;
+                                        // Printers
+
+  if (printers->num_printers < BRF_ETA_MAX_PRINTERS && !brf_PoolIsPool(printer))
+    printers->printers[printers->num_printers ++] = printer;
+}
+
+// 'brf_eta_count_pages()' - Count the pages of a BRF document.
+
+static int                              // O - Number of pages (at least 1)
+brf_eta_count_pages(const char *filename)
+                                        // I - Document
+{
+  int fd,                               // Document file
+      pages = 0;                        // Form feeds
+  char buffer[65536],                   // Read buffer
+      *ptr,                             // Pointer into buffer
+      *end,                             // End of buffer
+      last = '\f';                      // Last character read
+  ssize_t bytes;                        // Bytes read
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+    return (1);
+
+  while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+  {
+    for (ptr = buffer, end = buffer + bytes; (ptr = memchr(ptr, '\f', (size_t)(end - ptr))) != NULL; ptr ++)
+      pages ++;
+
+    last = buffer[bytes - 1];
+  }
+
+  close(fd);
+
+  // A last page without a form feed still counts
+  if (last != '\f')
+    pages ++;
+
+  return (pages > 0 ? pages : 1);
+}
+
+// 'brf_eta_format()' - Find the measurements of a document format.
+//
+// The caller holds the measurement mutex.
+
+static brf_eta_format_t *               // O - Measured format or `NULL`
+brf_eta_format(const char *format,      // I - MIME media type
+               bool create)             // I - Add the format if missing?
+{
+  int i;                                // Looping var
+  brf_eta_format_t *measured;           // Measured format
+
+  for (i = 0; i < brf_eta_shared->num_formats; i ++)
+  {
+    if (!strcmp(brf_eta_shared->formats[i].format, format))
+      return (brf_eta_shared->formats + i);
+  }
+
+  if (!create || brf_eta_shared->num_formats >= BRF_ETA_MAX_FORMATS)
+    return (NULL);
+
+  measured = brf_eta_shared->formats + brf_eta_shared->num_formats ++;
+  papplCopyString(measured->format, format, sizeof(measured->format));
+
+  return (measured);
+}
+
+// 'brf_eta_job()' - Add an active job to the estimate of its queue.
+
+static void
+brf_eta_job(pappl_job_t *job,           // I - Active job
+            void *data)                 // I - Queue
+{
+  brf_eta_queue_t *queue = (brf_eta_queue_t *)data;
+                                        // Queue
+  ipp_jstate_t state = papplJobGetState(job);
+                                        // Job state
+  int pages;                            // Estimated pages
+  double duration,                      // Estimated time to print the job
+      start;                            // Seconds until the job starts
+  char starts[64],                      // Start time
+      finishes[64];                     // Finish time
+
+  // Held jobs wait for a release and don't delay the others
+  if (state != IPP_JSTATE_PENDING && state != IPP_JSTATE_PROCESSING)
+    return;
+
+  if ((pages = papplJobGetImpressions(job)) <= 0)
+  {
+    pages = brf_EtaEstimatePages(job);
+    papplJobSetImpressions(job, pages);
+  }
+
+  if (queue->printer.page_jobs > 0 && queue->printer.ppm > 0.0)
+    duration = 60.0 * pages / queue->printer.ppm;
+  else if (queue->printer.jobs > 0 && queue->printer.cps > 0.0)
+    duration = pages * BRF_ETA_PAGE_CHARS / queue->printer.cps;
+  else
+    return;
+
+  start = queue->finish;
+  queue->jobs ++;
+
+  if (state == IPP_JSTATE_PROCESSING)
+  {
+    duration -= (double)(queue->now - papplJobGetTimeProcessed(job));
+
+    if (duration < 0.0)
+      duration = 0.0;
+  }
+
+  queue->finish += duration;
+
+  brf_eta_strtime(queue->now + (time_t)start, queue->now, starts, sizeof(starts));
+  brf_eta_strtime(queue->now + (time_t)queue->finish, queue->now, finishes, sizeof(finishes));
+
+  if (queue->client)
+  {
+    papplClientHTMLPrintf(queue->client, "              <tr><td>%d</td><td>", papplJobGetID(job));
+    papplClientHTMLEscape(queue->client, papplJobGetName(job), 0);
+    papplClientHTMLPrintf(queue->client, "</td><td>%s</td><td>%d</td><td>%s</td><td>%s</td></tr>\n", papplPrinterGetName(papplJobGetPrinter(job)), pages, state == IPP_JSTATE_PROCESSING ? "printing" : starts, finishes);
+  }
+  else if (state == IPP_JSTATE_PROCESSING)
+  {
+    if (duration > 0.0)
+      papplJobSetMessage(job, "Printing, expected to finish at %s.", finishes);
+    else
+      papplJobSetMessage(job, "Printing, taking longer than expected.");
+  }
+  else
+    papplJobSetMessage(job, "Expected to start at %s and finish at %s.", starts, finishes);
+}
+
+// 'brf_eta_load()' - Load the measurements.
+
+static void
+brf_eta_load(void)
+{
+  FILE *fp;                             // Measurement file
+  char line[1024],                      // Line from file
+      name[256];                        // Device URI or format
+  brf_eta_printer_t *printer;           // Measured printer
+  brf_eta_format_t *measured;           // Measured format
+  unsigned long jobs,                   // Measured jobs
+      page_jobs;                        // Measured jobs with a page count
+  double cps, ppm, cpp,                 // Printer measurements
+      bytes_per_page;                   // Format measurement
+
+  if ((fp = fopen(brf_eta_filename, "r")) == NULL)
+    return;
+
+  brf_eta_lock();
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    if (sscanf(line, "printer %lu %lu %lf %lf %lf %255s", &jobs, &page_jobs, &cps, &ppm, &cpp, name) == 6 && (printer = brf_eta_printer(name, true)) != NULL)
+    {
+      printer->jobs      = jobs;
+      printer->page_jobs = page_jobs;
+      printer->cps       = cps;
+      printer->ppm       = ppm;
+      printer->cpp       = cpp;
+    }
+    else if (sscanf(line, "format %lu %lf %127s", &jobs, &bytes_per_page, name) == 3 && (measured = brf_eta_format(name, true)) != NULL)
+    {
+      measured->jobs           = jobs;
+      measured->bytes_per_page = bytes_per_page;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_eta_shared->mutex);
+
+  fclose(fp);
+}
+
+// 'brf_eta_lock()' - Lock the shared measurements.
+//
+// Recovers the mutex when its holder died.
+
+static void
+brf_eta_lock(void)
+{
+  if (pthread_mutex_lock(&brf_eta_shared->mutex) == EOWNERDEAD)
+    pthread_mutex_consistent(&brf_eta_shared->mutex);
+}
+
+// 'brf_eta_printer()' - Find the measurements of a printer.
+//
+// The caller holds the measurement mutex.
+
+static brf_eta_printer_t *              // O - Measured printer or `NULL`
+brf_eta_printer(const char *device_uri, // I - Device URI
+                bool create)            // I - Add the printer if missing?
+{
+  int i;                                // Looping var
+  brf_eta_printer_t *printer;           // Measured printer
+
+  for (i = 0; i < brf_eta_shared->num_printers; i ++)
+  {
+    if (!strcmp(brf_eta_shared->printers[i].device_uri, device_uri))
+      return (brf_eta_shared->printers + i);
+  }
+
+  if (!create || brf_eta_shared->num_printers >= BRF_ETA_MAX_PRINTERS)
+    return (NULL);
+
+  printer = brf_eta_shared->printers + brf_eta_shared->num_printers ++;
+  papplCopyString(printer->device_uri, device_uri, sizeof(printer->device_uri));
+
+  return (printer);
+}
+
+// 'brf_eta_queue()' - Estimate the queue of a printer.
+//
+// Sets the estimates as the messages of the active jobs, or lists them to a
+// client.  Pool queues only forward their jobs and have no estimates.
+
+static bool                             // O - `true` if the printer was measured
+brf_eta_queue(pappl_printer_t *printer, // I - Printer
+              pappl_client_t *client,   // I - Client or `NULL` to set messages
+              brf_eta_queue_t *queue)   // O - Estimate
+{
+  brf_eta_printer_t *measured;          // Measured printer
+
+  memset(queue, 0, sizeof(brf_eta_queue_t));
+  queue->client = client;
+  queue->now    = time(NULL);
+
+  if (brf_PoolIsPool(printer))
+    return (false);
+
+  brf_eta_lock();
+  if ((measured = brf_eta_printer(papplPrinterGetDeviceURI(printer), false)) != NULL)
+    queue->printer = *measured;
+  pthread_mutex_unlock(&brf_eta_shared->mutex);
+
+  papplPrinterIterateActiveJobs(printer, brf_eta_job, queue, 1, 0);
+
+  return (queue->printer.jobs > 0);
+}
+
+// 'brf_eta_save()' - Save the measurements.
+
+static void
+brf_eta_save(void)
+{
+  FILE *fp;                             // Measurement file
+  char tmpname[1040];                   // Temporary file
+  brf_eta_shared_t *copy;               // Copy of the measurements
+  int i;                                // Looping var
+
+  if ((copy = (brf_eta_shared_t *)malloc(sizeof(brf_eta_shared_t))) == NULL)
+    return;
+
+  brf_eta_lock();
+  memcpy(copy, brf_eta_shared, sizeof(brf_eta_shared_t));
+  pthread_mutex_unlock(&brf_eta_shared->mutex);
+
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", brf_eta_filename);
+
+  if ((fp = fopen(tmpname, "w")) != NULL)
+  {
+    for (i = 0; i < copy->num_printers; i ++)
+      fprintf(fp, "printer %lu %lu %g %g %g %s\n", copy->printers[i].jobs, copy->printers[i].page_jobs, copy->printers[i].cps, copy->printers[i].ppm, copy->printers[i].cpp, copy->printers[i].device_uri);
+
+    for (i = 0; i < copy->num_formats; i ++)
+      fprintf(fp, "format %lu %g %s\n", copy->formats[i].jobs, copy->formats[i].bytes_per_page, copy->formats[i].format);
+
+    if (fclose(fp) || rename(tmpname, brf_eta_filename))
+      unlink(tmpname);
+    else
+      brf_eta_saved = copy->changes;
+  }
+
+  free(copy);
+}
+
+// 'brf_eta_strtime()' - Format the time a job starts or finishes.
+
+static void
+brf_eta_strtime(time_t t,               // I - Time
+                time_t now,             // I - Current time
+                char *buffer,           // I - String buffer
+                size_t bufsize)         // I - Size of string buffer
+{
+  struct tm tm;                         // Local time
+
+  localtime_r(&t, &tm);
+
+  // Show the date when it is not today
+  if (t - now > 12 * 60 * 60)
+    strftime(buffer, bufsize, "%b %d %H:%M", &tm);
+  else
+    strftime(buffer, bufsize, "%H:%M", &tm);
+}
+
+// 'brf_eta_timer()' - Update the estimates of all queues.
+
+static bool                             // O - `true` to keep the timer
+brf_eta_timer(pappl_system_t *system,   // I - System
+              void *data)               // I - Callback data (unused)
+{
+  unsigned long changes;                // Recorded jobs
+
+  (void)data;
+
+  papplSystemIteratePrinters(system, brf_eta_update, NULL);
+
+  brf_eta_lock();
+  changes = brf_eta_shared->changes;
+  pthread_mutex_unlock(&brf_eta_shared->mutex);
+
+  if (changes != brf_eta_saved)
+    brf_eta_save();
+
+  return (true);
+}
+
+// 'brf_eta_update()' - Update the estimates of a printer's jobs.
+//
+// A new pages per minute measurement also becomes the "pages-per-minute" of
+// the printer.
+
+static void
+brf_eta_update(pappl_printer_t *printer,// I - Printer
+               void *data)              // I - Callback data (unused)
+{
+  brf_eta_queue_t queue;                // Estimate of the queue
+  pappl_pr_driver_data_t driver_data;   // Driver data
+  ipp_t *driver_attrs,                  // Current driver attributes
+      *vendor_attrs;                    // Vendor attributes to keep
+  ipp_attribute_t *attr;                // Current attribute
+  const char *name;                     // Attribute name
+  size_t len;                           // Length of vendor option name
+  int i,                                // Looping var
+      ppm;                              // Measured pages per minute
+
+  (void)data;
+
+  brf_eta_queue(printer, NULL, &queue);
+
+  if (!papplPrinterGetDriverData(printer, &driver_data) || (ppm = brf_EtaGetPPM(papplPrinterGetDeviceURI(printer))) == driver_data.ppm)
+    return;
+
+  // Setting the driver data rebuilds the printer attributes, so hand back the
+  // vendor option attributes with the defaults set for the printer
+  if ((driver_attrs = papplPrinterGetDriverAttributes(printer)) == NULL || (vendor_attrs = ippNew()) == NULL)
+  {
+    ippDelete(driver_attrs);
+    return;
+  }
+
+  for (attr = ippFirstAttribute(driver_attrs); attr; attr = ippNextAttribute(driver_attrs))
+  {
+    if ((name = ippGetName(attr)) == NULL)
+      continue;
+
+    for (i = 0; i < driver_data.num_vendor; i ++)
+    {
+      len = strlen(driver_data.vendor[i]);
+
+      if (!strncmp(name, driver_data.vendor[i], len) && name[len] == '-')
+      {
+        ippCopyAttribute(vendor_attrs, attr, 0);
+        break;
+      }
+    }
+  }
+
+  papplLogPrinter(printer, PAPPL_LOGLEVEL_DEBUG, "Measured %d pages per minute.", ppm);
+
+  driver_data.ppm = ppm;
+  papplPrinterSetDriverData(printer, &driver_data, vendor_attrs);
+
+  ippDelete(vendor_attrs);
+  ippDelete(driver_attrs);
+}
+
+// 'brf_eta_web()' - Show the estimates page of the web interface.
+
+static bool                             // O - `true` if handled
+brf_eta_web(pappl_client_t *client,     // I - Client
+            void *data)                 // I - System
+{
+  pappl_system_t *system = (pappl_system_t *)data;
+                                        // System
+  brf_eta_printers_t printers;          // Printers
+  brf_eta_queue_t queue;                // Estimate of a queue
+  char empty[64];                       // Time the queue is empty
+  int i;                                // Looping var
+
+  if (!papplClientHTMLAuthorize(client))
+    return (true);
+
+  printers.num_printers = 0;
+  papplSystemIteratePrinters(system, brf_eta_add_printer, &printers);
+
+  if (!papplClientRespond(client, HTTP_STATUS_OK, NULL, "text/html", 0, 0))
+    return (false);
+
+  papplClientHTMLHeader(client, "Job Estimates", 0);
+  papplClientHTMLPuts(client,
+                      "    <div class=\"content\">\n"
+                      "      <div class=\"row\">\n"
+                      "        <div class=\"col-12\">\n"
+                      "          <h1 class=\"title\">Job Estimates</h1>\n"
+                      "          <p>The speed of every printer is measured on its completed jobs.  Jobs show their expected start and finish times as their state message.</p>\n"
+                      "          <table class=\"list\">\n"
+                      "            <thead>\n"
+                      "              <tr><th>Printer</th><th>Measured Jobs</th><th>Characters/s</th><th>Pages/min</th><th>Characters/Page</th><th>Active Jobs</th><th>Queue Empty</th></tr>\n"
+                      "            </thead>\n"
+                      "            <tbody>\n");
+
+  for (i = 0; i < printers.num_printers; i ++)
+  {
+    if (!brf_eta_queue(printers.printers[i], NULL, &queue))
+    {
+      papplClientHTMLPrintf(client, "              <tr><td>%s</td><td>0</td><td>-</td><td>-</td><td>-</td><td>%d</td><td>not measured yet</td></tr>\n", papplPrinterGetName(printers.printers[i]), papplPrinterGetNumberOfActiveJobs(printers.printers[i]));
+      continue;
+    }
+
+    brf_eta_strtime(queue.now + (time_t)queue.finish, queue.now, empty, sizeof(empty));
+
+    papplClientHTMLPrintf(client, "              <tr><td>%s</td><td>%lu</td><td>%.1f</td><td>%.1f</td><td>%.0f</td><td>%d</td><td>%s</td></tr>\n", papplPrinterGetName(printers.printers[i]), queue.printer.jobs, queue.printer.cps, queue.printer.ppm, queue.printer.cpp, papplPrinterGetNumberOfActiveJobs(printers.printers[i]), queue.jobs ? empty : "now");
+  }
+
+  papplClientHTMLPuts(client,
+                      "            </tbody>\n"
+                      "          </table>\n"
+                      "          <h2 class=\"title\">Active Jobs</h2>\n"
+                      "          <table class=\"list\">\n"
+                      "            <thead>\n"
+                      "              <tr><th>Job</th><th>Name</th><th>Printer</th><th>Pages</th><th>Start</th><th>Finish</th></tr>\n"
+                      "            </thead>\n"
+                      "            <tbody>\n");
+
+  for (i = 0; i < printers.num_printers; i ++)
+    brf_eta_queue(printers.printers[i], client, &queue);
+
+  papplClientHTMLPuts(client,
+                      "            </tbody>\n"
+                      "          </table>\n"
+                      "        </div>\n"
+                      "      </div>\n"
+                      "    </div>\n");
+  papplClientHTMLFooter(client);
+
+  return (true);
+}
@@ -0,0 +1,391 @@
+//
+// Conversion graph for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include <pthread.h>
+#include <float.h>
+#include <sys/resource.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_GRAPH_MAX_NODES 128          // Maximum number of MIME types
+#define BRF_GRAPH_HASH_SIZE 256          // Size of MIME type hash table
+#define BRF_GRAPH_DEFAULT_COST 0.1       // Cost of a stage that never ran (seconds)
+
+// Local types...
+
+typedef struct brf_graph_cost_s          // Measured stage cost, shared with
+                                         // the filter processes
+{
+  unsigned long runs;                    // Number of completed runs
+  unsigned long total_usecs;             // Total time of all runs
+} brf_graph_cost_t;
+
+typedef struct brf_graph_edge_s          // Conversion between two types
+{
+  int from,                              // Source node
+      to;                                // Destination node
+  brf_spooling_conversion_t *conversion; // Conversion table entry
+  brf_graph_cost_t *cost;                // Measured cost
+  cf_filter_filter_in_chain_t stage;     // Timed filter for chains
+} brf_graph_edge_t;
+
+typedef struct brf_graph_node_s          // MIME media type
+{
+  const char *mime_type;                 // MIME media type
+  double cost;                           // Cost of the path to the target
+  int num_path,                          // Number of edges in the path
+      path[BRF_GRAPH_MAX_NODES];         // Edges of the lowest-cost path
+} brf_graph_node_t;
+
+// Local globals...
+
+static pthread_rwlock_t brf_graph_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+                                         // Lock for paths
+static pappl_system_t *brf_graph_system = NULL;
+                                         // System for logging
+static pid_t brf_graph_pid = 0;          // Process that built the graph
+static int brf_graph_num_nodes = 0;      // Number of nodes
+static brf_graph_node_t brf_graph_nodes[BRF_GRAPH_MAX_NODES];
+                                         // Nodes
+static int brf_graph_hash[BRF_GRAPH_HASH_SIZE];
+                                         // Node index + 1 by MIME type hash
+static int brf_graph_num_edges = 0;      // Number of edges
+static brf_graph_edge_t *brf_graph_edges = NULL;
+                                         // Edges
+static brf_graph_cost_t *brf_graph_costs = NULL;
+                                         // Measured costs (shared memory)
+static unsigned long brf_graph_planned_runs = 0;
+                                         // Runs seen by the last plan
+static int brf_graph_target = -1;        // Target node
+
+// Local functions...
+
+static int brf_graph_add_node(const char *mime_type);
+static int brf_graph_find_node(const char *mime_type);
+static unsigned brf_graph_hash_string(const char *s);
+static void brf_graph_plan(void);
+static int brf_graph_timed_filter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// 'brf_GraphInit()' - Build the conversion graph from the conversion table.
+//
+// Every MIME type in the table becomes a node and every table entry becomes
+// an edge.  The lowest-cost path from each node to the target type is then
+// computed once, so jobs only need a hash lookup to get their filter chain.
+
+bool                                         // O - `true` on success, `false` on error
+brf_GraphInit(
+    pappl_system_t *system,                  // I - System
+    brf_spooling_conversion_t *conversions,  // I - Conversion table
+    const char *target)                      // I - Final MIME type
+{
+  int i,                                     // Looping var
+      num_conversions;                       // Number of conversions
+  brf_graph_edge_t *edge;                    // Current edge
+
+  brf_graph_system = system;
+  brf_graph_pid    = getpid();
+
+  for (num_conversions = 0; conversions[num_conversions].srctype; num_conversions ++);
+
+  if ((brf_graph_edges = (brf_graph_edge_t *)calloc((size_t)num_conversions, sizeof(brf_graph_edge_t))) == NULL)
+    return (false);
+
+  // Measured costs are updated by the forked filter processes, so they need
+  // to live in shared memory...
+  if ((brf_graph_costs = (brf_graph_cost_t *)brf_SharedAlloc((size_t)num_conversions * sizeof(brf_graph_cost_t))) == NULL)
+  {
+    free(brf_graph_edges);
+    brf_graph_edges = NULL;
+    return (false);
+  }
+
+  if ((brf_graph_target = brf_graph_add_node(target)) < 0)
+    return (false);
+
+  for (i = 0; i < num_conversions; i ++)
+  {
+    edge             = brf_graph_edges + brf_graph_num_edges;
+    edge->from       = brf_graph_add_node(conversions[i].srctype);
+    edge->to         = brf_graph_add_node(conversions[i].dsttype);
+    edge->conversion = conversions + i;
+    edge->cost       = brf_graph_costs + i;
+
+    if (edge->from < 0 || edge->to < 0)
+    {
+      papplLog(system, PAPPL_LOGLEVEL_ERROR, "Too many MIME types in conversion table.");
+      return (false);
+    }
+
+    edge->stage.function   = brf_graph_timed_filter;
+    edge->stage.parameters = edge;
+    edge->stage.name       = conversions[i].filters.name;
+
+    brf_graph_num_edges ++;
+  }
+
+  pthread_rwlock_wrlock(&brf_graph_rwlock);
+  brf_graph_plan();
+  pthread_rwlock_unlock(&brf_graph_rwlock);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Conversion graph has %d MIME types and %d conversions.", brf_graph_num_nodes, brf_graph_num_edges);
+
+  return (true);
+}
+
+// 'brf_GraphCanConvert()' - Check whether a MIME type can be converted to the target.
+
+bool                                     // O - `true` if convertible
+brf_GraphCanConvert(const char *mime_type) // I - MIME media type
+{
+  int node;                              // Node index
+  bool ret;                              // Return value
+
+  pthread_rwlock_rdlock(&brf_graph_rwlock);
+  ret = (node = brf_graph_find_node(mime_type)) >= 0 && brf_graph_nodes[node].cost < DBL_MAX;
+  pthread_rwlock_unlock(&brf_graph_rwlock);
+
+  return (ret);
+}
+
+// 'brf_GraphPlan()' - Add the filters for a conversion to a filter chain.
+//
+// The path was computed ahead of time, so this is a hash lookup plus a copy of
+// at most one filter per MIME type in the graph.
+
+bool                                     // O - `true` on success, `false` if not convertible
+brf_GraphPlan(const char *mime_type,     // I - Input MIME media type
+              cups_array_t *chain)       // I - Filter chain
+{
+  int i,                                 // Looping var
+      node;                              // Node index
+  bool ret = false;                      // Return value
+
+  pthread_rwlock_rdlock(&brf_graph_rwlock);
+
+  if ((node = brf_graph_find_node(mime_type)) >= 0 && brf_graph_nodes[node].cost < DBL_MAX)
+  {
+    for (i = 0; i < brf_graph_nodes[node].num_path; i ++)
+      cupsArrayAdd(chain, &brf_graph_edges[brf_graph_nodes[node].path[i]].stage);
+
+    ret = true;
+  }
+
+  pthread_rwlock_unlock(&brf_graph_rwlock);
+
+  return (ret);
+}
+
+// 'brf_GraphUpdate()' - Re-plan the paths if new stage costs were measured.
+
+void
+brf_GraphUpdate(void)
+{
+  int i;                                 // Looping var
+  unsigned long runs = 0;                // Total runs
+
+  for (i = 0; i < brf_graph_num_edges; i ++)
+    runs += __atomic_load_n(&brf_graph_edges[i].cost->runs, __ATOMIC_RELAXED);
+
+  pthread_rwlock_wrlock(&brf_graph_rwlock);
+
+  if (runs != brf_graph_planned_runs)
+  {
+    brf_graph_planned_runs = runs;
+    brf_graph_plan();
+  }
+
+  pthread_rwlock_unlock(&brf_graph_rwlock);
+}
+
+// 'brf_graph_add_node()' - Find or add a node for a MIME type.
+
+static int                               // O - Node index or -1 if full
+brf_graph_add_node(const char *mime_type) // I - MIME media type
+{
+  int node;                              // Node index
+  unsigned bucket;                       // Hash bucket
+
+  if ((node = brf_graph_find_node(mime_type)) >= 0)
+    return (node);
+
+  if (brf_graph_num_nodes >= BRF_GRAPH_MAX_NODES)
+    return (-1);
+
+  node = brf_graph_num_nodes ++;
+  brf_graph_nodes[node].mime_type = mime_type;
+
+  for (bucket = brf_graph_hash_string(mime_type); brf_graph_hash[bucket]; bucket = (bucket + 1) % BRF_GRAPH_HASH_SIZE);
+
+  brf_graph_hash[bucket] = node + 1;
+
+  return (node);
+}
+
+// 'brf_graph_find_node()' - Find the node for a MIME type.
+
+static int                                // O - Node index or -1 if not found
+brf_graph_find_node(const char *mime_type) // I - MIME media type
+{
+  unsigned bucket;                        // Hash bucket
+  int node;                               // Node index
+
+  // The table is at most half full, so the probe always reaches an empty
+  // bucket...
+  for (bucket = brf_graph_hash_string(mime_type); (node = brf_graph_hash[bucket]) != 0; bucket = (bucket + 1) % BRF_GRAPH_HASH_SIZE)
+  {
+    if (!strcasecmp(brf_graph_nodes[node - 1].mime_type, mime_type))
+      return (node - 1);
+  }
+
+  return (-1);
+}
+
+// 'brf_graph_hash_string()' - Hash a MIME type (FNV-1a, case-insensitive).
+
+static unsigned                          // O - Hash bucket
+brf_graph_hash_string(const char *s)     // I - String
+{
+  unsigned hash = 2166136261U;           // Hash value
+
+  for (; *s; s ++)
+    hash = (hash ^ (unsigned)tolower(*s & 255)) * 16777619U;
+
+  return (hash % BRF_GRAPH_HASH_SIZE);
+}
+
+// 'brf_graph_plan()' - Compute the lowest-cost path from every node to the target.
+//
+// Dijkstra's algorithm on the reversed graph, starting at the target.  Each
+// node is settled exactly once, so planning always terminates even when the
+// table contains cycles.  The caller must hold the write lock.
+
+static void
+brf_graph_plan(void)
+{
+  int i,                                 // Looping var
+      node,                              // Current node
+      next[BRF_GRAPH_MAX_NODES];         // First edge towards target
+  bool done[BRF_GRAPH_MAX_NODES];        // Settled nodes
+  double cost;                           // Cost through current edge
+  brf_graph_edge_t *edge;                // Current edge
+  brf_graph_node_t *n;                   // Current node
+
+  for (i = 0; i < brf_graph_num_nodes; i ++)
+  {
+    brf_graph_nodes[i].cost     = DBL_MAX;
+    brf_graph_nodes[i].num_path = 0;
+    next[i]                     = -1;
+    done[i]                     = false;
+  }
+
+  brf_graph_nodes[brf_graph_target].cost = 0.0;
+
+  for (;;)
+  {
+    // Settle the closest unsettled node...
+    for (i = 0, node = -1; i < brf_graph_num_nodes; i ++)
+    {
+      if (!done[i] && brf_graph_nodes[i].cost < DBL_MAX && (node < 0 || brf_graph_nodes[i].cost < brf_graph_nodes[node].cost))
+        node = i;
+    }
+
+    if (node < 0)
+      break;
+
+    done[node] = true;
+
+    // Relax the conversions that produce this node's type...
+    for (i = 0, edge = brf_graph_edges; i < brf_graph_num_edges; i ++, edge ++)
+    {
+      unsigned long runs = __atomic_load_n(&edge->cost->runs, __ATOMIC_RELAXED);
+
+      if (edge->to != node || done[edge->from])
+        continue;
+
+      if (runs > 0)
+        cost = (double)__atomic_load_n(&edge->cost->total_usecs, __ATOMIC_RELAXED) / (double)runs / 1000000.0;
+      else
+        cost = BRF_GRAPH_DEFAULT_COST;
+
+      cost += brf_graph_nodes[node].cost;
+
+      if (cost < brf_graph_nodes[edge->from].cost)
+      {
+        brf_graph_nodes[edge->from].cost = cost;
+        next[edge->from]                 = i;
+      }
+    }
+  }
+
+  // Store the paths so that jobs don't have to walk the graph...
+  for (i = 0, n = brf_graph_nodes; i < brf_graph_num_nodes; i ++, n ++)
+  {
+    for (node = i; node != brf_graph_target && next[node] >= 0 && n->num_path < BRF_GRAPH_MAX_NODES; node = brf_graph_edges[next[node]].to)
+      n->path[n->num_path ++] = next[node];
+
+    if (n->num_path > 0)
+      papplLog(brf_graph_system, PAPPL_LOGLEVEL_DEBUG, "Planned %d stage(s) for '%s', cost %.3fs.", n->num_path, n->mime_type, n->cost);
+  }
+}
+
+// 'brf_graph_timed_filter()' - Run a conversion and record its cost.
+//
+// Chains with more than one filter run each filter in a forked process, so
+// the cost is the CPU time of the process and its children rather than wall
+// time, which would also count the time spent waiting on the other stages of
+// the pipeline.  External filters run by a launcher are not children of the
+// process, their CPU time comes from brf_LauncherGetCPUTime().
+
+static int                               // O - Exit status of the filter
+brf_graph_timed_filter(
+    int inputfd,                         // I - Input file descriptor
+    int outputfd,                        // I - Output file descriptor
+    int inputseekable,                   // I - Is input seekable?
+    cf_filter_data_t *data,              // I - Job and printer data
+    void *parameters)                    // I - Graph edge
+{
+  brf_graph_edge_t *edge = (brf_graph_edge_t *)parameters;
+                                         // Graph edge
+  cf_filter_filter_in_chain_t *filter = &edge->conversion->filters;
+                                         // Real filter
+  int ret;                               // Exit status
+  double start,                          // Start time
+      elapsed;                           // Cost of this run
+  struct rusage self,                    // Usage of this process
+      children;                          // Usage of child processes
+  bool forked = getpid() != brf_graph_pid;
+                                         // Running in a filter process?
+
+  start = brf_GetTime();
+
+  brf_LauncherGetCPUTime();
+
+  ret = (filter->function)(inputfd, outputfd, inputseekable, data, filter->parameters);
+
+  // The latency histograms show the wall time each filter added to the job
+  brf_MetricsObserve(BRF_METRIC_FILTER, data->printer, filter->name, brf_GetTime() - start);
+
+  if (forked && !getrusage(RUSAGE_SELF, &self) && !getrusage(RUSAGE_CHILDREN, &children))
+    elapsed = (double)(self.ru_utime.tv_sec + self.ru_stime.tv_sec + children.ru_utime.tv_sec + children.ru_stime.tv_sec) + (double)(self.ru_utime.tv_usec + self.ru_stime.tv_usec + children.ru_utime.tv_usec + children.ru_stime.tv_usec) / 1000000.0 + brf_LauncherGetCPUTime();
+  else
+    elapsed = brf_GetTime() - start;
+
+  if (!ret)
+  {
+    __atomic_add_fetch(&edge->cost->total_usecs, (unsigned long)(elapsed * 1000000.0), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&edge->cost->runs, 1, __ATOMIC_RELAXED);
+  }
+
+  if (data->logfunc)
+    (data->logfunc)(data->logdata, CF_LOGLEVEL_DEBUG, "%s took %.3fs.", filter->name, elapsed);
+
+  return (ret);
+}
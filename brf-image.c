@@ -0,0 +1,1961 @@
+//
+// In-process image to tactile graphics conversion for the Braille Printer
+// Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <png.h>
+#include <jpeglib.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_IMAGE_MAX_INPUT (256 * 1024 * 1024)
+                                        // Maximum size of an image file
+#define BRF_IMAGE_MAX_PIXELS (256 * 1024 * 1024)
+                                        // Maximum number of pixels
+#define BRF_IMAGE_MAX_RADIUS 32         // Maximum blur radius
+#define BRF_IMAGE_MAX_THREADS 64        // Maximum number of worker threads
+#define BRF_IMAGE_MIN_PARALLEL (1024 * 1024)
+                                        // Smallest image worth threads
+#define BRF_IMAGE_OVERSAMPLE 4          // Minimum pixels per dot across and down
+#define BRF_IMAGE_TILE_ROWS 64          // Rows per band
+
+// Local types...
+
+typedef float brf_vf_t __attribute__((vector_size(16)));
+                                        // 4 floats
+typedef int brf_vi_t __attribute__((vector_size(16)));
+                                        // 4 ints (comparison results)
+typedef unsigned char brf_vu8_t __attribute__((vector_size(16)));
+                                        // 16 gray levels
+
+typedef struct brf_image_s              // Grayscale image
+{
+  int width,                            // Width in pixels
+      height;                           // Height in pixels
+  unsigned char *pixels;                // Pixels, 0 is black
+} brf_image_t;
+
+typedef struct brf_image_canny_s brf_image_canny_t;
+                                        // Edge detection state
+
+typedef struct brf_image_worker_s       // Edge detection worker
+{
+  brf_image_canny_t *canny;             // Edge detection state
+  int index;                            // Worker number
+  int next,                             // Next band of the range (atomic)
+      end;                              // End of the range
+  bool error;                           // Did a band fail?
+  float maxmag;                         // Largest thinned gradient seen
+  void *scratch;                        // Rows around the current band
+  size_t scratchsize;                   // Size of scratch memory
+} brf_image_worker_t;
+
+struct brf_image_canny_s                // Edge detection state
+{
+  const brf_image_t *image;             // Image
+  unsigned char *edges;                 // Edge map
+  float *kernel;                        // Gaussian weights
+  int radius;                           // Gaussian radius
+  float *nms;                           // Thinned squared gradients
+  float lower,                          // Lower threshold (squared)
+      upper;                            // Upper threshold (squared)
+  int pass;                             // 1 = gradients, 2 = thresholds
+  int num_tiles;                        // Number of bands
+  int num_workers;                      // Number of workers
+  brf_image_worker_t workers[BRF_IMAGE_MAX_THREADS];
+                                        // Workers
+};
+
+typedef struct brf_image_fit_s          // Fitting of an image to the page
+{
+  const brf_geometry_t *geometry;       // Page geometry
+  int rows;                             // Dot rows per cell
+  const char *rotate;                   // Rotate option
+  int angle,                            // Rotation to apply (0, 90 or 270)
+      grid_width,                       // Dots across
+      grid_height,                      // Dots down
+      factor;                           // Reduction factor (power of 2)
+} brf_image_fit_t;
+
+typedef struct brf_image_jpeg_err_s     // libjpeg error handler
+{
+  struct jpeg_error_mgr pub;            // Standard error manager
+  jmp_buf env;                          // Where to go on error
+  char message[JMSG_LENGTH_MAX];        // Last error message
+} brf_image_jpeg_err_t;
+
+typedef struct brf_image_png_src_s      // libpng memory source
+{
+  const unsigned char *data;            // Image file
+  size_t datasize,                      // Size of image file
+      offset;                           // Current offset
+  char message[256];                    // Last error message
+} brf_image_png_src_t;
+
+typedef struct brf_image_reducer_s      // Box reduction of decoded rows
+{
+  brf_image_t *image;                   // Reduced image
+  int width,                            // Width of decoded rows
+      height,                           // Number of decoded rows
+      factor,                           // Reduction factor
+      y;                                // Current decoded row
+  unsigned *sums;                       // Sums of the current reduced row
+} brf_image_reducer_t;
+
+// Local globals...
+
+static const char brf_image_ascii[64 + 1] = " A1B'K2L@CIF/MSP\"E3H9O6R^DJG>NTQ,*5<-U8V.%[$+X!&;:4\\0Z7(_?W]#Y)=";
+                                        // North American braille ASCII by dot pattern
+static const unsigned char brf_image_dot_bits[4][2] =
+{                                       // Dot bit by row and column in a cell
+  { 0x01, 0x08 },
+  { 0x02, 0x10 },
+  { 0x04, 0x20 },
+  { 0x40, 0x80 }
+};
+static const unsigned char brf_image_bayer[8][8] =
+{                                       // 8x8 Bayer matrix for ordered dithering
+  {  0, 32,  8, 40,  2, 34, 10, 42 },
+  { 48, 16, 56, 24, 50, 18, 58, 26 },
+  { 12, 44,  4, 36, 14, 46,  6, 38 },
+  { 60, 28, 52, 20, 62, 30, 54, 22 },
+  {  3, 35, 11, 43,  1, 33,  9, 41 },
+  { 51, 19, 59, 27, 49, 17, 57, 25 },
+  { 15, 47,  7, 39, 13, 45,  5, 37 },
+  { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+// Local functions...
+
+static void brf_image_average(const brf_image_t *image, int *sums, unsigned char *gray, int grid_width, int grid_height);
+static bool brf_image_canny(brf_image_t *image, int radius, double sigma, int lower, int upper, unsigned char *edges);
+static bool brf_image_canny_run(brf_image_canny_t *canny);
+static bool brf_image_canny_tile(brf_image_worker_t *worker, int tile);
+static void *brf_image_canny_worker(brf_image_worker_t *worker);
+static void brf_image_classify_row(const float *mag, unsigned char *edges, int width, float lower, float upper);
+static bool brf_image_decode(const unsigned char *data, size_t datasize, brf_image_fit_t *fit, brf_image_t *image, char *message, size_t msgsize);
+static bool brf_image_decode_jpeg(const unsigned char *data, size_t datasize, brf_image_fit_t *fit, brf_image_t *image, char *message, size_t msgsize);
+static bool brf_image_decode_png(const unsigned char *data, size_t datasize, brf_image_fit_t *fit, brf_image_t *image, char *message, size_t msgsize);
+static bool brf_image_decode_pnm(const unsigned char *data, size_t datasize, brf_image_fit_t *fit, brf_image_t *image, char *message, size_t msgsize);
+static bool brf_image_dither_diffusion(unsigned char *dots, int width, int height);
+static void brf_image_dither_ordered(unsigned char *dots, int width, int height);
+static int brf_image_fit(brf_image_fit_t *fit, int width, int height);
+static void brf_image_hblur_row(const unsigned char *src, float *row, float *dst, int width, const float *kernel, int radius);
+static void brf_image_jpeg_error(j_common_ptr cinfo);
+static void brf_image_nms_row(const float *above, const float *mag, const float *below, const unsigned char *dir, float *nms, int width);
+static void brf_image_png_error(png_structp png, png_const_charp message);
+static void brf_image_png_read(png_structp png, png_bytep data, png_size_t length);
+static void brf_image_png_warning(png_structp png, png_const_charp message);
+static void brf_image_reducer_add(brf_image_reducer_t *reducer, const unsigned char *row);
+static void brf_image_reducer_finish(brf_image_reducer_t *reducer);
+static void brf_image_reducer_free(brf_image_reducer_t *reducer, brf_image_t *image);
+static bool brf_image_reducer_init(brf_image_reducer_t *reducer, int width, int height, int factor, brf_image_t *image);
+static bool brf_image_rotate(brf_image_t *image, int angle);
+static void brf_image_sobel_row(const float *above, const float *row, const float *below, float *magrow, unsigned char *dirrow, int width);
+static void brf_image_threshold(brf_image_t *image, unsigned char *dots);
+static void brf_image_trace(unsigned char *edges, int width, int height);
+static void brf_image_vblur_row(const float **rows, float *dst, int width, const float *kernel, int ksize);
+static char *brf_image_write(const unsigned char *dots, int width, int height, const brf_geometry_t *geometry, int rows, int dilate, bool ubrl, size_t *length);
+
+
+// 'brf_ImageFilter()' - Convert a PNG, JPEG or PNM image to braille graphics.
+//
+// This replaces the external imagetobrf and imagetoubrl filters for the
+// formats it decodes itself.  Edges are found with Canny edge detection (or
+// dark areas are filled with "Edge=None"), reduced to the braille dot grid of
+// the page and written as braille cells, as North American braille ASCII for
+// BRF or as Unicode braille patterns for UBRL ("parameters" is
+// BRF_IMAGE_UBRL).  "Edge=Ordered" and "Edge=Diffusion" halftone the gray
+// levels onto the dot grid instead, for filled shapes and charts.
+
+int                                     // O - Exit status
+brf_ImageFilter(
+    int inputfd,                        // I - Input file descriptor
+    int outputfd,                       // I - Output file descriptor
+    int inputseekable,                  // I - Is input seekable? (unused)
+    cf_filter_data_t *data,             // I - Job and printer data
+    void *parameters)                   // I - Output format
+{
+  cf_logfunc_t log = data->logfunc;     // Log function
+  void *ld = data->logdata;             // Log function data
+  unsigned char *inbuf = NULL,          // Image file
+      *edges = NULL,                    // Edge or fill map
+      *dots = NULL;                     // Dot grid
+  size_t insize = 0,                    // Bytes in input
+      inalloc = 0,                      // Allocated input size
+      outlen;                           // Length of output
+  ssize_t bytes;                        // Bytes read
+  brf_image_t image = { 0, 0, NULL };   // Decoded image
+  brf_geometry_t geometry;              // Page geometry
+  brf_image_fit_t fit;                  // Fitting of the image to the page
+  const char *edge,                     // Edge option
+      *mode;                            // Rendering mode for the log
+  char message[256],                    // Decoder error
+      *outbuf = NULL;                   // Braille output
+  bool ubrl = parameters && !strcmp((const char *)parameters, BRF_IMAGE_UBRL);
+                                        // Write Unicode braille?
+  bool fill,                            // Fill dark areas instead of edges?
+      negate;                           // Negate the graphic?
+  int grid_width,                       // Dots across
+      grid_height,                      // Dots down
+      x, y,                             // Looping vars
+      ret = 1;                          // Exit status
+  int *counts = NULL;                   // Set pixels per dot
+  double start = brf_GetTime();         // Start time
+
+  (void)inputseekable;
+
+  // Read the whole image...
+  for (;;)
+  {
+    if (insize == inalloc)
+    {
+      unsigned char *temp;              // New buffer
+
+      if (inalloc >= BRF_IMAGE_MAX_INPUT)
+      {
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: Image is larger than %d bytes.", BRF_IMAGE_MAX_INPUT);
+        goto finish;
+      }
+
+      inalloc = inalloc ? 2 * inalloc : 65536;
+      if ((temp = (unsigned char *)realloc(inbuf, inalloc)) == NULL)
+      {
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: Unable to allocate %u bytes.", (unsigned)inalloc);
+        goto finish;
+      }
+
+      inbuf = temp;
+    }
+
+    if ((bytes = read(inputfd, inbuf + insize, inalloc - insize)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: Unable to read input: %s", strerror(errno));
+      goto finish;
+    }
+    else if (bytes == 0)
+      break;
+
+    insize += (size_t)bytes;
+  }
+
+  // Decode the image at the resolution of the braille dot grid of the
+  // page...
+  brf_GetGeometry(data->num_options, data->options, &geometry);
+
+  fit.geometry = &geometry;
+  fit.rows     = ubrl && geometry.dots == 8 ? 4 : 3;
+
+  if ((fit.rotate = cupsGetOption("Rotate", data->num_options, data->options)) == NULL)
+    fit.rotate = "90>";
+
+  if (!brf_image_decode(inbuf, insize, &fit, &image, message, sizeof(message)))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: %s", message);
+    goto finish;
+  }
+
+  free(inbuf);
+  inbuf = NULL;
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_ImageFilter: Decoded %dx%d image (1/%d scale) in %.3fs.", image.width, image.height, fit.factor, brf_GetTime() - start);
+
+  if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    goto finish;
+
+  if (!brf_image_rotate(&image, fit.angle))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: Unable to rotate image.");
+    goto finish;
+  }
+
+  // Reduce to the braille dot grid of the page...
+  grid_width  = fit.grid_width;
+  grid_height = fit.grid_height;
+
+  if ((dots = (unsigned char *)calloc((size_t)grid_width * (size_t)grid_height, 1)) == NULL || (counts = (int *)calloc((size_t)grid_width, sizeof(int))) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: Unable to allocate dot grid.");
+    goto finish;
+  }
+
+  if ((edge = cupsGetOption("Edge", data->num_options, data->options)) == NULL)
+    edge = "Canny";
+
+  negate = brf_GetBoolOption("Negate", false, data->num_options, data->options);
+  fill   = !strcasecmp(edge, "None");
+
+  if (!strcasecmp(edge, "Ordered") || !strcasecmp(edge, "Diffusion"))
+  {
+    // Halftone the gray level of each dot...
+    mode = !strcasecmp(edge, "Ordered") ? "ordered" : "diffusion";
+
+    brf_image_average(&image, counts, dots, grid_width, grid_height);
+
+    if (negate)
+    {
+      for (x = 0; x < grid_width * grid_height; x ++)
+        dots[x] = (unsigned char)(255 - dots[x]);
+    }
+
+    if (*mode == 'o')
+      brf_image_dither_ordered(dots, grid_width, grid_height);
+    else if (!brf_image_dither_diffusion(dots, grid_width, grid_height))
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: Unable to allocate error diffusion buffers.");
+      goto finish;
+    }
+  }
+  else
+  {
+    // Find the edges or the dark areas...
+    mode = fill ? "fill" : "edges";
+
+    if ((edges = (unsigned char *)malloc((size_t)image.width * (size_t)image.height)) == NULL)
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: Unable to allocate edge map.");
+      goto finish;
+    }
+
+    if (fill)
+    {
+      brf_image_threshold(&image, edges);
+    }
+    else if (!brf_image_canny(&image, brf_GetIntOption("CannyRadius", 0, data->num_options, data->options), brf_GetIntOption("CannySigma", 1, data->num_options, data->options), brf_GetIntOption("CannyLower", 10, data->num_options, data->options), brf_GetIntOption("CannyUpper", 30, data->num_options, data->options), edges))
+    {
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: Unable to allocate edge detection buffers.");
+      goto finish;
+    }
+
+    if (negate)
+    {
+      for (x = 0; x < image.width * image.height; x ++)
+        edges[x] ^= 1;
+    }
+
+    // A dot is raised for any edge pixel in its area, or for areas that are
+    // at least half dark...
+    for (y = 0; y < grid_height; y ++)
+    {
+      int y0 = (int)((long)y * image.height / grid_height),
+          y1 = (int)((long)(y + 1) * image.height / grid_height),
+          sy;                           // Source row
+
+      memset(counts, 0, (size_t)grid_width * sizeof(int));
+
+      for (sy = y0; sy < y1; sy ++)
+      {
+        const unsigned char *edgeptr = edges + (size_t)sy * (size_t)image.width;
+
+        for (x = 0; x < image.width; x ++)
+          counts[(long)x * grid_width / image.width] += edgeptr[x];
+      }
+
+      for (x = 0; x < grid_width; x ++)
+      {
+        int area = (y1 - y0) * (int)(((long)(x + 1) * image.width + grid_width - 1) / grid_width - ((long)x * image.width + grid_width - 1) / grid_width);
+
+        dots[y * grid_width + x] = fill ? (counts[x] * 2 >= area && area > 0) : (counts[x] > 0);
+      }
+    }
+  }
+
+  if ((outbuf = brf_image_write(dots, grid_width, grid_height, &geometry, fit.rows, brf_GetIntOption("EdgeFactor", 1, data->num_options, data->options) - 1, ubrl, &outlen)) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: Unable to allocate output buffer.");
+    goto finish;
+  }
+
+  if (brf_WriteAll(outputfd, outbuf, outlen) < 0)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_ImageFilter: Unable to write output: %s", strerror(errno));
+    goto finish;
+  }
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_ImageFilter: Wrote %dx%d dots (%s) in %.3fs.", grid_width, grid_height, mode, brf_GetTime() - start);
+
+  ret = 0;
+
+  finish:
+
+  free(inbuf);
+  free(image.pixels);
+  free(edges);
+  free(dots);
+  free(counts);
+  free(outbuf);
+
+  return (ret);
+}
+
+
+// 'brf_image_average()' - Compute the gray level of each dot of the grid.
+//
+// Dots cover the same pixels as in the edge reduction of brf_ImageFilter().
+
+static void
+brf_image_average(
+    const brf_image_t *image,           // I - Image
+    int *sums,                          // I - Scratch sums (grid_width)
+    unsigned char *gray,                // O - Gray level of each dot
+    int grid_width,                     // I - Dots across
+    int grid_height)                    // I - Dots down
+{
+  int x, y;                             // Looping vars
+
+  for (y = 0; y < grid_height; y ++)
+  {
+    int y0 = (int)((long)y * image->height / grid_height),
+        y1 = (int)((long)(y + 1) * image->height / grid_height),
+        sy;                             // Source row
+
+    memset(sums, 0, (size_t)grid_width * sizeof(int));
+
+    for (sy = y0; sy < y1; sy ++)
+    {
+      const unsigned char *pixptr = image->pixels + (size_t)sy * (size_t)image->width;
+
+      for (x = 0; x < image->width; x ++)
+        sums[(long)x * grid_width / image->width] += pixptr[x];
+    }
+
+    // Dots without pixels (images smaller than the grid) are white...
+    for (x = 0; x < grid_width; x ++)
+    {
+      int area = (y1 - y0) * (int)(((long)(x + 1) * image->width + grid_width - 1) / grid_width - ((long)x * image->width + grid_width - 1) / grid_width);
+
+      gray[y * grid_width + x] = area > 0 ? (unsigned char)((sums[x] + area / 2) / area) : 255;
+    }
+  }
+}
+
+
+// 'brf_image_canny()' - Find edges with Canny edge detection.
+//
+// "radius" and "sigma" are those of the Gaussian blur (a radius of 0 picks
+// one from sigma), "lower" and "upper" are the hysteresis thresholds in
+// percent of the strongest gradient, like ImageMagick's "-canny" operator.
+//
+// The image is cut in bands of rows that are blurred, differentiated and
+// thinned independently, each band reading enough rows around it to compute
+// its own rows exactly.  Bands are spread over worker threads, and a worker
+// that runs out of bands takes them from the others.  Every pixel goes
+// through the same computations whatever the number of threads, so the
+// result does not depend on it.
+
+static bool                             // O - `true` on success, `false` on error
+brf_image_canny(brf_image_t *image,     // I - Image
+                int radius,             // I - Blur radius
+                double sigma,           // I - Blur standard deviation
+                int lower,              // I - Lower threshold in percent
+                int upper,              // I - Upper threshold in percent
+                unsigned char *edges)   // O - Edge map (1 = edge)
+{
+  brf_image_canny_t canny;              // Edge detection state
+  float total = 0.0f,                   // Sum of kernel weights
+      maxmag = 0.0f,                    // Largest gradient
+      scale;                            // Threshold scale
+  int i,                                // Looping var
+      num_threads;                      // Number of threads
+  const char *value;                    // Environment variable
+  bool ret = false;                     // Return value
+
+  if (sigma <= 0.0)
+    sigma = 1.0;
+  if (radius <= 0)
+    radius = (int)ceil(3.0 * sigma);
+  if (radius > BRF_IMAGE_MAX_RADIUS)
+    radius = BRF_IMAGE_MAX_RADIUS;
+
+  memset(&canny, 0, sizeof(canny));
+
+  canny.image     = image;
+  canny.edges     = edges;
+  canny.radius    = radius;
+  canny.num_tiles = (image->height + BRF_IMAGE_TILE_ROWS - 1) / BRF_IMAGE_TILE_ROWS;
+
+  if ((canny.kernel = (float *)malloc((size_t)(2 * radius + 1) * sizeof(float))) == NULL || (canny.nms = (float *)malloc((size_t)image->width * (size_t)image->height * sizeof(float))) == NULL)
+    goto done;
+
+  for (i = 0; i <= 2 * radius; i ++)
+    total += canny.kernel[i] = (float)exp(-(double)((i - radius) * (i - radius)) / (2.0 * sigma * sigma));
+  for (i = 0; i <= 2 * radius; i ++)
+    canny.kernel[i] /= total;
+
+  // One thread per core, unless the image is small...
+  if ((value = getenv("BRF_IMAGE_THREADS")) != NULL && atoi(value) > 0)
+    num_threads = atoi(value);
+  else if ((size_t)image->width * (size_t)image->height < BRF_IMAGE_MIN_PARALLEL)
+    num_threads = 1;
+  else
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (num_threads > canny.num_tiles)
+    num_threads = canny.num_tiles;
+  if (num_threads > BRF_IMAGE_MAX_THREADS)
+    num_threads = BRF_IMAGE_MAX_THREADS;
+  if (num_threads < 1)
+    num_threads = 1;
+
+  canny.num_workers = num_threads;
+
+  // Blur, gradients and thinning...
+  canny.pass = 1;
+  if (!brf_image_canny_run(&canny))
+    goto done;
+
+  for (i = 0; i < canny.num_workers; i ++)
+    if (canny.workers[i].maxmag > maxmag)
+      maxmag = canny.workers[i].maxmag;
+
+  // Threshold classification with the global thresholds (magnitudes are
+  // squared)...
+  scale       = maxmag / 10000.0f;
+  canny.lower = scale * lower * lower;
+  canny.upper = scale * upper * upper;
+  canny.pass  = 2;
+
+  if (!brf_image_canny_run(&canny))
+    goto done;
+
+  // Edges connect across bands, so they are traced over the whole image...
+  brf_image_trace(edges, image->width, image->height);
+
+  ret = true;
+
+  done:
+
+  for (i = 0; i < BRF_IMAGE_MAX_THREADS; i ++)
+    free(canny.workers[i].scratch);
+
+  free(canny.kernel);
+  free(canny.nms);
+
+  return (ret);
+}
+
+
+// 'brf_image_canny_run()' - Run one pass over all bands with the workers.
+
+static bool                             // O - `true` on success, `false` on error
+brf_image_canny_run(
+    brf_image_canny_t *canny)           // I - Edge detection state
+{
+  int i,                                // Looping var
+      per_worker = canny->num_tiles / canny->num_workers,
+                                        // Bands per worker
+      extra = canny->num_tiles % canny->num_workers,
+                                        // Workers with one more band
+      next = 0;                         // First band of worker
+  pthread_t threads[BRF_IMAGE_MAX_THREADS];
+                                        // Worker threads
+  bool started[BRF_IMAGE_MAX_THREADS];  // Was the thread started?
+
+  // Give each worker a contiguous range of bands...
+  for (i = 0; i < canny->num_workers; i ++)
+  {
+    canny->workers[i].canny = canny;
+    canny->workers[i].index = i;
+    canny->workers[i].next  = next;
+    next += per_worker + (i < extra);
+    canny->workers[i].end   = next;
+    canny->workers[i].error = false;
+  }
+
+  // Worker 0 is this thread.  If a thread can't be started, the others steal
+  // its bands...
+  for (i = 1; i < canny->num_workers; i ++)
+    started[i] = !pthread_create(threads + i, NULL, (void *(*)(void *))brf_image_canny_worker, canny->workers + i);
+
+  brf_image_canny_worker(canny->workers);
+
+  for (i = 1; i < canny->num_workers; i ++)
+    if (started[i])
+      pthread_join(threads[i], NULL);
+
+  for (i = 0; i < canny->num_workers; i ++)
+    if (canny->workers[i].error)
+      return (false);
+
+  return (true);
+}
+
+
+// 'brf_image_canny_tile()' - Process one band of rows.
+
+static bool                             // O - `true` on success, `false` on error
+brf_image_canny_tile(
+    brf_image_worker_t *worker,         // I - Worker
+    int tile)                           // I - Band number
+{
+  brf_image_canny_t *canny = worker->canny;
+                                        // Edge detection state
+  const brf_image_t *image = canny->image;
+                                        // Image
+  int width = image->width,             // Width
+      height = image->height,           // Height
+      radius = canny->radius,           // Blur radius
+      ksize = 2 * radius + 1,           // Kernel size
+      y0 = tile * BRF_IMAGE_TILE_ROWS,  // First row
+      y1 = y0 + BRF_IMAGE_TILE_ROWS > height ? height : y0 + BRF_IMAGE_TILE_ROWS,
+                                        // Last row + 1
+      sa, sb,                           // Rows with gradients
+      ba, bb,                           // Rows with blur
+      ta, tb,                           // Rows with horizontal blur
+      y, k;                             // Looping vars
+  float *row,                           // Padded source row
+      *temp,                            // Horizontally blurred rows
+      *blur,                            // Blurred rows
+      *mag;                             // Squared gradients
+  unsigned char *dir;                   // Gradient directions
+  const float *rows[2 * BRF_IMAGE_MAX_RADIUS + 1];
+                                        // Rows of the vertical blur
+  size_t w = (size_t)width,             // Width for offsets
+      needed;                           // Scratch memory needed
+
+  if (canny->pass == 2)
+  {
+    for (y = y0; y < y1; y ++)
+      brf_image_classify_row(canny->nms + (size_t)y * w, canny->edges + (size_t)y * w, width, canny->lower, canny->upper);
+
+    return (true);
+  }
+
+  // Rows needed around the band: 1 for the thinning, 1 for the gradients and
+  // the blur radius...
+  sa = y0 > 0 ? y0 - 1 : 0;
+  sb = y1 < height ? y1 + 1 : height;
+  ba = sa > 0 ? sa - 1 : 0;
+  bb = sb < height ? sb + 1 : height;
+  ta = ba - radius > 0 ? ba - radius : 0;
+  tb = bb + radius < height ? bb + radius : height;
+
+  needed = (w + (size_t)ksize + 4 + (size_t)(tb - ta) * w + (size_t)(bb - ba) * w + (size_t)(sb - sa) * w) * sizeof(float) + (size_t)(sb - sa) * w;
+
+  if (needed > worker->scratchsize)
+  {
+    free(worker->scratch);
+
+    if ((worker->scratch = malloc(needed)) == NULL)
+    {
+      worker->scratchsize = 0;
+      return (false);
+    }
+
+    worker->scratchsize = needed;
+  }
+
+  row  = (float *)worker->scratch;
+  temp = row + w + (size_t)ksize + 4;
+  blur = temp + (size_t)(tb - ta) * w;
+  mag  = blur + (size_t)(bb - ba) * w;
+  dir  = (unsigned char *)(mag + (size_t)(sb - sa) * w);
+
+  for (y = ta; y < tb; y ++)
+    brf_image_hblur_row(image->pixels + (size_t)y * w, row, temp + (size_t)(y - ta) * w, width, canny->kernel, radius);
+
+  for (y = ba; y < bb; y ++)
+  {
+    for (k = 0; k < ksize; k ++)
+    {
+      int sy = y + k - radius;
+
+      rows[k] = temp + (size_t)((sy < 0 ? 0 : sy >= height ? height - 1 : sy) - ta) * w;
+    }
+
+    brf_image_vblur_row(rows, blur + (size_t)(y - ba) * w, width, canny->kernel, ksize);
+  }
+
+  for (y = sa; y < sb; y ++)
+  {
+    if (y == 0 || y == height - 1)
+    {
+      memset(mag + (size_t)(y - sa) * w, 0, w * sizeof(float));
+      memset(dir + (size_t)(y - sa) * w, 0, w);
+    }
+    else
+      brf_image_sobel_row(blur + (size_t)(y - 1 - ba) * w, blur + (size_t)(y - ba) * w, blur + (size_t)(y + 1 - ba) * w, mag + (size_t)(y - sa) * w, dir + (size_t)(y - sa) * w, width);
+  }
+
+  for (y = y0; y < y1; y ++)
+  {
+    float *nmsrow = canny->nms + (size_t)y * w;
+                                        // Thinned row
+
+    if (y == 0 || y == height - 1)
+      memset(nmsrow, 0, w * sizeof(float));
+    else
+      brf_image_nms_row(mag + (size_t)(y - 1 - sa) * w, mag + (size_t)(y - sa) * w, mag + (size_t)(y + 1 - sa) * w, dir + (size_t)(y - sa) * w, nmsrow, width);
+
+    for (k = 0; k < width; k ++)
+      if (nmsrow[k] > worker->maxmag)
+        worker->maxmag = nmsrow[k];
+  }
+
+  return (true);
+}
+
+
+// 'brf_image_canny_worker()' - Process bands until there are none left.
+
+static void *                           // O - Thread exit value (unused)
+brf_image_canny_worker(
+    brf_image_worker_t *worker)         // I - Worker
+{
+  brf_image_canny_t *canny = worker->canny;
+                                        // Edge detection state
+  int i,                                // Looping var
+      tile;                             // Current band
+
+  for (i = 0; i < canny->num_workers && !worker->error; )
+  {
+    brf_image_worker_t *victim = canny->workers + (worker->index + i) % canny->num_workers;
+                                        // Worker to take a band from
+
+    // Take the next band of our own range first, then those of the others...
+    if ((tile = __atomic_fetch_add(&victim->next, 1, __ATOMIC_RELAXED)) < victim->end)
+    {
+      if (!brf_image_canny_tile(worker, tile))
+        worker->error = true;
+    }
+    else
+      i ++;
+  }
+
+  return (NULL);
+}
+
+
+// 'brf_image_classify_row()' - Classify the thinned gradients of a row.
+//
+// Pixels are marked 0 (no edge), 1 (strong edge) or 2 (weak edge), 4 at a
+// time.
+
+static void
+brf_image_classify_row(
+    const float *mag,                   // I - Thinned squared gradients
+    unsigned char *edges,               // O - Classes
+    int width,                          // I - Width
+    float lower,                        // I - Lower threshold (squared)
+    float upper)                        // I - Upper threshold (squared)
+{
+  int x;                                // Looping var
+  brf_vf_t vlower = { lower, lower, lower, lower },
+      vupper = { upper, upper, upper, upper };
+                                        // Thresholds
+
+  for (x = 0; x + 4 <= width; x += 4)
+  {
+    brf_vf_t v;
+    brf_vi_t strong, weak, cls;
+
+    memcpy(&v, mag + x, sizeof(v));
+
+    strong = v >= vupper;
+    weak   = v >= vlower;
+    cls    = (strong & 1) | (~strong & weak & 2);
+
+    edges[x]     = (unsigned char)cls[0];
+    edges[x + 1] = (unsigned char)cls[1];
+    edges[x + 2] = (unsigned char)cls[2];
+    edges[x + 3] = (unsigned char)cls[3];
+  }
+
+  for (; x < width; x ++)
+    edges[x] = mag[x] >= upper ? 1 : mag[x] >= lower ? 2 : 0;
+}
+
+
+// 'brf_image_decode()' - Decode an image file by its signature.
+//
+// The image is decoded at the pyramid level chosen by brf_image_fit() once
+// its size is known.
+
+static bool                             // O - `true` on success, `false` on error
+brf_image_decode(
+    const unsigned char *data,          // I - Image file
+    size_t datasize,                    // I - Size of image file
+    brf_image_fit_t *fit,               // I - Page fitting
+    brf_image_t *image,                 // O - Image
+    char *message,                      // O - Error message
+    size_t msgsize)                     // I - Size of message buffer
+{
+  if (datasize >= 8 && !memcmp(data, "\211PNG\r\n\032\n", 8))
+    return (brf_image_decode_png(data, datasize, fit, image, message, msgsize));
+  else if (datasize >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff)
+    return (brf_image_decode_jpeg(data, datasize, fit, image, message, msgsize));
+  else if (datasize >= 2 && data[0] == 'P' && data[1] >= '1' && data[1] <= '6')
+    return (brf_image_decode_pnm(data, datasize, fit, image, message, msgsize));
+
+  snprintf(message, msgsize, "Unsupported image format.");
+  return (false);
+}
+
+
+// 'brf_image_decode_jpeg()' - Decode a JPEG image to grayscale.
+//
+// libjpeg scales the image down by up to 8 while decoding, the rest of the
+// reduction is done on the decoded rows.
+
+static bool                             // O - `true` on success, `false` on error
+brf_image_decode_jpeg(
+    const unsigned char *data,          // I - Image file
+    size_t datasize,                    // I - Size of image file
+    brf_image_fit_t *fit,               // I - Page fitting
+    brf_image_t *image,                 // O - Image
+    char *message,                      // O - Error message
+    size_t msgsize)                     // I - Size of message buffer
+{
+  struct jpeg_decompress_struct cinfo;  // Decompressor
+  brf_image_jpeg_err_t jerr;            // Error handler
+  brf_image_reducer_t reducer;          // Row reduction
+  JSAMPARRAY row;                       // Current row
+  int factor;                           // Reduction factor
+
+  memset(&reducer, 0, sizeof(reducer));
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = brf_image_jpeg_error;
+  jerr.message[0]     = '\0';
+
+  if (setjmp(jerr.env))
+  {
+    snprintf(message, msgsize, "Unable to decode JPEG image: %s", jerr.message);
+    jpeg_destroy_decompress(&cinfo);
+    brf_image_reducer_free(&reducer, image);
+    return (false);
+  }
+
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, (unsigned char *)data, (unsigned long)datasize);
+  jpeg_read_header(&cinfo, TRUE);
+
+  factor = brf_image_fit(fit, (int)cinfo.image_width, (int)cinfo.image_height);
+
+  cinfo.out_color_space = JCS_GRAYSCALE;
+  cinfo.scale_num       = 1;
+  cinfo.scale_denom     = (unsigned)(factor > 8 ? 8 : factor);
+
+  jpeg_start_decompress(&cinfo);
+
+  row = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, cinfo.output_width, 1);
+
+  if (!brf_image_reducer_init(&reducer, (int)cinfo.output_width, (int)cinfo.output_height, factor / (int)cinfo.scale_denom, image))
+  {
+    snprintf(message, msgsize, "JPEG image is too large (%ux%u).", cinfo.image_width, cinfo.image_height);
+    jpeg_destroy_decompress(&cinfo);
+    brf_image_reducer_free(&reducer, image);
+    return (false);
+  }
+
+  while (cinfo.output_scanline < cinfo.output_height)
+  {
+    jpeg_read_scanlines(&cinfo, row, 1);
+    brf_image_reducer_add(&reducer, row[0]);
+  }
+
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+
+  brf_image_reducer_finish(&reducer);
+
+  return (true);
+}
+
+
+// 'brf_image_decode_png()' - Decode a PNG image to grayscale.
+//
+// Rows are reduced as they are decoded, except for interlaced images that
+// libpng only delivers complete.  Transparent areas are composed on white
+// paper.
+
+static bool                             // O - `true` on success, `false` on error
+brf_image_decode_png(
+    const unsigned char *data,          // I - Image file
+    size_t datasize,                    // I - Size of image file
+    brf_image_fit_t *fit,               // I - Page fitting
+    brf_image_t *image,                 // O - Image
+    char *message,                      // O - Error message
+    size_t msgsize)                     // I - Size of message buffer
+{
+  png_structp png;                      // PNG decoder
+  png_infop info;                       // PNG information
+  brf_image_png_src_t src;              // Memory source
+  brf_image_reducer_t reducer;          // Row reduction
+  png_color_16 background = { 0, 255, 255, 255, 255 };
+                                        // Paper color
+  png_uint_32 width,                    // Width
+      height,                           // Height
+      y;                                // Current row
+  int passes;                           // Interlace passes
+  unsigned char *volatile rows = NULL;  // Decoded rows
+  png_bytep *volatile rowptrs = NULL;   // Row pointers (interlaced)
+
+  memset(&reducer, 0, sizeof(reducer));
+
+  src.data       = data;
+  src.datasize   = datasize;
+  src.offset     = 0;
+  src.message[0] = '\0';
+
+  if ((png = png_create_read_struct(PNG_LIBPNG_VER_STRING, &src, brf_image_png_error, brf_image_png_warning)) == NULL || (info = png_create_info_struct(png)) == NULL)
+  {
+    snprintf(message, msgsize, "Unable to create PNG decoder.");
+    png_destroy_read_struct(&png, NULL, NULL);
+    return (false);
+  }
+
+  if (setjmp(png_jmpbuf(png)))
+  {
+    snprintf(message, msgsize, "Unable to decode PNG image: %s", src.message);
+    png_destroy_read_struct(&png, &info, NULL);
+    free(rows);
+    free(rowptrs);
+    brf_image_reducer_free(&reducer, image);
+    return (false);
+  }
+
+  png_set_read_fn(png, &src, brf_image_png_read);
+  png_read_info(png, info);
+
+  width  = png_get_image_width(png, info);
+  height = png_get_image_height(png, info);
+
+  // 8-bit gray, composed on white in linear light like the simplified API...
+  png_set_expand(png);
+  png_set_strip_16(png);
+  if (png_get_color_type(png, info) & PNG_COLOR_MASK_COLOR)
+    png_set_rgb_to_gray_fixed(png, 1, -1, -1);
+  png_set_gamma_fixed(png, PNG_DEFAULT_sRGB, PNG_DEFAULT_sRGB);
+  png_set_background_fixed(png, &background, PNG_BACKGROUND_GAMMA_SCREEN, 0, PNG_FP_1);
+
+  passes = png_set_interlace_handling(png);
+
+  png_read_update_info(png, info);
+
+  if ((passes > 1 && (size_t)width * height > BRF_IMAGE_MAX_PIXELS) || !brf_image_reducer_init(&reducer, (int)width, (int)height, brf_image_fit(fit, (int)width, (int)height), image) || (rows = (unsigned char *)malloc((size_t)width * (passes > 1 ? height : 1))) == NULL || (passes > 1 && (rowptrs = (png_bytep *)malloc(height * sizeof(png_bytep))) == NULL))
+  {
+    snprintf(message, msgsize, "PNG image is too large (%ux%u).", (unsigned)width, (unsigned)height);
+    png_destroy_read_struct(&png, &info, NULL);
+    free(rows);
+    free(rowptrs);
+    brf_image_reducer_free(&reducer, image);
+    return (false);
+  }
+
+  if (passes > 1)
+  {
+    for (y = 0; y < height; y ++)
+      rowptrs[y] = rows + (size_t)y * width;
+
+    png_read_image(png, rowptrs);
+
+    for (y = 0; y < height; y ++)
+      brf_image_reducer_add(&reducer, rowptrs[y]);
+  }
+  else
+  {
+    for (y = 0; y < height; y ++)
+    {
+      png_read_row(png, rows, NULL);
+      brf_image_reducer_add(&reducer, rows);
+    }
+  }
+
+  png_read_end(png, NULL);
+  png_destroy_read_struct(&png, &info, NULL);
+
+  free(rows);
+  free(rowptrs);
+  brf_image_reducer_finish(&reducer);
+
+  return (true);
+}
+
+
+// 'brf_image_decode_pnm()' - Decode a PBM, PGM or PPM image to grayscale.
+
+static bool                             // O - `true` on success, `false` on error
+brf_image_decode_pnm(
+    const unsigned char *data,          // I - Image file
+    size_t datasize,                    // I - Size of image file
+    brf_image_fit_t *fit,               // I - Page fitting
+    brf_image_t *image,                 // O - Image
+    char *message,                      // O - Error message
+    size_t msgsize)                     // I - Size of message buffer
+{
+  const unsigned char *ptr = data + 2,  // Pointer into file
+      *end = data + datasize;           // End of file
+  int type = data[1] - '0',             // PNM type (1-6)
+      header[3] = { 0, 0, 1 },          // Width, height, maxval (1 for bitmaps)
+      num_header = type == 1 || type == 4 ? 2 : 3,
+                                        // Number of header values
+      i,                                // Looping var
+      x, y,                             // Current pixel
+      channels = type == 3 || type == 6 ? 3 : 1;
+                                        // Samples per pixel
+  unsigned char *row;                   // Current row
+  brf_image_reducer_t reducer;          // Row reduction
+
+  // Read the header values, skipping comments...
+  for (i = 0; i < num_header; i ++)
+  {
+    header[i] = 0;
+
+    while (ptr < end && (isspace(*ptr) || *ptr == '#'))
+    {
+      if (*ptr == '#')
+      {
+        while (ptr < end && *ptr != '\n')
+          ptr ++;
+      }
+      else
+        ptr ++;
+    }
+
+    if (ptr >= end || !isdigit(*ptr))
+    {
+      snprintf(message, msgsize, "Bad PNM header.");
+      return (false);
+    }
+
+    while (ptr < end && isdigit(*ptr) && header[i] < 100000)
+      header[i] = header[i] * 10 + *ptr++ - '0';
+  }
+
+  if (ptr < end)
+    ptr ++;                             // Single whitespace before raster
+
+  if (header[0] <= 0 || header[1] <= 0 || header[2] <= 0 || header[2] > 65535)
+  {
+    snprintf(message, msgsize, "Bad PNM size %dx%d.", header[0], header[1]);
+    return (false);
+  }
+
+  memset(&reducer, 0, sizeof(reducer));
+
+  if (!brf_image_reducer_init(&reducer, header[0], header[1], brf_image_fit(fit, header[0], header[1]), image) || (row = (unsigned char *)malloc((size_t)header[0])) == NULL)
+  {
+    snprintf(message, msgsize, "Unable to allocate %dx%d image.", header[0], header[1]);
+    brf_image_reducer_free(&reducer, image);
+    return (false);
+  }
+
+  for (y = 0; y < header[1]; y ++)
+  {
+    for (x = 0; x < header[0]; x ++)
+    {
+      unsigned sample[3] = { 0, 0, 0 }; // Samples of pixel
+
+      if (type == 4)
+      {
+        // Packed bitmap, rows are padded to bytes, 1 is black...
+        size_t offset = (size_t)y * (size_t)((header[0] + 7) / 8) + (size_t)x / 8;
+
+        row[x] = ptr + offset < end && (ptr[offset] & (0x80 >> (x & 7))) ? 0 : 255;
+        continue;
+      }
+
+      for (i = 0; i < channels; i ++)
+      {
+        if (type <= 3)
+        {
+          // Plain (ASCII) samples...
+          while (ptr < end && (isspace(*ptr) || *ptr == '#'))
+          {
+            if (*ptr == '#')
+            {
+              while (ptr < end && *ptr != '\n')
+                ptr ++;
+            }
+            else
+              ptr ++;
+          }
+
+          if (ptr >= end)
+            sample[i] = type == 1 ? 0 : (unsigned)header[2];
+          else if (type == 1)
+            sample[i] = *ptr++ == '1';
+          else
+          {
+            while (ptr < end && isdigit(*ptr))
+              sample[i] = sample[i] * 10 + (unsigned)(*ptr++ - '0');
+          }
+        }
+        else if (header[2] > 255)
+        {
+          // Missing data is white paper...
+          if (ptr + 2 > end)
+          {
+            sample[i] = (unsigned)header[2];
+            continue;
+          }
+
+          sample[i] = (unsigned)((ptr[0] << 8) | ptr[1]);
+          ptr += 2;
+        }
+        else
+          sample[i] = ptr < end ? *ptr++ : (unsigned)header[2];
+      }
+
+      if (type == 1)
+        row[x] = sample[0] ? 0 : 255;
+      else if (channels == 3)
+        row[x] = (unsigned char)((sample[0] * 77 + sample[1] * 150 + sample[2] * 29) * 255 / (256 * (unsigned)header[2]));
+      else
+        row[x] = (unsigned char)(sample[0] * 255 / (unsigned)header[2]);
+    }
+
+    brf_image_reducer_add(&reducer, row);
+  }
+
+  free(row);
+  brf_image_reducer_finish(&reducer);
+
+  return (true);
+}
+
+
+// 'brf_image_dither_diffusion()' - Halftone a dot grid with error diffusion.
+//
+// Floyd-Steinberg error diffusion, alternating the direction of the rows to
+// avoid diagonal artifacts.  Error diffusion is sequential along a row, so
+// unlike ordered dithering this is not vectorized, but it only runs on the
+// dot grid.
+
+static bool                             // O - `true` on success, `false` on error
+brf_image_dither_diffusion(
+    unsigned char *dots,                // IO - Gray levels in, dots out (1 = raised)
+    int width,                          // I - Dots across
+    int height)                         // I - Dots down
+{
+  int *errors,                          // Error rows, in 1/16 levels
+      *cur,                             // Errors of the current row
+      *next,                            // Errors of the next row
+      *temp,                            // Swap pointer
+      x, y,                             // Looping vars
+      dir,                              // Direction of the row
+      value,                            // Level with diffused error
+      error;                            // Quantization error
+  unsigned char *dotptr;                // Current dot
+
+  // Errors are padded by one on each side...
+  if ((errors = (int *)calloc(2 * (size_t)(width + 2), sizeof(int))) == NULL)
+    return (false);
+
+  cur  = errors + 1;
+  next = errors + width + 3;
+
+  for (y = 0; y < height; y ++)
+  {
+    dir    = (y & 1) ? -1 : 1;
+    x      = (y & 1) ? width - 1 : 0;
+    dotptr = dots + (size_t)y * (size_t)width + x;
+
+    for (; x >= 0 && x < width; x += dir, dotptr += dir)
+    {
+      value = *dotptr + (cur[x] >= 0 ? cur[x] + 8 : cur[x] - 8) / 16;
+
+      if (value < 128)
+      {
+        *dotptr = 1;
+        error   = value;
+      }
+      else
+      {
+        *dotptr = 0;
+        error   = value - 255;
+      }
+
+      cur[x + dir]  += error * 7;
+      next[x - dir] += error * 3;
+      next[x]       += error * 5;
+      next[x + dir] += error;
+    }
+
+    temp = cur;
+    cur  = next;
+    next = temp;
+
+    memset(next - 1, 0, (size_t)(width + 2) * sizeof(int));
+  }
+
+  free(errors);
+
+  return (true);
+}
+
+
+// 'brf_image_dither_ordered()' - Halftone a dot grid with ordered dithering.
+//
+// Dots are compared with an 8x8 Bayer matrix, 16 dots at a time.
+
+static void
+brf_image_dither_ordered(
+    unsigned char *dots,                // IO - Gray levels in, dots out (1 = raised)
+    int width,                          // I - Dots across
+    int height)                         // I - Dots down
+{
+  int i, x, y;                          // Looping vars
+  unsigned char thresholds[16];         // Thresholds of a row
+  brf_vu8_t threshv,                    // Thresholds
+      grayv,                            // Gray levels
+      one = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+                                        // Raised dots
+
+  for (y = 0; y < height; y ++)
+  {
+    unsigned char *row = dots + (size_t)y * (size_t)width;
+                                        // Current row
+
+    // Levels 0 to 255 map to thresholds 2 to 254, so white is never raised
+    // and black always is...
+    for (i = 0; i < 16; i ++)
+      thresholds[i] = (unsigned char)(brf_image_bayer[y & 7][i & 7] * 4 + 2);
+
+    memcpy(&threshv, thresholds, sizeof(threshv));
+
+    for (x = 0; x + 16 <= width; x += 16)
+    {
+      memcpy(&grayv, row + x, sizeof(grayv));
+      grayv = (brf_vu8_t)(grayv < threshv) & one;
+      memcpy(row + x, &grayv, sizeof(grayv));
+    }
+
+    for (; x < width; x ++)
+      row[x] = row[x] < thresholds[x & 15];
+  }
+}
+
+
+// 'brf_image_fit()' - Fit an image to the dot grid of the page.
+//
+// Called by the decoders once the image size is known.  Decides about the
+// rotation, computes the dot grid and returns the pyramid level to decode
+// the image at: the largest power of 2 reduction that still leaves
+// BRF_IMAGE_OVERSAMPLE pixels per dot, so edge detection works on the
+// smallest image that resolves the grid.
+
+static int                              // O - Reduction factor
+brf_image_fit(brf_image_fit_t *fit,     // I - Page fitting
+              int width,                // I - Image width
+              int height)               // I - Image height
+{
+  const brf_geometry_t *geometry = fit->geometry;
+                                        // Page geometry
+  const char *cond = fit->rotate + strspn(fit->rotate, "0123456789-");
+                                        // Rotation condition
+  int angle = atoi(fit->rotate),        // Rotation angle
+      cols = geometry->cells_per_line * 2,
+                                        // Dots across the page
+      rows = geometry->lines_per_page * fit->rows,
+                                        // Dots down the page
+      need_width,                       // Pixels needed across the image
+      need_height,                      // Pixels needed down the image
+      factor = 1;                       // Reduction factor
+  double dot_width = geometry->cell_width / 2.0,
+                                        // Width of a dot
+      dot_height = (double)geometry->line_height / fit->rows,
+                                        // Height of a dot
+      scale;                            // Physical size of a pixel
+
+  // The "Rotate" option uses ImageMagick's geometry: "90" always rotates,
+  // "90>" only wide images and "90<" only tall ones...
+  angle = ((angle % 360) + 360) % 360;
+
+  if ((angle != 90 && angle != 270) || (*cond == '>' && width <= height) || (*cond == '<' && width >= height))
+    fit->angle = 0;
+  else
+    fit->angle = angle;
+
+  if (fit->angle)
+  {
+    int temp = width;                   // Swap width and height
+
+    width  = height;
+    height = temp;
+  }
+
+  scale = fmin(cols * dot_width / width, rows * dot_height / height);
+
+  if ((fit->grid_width = (int)(width * scale / dot_width + 0.5)) < 1)
+    fit->grid_width = 1;
+  else if (fit->grid_width > cols)
+    fit->grid_width = cols;
+
+  if ((fit->grid_height = (int)(height * scale / dot_height + 0.5)) < 1)
+    fit->grid_height = 1;
+  else if (fit->grid_height > rows)
+    fit->grid_height = rows;
+
+  // Pick the pyramid level...
+  need_width  = fit->grid_width * BRF_IMAGE_OVERSAMPLE;
+  need_height = fit->grid_height * BRF_IMAGE_OVERSAMPLE;
+
+  while (width / (2 * factor) >= need_width && height / (2 * factor) >= need_height)
+    factor *= 2;
+
+  fit->factor = factor;
+
+  return (factor);
+}
+
+
+// 'brf_image_hblur_row()' - Blur a row horizontally.
+//
+// The row is padded by repeating its end pixels and blurred 4 pixels at a
+// time.
+
+static void
+brf_image_hblur_row(
+    const unsigned char *src,           // I - Source row
+    float *row,                         // I - Padded row buffer
+    float *dst,                         // O - Blurred row
+    int width,                          // I - Width
+    const float *kernel,                // I - Kernel weights
+    int radius)                         // I - Kernel radius
+{
+  int ksize = 2 * radius + 1,           // Kernel size
+      k, x;                             // Looping vars
+
+  for (x = 0; x < width + ksize + 4; x ++)
+  {
+    int sx = x - radius;
+
+    row[x] = src[sx < 0 ? 0 : sx >= width ? width - 1 : sx];
+  }
+
+  for (x = 0; x + 4 <= width; x += 4)
+  {
+    brf_vf_t acc = { 0.0f, 0.0f, 0.0f, 0.0f }, v;
+
+    for (k = 0; k < ksize; k ++)
+    {
+      memcpy(&v, row + x + k, sizeof(v));
+      acc += v * kernel[k];
+    }
+
+    memcpy(dst + x, &acc, sizeof(acc));
+  }
+
+  for (; x < width; x ++)
+  {
+    float acc = 0.0f;
+
+    for (k = 0; k < ksize; k ++)
+      acc += row[x + k] * kernel[k];
+
+    dst[x] = acc;
+  }
+}
+
+
+// 'brf_image_jpeg_error()' - Handle a fatal libjpeg error.
+
+static void
+brf_image_jpeg_error(j_common_ptr cinfo)// I - Decompressor
+{
+  brf_image_jpeg_err_t *jerr = (brf_image_jpeg_err_t *)cinfo->err;
+                                        // Error handler
+
+  (cinfo->err->format_message)(cinfo, jerr->message);
+  longjmp(jerr->env, 1);
+}
+
+
+// 'brf_image_nms_row()' - Thin the gradients of a row to one pixel wide edges.
+//
+// A pixel is kept if its gradient is the largest along the gradient
+// direction.  The first and last pixels are never edges.
+
+static void
+brf_image_nms_row(
+    const float *above,                 // I - Squared gradients of previous row
+    const float *mag,                   // I - Squared gradients of row
+    const float *below,                 // I - Squared gradients of next row
+    const unsigned char *dir,           // I - Gradient directions of row
+    float *nms,                         // O - Thinned gradients
+    int width)                          // I - Width
+{
+  int x;                                // Looping var
+
+  nms[0] = 0.0f;
+
+  for (x = 1; x < width - 1; x ++)
+  {
+    float m = mag[x],                   // Gradient
+        before,                         // Gradient before along direction
+        after;                          // Gradient after along direction
+
+    switch (dir[x])
+    {
+      default :                         // Horizontal gradient
+          before = mag[x - 1];
+          after  = mag[x + 1];
+          break;
+      case 1 :                          // Diagonal down
+          before = above[x - 1];
+          after  = below[x + 1];
+          break;
+      case 2 :                          // Vertical gradient
+          before = above[x];
+          after  = below[x];
+          break;
+      case 3 :                          // Diagonal up
+          before = above[x + 1];
+          after  = below[x - 1];
+          break;
+    }
+
+    nms[x] = m > 0.0f && m > before && m >= after ? m : 0.0f;
+  }
+
+  if (width > 1)
+    nms[width - 1] = 0.0f;
+}
+
+
+// 'brf_image_png_error()' - Handle a fatal libpng error.
+
+static void
+brf_image_png_error(
+    png_structp png,                    // I - PNG decoder
+    png_const_charp message)            // I - Error message
+{
+  brf_image_png_src_t *src = (brf_image_png_src_t *)png_get_error_ptr(png);
+                                        // Memory source
+
+  snprintf(src->message, sizeof(src->message), "%s", message);
+  png_longjmp(png, 1);
+}
+
+
+// 'brf_image_png_read()' - Read PNG data from memory.
+
+static void
+brf_image_png_read(png_structp png,     // I - PNG decoder
+                   png_bytep data,      // O - Data
+                   png_size_t length)   // I - Bytes to read
+{
+  brf_image_png_src_t *src = (brf_image_png_src_t *)png_get_io_ptr(png);
+                                        // Memory source
+
+  if (length > src->datasize - src->offset)
+    png_error(png, "Truncated PNG image");
+
+  memcpy(data, src->data + src->offset, length);
+  src->offset += length;
+}
+
+
+// 'brf_image_png_warning()' - Ignore a libpng warning.
+
+static void
+brf_image_png_warning(
+    png_structp png,                    // I - PNG decoder
+    png_const_charp message)            // I - Warning message
+{
+  (void)png;
+  (void)message;
+}
+
+
+// 'brf_image_reducer_add()' - Add a decoded row to the reduced image.
+//
+// Each reduced pixel is the average of a "factor" x "factor" box of decoded
+// pixels, boxes on the right and bottom edges can be smaller.
+
+static void
+brf_image_reducer_add(
+    brf_image_reducer_t *reducer,       // I - Row reduction
+    const unsigned char *row)           // I - Decoded row
+{
+  int x,                                // Looping var
+      factor = reducer->factor;         // Reduction factor
+  unsigned *sums = reducer->sums;       // Box sums
+
+  if (reducer->y >= reducer->height)
+    return;
+
+  if (factor == 1)
+  {
+    memcpy(reducer->image->pixels + (size_t)reducer->y * (size_t)reducer->width, row, (size_t)reducer->width);
+    reducer->y ++;
+    return;
+  }
+
+  for (x = 0; x < reducer->width; x ++)
+    sums[x / factor] += row[x];
+
+  reducer->y ++;
+
+  if ((reducer->y % factor) == 0 || reducer->y == reducer->height)
+  {
+    brf_image_t *image = reducer->image;// Reduced image
+    unsigned char *dst = image->pixels + (size_t)((reducer->y - 1) / factor) * (size_t)image->width;
+                                        // Reduced row
+    unsigned box_height = (unsigned)(reducer->y - (reducer->y - 1) / factor * factor),
+                                        // Decoded rows in the boxes
+        box_width;                      // Decoded columns in a box
+
+    for (x = 0; x < image->width; x ++)
+    {
+      box_width = (unsigned)(x < image->width - 1 ? factor : reducer->width - x * factor);
+      dst[x]    = (unsigned char)((sums[x] + box_width * box_height / 2) / (box_width * box_height));
+    }
+
+    memset(sums, 0, (size_t)image->width * sizeof(unsigned));
+  }
+}
+
+
+// 'brf_image_reducer_finish()' - Finish the reduced image.
+//
+// Rows that were never decoded (truncated files) are white paper.
+
+static void
+brf_image_reducer_finish(
+    brf_image_reducer_t *reducer)       // I - Row reduction
+{
+  brf_image_t *image = reducer->image;  // Reduced image
+  int done = (reducer->y + reducer->factor - 1) / reducer->factor;
+                                        // Complete reduced rows
+
+  if (done < image->height)
+    memset(image->pixels + (size_t)done * (size_t)image->width, 255, (size_t)(image->height - done) * (size_t)image->width);
+
+  free(reducer->sums);
+  reducer->sums = NULL;
+}
+
+
+// 'brf_image_reducer_free()' - Free a row reduction and its image after an error.
+
+static void
+brf_image_reducer_free(
+    brf_image_reducer_t *reducer,       // I - Row reduction
+    brf_image_t *image)                 // I - Reduced image
+{
+  free(reducer->sums);
+  reducer->sums = NULL;
+
+  free(image->pixels);
+  image->pixels = NULL;
+}
+
+
+// 'brf_image_reducer_init()' - Start reducing decoded rows by a factor.
+
+static bool                             // O - `true` on success, `false` on error
+brf_image_reducer_init(
+    brf_image_reducer_t *reducer,       // I - Row reduction
+    int width,                          // I - Width of decoded rows
+    int height,                         // I - Number of decoded rows
+    int factor,                         // I - Reduction factor
+    brf_image_t *image)                 // O - Reduced image
+{
+  if (factor < 1)
+    factor = 1;
+
+  reducer->image   = image;
+  reducer->width   = width;
+  reducer->height  = height;
+  reducer->factor  = factor;
+  reducer->y       = 0;
+  reducer->sums    = NULL;
+
+  image->width  = (width + factor - 1) / factor;
+  image->height = (height + factor - 1) / factor;
+
+  if (width <= 0 || height <= 0 || (size_t)image->width * (size_t)image->height > BRF_IMAGE_MAX_PIXELS)
+    return (false);
+
+  if ((image->pixels = (unsigned char *)malloc((size_t)image->width * (size_t)image->height)) == NULL)
+    return (false);
+
+  if (factor > 1 && (reducer->sums = (unsigned *)calloc((size_t)image->width, sizeof(unsigned))) == NULL)
+  {
+    free(image->pixels);
+    image->pixels = NULL;
+    return (false);
+  }
+
+  return (true);
+}
+
+
+// 'brf_image_rotate()' - Rotate an image by 90 degrees.
+//
+// "angle" is 90 to rotate clockwise, 270 to rotate counter-clockwise and 0
+// to keep the image as is.
+
+static bool                             // O - `true` on success, `false` on error
+brf_image_rotate(brf_image_t *image,    // I - Image
+                 int angle)             // I - Rotation angle
+{
+  int x, y;                             // Looping vars
+  unsigned char *pixels;                // Rotated pixels
+
+  if (angle != 90 && angle != 270)
+    return (true);
+
+  if ((pixels = (unsigned char *)malloc((size_t)image->width * (size_t)image->height)) == NULL)
+    return (false);
+
+  // Rotate clockwise (or counter-clockwise for 270)...
+  for (y = 0; y < image->height; y ++)
+  {
+    const unsigned char *src = image->pixels + (size_t)y * (size_t)image->width;
+
+    for (x = 0; x < image->width; x ++)
+    {
+      if (angle == 90)
+        pixels[(size_t)x * (size_t)image->height + (size_t)(image->height - 1 - y)] = src[x];
+      else
+        pixels[(size_t)(image->width - 1 - x) * (size_t)image->height + (size_t)y] = src[x];
+    }
+  }
+
+  free(image->pixels);
+
+  image->pixels = pixels;
+  x             = image->width;
+  image->width  = image->height;
+  image->height = x;
+
+  return (true);
+}
+
+
+// 'brf_image_sobel_row()' - Compute squared gradients and directions of a row.
+//
+// Gradients and directions are computed 4 pixels at a time.  Directions are
+// quantized to 0 (horizontal), 1 (diagonal down), 2 (vertical) and 3
+// (diagonal up).  The first and last pixels get no gradient.
+
+static void
+brf_image_sobel_row(
+    const float *above,                 // I - Previous blurred row
+    const float *row,                   // I - Blurred row
+    const float *below,                 // I - Next blurred row
+    float *magrow,                      // O - Squared gradients
+    unsigned char *dirrow,              // O - Gradient directions
+    int width)                          // I - Width
+{
+  int x;                                // Looping var
+  const brf_vf_t tan22 = { 0.41421356f, 0.41421356f, 0.41421356f, 0.41421356f },
+      tan67 = { 2.41421356f, 2.41421356f, 2.41421356f, 2.41421356f },
+      zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+                                        // Sector limits
+
+  magrow[0] = 0.0f;
+  dirrow[0] = 0;
+
+  for (x = 1; x + 4 <= width - 1; x += 4)
+  {
+    brf_vf_t a0, a1, a2, r0, r2, b0, b1, b2, gx, gy, ax, ay, m;
+    brf_vi_t horiz, vert, same, d;
+
+    memcpy(&a0, above + x - 1, sizeof(a0));
+    memcpy(&a1, above + x, sizeof(a1));
+    memcpy(&a2, above + x + 1, sizeof(a2));
+    memcpy(&r0, row + x - 1, sizeof(r0));
+    memcpy(&r2, row + x + 1, sizeof(r2));
+    memcpy(&b0, below + x - 1, sizeof(b0));
+    memcpy(&b1, below + x, sizeof(b1));
+    memcpy(&b2, below + x + 1, sizeof(b2));
+
+    gx = (a2 + 2.0f * r2 + b2) - (a0 + 2.0f * r0 + b0);
+    gy = (b0 + 2.0f * b1 + b2) - (a0 + 2.0f * a1 + a2);
+    m  = gx * gx + gy * gy;
+
+    ax = (brf_vf_t)((brf_vi_t)gx & 0x7fffffff);
+    ay = (brf_vf_t)((brf_vi_t)gy & 0x7fffffff);
+
+    horiz = ay <= ax * tan22;
+    vert  = ay >= ax * tan67;
+    same  = (gx >= zero) == (gy >= zero);
+    d     = (vert & 2) | (~horiz & ~vert & ((same & 1) | (~same & 3)));
+
+    memcpy(magrow + x, &m, sizeof(m));
+    dirrow[x]     = (unsigned char)d[0];
+    dirrow[x + 1] = (unsigned char)d[1];
+    dirrow[x + 2] = (unsigned char)d[2];
+    dirrow[x + 3] = (unsigned char)d[3];
+  }
+
+  for (; x < width - 1; x ++)
+  {
+    float gx = (above[x + 1] + 2.0f * row[x + 1] + below[x + 1]) - (above[x - 1] + 2.0f * row[x - 1] + below[x - 1]),
+        gy = (below[x - 1] + 2.0f * below[x] + below[x + 1]) - (above[x - 1] + 2.0f * above[x] + above[x + 1]),
+        ax = fabsf(gx),
+        ay = fabsf(gy);
+
+    magrow[x] = gx * gx + gy * gy;
+
+    if (ay <= ax * 0.41421356f)
+      dirrow[x] = 0;
+    else if (ay >= ax * 2.41421356f)
+      dirrow[x] = 2;
+    else
+      dirrow[x] = (gx >= 0.0f) == (gy >= 0.0f) ? 1 : 3;
+  }
+
+  if (width > 1)
+  {
+    magrow[width - 1] = 0.0f;
+    dirrow[width - 1] = 0;
+  }
+}
+
+
+// 'brf_image_threshold()' - Mark the dark pixels of an image.
+
+static void
+brf_image_threshold(brf_image_t *image, // I - Image
+                    unsigned char *dots)// O - Fill map (1 = dark)
+{
+  size_t i,                             // Looping var
+      count = (size_t)image->width * (size_t)image->height;
+                                        // Number of pixels
+
+  for (i = 0; i < count; i ++)
+    dots[i] = image->pixels[i] < 128;
+}
+
+
+// 'brf_image_trace()' - Keep the weak edges that connect to strong ones.
+//
+// The weak pixels next to strong ones are followed with a stack, then the
+// weak pixels that were not reached are dropped.
+
+static void
+brf_image_trace(unsigned char *edges,   // I - Classes in, edge map out (1 = edge)
+                int width,              // I - Width
+                int height)             // I - Height
+{
+  size_t count = (size_t)width * (size_t)height,
+                                        // Number of pixels
+      i,                                // Looping var
+      *stack,                           // Pixels to follow
+      num_stack = 0;                    // Number of pixels on stack
+
+  if ((stack = (size_t *)malloc(count * sizeof(size_t))) == NULL)
+  {
+    // Keep the strong edges only...
+    for (i = 0; i < count; i ++)
+      edges[i] &= 1;
+    return;
+  }
+
+  for (i = 0; i < count; i ++)
+  {
+    if (edges[i] != 1)
+      continue;
+
+    stack[num_stack ++] = i;
+
+    while (num_stack > 0)
+    {
+      size_t p = stack[-- num_stack];
+      int px = (int)(p % (size_t)width),
+          py = (int)(p / (size_t)width),
+          dx, dy;
+
+      for (dy = -1; dy <= 1; dy ++)
+      {
+        if (py + dy < 0 || py + dy >= height)
+          continue;
+
+        for (dx = -1; dx <= 1; dx ++)
+        {
+          size_t q;
+
+          if (px + dx < 0 || px + dx >= width)
+            continue;
+
+          q = (size_t)(py + dy) * (size_t)width + (size_t)(px + dx);
+
+          if (edges[q] == 2)
+          {
+            edges[q] = 1;
+            stack[num_stack ++] = q;
+          }
+        }
+      }
+    }
+  }
+
+  for (i = 0; i < count; i ++)
+    edges[i] &= 1;
+
+  free(stack);
+}
+
+
+// 'brf_image_vblur_row()' - Blur a row vertically.
+//
+// "rows" are the horizontally blurred rows under the kernel, the row is
+// blurred 4 pixels at a time.
+
+static void
+brf_image_vblur_row(
+    const float **rows,                 // I - Source rows
+    float *dst,                         // O - Blurred row
+    int width,                          // I - Width
+    const float *kernel,                // I - Kernel weights
+    int ksize)                          // I - Kernel size
+{
+  int k, x;                             // Looping vars
+
+  for (x = 0; x + 4 <= width; x += 4)
+  {
+    brf_vf_t acc = { 0.0f, 0.0f, 0.0f, 0.0f }, v;
+
+    for (k = 0; k < ksize; k ++)
+    {
+      memcpy(&v, rows[k] + x, sizeof(v));
+      acc += v * kernel[k];
+    }
+
+    memcpy(dst + x, &acc, sizeof(acc));
+  }
+
+  for (; x < width; x ++)
+  {
+    float acc = 0.0f;
+
+    for (k = 0; k < ksize; k ++)
+      acc += rows[k][x] * kernel[k];
+
+    dst[x] = acc;
+  }
+}
+
+
+// 'brf_image_write()' - Format a dot grid as braille cells.
+//
+// The graphic is placed inside the braille margins of a single page.  Dots
+// are widened by "dilate" dots in every direction (EdgeFactor - 1) to make
+// thin lines easier to feel.
+
+static char *                           // O - Output or `NULL` on error
+brf_image_write(
+    const unsigned char *dots,          // I - Dot grid
+    int width,                          // I - Dots across
+    int height,                         // I - Dots down
+    const brf_geometry_t *geometry,     // I - Page geometry
+    int rows,                           // I - Dot rows per cell
+    int dilate,                         // I - Dots to widen by
+    bool ubrl,                          // I - Write Unicode braille?
+    size_t *length)                     // O - Length of output
+{
+  int cells = (width + 1) / 2,          // Cells per line
+      lines = (height + rows - 1) / rows,
+                                        // Lines
+      cx, cy, r, c,                     // Looping vars
+      dx, dy;                           // Dilation offsets
+  char *output,                         // Output
+      *outptr,                          // Pointer into output
+      *lineend;                         // End of non-blank cells
+  size_t outsize;                       // Size of output
+
+  if (dilate < 0)
+    dilate = 0;
+  else if (dilate > 4)
+    dilate = 4;
+
+  outsize = (size_t)(geometry->top_margin + 1) + (size_t)lines * ((size_t)geometry->left_margin + (size_t)cells * (ubrl ? 3 : 1) + 1) + 2;
+
+  if ((output = (char *)malloc(outsize)) == NULL)
+    return (NULL);
+
+  outptr = output;
+  for (r = 0; r < geometry->top_margin; r ++)
+    *outptr++ = '\n';
+
+  for (cy = 0; cy < lines; cy ++)
+  {
+    memset(outptr, ' ', (size_t)geometry->left_margin);
+    outptr += geometry->left_margin;
+    lineend = outptr;
+
+    for (cx = 0; cx < cells; cx ++)
+    {
+      unsigned pattern = 0;             // Dot pattern of cell
+
+      for (r = 0; r < rows; r ++)
+      {
+        for (c = 0; c < 2; c ++)
+        {
+          int x = cx * 2 + c,
+              y = cy * rows + r;
+          bool set = false;
+
+          for (dy = -dilate; dy <= dilate && !set; dy ++)
+          {
+            if (y + dy < 0 || y + dy >= height)
+              continue;
+
+            for (dx = -dilate; dx <= dilate && !set; dx ++)
+            {
+              if (x + dx >= 0 && x + dx < width && dots[(y + dy) * width + x + dx])
+                set = true;
+            }
+          }
+
+          if (set)
+            pattern |= brf_image_dot_bits[r][c];
+        }
+      }
+
+      if (ubrl)
+      {
+        // U+2800 + pattern in UTF-8...
+        *outptr++ = (char)0xe2;
+        *outptr++ = (char)(0xa0 | (pattern >> 6));
+        *outptr++ = (char)(0x80 | (pattern & 0x3f));
+      }
+      else
+        *outptr++ = brf_image_ascii[pattern];
+
+      if (pattern)
+        lineend = outptr;
+    }
+
+    // Trailing blank cells are not embossed...
+    outptr    = lineend;
+    *outptr++ = '\n';
+  }
+
+  *outptr++ = '\f';
+  *length   = (size_t)(outptr - output);
+
+  return (output);
+}
@@ -0,0 +1,982 @@
+//
+// Pre-forked launchers for external filters for the Braille Printer
+// Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_LAUNCHER_MAX 8              // Maximum number of launchers
+#define BRF_LAUNCHER_MAX_ARGS 16        // Maximum number of filter arguments
+#define BRF_LAUNCHER_MAX_ENV 64         // Maximum number of environment strings
+#define BRF_LAUNCHER_MAX_FILTERS 16     // Maximum number of filter programs
+#define BRF_LAUNCHER_MAX_RUNNING 256    // Maximum filters running per launcher
+#define BRF_LAUNCHER_MAX_SLOTS 64       // Maximum run slots per filter
+#define BRF_LAUNCHER_REQUEST 65536      // Maximum size of a request
+
+// Local types...
+
+typedef struct brf_launcher_filter_s    // Filter program
+{
+  const cf_filter_external_t *params;   // Filter parameters in the conversion table
+  pid_t slots[BRF_LAUNCHER_MAX_SLOTS];  // Processes holding the run slots
+  brf_launcher_stats_t stats;           // Statistics
+} brf_launcher_filter_t;
+
+typedef struct brf_launcher_shared_s    // State shared with the filter chains
+{
+  pthread_mutex_t mutex;                // Mutex for run slots and statistics
+  pthread_cond_t cond;                  // Run slot freed
+  int num_filters;                      // Number of filter programs
+  brf_launcher_filter_t filters[BRF_LAUNCHER_MAX_FILTERS];
+                                        // Filter programs
+} brf_launcher_shared_t;
+
+typedef struct brf_launcher_child_s     // Filter run by a launcher
+{
+  pid_t pid;                            // Process ID
+  int replyfd;                          // Pipe for the exit status
+} brf_launcher_child_t;
+
+typedef struct brf_launcher_reply_s     // Exit of a filter
+{
+  int status;                           // Exit status
+  double cpu_time;                      // CPU seconds of the filter
+} brf_launcher_reply_t;
+
+// Local globals...
+
+static pappl_system_t *brf_launcher_system = NULL;
+                                        // System for logging
+static brf_launcher_shared_t *brf_launcher_shared = NULL;
+                                        // Shared state
+static int brf_launcher_fds[2] = { -1, -1 };
+                                        // Request socket (chain and launcher ends)
+static int brf_launcher_count = 0;      // Number of launchers
+static pid_t brf_launcher_pids[BRF_LAUNCHER_MAX];
+                                        // Launcher processes
+static __thread double brf_launcher_cpu_time = 0.0;
+                                        // CPU seconds of the last filter
+
+// Local functions...
+
+static int brf_launcher_claim(brf_launcher_filter_t *filter);
+static bool brf_launcher_encode(char *buffer, size_t bufsize, size_t *used, const char *s);
+static brf_launcher_filter_t *brf_launcher_find(const cf_filter_external_t *params);
+static void brf_launcher_lock(void);
+static void brf_launcher_log(cf_filter_data_t *data, char *line);
+static void brf_launcher_main(int sockfd);
+static pid_t brf_launcher_spawn(void);
+static void brf_launcher_start(int sockfd, brf_launcher_child_t *children, int *num_children);
+static void *brf_launcher_supervise(void *data);
+
+// 'brf_LauncherFilter()' - Run an external filter through a launcher.
+//
+// This is a drop-in replacement for cfFilterExternal().  The filter waits for
+// one of the run slots of its program, then a launcher forks and executes it
+// with the chain's file descriptors.  The launchers are small processes forked
+// when the server started, so a burst of jobs does not fork the whole server
+// for every filter.  Without launchers the filter still waits for a run slot
+// and then runs through cfFilterExternal().
+
+int                                     // O - Exit status
+brf_LauncherFilter(
+    int inputfd,                        // I - Input file
+    int outputfd,                       // I - Output file
+    int inputseekable,                  // I - Is input seekable?
+    cf_filter_data_t *data,             // I - Job and printer data
+    void *parameters)                   // I - Filter parameters
+{
+  cf_filter_external_t *params = (cf_filter_external_t *)parameters;
+                                        // Filter parameters
+  brf_launcher_filter_t *filter;        // Filter program
+  cf_logfunc_t log = data->logfunc;     // Log function
+  void *ld = data->logdata;             // Log function data
+  char request[BRF_LAUNCHER_REQUEST],   // Request message
+      value[1024],                      // Argument or environment string
+      options[8192],                    // Encoded job options
+      *optptr,                          // Pointer into options
+      line[2048];                       // Line of filter messages
+  size_t used = 0,                      // Bytes used in request
+      linelen = 0;                      // Bytes used in line
+  int i,                                // Looping var
+      argc = 0,                         // Number of arguments
+      envc = 0,                         // Number of environment strings
+      errpipe[2] = { -1, -1 },          // Filter messages
+      replypipe[2] = { -1, -1 },        // Launcher replies
+      fds[4],                           // Descriptors for the launcher
+      slot,                             // Run slot
+      status = -1;                      // Exit status
+  pid_t pid = 0;                        // Filter process
+  struct msghdr msg;                    // Request message
+  struct iovec iov;                     // Request data
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(fds))];  // Control data
+    struct cmsghdr align;               // Alignment
+  } control;
+  struct cmsghdr *cmsg;                 // Descriptor message
+  struct timespec timeout;              // Time to wait for a slot
+  struct pollfd pfds[2];                // Filter messages and replies
+  double queued,                        // Time the filter was queued
+      started,                          // Time the filter started
+      wait_time,                        // Time in the queue
+      run_time;                         // Time running
+  bool have_pid = false,                // Got the process ID?
+      have_status = false;              // Got the exit status?
+  brf_launcher_stats_t stats;           // Statistics after this run
+  ssize_t bytes;                        // Bytes read
+
+  if (!brf_launcher_shared || (filter = brf_launcher_find(params)) == NULL)
+    return (cfFilterExternal(inputfd, outputfd, inputseekable, data, parameters));
+
+  // Wait for a free run slot of the filter...
+  queued = brf_GetTime();
+
+  brf_launcher_lock();
+
+  filter->stats.waiting ++;
+  if (filter->stats.waiting > filter->stats.max_waiting)
+    filter->stats.max_waiting = filter->stats.waiting;
+
+  while ((slot = brf_launcher_claim(filter)) < 0)
+  {
+    if (data->iscanceledfunc && data->iscanceledfunc(data->iscanceleddata))
+    {
+      filter->stats.waiting --;
+      pthread_mutex_unlock(&brf_launcher_shared->mutex);
+      return (1);
+    }
+
+    // Wake up every second to check for cancellation and dead slot holders
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    timeout.tv_sec ++;
+
+    if (pthread_cond_timedwait(&brf_launcher_shared->cond, &brf_launcher_shared->mutex, &timeout) == EOWNERDEAD)
+      pthread_mutex_consistent(&brf_launcher_shared->mutex);
+  }
+
+  filter->stats.waiting --;
+  filter->stats.running ++;
+
+  pthread_mutex_unlock(&brf_launcher_shared->mutex);
+
+  started   = brf_GetTime();
+  wait_time = started - queued;
+
+  brf_launcher_cpu_time = 0.0;
+
+  if (!brf_launcher_count)
+  {
+    status = cfFilterExternal(inputfd, outputfd, inputseekable, data, parameters);
+    goto finish;
+  }
+
+  // Build the request: program, CUPS filter arguments and environment
+  brf_launcher_encode(request, sizeof(request), &used, params->filter);
+
+  for (i = 0, optptr = options, *optptr = '\0'; i < data->num_options && optptr; i ++)
+  {
+    const char *s;                      // Pointer into value
+    size_t remaining = (size_t)(options + sizeof(options) - optptr);
+                                        // Space left in options
+    int len;                            // Length of name
+
+    // Each option needs room for a separator, "name=" and the nul...
+    if ((len = snprintf(optptr, remaining, "%s%s=", optptr > options ? " " : "", data->options[i].name)) < 0 || (size_t)len >= remaining)
+    {
+      optptr = NULL;
+      break;
+    }
+
+    optptr += len;
+
+    // ...and every character of the value for itself and its escape
+    for (s = data->options[i].value; *s; s ++)
+    {
+      if (optptr >= options + sizeof(options) - 3)
+      {
+        optptr = NULL;
+        break;
+      }
+
+      if (strchr(" \t\\\'\"", *s))
+        *optptr++ = '\\';
+      *optptr++ = *s;
+    }
+
+    if (optptr)
+      *optptr = '\0';
+  }
+
+  if (!optptr)
+    options[0] = '\0';                  // Too long, fails below
+
+  argc += brf_launcher_encode(request, sizeof(request), &used, data->printer ? data->printer : params->filter);
+  snprintf(value, sizeof(value), "%d", data->job_id);
+  argc += brf_launcher_encode(request, sizeof(request), &used, value);
+  argc += brf_launcher_encode(request, sizeof(request), &used, data->job_user ? data->job_user : "");
+  argc += brf_launcher_encode(request, sizeof(request), &used, data->job_title ? data->job_title : "");
+  snprintf(value, sizeof(value), "%d", data->copies > 0 ? data->copies : 1);
+  argc += brf_launcher_encode(request, sizeof(request), &used, value);
+  argc += brf_launcher_encode(request, sizeof(request), &used, options);
+
+  for (i = 0; params->envp && params->envp[i] && i < BRF_LAUNCHER_MAX_ENV - 4; i ++)
+    envc += brf_launcher_encode(request, sizeof(request), &used, params->envp[i]);
+
+  if (data->printer)
+  {
+    snprintf(value, sizeof(value), "PRINTER=%s", data->printer);
+    envc += brf_launcher_encode(request, sizeof(request), &used, value);
+  }
+  if (data->final_content_type)
+  {
+    snprintf(value, sizeof(value), "FINAL_CONTENT_TYPE=%s", data->final_content_type);
+    envc += brf_launcher_encode(request, sizeof(request), &used, value);
+  }
+  snprintf(value, sizeof(value), "PATH=%s", getenv("PATH") ? getenv("PATH") : "/usr/bin:/bin");
+  envc += brf_launcher_encode(request, sizeof(request), &used, value);
+
+  if (argc != 6 || !optptr)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Arguments of filter %s are too long.", params->filter);
+    goto finish;
+  }
+
+  // Pass the descriptors of the chain to a launcher...
+  if (pipe2(errpipe, O_CLOEXEC) || pipe2(replypipe, O_CLOEXEC))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unable to create pipes for filter %s: %s", params->filter, strerror(errno));
+    goto finish;
+  }
+
+  fds[0] = inputfd;
+  fds[1] = outputfd;
+  fds[2] = errpipe[1];
+  fds[3] = replypipe[1];
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+
+  iov.iov_base       = request;
+  iov.iov_len        = used;
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  cmsg             = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  while ((bytes = sendmsg(brf_launcher_fds[0], &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+
+  close(errpipe[1]);
+  close(replypipe[1]);
+  errpipe[1] = replypipe[1] = -1;
+
+  if (bytes < 0)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Unable to send filter %s to a launcher: %s", params->filter, strerror(errno));
+    goto finish;
+  }
+
+  // Relay the messages of the filter until it exits...
+  pfds[0].fd     = errpipe[0];
+  pfds[0].events = POLLIN;
+  pfds[1].fd     = replypipe[0];
+  pfds[1].events = POLLIN;
+
+  while (pfds[0].fd >= 0 || pfds[1].fd >= 0)
+  {
+    if (poll(pfds, 2, 1000) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (have_pid && pid > 0 && !have_status && data->iscanceledfunc && data->iscanceledfunc(data->iscanceleddata))
+      kill(pid, SIGTERM);
+
+    if (pfds[0].revents)
+    {
+      if ((bytes = read(errpipe[0], line + linelen, sizeof(line) - 1 - linelen)) > 0)
+      {
+        char *start,                    // Start of line
+            *nl;                        // End of line
+
+        linelen += (size_t)bytes;
+        line[linelen] = '\0';
+
+        for (start = line; (nl = strchr(start, '\n')) != NULL; start = nl + 1)
+        {
+          *nl = '\0';
+          brf_launcher_log(data, start);
+        }
+
+        linelen -= (size_t)(start - line);
+        memmove(line, start, linelen);
+
+        if (linelen == sizeof(line) - 1)
+        {
+          brf_launcher_log(data, line);
+          linelen = 0;
+        }
+      }
+      else if (bytes == 0 || errno != EINTR)
+        pfds[0].fd = -1;
+    }
+
+    if (pfds[1].revents)
+    {
+      int reply_pid;                    // Process ID
+      brf_launcher_reply_t reply;       // Exit status
+
+      if (!have_pid)
+      {
+        if ((bytes = read(replypipe[0], &reply_pid, sizeof(reply_pid))) == sizeof(reply_pid))
+        {
+          pid      = (pid_t)reply_pid;
+          have_pid = true;
+        }
+      }
+      else if ((bytes = read(replypipe[0], &reply, sizeof(reply))) == sizeof(reply))
+      {
+        status                = reply.status;
+        brf_launcher_cpu_time = reply.cpu_time;
+        have_status           = true;
+      }
+
+      if (bytes == 0 || (bytes < 0 && errno != EINTR))
+        pfds[1].fd = -1;
+    }
+  }
+
+  if (linelen > 0)
+  {
+    line[linelen] = '\0';
+    brf_launcher_log(data, line);
+  }
+
+  if (!have_status)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Launcher of filter %s stopped.", params->filter);
+    status = -1;
+  }
+  else if (WIFEXITED(status))
+    status = WEXITSTATUS(status);
+  else if (WIFSIGNALED(status))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "Filter %s crashed on signal %d.", params->filter, WTERMSIG(status));
+    status = 128 + WTERMSIG(status);
+  }
+
+  finish:
+
+  if (errpipe[0] >= 0)
+    close(errpipe[0]);
+  if (errpipe[1] >= 0)
+    close(errpipe[1]);
+  if (replypipe[0] >= 0)
+    close(replypipe[0]);
+  if (replypipe[1] >= 0)
+    close(replypipe[1]);
+
+  run_time = brf_GetTime() - started;
+
+  brf_launcher_lock();
+  filter->slots[slot] = 0;
+  pthread_cond_broadcast(&brf_launcher_shared->cond);
+  filter->stats.running --;
+  filter->stats.runs ++;
+  if (status)
+    filter->stats.failures ++;
+  filter->stats.wait_time += wait_time;
+  filter->stats.run_time  += run_time;
+  if (wait_time > filter->stats.max_wait)
+    filter->stats.max_wait = wait_time;
+  if (run_time > filter->stats.max_run)
+    filter->stats.max_run = run_time;
+  stats = filter->stats;
+  pthread_mutex_unlock(&brf_launcher_shared->mutex);
+
+  if (log)
+    log(ld, CF_LOGLEVEL_INFO, "Filter %s waited %.3fs for a run slot and ran %.3fs (%lu runs, %.3fs average wait, %.3fs average run).", stats.name, wait_time, run_time, stats.runs, stats.wait_time / stats.runs, stats.run_time / stats.runs);
+
+  return (status);
+}
+
+// 'brf_LauncherGetCPUTime()' - Get and clear the CPU time of the last filter.
+//
+// The filters are children of a launcher, not of the filter chain, so their
+// CPU time is missing from the chain's RUSAGE_CHILDREN.  The launcher reports
+// it with the exit status instead.
+
+double                                  // O - CPU seconds or 0.0
+brf_LauncherGetCPUTime(void)
+{
+  double cpu_time = brf_launcher_cpu_time;
+                                        // CPU seconds of the last filter
+
+  brf_launcher_cpu_time = 0.0;
+
+  return (cpu_time);
+}
+
+// 'brf_LauncherGetStats()' - Get the statistics of the external filters.
+
+int                                     // O - Number of filters
+brf_LauncherGetStats(
+    brf_launcher_stats_t *stats,        // I - Statistics array
+    int max_stats)                      // I - Size of statistics array
+{
+  int i,                                // Looping var
+      count;                            // Number of filters
+
+  if (!brf_launcher_shared)
+    return (0);
+
+  brf_launcher_lock();
+
+  for (i = 0, count = brf_launcher_shared->num_filters; i < count && i < max_stats; i ++)
+    stats[i] = brf_launcher_shared->filters[i].stats;
+
+  pthread_mutex_unlock(&brf_launcher_shared->mutex);
+
+  return (count < max_stats ? count : max_stats);
+}
+
+// 'brf_LauncherInit()' - Start the launchers for external filters.
+//
+// Every external filter of the conversion table gets `limit` run slots.  Call
+// this early, while the server process is still small, since each launcher is
+// a fork of it.
+
+bool                                    // O - `true` on success
+brf_LauncherInit(
+    pappl_system_t *system,             // I - System
+    brf_spooling_conversion_t *conversions, // I - Conversion table
+    int num_launchers,                  // I - Number of launchers
+    int limit)                          // I - Run slots per filter
+{
+  int i, j;                             // Looping vars
+  pthread_mutexattr_t mattr;            // Shared mutex attributes
+  pthread_condattr_t cattr;             // Shared condition attributes
+  pthread_t tid;                        // Supervisor thread
+  brf_launcher_filter_t *filter;        // Filter program
+
+  brf_launcher_system = system;
+
+  if ((brf_launcher_shared = (brf_launcher_shared_t *)brf_SharedAlloc(sizeof(brf_launcher_shared_t))) == NULL)
+    return (false);
+
+  // Filter processes can be killed at any time, so the mutex is robust and
+  // the run slots remember their holders
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&brf_launcher_shared->mutex, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+  pthread_cond_init(&brf_launcher_shared->cond, &cattr);
+  pthread_condattr_destroy(&cattr);
+
+  if (limit < 1)
+    limit = 1;
+  else if (limit > BRF_LAUNCHER_MAX_SLOTS)
+    limit = BRF_LAUNCHER_MAX_SLOTS;
+
+  // Give every external filter program its run slots...
+  for (i = 0; conversions[i].srctype; i ++)
+  {
+    const cf_filter_external_t *params = (const cf_filter_external_t *)conversions[i].filters.parameters;
+                                        // Filter parameters
+
+    if (conversions[i].filters.function != brf_LauncherFilter || !params || !params->filter)
+      continue;
+
+    for (j = 0; j < brf_launcher_shared->num_filters; j ++)
+    {
+      if (!strcmp(brf_launcher_shared->filters[j].params->filter, params->filter))
+        break;
+    }
+
+    if (j < brf_launcher_shared->num_filters || j >= BRF_LAUNCHER_MAX_FILTERS)
+      continue;
+
+    filter         = brf_launcher_shared->filters + j;
+    filter->params = params;
+
+    papplCopyString(filter->stats.name, strrchr(params->filter, '/') ? strrchr(params->filter, '/') + 1 : params->filter, sizeof(filter->stats.name));
+    filter->stats.limit = limit;
+
+    brf_launcher_shared->num_filters ++;
+  }
+
+  if (num_launchers <= 0)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_INFO, "External filters run without launchers, %d at a time per filter.", limit);
+    return (true);
+  }
+
+  // Start the launchers...
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, brf_launcher_fds))
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to create launcher socket: %s", strerror(errno));
+    return (false);
+  }
+
+  if (num_launchers > BRF_LAUNCHER_MAX)
+    num_launchers = BRF_LAUNCHER_MAX;
+
+  for (i = 0; i < num_launchers; i ++)
+  {
+    if ((brf_launcher_pids[i] = brf_launcher_spawn()) < 0)
+      break;
+  }
+
+  if ((brf_launcher_count = i) == 0)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to start filter launchers: %s", strerror(errno));
+    return (false);
+  }
+
+  if (pthread_create(&tid, NULL, brf_launcher_supervise, NULL))
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to supervise filter launchers: %s", strerror(errno));
+  else
+    pthread_detach(tid);
+
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Started %d filter launcher(s) for %d external filter(s), %d run slot(s) each.", brf_launcher_count, brf_launcher_shared->num_filters, limit);
+
+  return (true);
+}
+
+// 'brf_launcher_claim()' - Take a free run slot of a filter.
+//
+// A slot held by a process that no longer exists is taken over, so a filter
+// process that is killed while running does not leak its slot.  Call with
+// the mutex locked.
+
+static int                              // O - Run slot or -1 if all are busy
+brf_launcher_claim(
+    brf_launcher_filter_t *filter)      // I - Filter program
+{
+  int i;                                // Looping var
+
+  for (i = 0; i < filter->stats.limit; i ++)
+  {
+    if (!filter->slots[i])
+      break;
+  }
+
+  if (i >= filter->stats.limit)
+  {
+    for (i = 0; i < filter->stats.limit; i ++)
+    {
+      if (kill(filter->slots[i], 0) && errno == ESRCH)
+      {
+        // The holder died, it no longer runs
+        filter->stats.running --;
+        break;
+      }
+    }
+
+    if (i >= filter->stats.limit)
+      return (-1);
+  }
+
+  filter->slots[i] = getpid();
+
+  return (i);
+}
+
+// 'brf_launcher_encode()' - Append a string to a request.
+
+static bool                             // O - `true` if it fit
+brf_launcher_encode(char *buffer,       // I - Request buffer
+                    size_t bufsize,     // I - Size of request buffer
+                    size_t *used,       // IO - Bytes used
+                    const char *s)      // I - String
+{
+  size_t len = strlen(s) + 1;           // Length with nul
+
+  if (*used + len > bufsize)
+    return (false);
+
+  memcpy(buffer + *used, s, len);
+  *used += len;
+
+  return (true);
+}
+
+// 'brf_launcher_find()' - Find the run slots of a filter program.
+
+static brf_launcher_filter_t *          // O - Filter program or `NULL`
+brf_launcher_find(
+    const cf_filter_external_t *params) // I - Filter parameters
+{
+  int i;                                // Looping var
+
+  if (!params || !params->filter)
+    return (NULL);
+
+  for (i = 0; i < brf_launcher_shared->num_filters; i ++)
+  {
+    if (brf_launcher_shared->filters[i].params == params || !strcmp(brf_launcher_shared->filters[i].params->filter, params->filter))
+      return (brf_launcher_shared->filters + i);
+  }
+
+  return (NULL);
+}
+
+// 'brf_launcher_lock()' - Lock the shared state.
+//
+// Recovers the mutex when its holder died.
+
+static void
+brf_launcher_lock(void)
+{
+  if (pthread_mutex_lock(&brf_launcher_shared->mutex) == EOWNERDEAD)
+    pthread_mutex_consistent(&brf_launcher_shared->mutex);
+}
+
+// 'brf_launcher_log()' - Log a message line of a filter.
+//
+// Lines use the CUPS filter prefixes, "PAGE:" and "ATTR:" lines are control
+// messages for the job.
+
+static void
+brf_launcher_log(cf_filter_data_t *data,// I - Job and printer data
+                 char *line)            // I - Message line
+{
+  static const struct
+  {
+    const char *prefix;                 // Message prefix
+    cf_loglevel_t level;                // Log level
+    bool keep;                          // Keep the prefix in the message?
+  } levels[] =
+  {
+    { "ERROR:",   CF_LOGLEVEL_ERROR,   false },
+    { "WARNING:", CF_LOGLEVEL_WARN,    false },
+    { "NOTICE:",  CF_LOGLEVEL_INFO,    false },
+    { "INFO:",    CF_LOGLEVEL_INFO,    false },
+    { "DEBUG:",   CF_LOGLEVEL_DEBUG,   false },
+    { "DEBUG2:",  CF_LOGLEVEL_DEBUG,   false },
+    { "PAGE:",    CF_LOGLEVEL_CONTROL, true },
+    { "ATTR:",    CF_LOGLEVEL_CONTROL, true }
+  };
+  size_t i,                             // Looping var
+      len;                              // Length of prefix
+
+  if (!data->logfunc || !*line)
+    return;
+
+  for (i = 0; i < sizeof(levels) / sizeof(levels[0]); i ++)
+  {
+    len = strlen(levels[i].prefix);
+
+    if (!strncmp(line, levels[i].prefix, len))
+    {
+      if (!levels[i].keep)
+      {
+        for (line += len; *line == ' '; line ++);
+      }
+
+      data->logfunc(data->logdata, levels[i].level, "%s", line);
+      return;
+    }
+  }
+
+  data->logfunc(data->logdata, CF_LOGLEVEL_DEBUG, "%s", line);
+}
+
+// 'brf_launcher_main()' - Run filters for the filter chains.
+//
+// The launcher only holds its socket, the descriptors of the filters it runs
+// and a signalfd for reaping them, and exits with the server.
+
+static void
+brf_launcher_main(int sockfd)           // I - Launcher end of the request socket
+{
+  sigset_t mask;                        // SIGCHLD mask
+  int sigfd,                            // SIGCHLD signalfd
+      fd,                               // Looping var
+      max_fd,                           // Highest descriptor to close
+      num_children = 0;                 // Number of running filters
+  struct pollfd pfds[2];                // Request socket and signalfd
+  static brf_launcher_child_t children[BRF_LAUNCHER_MAX_RUNNING];
+                                        // Running filters
+
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  prctl(PR_SET_NAME, "brf-launcher");
+
+  signal(SIGPIPE, SIG_IGN);
+
+  // Drop everything inherited from the server...
+  if ((max_fd = (int)sysconf(_SC_OPEN_MAX)) < 0 || max_fd > 65536)
+    max_fd = 65536;
+
+  for (fd = 3; fd < max_fd; fd ++)
+  {
+    if (fd != sockfd)
+      close(fd);
+  }
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+
+  if ((sigfd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0)
+    _exit(1);
+
+  pfds[0].fd     = sockfd;
+  pfds[0].events = POLLIN;
+  pfds[1].fd     = sigfd;
+  pfds[1].events = POLLIN;
+
+  for (;;)
+  {
+    // Stop taking requests while all slots are busy
+    pfds[0].fd = num_children < BRF_LAUNCHER_MAX_RUNNING ? sockfd : -1;
+
+    if (poll(pfds, 2, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      _exit(1);
+    }
+
+    if (pfds[1].revents)
+    {
+      struct signalfd_siginfo info;     // Signal information
+      pid_t pid;                        // Exited filter
+      int status, i;                    // Exit status and looping var
+      struct rusage usage;              // CPU usage of the filter
+      brf_launcher_reply_t reply;       // Reply to the chain
+
+      while (read(sigfd, &info, sizeof(info)) < 0 && errno == EINTR);
+
+      while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0)
+      {
+        for (i = 0; i < num_children; i ++)
+        {
+          if (children[i].pid == pid)
+          {
+            reply.status   = status;
+            reply.cpu_time = (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+
+            while (write(children[i].replyfd, &reply, sizeof(reply)) < 0 && errno == EINTR);
+            close(children[i].replyfd);
+            children[i] = children[-- num_children];
+            break;
+          }
+        }
+      }
+    }
+
+    if (pfds[0].revents & POLLIN)
+      brf_launcher_start(sockfd, children, &num_children);
+    else if (pfds[0].revents & (POLLHUP | POLLERR))
+      _exit(0);
+  }
+}
+
+// 'brf_launcher_spawn()' - Fork a launcher.
+
+static pid_t                            // O - Process ID or -1 on error
+brf_launcher_spawn(void)
+{
+  pid_t pid;                            // Process ID
+
+  if ((pid = fork()) == 0)
+  {
+    brf_launcher_main(brf_launcher_fds[1]);
+    _exit(0);
+  }
+
+  return (pid);
+}
+
+// 'brf_launcher_start()' - Receive a request and start its filter.
+
+static void
+brf_launcher_start(
+    int sockfd,                         // I  - Request socket
+    brf_launcher_child_t *children,     // I  - Running filters
+    int *num_children)                  // IO - Number of running filters
+{
+  static char request[BRF_LAUNCHER_REQUEST + 1];
+                                        // Request message
+  char *argv[BRF_LAUNCHER_MAX_ARGS],    // Filter arguments
+      *envp[BRF_LAUNCHER_MAX_ENV],      // Filter environment
+      *path,                            // Filter program
+      *ptr,                             // Pointer into request
+      *end;                             // End of request
+  int fds[4] = { -1, -1, -1, -1 },      // Received descriptors
+      i,                                // Looping var
+      argc = 0,                         // Number of arguments
+      envc = 0;                         // Number of environment strings
+  ssize_t bytes;                        // Size of request
+  pid_t pid;                            // Filter process
+  struct msghdr msg;                    // Request message
+  struct iovec iov;                     // Request data
+  union
+  {
+    char buf[CMSG_SPACE(sizeof(fds))];  // Control data
+    struct cmsghdr align;               // Alignment
+  } control;
+  struct cmsghdr *cmsg;                 // Descriptor message
+  sigset_t mask;                        // Signal mask for the filter
+
+  memset(&msg, 0, sizeof(msg));
+
+  iov.iov_base       = request;
+  iov.iov_len        = BRF_LAUNCHER_REQUEST;
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  if ((bytes = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT)) <= 0)
+  {
+    if (bytes == 0)
+      _exit(0);
+    return;
+  }
+
+  if ((cmsg = CMSG_FIRSTHDR(&msg)) != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  // Split the request into program, arguments and environment
+  request[bytes] = '\0';
+  path = request;
+  end  = request + bytes;
+
+  for (ptr = path + strlen(path) + 1; ptr < end; ptr += strlen(ptr) + 1)
+  {
+    if (argc < 6)
+      argv[argc ++] = ptr;
+    else if (envc < BRF_LAUNCHER_MAX_ENV - 1)
+      envp[envc ++] = ptr;
+  }
+
+  argv[argc] = NULL;
+  envp[envc] = NULL;
+
+  if (fds[3] < 0)
+    goto finish;
+
+  if (argc != 6 || fds[0] < 0 || fds[1] < 0 || fds[2] < 0 || (pid = fork()) < 0)
+  {
+    int reply_pid = -1;                 // No process
+    brf_launcher_reply_t reply = { 127 << 8, 0.0 };
+                                        // Exit status 127
+
+    while (write(fds[3], &reply_pid, sizeof(reply_pid)) < 0 && errno == EINTR);
+    while (write(fds[3], &reply, sizeof(reply)) < 0 && errno == EINTR);
+    goto finish;
+  }
+
+  if (pid == 0)
+  {
+    // Filter process: chain descriptors on stdin, stdout and stderr
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    signal(SIGPIPE, SIG_DFL);
+    prctl(PR_SET_PDEATHSIG, 0);
+
+    if (dup2(fds[0], 0) < 0 || dup2(fds[1], 1) < 0 || dup2(fds[2], 2) < 0)
+      _exit(127);
+
+    execve(path, argv, envp);
+    _exit(127);
+  }
+
+  // Tell the chain which process runs its filter, the exit status follows
+  while (write(fds[3], &pid, sizeof(int)) < 0 && errno == EINTR);
+
+  children[*num_children].pid     = pid;
+  children[*num_children].replyfd = fds[3];
+  (*num_children) ++;
+  fds[3] = -1;
+
+  finish:
+
+  for (i = 0; i < 4; i ++)
+  {
+    if (fds[i] >= 0)
+      close(fds[i]);
+  }
+}
+
+// 'brf_launcher_supervise()' - Restart launchers that stopped.
+
+static void *                           // O - Thread exit status (unused)
+brf_launcher_supervise(void *data)      // I - Thread data (unused)
+{
+  struct pollfd pfds[BRF_LAUNCHER_MAX]; // Launcher pidfds
+  int i;                                // Looping var
+
+  (void)data;
+
+  for (i = 0; i < brf_launcher_count; i ++)
+  {
+    pfds[i].fd     = (int)syscall(SYS_pidfd_open, brf_launcher_pids[i], 0);
+    pfds[i].events = POLLIN;
+  }
+
+  for (;;)
+  {
+    if (poll(pfds, (nfds_t)brf_launcher_count, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    for (i = 0; i < brf_launcher_count; i ++)
+    {
+      if (pfds[i].fd < 0 || !pfds[i].revents)
+        continue;
+
+      close(pfds[i].fd);
+      waitpid(brf_launcher_pids[i], NULL, 0);
+
+      papplLog(brf_launcher_system, PAPPL_LOGLEVEL_WARN, "Filter launcher (PID %d) stopped, restarting it.", (int)brf_launcher_pids[i]);
+
+      if ((brf_launcher_pids[i] = brf_launcher_spawn()) > 0)
+        pfds[i].fd = (int)syscall(SYS_pidfd_open, brf_launcher_pids[i], 0);
+      else
+        pfds[i].fd = -1;
+    }
+  }
+
+  return (NULL);
+}
@@ -0,0 +1,663 @@
+//
+// In-process liblouis translation for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include <pthread.h>
+#include <malloc.h>
+#include <liblouisutdml/liblouisutdml.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_LOUIS_CONFIG "preferences.cfg"
+                                        // liblouisutdml configuration file
+#define BRF_LOUIS_MAX_INPUT (16 * 1024 * 1024)
+                                        // Maximum size of a text document
+#ifndef BRF_LOUIS_TABLESDIR
+#  define BRF_LOUIS_TABLESDIR "/usr/share/liblouis/tables"
+                                        // Default liblouis table directory
+#endif // !BRF_LOUIS_TABLESDIR
+
+// Local types...
+
+typedef struct brf_louis_table_s        // Compiled table list
+{
+  char *tables;                         // Table list
+  int refcount;                         // Number of jobs using the tables
+  size_t size;                          // Memory used by the compiled tables
+} brf_louis_table_t;
+
+// Local globals...
+
+static pthread_mutex_t brf_louis_mutex = PTHREAD_MUTEX_INITIALIZER;
+                                        // Mutex for the cache and liblouis
+static cups_array_t *brf_louis_cache = NULL;
+                                        // Compiled table lists
+static brf_louis_stats_t brf_louis_stats;
+                                        // Cache statistics
+static char brf_louis_locale_table[256] = "en-us-g2.ctb",
+                                        // Translation table for the locale
+    brf_louis_locale_hyph[256] = "";    // Hyphenation table for the locale or ""
+
+// Local functions...
+
+static void brf_louis_atfork_prepare(void);
+static void brf_louis_atfork_release(void);
+static int brf_louis_compare(brf_louis_table_t *a, brf_louis_table_t *b, void *data);
+static bool brf_louis_exists(const char *name);
+static void brf_louis_locale(void);
+static char *brf_louis_margin(char *bufptr, int count, char ch);
+static const char *brf_louis_position(const char *value, const char *defpos);
+static void brf_louis_prewarm(pappl_printer_t *printer, void *data);
+static const char *brf_louis_resolve(const char *value, bool hyphenation);
+
+// 'brf_LouisFilter()' - Translate text, HTML or XML to BRF with liblouisutdml.
+//
+// This replaces the external texttobrf filter for the formats liblouisutdml
+// reads directly.  The page geometry, the LibLouis* tables and the page
+// numbering options are passed to liblouisutdml as a settings string, and the
+// braille margins are added while the result is written out.  BRF only has
+// 6-dot cells, so "TextDots" only changes the line height of the geometry.
+
+int                                     // O - Exit status
+brf_LouisFilter(
+    int inputfd,                        // I - Input file descriptor
+    int outputfd,                       // I - Output file descriptor
+    int inputseekable,                  // I - Is input seekable? (unused)
+    cf_filter_data_t *data,             // I - Job and printer data
+    void *parameters)                   // I - Filter parameters (unused)
+{
+  cf_logfunc_t log = data->logfunc;     // Log function
+  void *ld = data->logdata;             // Log function data
+  char *inbuf = NULL,                   // Input document
+      tables[1024],                     // Translation table list
+      settings[2048];                   // liblouisutdml settings
+  size_t insize = 0,                    // Bytes in input
+      inalloc = 0;                      // Allocated input size
+  ssize_t bytes;                        // Bytes read
+  widechar *outbuf = NULL;              // Translated document
+  int outlen,                           // Length of translated document
+      i,                                // Looping var
+      column = 0,                       // Current output column
+      ret = 1;                          // Exit status
+  char *outbytes = NULL,                // Output document
+      *bufptr;                          // Pointer into output document
+  size_t breaks;                        // Number of line and page breaks
+  const char *braille_page,             // Braille page number position
+      *print_page;                      // Print page number position
+  char braille_numbers[64],             // Braille page number settings
+      print_numbers[64];                // Print page number settings
+  brf_geometry_t geometry;              // Page geometry
+  double start = brf_GetTime();         // Start time
+
+  (void)inputseekable;
+  (void)parameters;
+
+  // Read the whole document, liblouisutdml formats it as a unit...
+  for (;;)
+  {
+    if (insize == inalloc)
+    {
+      char *temp;                       // New buffer
+
+      if (inalloc >= BRF_LOUIS_MAX_INPUT)
+      {
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "brf_LouisFilter: Document is larger than %d bytes.", BRF_LOUIS_MAX_INPUT);
+        goto finish;
+      }
+
+      inalloc = inalloc ? 2 * inalloc : 65536;
+      if ((temp = (char *)realloc(inbuf, inalloc)) == NULL)
+      {
+        if (log)
+          log(ld, CF_LOGLEVEL_ERROR, "brf_LouisFilter: Unable to allocate %u bytes.", (unsigned)inalloc);
+        goto finish;
+      }
+
+      inbuf = temp;
+    }
+
+    if ((bytes = read(inputfd, inbuf + insize, inalloc - insize)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_LouisFilter: Unable to read input: %s", strerror(errno));
+      goto finish;
+    }
+    else if (bytes == 0)
+      break;
+
+    insize += (size_t)bytes;
+  }
+
+  if (insize == 0)
+  {
+    ret = 0;
+    goto finish;
+  }
+
+  if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+    goto finish;
+
+  // Build the settings from the job options...
+  brf_GetGeometry(data->num_options, data->options, &geometry);
+  brf_LouisGetTables(data->num_options, data->options, tables, sizeof(tables));
+
+  // Page numbers set to "None" are left out entirely
+  if ((braille_page = brf_louis_position(cupsGetOption("BraillePageNumber", data->num_options, data->options), "bottom")) != NULL)
+    snprintf(braille_numbers, sizeof(braille_numbers), "braillePages yes\nbraillePageNumberAt %s\n", braille_page);
+  else
+    papplCopyString(braille_numbers, "braillePages no\n", sizeof(braille_numbers));
+
+  if ((print_page = brf_louis_position(cupsGetOption("PrintPageNumber", data->num_options, data->options), "top")) != NULL)
+    snprintf(print_numbers, sizeof(print_numbers), "printPages yes\nprintPageNumberAt %s\n", print_page);
+  else
+    papplCopyString(print_numbers, "printPages no\n", sizeof(print_numbers));
+
+  snprintf(settings, sizeof(settings),
+           "formatFor textDevice\n"
+           "outputEncoding ascii8\n"
+           "literaryTextTable %s\n"
+           "cellsPerLine %d\n"
+           "linesPerPage %d\n"
+           "hyphenate %s\n"
+           "%s"
+           "%s"
+           "pageSeparator %s\n"
+           "pageSeparatorNumber %s\n"
+           "continuePages %s\n"
+           "lineEnd \\n\n"
+           "pageEnd \\f\n",
+           tables, geometry.cells_per_line, geometry.lines_per_page,
+           strstr(tables, "hyph_") ? "yes" : "no",
+           braille_numbers, print_numbers,
+           brf_GetBoolOption("PageSeparator", true, data->num_options, data->options) ? "yes" : "no",
+           brf_GetBoolOption("PageSeparatorNumber", true, data->num_options, data->options) ? "yes" : "no",
+           brf_GetBoolOption("ContinuePages", true, data->num_options, data->options) ? "yes" : "no");
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_LouisFilter: Translating %u bytes with tables '%s', %dx%d cells.", (unsigned)insize, tables, geometry.cells_per_line, geometry.lines_per_page);
+
+  // Contraction rarely doubles the length, leave room for page formatting...
+  outlen = (int)(insize * 3 + 4096);
+  if ((outbuf = (widechar *)malloc((size_t)outlen * sizeof(widechar))) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_LouisFilter: Unable to allocate output buffer.");
+    goto finish;
+  }
+
+  if (!lbu_translateString(BRF_LOUIS_CONFIG, inbuf, (int)insize, outbuf, &outlen, NULL, settings, 0))
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_LouisFilter: Translation with tables '%s' failed.", tables);
+    goto finish;
+  }
+
+  // Add the braille margins and write the result in one go...
+  for (i = 0, breaks = 1; i < outlen; i ++)
+    if (outbuf[i] == '\n' || outbuf[i] == '\f')
+      breaks ++;
+
+  if ((outbytes = (char *)malloc((size_t)outlen + breaks * (size_t)(geometry.left_margin + geometry.top_margin))) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_LouisFilter: Unable to allocate output buffer.");
+    goto finish;
+  }
+
+  bufptr = brf_louis_margin(outbytes, geometry.top_margin, '\n');
+
+  for (i = 0; i < outlen; i ++)
+  {
+    char ch = (char)(outbuf[i] < 256 ? outbuf[i] : ' ');
+                                        // Output character
+
+    if (column == 0 && ch != '\n' && ch != '\f')
+      bufptr = brf_louis_margin(bufptr, geometry.left_margin, ' ');
+
+    *bufptr++ = ch;
+
+    if (ch == '\f')
+    {
+      column = 0;
+      bufptr = brf_louis_margin(bufptr, geometry.top_margin, '\n');
+    }
+    else if (ch == '\n')
+      column = 0;
+    else
+      column ++;
+  }
+
+  if (brf_WriteAll(outputfd, outbytes, (size_t)(bufptr - outbytes)) < 0)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_LouisFilter: Unable to write output: %s", strerror(errno));
+    goto finish;
+  }
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_LouisFilter: Wrote %d cells in %.3fs.", outlen, brf_GetTime() - start);
+
+  ret = 0;
+
+  finish:
+
+  free(inbuf);
+  free(outbuf);
+  free(outbytes);
+
+  return (ret);
+}
+
+// 'brf_LouisAcquire()' - Get compiled translation tables from the cache.
+//
+// Tables are compiled by liblouis in the server process and stay resident, so
+// the filter processes that cfFilterChain() forks for a job inherit them
+// already compiled.  Acquire the job's tables before the chain starts and
+// release them once it is done.
+
+bool                                    // O - `true` on success, `false` if the tables don't compile
+brf_LouisAcquire(const char *tables)    // I - Table list
+{
+  brf_louis_table_t key,                // Search key
+      *table;                           // Cache entry
+  bool ret = true;                      // Return value
+
+  pthread_mutex_lock(&brf_louis_mutex);
+
+  key.tables = (char *)tables;
+
+  if ((table = (brf_louis_table_t *)cupsArrayFind(brf_louis_cache, &key)) != NULL)
+  {
+    table->refcount ++;
+    brf_louis_stats.hits ++;
+  }
+  else if ((table = (brf_louis_table_t *)calloc(1, sizeof(brf_louis_table_t))) != NULL && (table->tables = strdup(tables)) != NULL)
+  {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    size_t before = mallinfo2().uordblks;
+                                        // Heap in use before compiling
+#endif // __GLIBC__
+
+    brf_louis_stats.misses ++;
+
+    if (lou_getTable(tables))
+    {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+      size_t after = mallinfo2().uordblks;
+                                        // Heap in use after compiling
+
+      table->size = after > before ? after - before : 0;
+#endif // __GLIBC__
+
+      table->refcount = 1;
+      cupsArrayAdd(brf_louis_cache, table);
+
+      brf_louis_stats.num_tables ++;
+      brf_louis_stats.bytes += table->size;
+    }
+    else
+    {
+      free(table->tables);
+      free(table);
+      ret = false;
+    }
+  }
+  else
+  {
+    free(table);
+    ret = false;
+  }
+
+  pthread_mutex_unlock(&brf_louis_mutex);
+
+  return (ret);
+}
+
+// 'brf_LouisGetStats()' - Get a copy of the table cache statistics.
+
+void
+brf_LouisGetStats(brf_louis_stats_t *stats) // O - Statistics
+{
+  pthread_mutex_lock(&brf_louis_mutex);
+  *stats = brf_louis_stats;
+  pthread_mutex_unlock(&brf_louis_mutex);
+}
+
+// 'brf_LouisInit()' - Set up the translation table cache.
+
+void
+brf_LouisInit(void)
+{
+  brf_louis_cache = cupsArrayNew((cups_array_func_t)brf_louis_compare, NULL);
+
+  // The locale doesn't change, look up its tables once...
+  brf_louis_locale();
+
+  // Don't fork a filter process while liblouis is compiling in another
+  // thread, the child would inherit a half-built table...
+  pthread_atfork(brf_louis_atfork_prepare, brf_louis_atfork_release, brf_louis_atfork_release);
+}
+
+// 'brf_LouisPrewarm()' - Compile the default tables of every printer.
+
+void
+brf_LouisPrewarm(pappl_system_t *system) // I - System
+{
+  brf_louis_stats_t stats;              // Cache statistics
+
+  papplSystemIteratePrinters(system, brf_louis_prewarm, NULL);
+
+  brf_LouisGetStats(&stats);
+  papplLog(system, PAPPL_LOGLEVEL_INFO, "Translation table cache has %d table list(s) using %lu KiB.", stats.num_tables, (unsigned long)(stats.bytes / 1024));
+}
+
+// 'brf_LouisRelease()' - Release translation tables acquired for a job.
+//
+// liblouis can only free all of its tables at once, so released tables stay
+// compiled for the next job.  The cache is bounded by the table lists the
+// printers are configured for.
+
+void
+brf_LouisRelease(const char *tables)    // I - Table list
+{
+  brf_louis_table_t key,                // Search key
+      *table;                           // Cache entry
+
+  pthread_mutex_lock(&brf_louis_mutex);
+
+  key.tables = (char *)tables;
+
+  if ((table = (brf_louis_table_t *)cupsArrayFind(brf_louis_cache, &key)) != NULL && table->refcount > 0)
+    table->refcount --;
+
+  pthread_mutex_unlock(&brf_louis_mutex);
+}
+
+// 'brf_LouisGetTables()' - Get the liblouis table list for the LibLouis* options.
+//
+// "LibLouis" selects the translation table and "LibLouis2" the hyphenation
+// table, "LibLouis3" and "LibLouis4" add extra tables.  "Locale" and
+// "HyphLocale" pick the tables for the current locale, "None" skips the
+// entry.
+
+char *                                  // O - Table list
+brf_LouisGetTables(
+    int num_options,                    // I - Number of options
+    cups_option_t *options,             // I - Options
+    char *buffer,                       // I - Table list buffer
+    size_t bufsize)                     // I - Size of buffer
+{
+  static const char * const names[] =   // Table options
+  {
+    "LibLouis",
+    "LibLouis2",
+    "LibLouis3",
+    "LibLouis4"
+  };
+  size_t i;                             // Looping var
+  const char *value;                    // Option value
+  char *bufptr = buffer,                // Pointer into buffer
+      *bufend = buffer + bufsize;       // End of buffer
+
+  *buffer = '\0';
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i ++)
+  {
+    if ((value = cupsGetOption(names[i], num_options, options)) == NULL)
+      value = i == 0 ? "Locale" : i == 1 ? "HyphLocale" : "None";
+
+    if ((value = brf_louis_resolve(value, i == 1)) == NULL)
+      continue;
+
+    snprintf(bufptr, (size_t)(bufend - bufptr), "%s%s", bufptr > buffer ? "," : "", value);
+    bufptr += strlen(bufptr);
+  }
+
+  if (!*buffer)
+    papplCopyString(buffer, "en-us-g2.ctb", bufsize);
+
+  return (buffer);
+}
+
+// 'brf_louis_atfork_prepare()' - Lock the cache before forking.
+
+static void
+brf_louis_atfork_prepare(void)
+{
+  pthread_mutex_lock(&brf_louis_mutex);
+}
+
+// 'brf_louis_atfork_release()' - Unlock the cache after forking.
+
+static void
+brf_louis_atfork_release(void)
+{
+  pthread_mutex_unlock(&brf_louis_mutex);
+}
+
+// 'brf_louis_compare()' - Compare two cache entries.
+
+static int                              // O - Result of comparison
+brf_louis_compare(brf_louis_table_t *a, // I - First entry
+                  brf_louis_table_t *b, // I - Second entry
+                  void *data)           // I - Callback data (unused)
+{
+  (void)data;
+
+  return (strcmp(a->tables, b->tables));
+}
+
+// 'brf_louis_exists()' - Check whether liblouis can find a table file.
+//
+// Looks in the directories of LOUIS_TABLEPATH, the data path set for liblouis
+// and the default table directory.
+
+static bool                             // O - `true` if the file exists
+brf_louis_exists(const char *name)      // I - Table file name
+{
+  const char *path,                     // Directory list
+      *dataptr;                         // liblouis data path
+  char dirs[2048],                      // Directories to search
+      *dir,                             // Current directory
+      *next,                            // Next directory
+      filename[1024];                   // Table file
+
+  dirs[0] = '\0';
+
+  if ((path = getenv("LOUIS_TABLEPATH")) != NULL && *path)
+    snprintf(dirs, sizeof(dirs), "%s,", path);
+
+  if ((dataptr = lou_getDataPath()) != NULL && *dataptr)
+    snprintf(dirs + strlen(dirs), sizeof(dirs) - strlen(dirs), "%s/liblouis/tables,", dataptr);
+
+  snprintf(dirs + strlen(dirs), sizeof(dirs) - strlen(dirs), "%s", BRF_LOUIS_TABLESDIR);
+
+  for (dir = dirs; dir; dir = next)
+  {
+    if ((next = strchr(dir, ',')) != NULL)
+      *next++ = '\0';
+
+    if (!*dir)
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+    if (!access(filename, R_OK))
+      return (true);
+  }
+
+  return (false);
+}
+
+// 'brf_louis_locale()' - Look up the tables for the current locale.
+//
+// The literary table for "Locale" comes from the liblouis table metadata, the
+// hyphenation table for "HyphLocale" is only used if liblouis has one for the
+// language.
+
+static void
+brf_louis_locale(void)
+{
+  const char *lang;                     // Locale name
+  char language[3],                     // Language code
+      country[3],                       // Country code
+      query[256];                       // Table query
+  char *found;                          // Table found by liblouis
+
+  // Get "ll_CC" from the environment...
+  if ((lang = getenv("LC_ALL")) == NULL || !*lang)
+    if ((lang = getenv("LC_CTYPE")) == NULL || !*lang)
+      if ((lang = getenv("LANG")) == NULL || !*lang)
+        lang = "en_US";
+
+  if (!isalpha(lang[0] & 255) || !isalpha(lang[1] & 255) || !strcmp(lang, "C") || !strcmp(lang, "POSIX"))
+    lang = "en_US";
+
+  language[0] = (char)tolower(lang[0] & 255);
+  language[1] = (char)tolower(lang[1] & 255);
+  language[2] = '\0';
+
+  if (lang[2] == '_' && isalpha(lang[3] & 255) && isalpha(lang[4] & 255))
+  {
+    country[0] = (char)toupper(lang[3] & 255);
+    country[1] = (char)toupper(lang[4] & 255);
+  }
+  else
+  {
+    country[0] = (char)toupper(language[0]);
+    country[1] = (char)toupper(language[1]);
+  }
+  country[2] = '\0';
+
+  // Ask liblouis for a literary table for this language...
+  pthread_mutex_lock(&brf_louis_mutex);
+
+  snprintf(query, sizeof(query), "language:%s-%s type:literary", language, country);
+  if ((found = lou_findTable(query)) == NULL)
+  {
+    snprintf(query, sizeof(query), "language:%s type:literary", language);
+    found = lou_findTable(query);
+  }
+
+  pthread_mutex_unlock(&brf_louis_mutex);
+
+  if (found)
+  {
+    papplCopyString(brf_louis_locale_table, found, sizeof(brf_louis_locale_table));
+    free(found);
+  }
+
+  // Not every language has a hyphenation dictionary...
+  snprintf(query, sizeof(query), "hyph_%s_%s.dic", language, country);
+  if (brf_louis_exists(query))
+    papplCopyString(brf_louis_locale_hyph, query, sizeof(brf_louis_locale_hyph));
+}
+
+// 'brf_louis_margin()' - Add blank margin characters to the output.
+
+static char *                           // O - New end of output
+brf_louis_margin(char *bufptr,          // I - End of output
+                 int count,             // I - Number of characters
+                 char ch)               // I - Margin character
+{
+  if (count > 0)
+  {
+    memset(bufptr, ch, (size_t)count);
+    bufptr += count;
+  }
+
+  return (bufptr);
+}
+
+// 'brf_louis_position()' - Get the position of a page number.
+//
+// Takes the same values as the paginator, "None" turns the number off.
+
+static const char *                     // O - "top", "bottom" or `NULL` for none
+brf_louis_position(const char *value,   // I - Option value or `NULL`
+                   const char *defpos)  // I - Default position
+{
+  if (!value || !*value)
+    return (defpos);
+  else if (!strcasecmp(value, "TopMargin") || !strcasecmp(value, "top"))
+    return ("top");
+  else if (!strcasecmp(value, "BottomMargin") || !strcasecmp(value, "bottom"))
+    return ("bottom");
+  else if (!strcasecmp(value, "None") || !strcasecmp(value, "no") || !strcasecmp(value, "false"))
+    return (NULL);
+
+  return (defpos);
+}
+
+// 'brf_louis_prewarm()' - Compile the default tables of a printer.
+
+static void
+brf_louis_prewarm(pappl_printer_t *printer, // I - Printer
+                  void *data)               // I - Callback data (unused)
+{
+  static const char * const names[] =       // Table options
+  {
+    "LibLouis",
+    "LibLouis2",
+    "LibLouis3",
+    "LibLouis4"
+  };
+  size_t i;                                 // Looping var
+  ipp_t *driver_attrs = papplPrinterGetDriverAttributes(printer);
+                                            // Driver attributes
+  ipp_attribute_t *attr;                    // Default value
+  char name[64],                            // Attribute name
+      tables[1024];                         // Table list
+  int num_options = 0;                      // Number of options
+  cups_option_t *options = NULL;            // Options
+
+  (void)data;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i ++)
+  {
+    snprintf(name, sizeof(name), "%s-default", names[i]);
+
+    if ((attr = ippFindAttribute(driver_attrs, name, IPP_TAG_ZERO)) != NULL && ippGetString(attr, 0, NULL))
+      num_options = cupsAddOption(names[i], ippGetString(attr, 0, NULL), num_options, &options);
+  }
+
+  ippDelete(driver_attrs);
+
+  brf_LouisGetTables(num_options, options, tables, sizeof(tables));
+
+  if (brf_LouisAcquire(tables))
+  {
+    brf_LouisRelease(tables);
+    papplLogPrinter(printer, PAPPL_LOGLEVEL_DEBUG, "Preloaded translation tables '%s'.", tables);
+  }
+  else
+    papplLogPrinter(printer, PAPPL_LOGLEVEL_WARN, "Unable to compile translation tables '%s'.", tables);
+
+  cupsFreeOptions(num_options, options);
+}
+
+// 'brf_louis_resolve()' - Resolve a LibLouis* option value to a table name.
+
+static const char *                     // O - Table name or `NULL` for none
+brf_louis_resolve(const char *value,    // I - Option value
+                  bool hyphenation)     // I - Hyphenation table?
+{
+  if (!strcasecmp(value, "None") || !*value)
+    return (NULL);
+  else if (strcasecmp(value, "Locale") && strcasecmp(value, "HyphLocale"))
+    return (value);
+  else if (hyphenation)
+    return (brf_louis_locale_hyph[0] ? brf_louis_locale_hyph : NULL);
+  else
+    return (brf_louis_locale_table);
+}
@@ -0,0 +1,398 @@
+//
+// Stage latency metrics for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include <pthread.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_METRICS_MAX_BUCKETS 18      // Maximum number of histogram buckets
+#define BRF_METRICS_MAX_FILTERS 16      // Maximum number of external filters
+#define BRF_METRICS_MAX_SERIES 512      // Maximum number of label combinations
+#define BRF_METRICS_RESOURCE "/metrics" // Metrics path of the web server
+
+// Local types...
+
+typedef struct brf_metrics_desc_s       // Metric description
+{
+  const char *name,                     // Metric name
+      *help,                            // Help text
+      *stage_label;                     // Name of the stage label or `NULL`
+  const double *buckets;                // Upper bounds of the buckets
+  int num_buckets;                      // Number of buckets
+} brf_metrics_desc_t;
+
+typedef struct brf_metrics_series_s     // Histogram of one label combination
+{
+  brf_metric_t metric;                  // Metric
+  char printer[128],                    // Printer name or ""
+      stage[64];                        // Stage name or ""
+  unsigned long counts[BRF_METRICS_MAX_BUCKETS + 1],
+                                        // Observations per bucket, then +Inf
+      count;                            // Number of observations
+  double sum;                           // Sum of observations
+} brf_metrics_series_t;
+
+typedef struct brf_metrics_shared_s     // Histograms shared with filters
+{
+  pthread_mutex_t mutex;                // Mutex for histograms
+  int num_series;                       // Number of histograms
+  brf_metrics_series_t series[BRF_METRICS_MAX_SERIES];
+                                        // Histograms
+} brf_metrics_shared_t;
+
+// Local globals...
+
+static const double brf_metrics_seconds[] =
+{                                       // Buckets for latencies
+  0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5,
+  1.0, 2.5, 5.0, 10.0, 30.0, 60.0, 120.0, 300.0, 600.0
+};
+static const double brf_metrics_rates[] =
+{                                       // Buckets for throughput
+  256.0, 1024.0, 4096.0, 16384.0, 65536.0, 262144.0, 1048576.0,
+  4194304.0, 16777216.0, 67108864.0
+};
+static const brf_metrics_desc_t brf_metrics_descs[] =
+{                                       // Metrics, in brf_metric_t order
+  { "brf_queue_wait_seconds", "Time jobs waited in the queue before processing.", NULL, brf_metrics_seconds, (int)(sizeof(brf_metrics_seconds) / sizeof(brf_metrics_seconds[0])) },
+  { "brf_mime_detect_seconds", "Time to detect the MIME media type of a document.", NULL, brf_metrics_seconds, (int)(sizeof(brf_metrics_seconds) / sizeof(brf_metrics_seconds[0])) },
+  { "brf_filter_seconds", "Wall time of each filter in the conversion chain.", "filter", brf_metrics_seconds, (int)(sizeof(brf_metrics_seconds) / sizeof(brf_metrics_seconds[0])) },
+  { "brf_first_byte_seconds", "Time from the start of a job to its first byte reaching the device.", NULL, brf_metrics_seconds, (int)(sizeof(brf_metrics_seconds) / sizeof(brf_metrics_seconds[0])) },
+  { "brf_device_bytes_per_second", "Throughput of the device writes of a job.", NULL, brf_metrics_rates, (int)(sizeof(brf_metrics_rates) / sizeof(brf_metrics_rates[0])) }
+};
+static brf_metrics_shared_t *brf_metrics_shared = NULL;
+                                        // Histograms
+
+// Local functions...
+
+static void brf_metrics_filters(pappl_client_t *client);
+static void brf_metrics_labels(const brf_metrics_series_t *series, char *buffer, size_t bufsize);
+static void brf_metrics_lock(void);
+static void brf_metrics_mime(pappl_client_t *client);
+static bool brf_metrics_web(pappl_client_t *client, void *data);
+
+// 'brf_MetricsInit()' - Serve the stage histograms in Prometheus format.
+//
+// The histograms are served as plain text on "/metrics" of the web server,
+// which is what Prometheus scrapes by default.
+
+bool                                    // O - `true` on success
+brf_MetricsInit(pappl_system_t *system) // I - System
+{
+  pthread_mutexattr_t mattr;            // Shared mutex attributes
+
+  // Filters and the print function observe from forked processes, so the
+  // histograms need to live in shared memory...
+  if ((brf_metrics_shared = (brf_metrics_shared_t *)brf_SharedAlloc(sizeof(brf_metrics_shared_t))) == NULL)
+    return (false);
+
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&brf_metrics_shared->mutex, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+
+  papplSystemAddResourceCallback(system, BRF_METRICS_RESOURCE, "text/plain", brf_metrics_web, NULL);
+
+  return (true);
+}
+
+// 'brf_MetricsObserve()' - Add an observation to a stage histogram.
+
+void
+brf_MetricsObserve(brf_metric_t metric, // I - Metric
+                   const char *printer, // I - Printer name or `NULL`
+                   const char *stage,   // I - Stage name or `NULL`
+                   double value)        // I - Observed value
+{
+  const brf_metrics_desc_t *desc;       // Metric description
+  brf_metrics_series_t *series;         // Histogram
+  int i;                                // Looping var
+
+  if (!brf_metrics_shared || metric < BRF_METRIC_QUEUE_WAIT || metric > BRF_METRIC_DEVICE_RATE)
+    return;
+
+  desc = brf_metrics_descs + metric;
+
+  if (!printer)
+    printer = "";
+  if (!stage || !desc->stage_label)
+    stage = "";
+
+  brf_metrics_lock();
+
+  for (i = 0, series = brf_metrics_shared->series; i < brf_metrics_shared->num_series; i ++, series ++)
+  {
+    if (series->metric == metric && !strcmp(series->printer, printer) && !strcmp(series->stage, stage))
+      break;
+  }
+
+  if (i >= brf_metrics_shared->num_series)
+  {
+    if (brf_metrics_shared->num_series >= BRF_METRICS_MAX_SERIES)
+    {
+      pthread_mutex_unlock(&brf_metrics_shared->mutex);
+      return;
+    }
+
+    series         = brf_metrics_shared->series + brf_metrics_shared->num_series ++;
+    series->metric = metric;
+    papplCopyString(series->printer, printer, sizeof(series->printer));
+    papplCopyString(series->stage, stage, sizeof(series->stage));
+  }
+
+  for (i = 0; i < desc->num_buckets && value > desc->buckets[i]; i ++);
+
+  series->counts[i] ++;
+  series->count ++;
+  series->sum += value;
+
+  pthread_mutex_unlock(&brf_metrics_shared->mutex);
+}
+
+// 'brf_metrics_filters()' - Send the run slot statistics of the external filters.
+
+static void
+brf_metrics_filters(
+    pappl_client_t *client)             // I - Client
+{
+  static const struct
+  {
+    const char *name,                   // Metric name
+        *type,                          // Metric type
+        *help;                          // Help text
+  } metrics[] =
+  {
+    { "brf_external_filter_slots", "gauge", "Run slots of an external filter." },
+    { "brf_external_filter_waiting", "gauge", "External filters waiting for a run slot." },
+    { "brf_external_filter_running", "gauge", "External filters running." },
+    { "brf_external_filter_runs_total", "counter", "Completed runs of an external filter." },
+    { "brf_external_filter_failures_total", "counter", "Runs of an external filter with a non-zero exit status." },
+    { "brf_external_filter_wait_seconds_total", "counter", "Time external filters waited for a run slot." },
+    { "brf_external_filter_run_seconds_total", "counter", "Time external filters ran." }
+  };
+  brf_launcher_stats_t stats[BRF_METRICS_MAX_FILTERS];
+                                        // Filter statistics
+  int num_stats,                        // Number of filters
+      i, j;                             // Looping vars
+  double value;                         // Metric value
+  char line[1024];                      // Output line
+
+  if ((num_stats = brf_LauncherGetStats(stats, BRF_METRICS_MAX_FILTERS)) == 0)
+    return;
+
+  for (i = 0; i < (int)(sizeof(metrics) / sizeof(metrics[0])); i ++)
+  {
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", metrics[i].name, metrics[i].help, metrics[i].name, metrics[i].type);
+    papplClientHTMLPuts(client, line);
+
+    for (j = 0; j < num_stats; j ++)
+    {
+      switch (i)
+      {
+        case 0 :
+            value = stats[j].limit;
+            break;
+        case 1 :
+            value = stats[j].waiting;
+            break;
+        case 2 :
+            value = stats[j].running;
+            break;
+        case 3 :
+            value = stats[j].runs;
+            break;
+        case 4 :
+            value = stats[j].failures;
+            break;
+        case 5 :
+            value = stats[j].wait_time;
+            break;
+        default :
+            value = stats[j].run_time;
+            break;
+      }
+
+      snprintf(line, sizeof(line), "%s{filter=\"%s\"} %.15g\n", metrics[i].name, stats[j].name, value);
+      papplClientHTMLPuts(client, line);
+    }
+  }
+}
+
+// 'brf_metrics_labels()' - Format the labels of a histogram.
+//
+// Label values are escaped as the exposition format requires.
+
+static void
+brf_metrics_labels(
+    const brf_metrics_series_t *series, // I - Histogram
+    char *buffer,                       // I - Label buffer
+    size_t bufsize)                     // I - Size of label buffer
+{
+  const char *values[2],                // Label values
+      *names[2],                        // Label names
+      *valptr;                          // Pointer into value
+  char *bufptr = buffer,                // Pointer into buffer
+      *bufend = buffer + bufsize - 4;   // End of buffer, leaving room for '",'
+  int i,                                // Looping var
+      num_labels = 0;                   // Number of labels
+
+  if (series->printer[0])
+  {
+    names[num_labels]     = "printer";
+    values[num_labels ++] = series->printer;
+  }
+
+  if (series->stage[0])
+  {
+    names[num_labels]     = brf_metrics_descs[series->metric].stage_label;
+    values[num_labels ++] = series->stage;
+  }
+
+  *bufptr = '\0';
+
+  for (i = 0; i < num_labels; i ++)
+  {
+    bufptr += snprintf(bufptr, (size_t)(bufend - bufptr), "%s%s=\"", i ? "," : "", names[i]);
+
+    for (valptr = values[i]; *valptr && bufptr < bufend - 1; valptr ++)
+    {
+      if (*valptr == '\\' || *valptr == '\"')
+        *bufptr++ = '\\';
+      else if (*valptr == '\n')
+      {
+        *bufptr++ = '\\';
+        *bufptr++ = 'n';
+        continue;
+      }
+
+      *bufptr++ = *valptr;
+    }
+
+    *bufptr++ = '\"';
+    *bufptr   = '\0';
+  }
+}
+
+// 'brf_metrics_lock()' - Lock the shared histograms.
+//
+// Recovers the mutex when its holder died.
+
+static void
+brf_metrics_lock(void)
+{
+  if (pthread_mutex_lock(&brf_metrics_shared->mutex) == EOWNERDEAD)
+    pthread_mutex_consistent(&brf_metrics_shared->mutex);
+}
+
+// 'brf_metrics_mime()' - Send the MIME type detection statistics.
+//
+// The detection times are in the "brf_mime_detect_seconds" histogram, this
+// adds how many documents the built-in signatures typed without libmagic.
+
+static void
+brf_metrics_mime(
+    pappl_client_t *client)             // I - Client
+{
+  brf_mime_stats_t stats;               // Detection statistics
+  char line[1024];                      // Output line
+
+  brf_MimeGetStats(&stats);
+
+  snprintf(line, sizeof(line), "# HELP brf_mime_sniffed_total Documents typed by the built-in signatures.\n# TYPE brf_mime_sniffed_total counter\nbrf_mime_sniffed_total %lu\n", stats.sniffed);
+  papplClientHTMLPuts(client, line);
+
+  snprintf(line, sizeof(line), "# HELP brf_mime_magic_total Documents typed by libmagic.\n# TYPE brf_mime_magic_total counter\nbrf_mime_magic_total %lu\n", stats.detections - stats.sniffed);
+  papplClientHTMLPuts(client, line);
+
+  snprintf(line, sizeof(line), "# HELP brf_mime_detect_max_seconds Slowest MIME media type detection.\n# TYPE brf_mime_detect_max_seconds gauge\nbrf_mime_detect_max_seconds %.6f\n", stats.max_time);
+  papplClientHTMLPuts(client, line);
+
+  snprintf(line, sizeof(line), "# HELP brf_mime_magic_handles Loaded libmagic handles.\n# TYPE brf_mime_magic_handles gauge\nbrf_mime_magic_handles %d\n", stats.num_handles);
+  papplClientHTMLPuts(client, line);
+}
+
+// 'brf_metrics_web()' - Send the histograms in Prometheus exposition format.
+//
+// The MIME type detection and external filter statistics follow the
+// histograms.
+
+static bool                             // O - `true` if handled
+brf_metrics_web(pappl_client_t *client, // I - Client
+                void *data)             // I - Callback data (unused)
+{
+  brf_metrics_shared_t *copy;           // Copy of the histograms
+  const brf_metrics_desc_t *desc;       // Metric description
+  const brf_metrics_series_t *series;   // Histogram
+  char labels[512],                     // Labels of histogram
+      line[1024];                       // Output line
+  unsigned long total;                  // Cumulative count
+  int i, j;                             // Looping vars
+  brf_metric_t metric;                  // Current metric
+
+  (void)data;
+
+  if (!brf_metrics_shared || (copy = (brf_metrics_shared_t *)malloc(sizeof(brf_metrics_shared_t))) == NULL)
+    return (false);
+
+  brf_metrics_lock();
+  memcpy(copy, brf_metrics_shared, sizeof(brf_metrics_shared_t));
+  pthread_mutex_unlock(&brf_metrics_shared->mutex);
+
+  if (!papplClientRespond(client, HTTP_STATUS_OK, NULL, "text/plain; version=0.0.4", 0, 0))
+  {
+    free(copy);
+    return (false);
+  }
+
+  for (metric = BRF_METRIC_QUEUE_WAIT; metric <= BRF_METRIC_DEVICE_RATE; metric ++)
+  {
+    desc = brf_metrics_descs + metric;
+
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n", desc->name, desc->help, desc->name);
+    papplClientHTMLPuts(client, line);
+
+    for (i = 0, series = copy->series; i < copy->num_series; i ++, series ++)
+    {
+      if (series->metric != metric)
+        continue;
+
+      brf_metrics_labels(series, labels, sizeof(labels));
+
+      for (j = 0, total = 0; j <= desc->num_buckets; j ++)
+      {
+        char le[32];                    // Upper bound of bucket
+
+        if (j < desc->num_buckets)
+          snprintf(le, sizeof(le), "%.15g", desc->buckets[j]);
+        else
+          papplCopyString(le, "+Inf", sizeof(le));
+
+        total += series->counts[j];
+        snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%s\"} %lu\n", desc->name, labels, labels[0] ? "," : "", le, total);
+        papplClientHTMLPuts(client, line);
+      }
+
+      if (labels[0])
+        snprintf(line, sizeof(line), "%s_sum{%s} %.6f\n%s_count{%s} %lu\n", desc->name, labels, series->sum, desc->name, labels, series->count);
+      else
+        snprintf(line, sizeof(line), "%s_sum %.6f\n%s_count %lu\n", desc->name, series->sum, desc->name, series->count);
+      papplClientHTMLPuts(client, line);
+    }
+  }
+
+  free(copy);
+
+  brf_metrics_mime(client);
+  brf_metrics_filters(client);
+
+  return (true);
+}
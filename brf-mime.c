@@ -0,0 +1,580 @@
+//
+// MIME type detection for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <strings.h>
+#include <magic.h>
+
+#include "brf-printer.h"
+
+// Local types...
+
+typedef struct brf_mime_handle_s // Loaded libmagic handle
+{
+  struct brf_mime_handle_s *next; // Next free handle
+  magic_t magic;                  // libmagic cookie
+} brf_mime_handle_t;
+
+typedef bool (*brf_mime_sniff_cb_t)(const unsigned char *header, size_t headersize);
+                                  // Signature test callback
+
+typedef struct brf_mime_sniffer_s // Built-in signature
+{
+  const char *mime_type;          // MIME media type
+  const char *magic;              // Leading bytes or `NULL`
+  size_t magiclen;                // Length of leading bytes
+  brf_mime_sniff_cb_t cb;         // Test callback or `NULL`
+} brf_mime_sniffer_t;
+
+// Local functions...
+
+static brf_mime_handle_t *brf_mime_acquire(void);
+static const char *brf_mime_intern(const char *mime_type);
+static bool brf_mime_is_bmp(const unsigned char *header, size_t headersize);
+static bool brf_mime_is_brf(const unsigned char *header, size_t headersize);
+static bool brf_mime_is_html(const unsigned char *header, size_t headersize);
+static bool brf_mime_is_pbm(const unsigned char *header, size_t headersize);
+static bool brf_mime_is_pgm(const unsigned char *header, size_t headersize);
+static bool brf_mime_is_ppm(const unsigned char *header, size_t headersize);
+static bool brf_mime_is_svg(const unsigned char *header, size_t headersize);
+static bool brf_mime_is_text(const unsigned char *header, size_t headersize);
+static bool brf_mime_is_ubrl(const unsigned char *header, size_t headersize);
+static brf_mime_handle_t *brf_mime_load(void);
+static void brf_mime_release(brf_mime_handle_t *handle);
+static size_t brf_mime_utf8_length(const unsigned char *ptr, const unsigned char *end);
+
+// Local globals...
+
+static const brf_mime_sniffer_t brf_mime_sniffers[] =
+{                                       // Built-in signatures, most specific first
+  { "application/pdf", "%PDF-", 5, NULL },
+  { "image/png", "\211PNG\r\n\032\n", 8, NULL },
+  { "image/jpeg", "\377\330\377", 3, NULL },
+  { "image/gif", "GIF87a", 6, NULL },
+  { "image/gif", "GIF89a", 6, NULL },
+  { "image/tiff", "II*\0", 4, NULL },
+  { "image/tiff", "MM\0*", 4, NULL },
+  { "application/msword", "\320\317\021\340\241\261\032\341", 8, NULL },
+  { "text/rtf", "{\\rtf", 5, NULL },
+  { "image/x-ms-bmp", NULL, 0, brf_mime_is_bmp },
+  { "image/x-portable-bitmap", NULL, 0, brf_mime_is_pbm },
+  { "image/x-portable-graymap", NULL, 0, brf_mime_is_pgm },
+  { "image/x-portable-pixmap", NULL, 0, brf_mime_is_ppm },
+  { "application/vnd.cups-ubrl", NULL, 0, brf_mime_is_ubrl },
+  { "image/svg+xml", NULL, 0, brf_mime_is_svg },
+  { "text/html", NULL, 0, brf_mime_is_html },
+  { "application/xml", "<?xml", 5, NULL },
+  { "application/vnd.cups-brf", NULL, 0, brf_mime_is_brf },
+  { "text/plain", NULL, 0, brf_mime_is_text }
+};
+static bool brf_mime_enabled[sizeof(brf_mime_sniffers) / sizeof(brf_mime_sniffers[0])];
+                                        // Signatures for types we can convert
+
+static pthread_mutex_t brf_mime_mutex = PTHREAD_MUTEX_INITIALIZER;
+                                        // Mutex for handles, types and stats
+static pappl_system_t *brf_mime_system = NULL;
+                                        // System for logging
+static brf_mime_handle_t *brf_mime_free = NULL;
+                                        // Idle, loaded handles
+static cups_array_t *brf_mime_types = NULL;
+                                        // Interned MIME type strings
+static brf_mime_stats_t brf_mime_stats; // Detection statistics
+
+// 'brf_MimeInit()' - Load the magic database for MIME type detection.
+//
+// The database is parsed once here and the loaded handle is parked on a free
+// list.  Every detecting thread takes a handle from the list for the duration
+// of a single magic_buffer() call, so concurrent submissions each get their own
+// handle and additional handles are only loaded when more threads detect at
+// the same time than ever before.
+//
+// Built-in signatures are only enabled for the types that appear in the
+// conversion table, so the fast path never reports a type we cannot print.
+
+bool                                         // O - `true` on success, `false` on error
+brf_MimeInit(
+    pappl_system_t *system,                  // I - System
+    brf_spooling_conversion_t *conversions)  // I - Conversion table
+{
+  size_t i;                                  // Looping var
+  brf_spooling_conversion_t *conversion;     // Current conversion
+  brf_mime_handle_t *handle;                 // Initial handle
+
+  brf_mime_system = system;
+
+  for (i = 0; i < sizeof(brf_mime_sniffers) / sizeof(brf_mime_sniffers[0]); i ++)
+  {
+    for (conversion = conversions; conversion->srctype; conversion ++)
+    {
+      if (!strcmp(conversion->srctype, brf_mime_sniffers[i].mime_type) || !strcmp(conversion->dsttype, brf_mime_sniffers[i].mime_type))
+      {
+        brf_mime_enabled[i] = true;
+        break;
+      }
+    }
+
+    if (!brf_mime_enabled[i])
+      papplLog(system, PAPPL_LOGLEVEL_DEBUG, "No conversion for '%s', signature disabled.", brf_mime_sniffers[i].mime_type);
+  }
+
+  if ((handle = brf_mime_load()) == NULL)
+    return (false);
+
+  brf_mime_release(handle);
+
+  return (true);
+}
+
+// 'brf_MimeDetect()' - Detect the MIME media type of a document header.
+
+const char *                          // O - MIME media type or `NULL` if none
+brf_MimeDetect(
+    const unsigned char *header,      // I - Header data
+    size_t headersize)                // I - Size of header data
+{
+  brf_mime_handle_t *handle;          // libmagic handle
+  const char *mime_type = NULL;       // MIME media type
+  double start,                       // Start time
+      elapsed;                        // Detection time
+  unsigned long detections;           // Number of detections so far
+  bool sniffed = false;               // Typed by the built-in signatures?
+
+  start = brf_GetTime();
+
+  // Try the built-in signatures first, only falling back on libmagic for
+  // unknown inputs...
+  if ((mime_type = brf_MimeSniff(header, headersize)) == NULL)
+  {
+    if ((handle = brf_mime_acquire()) == NULL)
+      return (NULL);
+
+    if ((mime_type = magic_buffer(handle->magic, header, headersize)) == NULL)
+      papplLog(brf_mime_system, PAPPL_LOGLEVEL_ERROR, "Failed to determine MIME type: %s", magic_error(handle->magic));
+    else
+      mime_type = brf_mime_intern(mime_type);
+
+    brf_mime_release(handle);
+  }
+  else
+    sniffed = true;
+
+  elapsed = brf_GetTime() - start;
+
+  // Both counts change together so brf_MimeGetStats() never sees more
+  // sniffed documents than detections...
+  pthread_mutex_lock(&brf_mime_mutex);
+
+  if (sniffed)
+    brf_mime_stats.sniffed ++;
+
+  detections = ++brf_mime_stats.detections;
+  brf_mime_stats.last_time = elapsed;
+  brf_mime_stats.total_time += elapsed;
+  if (elapsed > brf_mime_stats.max_time)
+    brf_mime_stats.max_time = elapsed;
+
+  pthread_mutex_unlock(&brf_mime_mutex);
+
+  brf_MetricsObserve(BRF_METRIC_DETECT, NULL, NULL, elapsed);
+
+  papplLog(brf_mime_system, PAPPL_LOGLEVEL_DEBUG, "Detected MIME type '%s' in %.3fms (detection #%lu).", mime_type ? mime_type : "(null)", elapsed * 1000.0, detections);
+
+  return (mime_type);
+}
+
+// 'brf_MimeGetStats()' - Get a copy of the MIME detection statistics.
+
+void
+brf_MimeGetStats(brf_mime_stats_t *stats) // O - Statistics
+{
+  pthread_mutex_lock(&brf_mime_mutex);
+  *stats = brf_mime_stats;
+  pthread_mutex_unlock(&brf_mime_mutex);
+}
+
+// 'brf_MimeSniff()' - Match a document header against the built-in signatures.
+
+const char *                      // O - MIME media type or `NULL` if unknown
+brf_MimeSniff(
+    const unsigned char *header,  // I - Header data
+    size_t headersize)            // I - Size of header data
+{
+  size_t i;                       // Looping var
+  const brf_mime_sniffer_t *sniffer; // Current signature
+
+  for (i = 0, sniffer = brf_mime_sniffers; i < sizeof(brf_mime_sniffers) / sizeof(brf_mime_sniffers[0]); i ++, sniffer ++)
+  {
+    if (!brf_mime_enabled[i])
+      continue;
+
+    if (sniffer->magic)
+    {
+      if (headersize >= sniffer->magiclen && !memcmp(header, sniffer->magic, sniffer->magiclen))
+        return (sniffer->mime_type);
+    }
+    else if ((sniffer->cb)(header, headersize))
+      return (sniffer->mime_type);
+  }
+
+  return (NULL);
+}
+
+// 'brf_MimeShutdown()' - Close all libmagic handles.
+
+void
+brf_MimeShutdown(void)
+{
+  brf_mime_handle_t *handle; // Current handle
+
+  pthread_mutex_lock(&brf_mime_mutex);
+
+  while ((handle = brf_mime_free) != NULL)
+  {
+    brf_mime_free = handle->next;
+    magic_close(handle->magic);
+    free(handle);
+  }
+
+  brf_mime_stats.num_handles = 0;
+
+  pthread_mutex_unlock(&brf_mime_mutex);
+}
+
+// 'brf_mime_acquire()' - Take an idle handle or load a new one.
+
+static brf_mime_handle_t * // O - Handle or `NULL` on error
+brf_mime_acquire(void)
+{
+  brf_mime_handle_t *handle; // Handle
+
+  pthread_mutex_lock(&brf_mime_mutex);
+  if ((handle = brf_mime_free) != NULL)
+    brf_mime_free = handle->next;
+  pthread_mutex_unlock(&brf_mime_mutex);
+
+  if (!handle)
+    handle = brf_mime_load();
+
+  return (handle);
+}
+
+// 'brf_mime_intern()' - Return a persistent copy of a MIME type string.
+//
+// The string returned by magic_buffer() belongs to the handle and is
+// overwritten by the next call, so hand PAPPL a copy that lives as long as the
+// process.  The set of types libmagic reports is small and fixed.
+
+static const char *                 // O - Interned string
+brf_mime_intern(const char *mime_type) // I - MIME type from libmagic
+{
+  char *interned;                   // Interned string
+
+  pthread_mutex_lock(&brf_mime_mutex);
+
+  if (!brf_mime_types)
+    brf_mime_types = cupsArrayNew((cups_array_func_t)strcmp, NULL);
+
+  if ((interned = (char *)cupsArrayFind(brf_mime_types, (void *)mime_type)) == NULL && (interned = strdup(mime_type)) != NULL)
+    cupsArrayAdd(brf_mime_types, interned);
+
+  pthread_mutex_unlock(&brf_mime_mutex);
+
+  return (interned);
+}
+
+// 'brf_mime_load()' - Open a handle and load the magic database into it.
+
+static brf_mime_handle_t * // O - Handle or `NULL` on error
+brf_mime_load(void)
+{
+  brf_mime_handle_t *handle; // Handle
+  double start;              // Start time
+
+  start = brf_GetTime();
+
+  if ((handle = (brf_mime_handle_t *)calloc(1, sizeof(brf_mime_handle_t))) == NULL)
+    return (NULL);
+
+  if ((handle->magic = magic_open(MAGIC_MIME_TYPE)) == NULL)
+  {
+    papplLog(brf_mime_system, PAPPL_LOGLEVEL_ERROR, "Failed to initialize libmagic.");
+    free(handle);
+    return (NULL);
+  }
+
+  if (magic_load(handle->magic, NULL) != 0)
+  {
+    papplLog(brf_mime_system, PAPPL_LOGLEVEL_ERROR, "Failed to load magic database: %s", magic_error(handle->magic));
+    magic_close(handle->magic);
+    free(handle);
+    return (NULL);
+  }
+
+  pthread_mutex_lock(&brf_mime_mutex);
+  brf_mime_stats.num_handles ++;
+  pthread_mutex_unlock(&brf_mime_mutex);
+
+  papplLog(brf_mime_system, PAPPL_LOGLEVEL_DEBUG, "Loaded magic database in %.3fms.", (brf_GetTime() - start) * 1000.0);
+
+  return (handle);
+}
+
+// 'brf_mime_release()' - Return a handle to the free list.
+
+static void
+brf_mime_release(brf_mime_handle_t *handle) // I - Handle
+{
+  pthread_mutex_lock(&brf_mime_mutex);
+  handle->next  = brf_mime_free;
+  brf_mime_free = handle;
+  pthread_mutex_unlock(&brf_mime_mutex);
+}
+
+// 'brf_mime_is_bmp()' - Check for a Windows bitmap.
+
+static bool                          // O - `true` on match
+brf_mime_is_bmp(
+    const unsigned char *header,     // I - Header data
+    size_t headersize)               // I - Size of header data
+{
+  // "BM" is common at the start of text, so also check the reserved words
+  // and the size of the info header...
+  return (headersize >= 18 && header[0] == 'B' && header[1] == 'M' && !header[6] && !header[7] && !header[8] && !header[9] && (header[14] == 12 || header[14] == 40 || header[14] == 108 || header[14] == 124) && !header[15] && !header[16] && !header[17]);
+}
+
+// 'brf_mime_is_brf()' - Check for braille ASCII (BRF) text.
+//
+// BRF only uses the 64 braille ASCII characters plus line and page breaks.
+// Upper-case prose and program text can have the same shape, so BRF needs at
+// least two lines within the width of an embosser and characters that are
+// rare in prose but common in braille ASCII: at least 4 of them and one for
+// every 50 letters.  Anything weaker is left to libmagic.
+
+static bool                          // O - `true` on match
+brf_mime_is_brf(
+    const unsigned char *header,     // I - Header data
+    size_t headersize)               // I - Size of header data
+{
+  const unsigned char *ptr,          // Pointer into header
+      *end = header + headersize;    // End of header
+  int column = 0,                    // Current column
+      lines = 0;                     // Line and page breaks
+  size_t braille = 0,                // Braille-only characters
+      letters = 0;                   // Letters
+
+  if (headersize < 2 || ((header[0] == '%' || header[0] == '#') && header[1] == '!'))
+    return (false);
+
+  for (ptr = header; ptr < end; ptr ++)
+  {
+    if (*ptr == '\n' || *ptr == '\f')
+    {
+      column = 0;
+      lines ++;
+      continue;
+    }
+    else if (*ptr == '\r')
+    {
+      column = 0;
+      continue;
+    }
+    else if (*ptr < ' ' || *ptr > '_' || ++ column > 60)
+      return (false);
+
+    if (strchr("@^_[]\\#", *ptr))
+      braille ++;
+    else if (isupper(*ptr))
+      letters ++;
+  }
+
+  return (lines >= 2 && braille >= 4 && braille * 50 >= letters);
+}
+
+// 'brf_mime_is_html()' - Check for HTML.
+
+static bool                          // O - `true` on match
+brf_mime_is_html(
+    const unsigned char *header,     // I - Header data
+    size_t headersize)               // I - Size of header data
+{
+  const unsigned char *ptr,          // Pointer into header
+      *end = header + headersize;    // End of header
+
+  ptr = header;
+  if (headersize >= 3 && !memcmp(ptr, "\357\273\277", 3))
+    ptr += 3;                        // Skip UTF-8 BOM
+
+  while (ptr < end && isspace(*ptr))
+    ptr ++;
+
+  if ((size_t)(end - ptr) >= 14 && !strncasecmp((const char *)ptr, "<!doctype html", 14))
+    return (true);
+
+  return ((size_t)(end - ptr) >= 5 && !strncasecmp((const char *)ptr, "<html", 5));
+}
+
+// 'brf_mime_is_pbm()' - Check for a portable bitmap.
+
+static bool                          // O - `true` on match
+brf_mime_is_pbm(
+    const unsigned char *header,     // I - Header data
+    size_t headersize)               // I - Size of header data
+{
+  return (headersize >= 3 && header[0] == 'P' && (header[1] == '1' || header[1] == '4') && isspace(header[2]));
+}
+
+// 'brf_mime_is_pgm()' - Check for a portable graymap.
+
+static bool                          // O - `true` on match
+brf_mime_is_pgm(
+    const unsigned char *header,     // I - Header data
+    size_t headersize)               // I - Size of header data
+{
+  return (headersize >= 3 && header[0] == 'P' && (header[1] == '2' || header[1] == '5') && isspace(header[2]));
+}
+
+// 'brf_mime_is_ppm()' - Check for a portable pixmap.
+
+static bool                          // O - `true` on match
+brf_mime_is_ppm(
+    const unsigned char *header,     // I - Header data
+    size_t headersize)               // I - Size of header data
+{
+  return (headersize >= 3 && header[0] == 'P' && (header[1] == '3' || header[1] == '6') && isspace(header[2]));
+}
+
+// 'brf_mime_is_svg()' - Check for an SVG drawing.
+
+static bool                          // O - `true` on match
+brf_mime_is_svg(
+    const unsigned char *header,     // I - Header data
+    size_t headersize)               // I - Size of header data
+{
+  const unsigned char *ptr,          // Pointer into header
+      *end = header + headersize;    // End of header
+
+  for (ptr = header; ptr < end && isspace(*ptr); ptr ++);
+
+  if ((size_t)(end - ptr) >= 4 && !memcmp(ptr, "<svg", 4))
+    return (true);
+
+  if ((size_t)(end - ptr) < 5 || memcmp(ptr, "<?xml", 5))
+    return (false);
+
+  // XML prolog, look for the root element in the rest of the header...
+  return (memmem(ptr, (size_t)(end - ptr), "<svg", 4) != NULL);
+}
+
+// 'brf_mime_is_text()' - Check for plain UTF-8 text.
+//
+// Text that libmagic can tell apart is left to it: PostScript ("%!"),
+// scripts ("#!"), printer languages (escape codes), markup and JSON, and
+// upper-case-only text that might be BRF without enough braille characters.
+
+static bool                          // O - `true` on match
+brf_mime_is_text(
+    const unsigned char *header,     // I - Header data
+    size_t headersize)               // I - Size of header data
+{
+  const unsigned char *ptr,          // Pointer into header
+      *end = header + headersize;    // End of header
+  size_t len;                        // Length of UTF-8 sequence
+  bool braille_ascii = true;         // Only braille ASCII characters?
+
+  if (headersize == 0)
+    return (false);
+
+  if (headersize >= 2 && (header[0] == '%' || header[0] == '#') && header[1] == '!')
+    return (false);
+
+  for (ptr = header; ptr < end && isspace(*ptr); ptr ++);
+
+  if (ptr < end && strchr("<{[", *ptr))
+    return (false);
+
+  for (ptr = header; ptr < end; ptr += len)
+  {
+    if (!*ptr || (*ptr < ' ' && !strchr("\t\n\f\r", *ptr)))
+      return (false);
+    else if (*ptr == 0x7f)
+      return (false);
+
+    if ((len = brf_mime_utf8_length(ptr, end)) == 0)
+      return (false);
+
+    if (*ptr > '_' || *ptr == '\t')
+      braille_ascii = false;
+  }
+
+  return (!braille_ascii);
+}
+
+// 'brf_mime_is_ubrl()' - Check for Unicode braille (UBRL) text.
+
+static bool                          // O - `true` on match
+brf_mime_is_ubrl(
+    const unsigned char *header,     // I - Header data
+    size_t headersize)               // I - Size of header data
+{
+  const unsigned char *ptr,          // Pointer into header
+      *end = header + headersize;    // End of header
+  size_t len,                        // Length of UTF-8 sequence
+      cells = 0,                     // Braille pattern characters
+      others = 0;                    // Other printable characters
+
+  for (ptr = header; ptr < end; ptr += len)
+  {
+    if ((len = brf_mime_utf8_length(ptr, end)) == 0)
+      return (false);
+
+    // U+2800 to U+28FF are encoded as E2 A0 80 to E2 A3 BF...
+    if (len == 3 && ptr[0] == 0xe2 && ptr[1] >= 0xa0 && ptr[1] <= 0xa3)
+      cells ++;
+    else if (*ptr > ' ')
+      others ++;
+  }
+
+  return (cells > 0 && cells >= 4 * others);
+}
+
+// 'brf_mime_utf8_length()' - Get the length of a UTF-8 sequence.
+//
+// A sequence cut off by the end of the header is accepted since the header is
+// only the start of the document.
+
+static size_t                        // O - Length or 0 if invalid
+brf_mime_utf8_length(
+    const unsigned char *ptr,        // I - Start of sequence
+    const unsigned char *end)        // I - End of header
+{
+  size_t i,                          // Looping var
+      len;                           // Length of sequence
+
+  if (*ptr < 0x80)
+    return (1);
+  else if ((*ptr & 0xe0) == 0xc0)
+    len = 2;
+  else if ((*ptr & 0xf0) == 0xe0)
+    len = 3;
+  else if ((*ptr & 0xf8) == 0xf0)
+    len = 4;
+  else
+    return (0);
+
+  for (i = 1; i < len; i ++)
+  {
+    if (ptr + i >= end)
+      return ((size_t)(end - ptr));
+    else if ((ptr[i] & 0xc0) != 0x80)
+      return (0);
+  }
+
+  return (len);
+}
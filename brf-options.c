@@ -0,0 +1,325 @@
+//
+// Job option helpers for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include <limits.h>
+#include <pthread.h>
+
+#include "brf-printer.h"
+
+// Local types...
+
+typedef struct brf_options_snapshot_s   // Driver defaults of a printer
+{
+  int printer_id;                       // Printer ID
+  int num_options;                      // Number of defaults
+  cups_option_t *options;               // Defaults
+} brf_options_snapshot_t;
+
+// Local globals...
+
+static const char * const brf_options_names[] =
+{                                       // Options passed to the filters
+  "PageSize", "mirror", "fitplot", "SendFF", "SendSUB", "LibLouis",
+  "LibLouis2", "LibLouis3", "LibLouis4", "TextDotDistance", "TextDots",
+  "LineSpacing", "TopMargin", "BottomMargin", "LeftMargin", "RightMargin",
+  "BraillePageNumber", "PrintPageNumber", "PageSeparator",
+  "PageSeparatorNumber", "ContinuePages", "GraphicDotDistance", "Rotate",
+  "Edge", "Negate", "EdgeFactor", "CannyRadius", "CannySigma", "CannyLower",
+  "CannyUpper", "page-left", "page-right", "page-top", "page-bottom",
+  "VolumePages"
+};
+static pthread_rwlock_t brf_options_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+                                        // Lock for the snapshots
+static cups_array_t *brf_options_snapshots = NULL;
+                                        // Snapshots sorted by printer ID
+
+// Local functions...
+
+static int brf_options_compare(brf_options_snapshot_t *a, brf_options_snapshot_t *b, void *data);
+static brf_options_snapshot_t *brf_options_create(pappl_printer_t *printer);
+static void brf_options_delete(brf_options_snapshot_t *snapshot);
+static const char *brf_options_value(ipp_attribute_t *attr, char *buffer, size_t bufsize);
+
+// 'brf_GetBoolOption()' - Get a boolean vendor option.
+
+bool                                    // O - Option value
+brf_GetBoolOption(const char *name,     // I - Option name
+                  bool defvalue,        // I - Default value
+                  int num_options,      // I - Number of options
+                  cups_option_t *options) // I - Options
+{
+  const char *value = cupsGetOption(name, num_options, options);
+                                        // Option value
+
+  if (!value || !*value)
+    return (defvalue);
+
+  return (!strcasecmp(value, "true") || !strcasecmp(value, "yes") || !strcasecmp(value, "on") || !strcmp(value, "1"));
+}
+
+// 'brf_GetIntOption()' - Get an integer vendor option.
+
+int                                     // O - Option value
+brf_GetIntOption(const char *name,      // I - Option name
+                 int defvalue,          // I - Default value
+                 int num_options,       // I - Number of options
+                 cups_option_t *options) // I - Options
+{
+  const char *value = cupsGetOption(name, num_options, options);
+                                        // Option value
+  char *end;                            // End of number
+  long number;                          // Number
+
+  if (!value || !*value)
+    return (defvalue);
+
+  number = strtol(value, &end, 10);
+  if (*end || number < INT_MIN || number > INT_MAX)
+    return (defvalue);
+
+  return ((int)number);
+}
+
+// 'brf_GetGeometry()' - Compute the braille page geometry for a job.
+//
+// Dimensions are in hundredths of millimeters like PWG media sizes.  The
+// physical page margins come from the CUPS "page-left" etc. options (points)
+// and the braille margins from "TopMargin" etc. (blank cells or lines).  A
+// braille cell is 2.4 times the dot distance wide, and a line is the height of
+// the cell plus "LineSpacing".
+
+void
+brf_GetGeometry(int num_options,          // I - Number of options
+                cups_option_t *options,   // I - Options
+                brf_geometry_t *geometry) // O - Page geometry
+{
+  const char *value;                      // Option value
+  pwg_media_t *pwg = NULL;                // Media size
+  int width = 21000,                      // Page width (A4)
+      length = 29700,                     // Page length (A4)
+      dot_distance,                       // Text dot distance
+      cell_width,                         // Width of a cell
+      line_height;                        // Height of a line
+
+  if ((value = cupsGetOption("PageSize", num_options, options)) != NULL)
+    pwg = pwgMediaForPPD(value);
+  if (!pwg && (value = cupsGetOption("media", num_options, options)) != NULL)
+    pwg = pwgMediaForPWG(value);
+
+  if (pwg)
+  {
+    width  = pwg->width;
+    length = pwg->length;
+  }
+
+  width  -= (brf_GetIntOption("page-left", 0, num_options, options) + brf_GetIntOption("page-right", 0, num_options, options)) * 2540 / 72;
+  length -= (brf_GetIntOption("page-top", 0, num_options, options) + brf_GetIntOption("page-bottom", 0, num_options, options)) * 2540 / 72;
+
+  geometry->dots = brf_GetIntOption("TextDots", 6, num_options, options) == 8 ? 8 : 6;
+
+  if ((dot_distance = brf_GetIntOption("TextDotDistance", 250, num_options, options)) <= 0)
+    dot_distance = 250;
+
+  cell_width  = dot_distance * 12 / 5;
+  line_height = dot_distance * (geometry->dots == 8 ? 3 : 2) + brf_GetIntOption("LineSpacing", 500, num_options, options);
+  if (line_height <= 0)
+    line_height = 1000;
+
+  geometry->cell_width  = cell_width;
+  geometry->line_height = line_height;
+
+  geometry->top_margin    = brf_GetIntOption("TopMargin", 0, num_options, options);
+  geometry->bottom_margin = brf_GetIntOption("BottomMargin", 0, num_options, options);
+  geometry->left_margin   = brf_GetIntOption("LeftMargin", 0, num_options, options);
+  geometry->right_margin  = brf_GetIntOption("RightMargin", 0, num_options, options);
+
+  if (geometry->top_margin < 0)
+    geometry->top_margin = 0;
+  if (geometry->bottom_margin < 0)
+    geometry->bottom_margin = 0;
+  if (geometry->left_margin < 0)
+    geometry->left_margin = 0;
+  if (geometry->right_margin < 0)
+    geometry->right_margin = 0;
+
+  geometry->cells_per_line = width / cell_width - geometry->left_margin - geometry->right_margin;
+  geometry->lines_per_page = length / line_height - geometry->top_margin - geometry->bottom_margin;
+
+  // Never produce an unusable page, whatever the options say...
+  if (geometry->cells_per_line < 10)
+    geometry->cells_per_line = 10;
+  if (geometry->lines_per_page < 4)
+    geometry->lines_per_page = 4;
+}
+
+// 'brf_GetJobOptions()' - Add the filter options of a job.
+//
+// The driver defaults come from a snapshot of the printer that is made on
+// first use and kept until brf_InvalidateJobOptions() is called for it, so a
+// job only has to look up the attributes it supplied itself.
+
+int                                     // O  - Number of options
+brf_GetJobOptions(pappl_job_t *job,     // I  - Job
+                  int num_options,      // I  - Number of options
+                  cups_option_t **options) // IO - Options
+{
+  pappl_printer_t *printer = papplJobGetPrinter(job);
+                                        // Printer
+  brf_options_snapshot_t key,           // Search key
+      *snapshot,                        // Driver defaults
+      *created;                         // New snapshot
+  ipp_attribute_t *attr;                // Job attribute
+  const char *value;                    // Option value
+  char buffer[1024];                    // Value buffer
+  size_t i;                             // Looping var
+
+  key.printer_id = papplPrinterGetID(printer);
+
+  pthread_rwlock_rdlock(&brf_options_rwlock);
+
+  while ((snapshot = (brf_options_snapshot_t *)cupsArrayFind(brf_options_snapshots, &key)) == NULL)
+  {
+    // Compile the defaults outside of the lock, a concurrent job of the same
+    // printer may win the race but makes the same snapshot
+    pthread_rwlock_unlock(&brf_options_rwlock);
+
+    created = brf_options_create(printer);
+
+    pthread_rwlock_wrlock(&brf_options_rwlock);
+
+    if (!brf_options_snapshots)
+      brf_options_snapshots = cupsArrayNew((cups_array_func_t)brf_options_compare, NULL);
+
+    if (!created || cupsArrayFind(brf_options_snapshots, &key) || !cupsArrayAdd(brf_options_snapshots, created))
+      brf_options_delete(created);
+
+    if (!created)
+      break;
+  }
+
+  for (i = 0; i < sizeof(brf_options_names) / sizeof(brf_options_names[0]); i ++)
+  {
+    if ((attr = papplJobGetAttribute(job, brf_options_names[i])) != NULL)
+      value = brf_options_value(attr, buffer, sizeof(buffer));
+    else if (snapshot)
+      value = cupsGetOption(brf_options_names[i], snapshot->num_options, snapshot->options);
+    else
+      value = NULL;
+
+    if (value)
+      num_options = cupsAddOption(brf_options_names[i], value, num_options, options);
+  }
+
+  pthread_rwlock_unlock(&brf_options_rwlock);
+
+  return (num_options);
+}
+
+// 'brf_InvalidateJobOptions()' - Discard the snapshot of a printer's defaults.
+
+void
+brf_InvalidateJobOptions(
+    pappl_printer_t *printer)           // I - Printer
+{
+  brf_options_snapshot_t key,           // Search key
+      *snapshot;                        // Snapshot
+
+  key.printer_id = papplPrinterGetID(printer);
+
+  pthread_rwlock_wrlock(&brf_options_rwlock);
+
+  if ((snapshot = (brf_options_snapshot_t *)cupsArrayFind(brf_options_snapshots, &key)) != NULL)
+  {
+    cupsArrayRemove(brf_options_snapshots, snapshot);
+    brf_options_delete(snapshot);
+  }
+
+  pthread_rwlock_unlock(&brf_options_rwlock);
+}
+
+// 'brf_options_compare()' - Compare two snapshots by printer ID.
+
+static int                              // O - Result of comparison
+brf_options_compare(
+    brf_options_snapshot_t *a,          // I - First snapshot
+    brf_options_snapshot_t *b,          // I - Second snapshot
+    void *data)                         // I - Callback data (unused)
+{
+  (void)data;
+
+  return (a->printer_id - b->printer_id);
+}
+
+// 'brf_options_create()' - Compile the driver defaults of a printer.
+
+static brf_options_snapshot_t *         // O - Snapshot or `NULL` on error
+brf_options_create(
+    pappl_printer_t *printer)           // I - Printer
+{
+  brf_options_snapshot_t *snapshot;     // Snapshot
+  ipp_t *driver_attrs;                  // Driver attributes
+  ipp_attribute_t *attr;                // Default attribute
+  const char *value;                    // Default value
+  char name[256],                       // Attribute name
+      buffer[1024];                     // Value buffer
+  size_t i;                             // Looping var
+
+  if ((snapshot = (brf_options_snapshot_t *)calloc(1, sizeof(brf_options_snapshot_t))) == NULL)
+    return (NULL);
+
+  snapshot->printer_id = papplPrinterGetID(printer);
+
+  driver_attrs = papplPrinterGetDriverAttributes(printer);
+
+  for (i = 0; i < sizeof(brf_options_names) / sizeof(brf_options_names[0]); i ++)
+  {
+    snprintf(name, sizeof(name), "%s-default", brf_options_names[i]);
+
+    if ((attr = ippFindAttribute(driver_attrs, name, IPP_TAG_ZERO)) != NULL && (value = brf_options_value(attr, buffer, sizeof(buffer))) != NULL)
+      snapshot->num_options = cupsAddOption(brf_options_names[i], value, snapshot->num_options, &snapshot->options);
+  }
+
+  ippDelete(driver_attrs);
+
+  return (snapshot);
+}
+
+// 'brf_options_delete()' - Free a snapshot.
+
+static void
+brf_options_delete(
+    brf_options_snapshot_t *snapshot)   // I - Snapshot
+{
+  if (!snapshot)
+    return;
+
+  cupsFreeOptions(snapshot->num_options, snapshot->options);
+  free(snapshot);
+}
+
+// 'brf_options_value()' - Get the option value of an attribute.
+
+static const char *                     // O - Value or `NULL` for none
+brf_options_value(ipp_attribute_t *attr,// I - Attribute
+                  char *buffer,         // I - Value buffer
+                  size_t bufsize)       // I - Size of value buffer
+{
+  switch (ippGetValueTag(attr))
+  {
+    case IPP_TAG_INTEGER :
+        snprintf(buffer, bufsize, "%d", ippGetInteger(attr, 0));
+        return (buffer);
+
+    case IPP_TAG_BOOLEAN :
+        return (ippGetBoolean(attr, 0) ? "True" : "False");
+
+    default :
+        return (ippGetString(attr, 0, NULL));
+  }
+}
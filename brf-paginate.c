@@ -0,0 +1,712 @@
+//
+// In-process pagination of braille documents for the Braille Printer
+// Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_PAGINATE_BUFSIZE 65536      // Size of input and output buffers
+#define BRF_PAGINATE_MAX_CELLS 1024     // Maximum cells per line
+
+// Local types...
+
+typedef enum brf_paginate_pos_e         // Position of a page number
+{
+  BRF_PAGINATE_NONE,                    // Not printed
+  BRF_PAGINATE_TOP,                     // Right end of the first line
+  BRF_PAGINATE_BOTTOM                   // Right end of the last line
+} brf_paginate_pos_t;
+
+typedef struct brf_paginate_s           // Paginator state
+{
+  cf_filter_data_t *data;               // Job and printer data
+  int outputfd;                         // Output file descriptor
+  bool ubrl,                            // Unicode braille?
+      error;                            // Did a write fail?
+  brf_geometry_t geometry;              // Page geometry
+  int body_lines;                       // Text lines per braille page
+  brf_paginate_pos_t braille_pos,       // Braille page number position
+      print_pos;                        // Print page number position
+  bool separator,                       // Mark print page breaks?
+      separator_number,                 // Number the marks?
+      continue_pages;                   // Continue braille pages over print page breaks?
+  int braille_page,                     // Current braille page number
+      print_page,                       // Current print page number
+      first_print_page;                 // Print page at the start of the braille page
+  bool page_open;                       // Has the braille page been started?
+  int page_breaks;                      // Print page breaks before the next line
+  int page_lines;                       // Text lines on the braille page
+  char line[BRF_PAGINATE_MAX_CELLS * 4];// Current line
+  size_t linelen;                       // Bytes in current line
+  int linecells;                        // Cells in current line
+  char output[BRF_PAGINATE_BUFSIZE];    // Output buffer
+  size_t outlen;                        // Bytes in output buffer
+} brf_paginate_t;
+
+struct brf_paginator_s                  // Paginator thread of a job
+{
+  pappl_job_t *job;                     // Job
+  int inputfd,                          // Document
+      pipefds[2];                       // Paginated document
+  cups_option_t *options;               // Job options
+  cf_filter_data_t data;                // Job data for the paginator
+  pthread_t thread;                     // Paginator thread
+  atomic_bool stop;                     // Stop paginating?
+  int status;                           // Exit status of the paginator
+};
+
+// Local globals...
+
+static const unsigned char brf_paginate_digits[10] =
+{                                       // Dot patterns of the digits J, A-I
+  0x1a, 0x01, 0x03, 0x09, 0x19, 0x11, 0x0b, 0x1b, 0x13, 0x0a
+};
+
+// Local functions...
+
+static void brf_paginate_add(brf_paginate_t *pg, unsigned char ch);
+static int brf_paginate_canceled(void *data);
+static void brf_paginate_end_line(brf_paginate_t *pg);
+static void brf_paginate_end_page(brf_paginate_t *pg);
+static void brf_paginate_flush(brf_paginate_t *pg);
+static bool brf_paginate_is_blank(const char *cell, size_t len);
+static void brf_paginate_log(void *data, cf_loglevel_t level, const char *message, ...);
+static int brf_paginate_number(char *buffer, int number);
+static void brf_paginate_number_line(brf_paginate_t *pg, brf_paginate_pos_t pos);
+static brf_paginate_pos_t brf_paginate_position(const char *value, brf_paginate_pos_t defpos);
+static void brf_paginate_put(brf_paginate_t *pg, const char *data, size_t len);
+static void brf_paginate_put_cells(brf_paginate_t *pg, const char *cells, int count);
+static void *brf_paginate_run(brf_paginator_t *paginator);
+static void brf_paginate_separator(brf_paginate_t *pg);
+static void brf_paginate_start_page(brf_paginate_t *pg);
+static void brf_paginate_write_line(brf_paginate_t *pg, const char *line, size_t len);
+
+// 'brf_PaginateFilter()' - Format a braille document into embosser pages.
+//
+// This replaces the external brftopagedbrf filter.  Lines ("\n") and print
+// pages ("\f") of BRF or UBRL ("parameters" is BRF_PAGINATE_UBRL) are laid
+// out on braille pages of the job's page geometry in a single pass with
+// constant memory: long lines are wrapped at the last blank, print page
+// breaks start a new braille page or, with "ContinuePages", are marked with
+// a separator line ("PageSeparator", numbered with "PageSeparatorNumber"),
+// and the braille and print page numbers are placed on the first or last
+// line ("BraillePageNumber" and "PrintPageNumber").  A "PAGE:" control
+// message is logged as each braille page is finished.
+
+int                                     // O - Exit status
+brf_PaginateFilter(
+    int inputfd,                        // I - Input file descriptor
+    int outputfd,                       // I - Output file descriptor
+    int inputseekable,                  // I - Is input seekable? (unused)
+    cf_filter_data_t *data,             // I - Job and printer data
+    void *parameters)                   // I - Input format
+{
+  cf_logfunc_t log = data->logfunc;     // Log function
+  void *ld = data->logdata;             // Log function data
+  brf_paginate_t *pg;                   // Paginator state
+  unsigned char inbuf[BRF_PAGINATE_BUFSIZE];
+                                        // Input buffer
+  ssize_t bytes,                        // Bytes read
+      i;                                // Looping var
+  int ret = 1;                          // Exit status
+  double start = brf_GetTime();         // Start time
+
+  (void)inputseekable;
+
+  if ((pg = (brf_paginate_t *)calloc(1, sizeof(brf_paginate_t))) == NULL)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_PaginateFilter: Unable to allocate paginator.");
+    return (1);
+  }
+
+  pg->data     = data;
+  pg->outputfd = outputfd;
+  pg->ubrl     = parameters && !strcmp((const char *)parameters, BRF_PAGINATE_UBRL);
+
+  brf_GetGeometry(data->num_options, data->options, &pg->geometry);
+
+  if (pg->geometry.cells_per_line > BRF_PAGINATE_MAX_CELLS)
+    pg->geometry.cells_per_line = BRF_PAGINATE_MAX_CELLS;
+
+  pg->braille_pos      = brf_paginate_position(cupsGetOption("BraillePageNumber", data->num_options, data->options), BRF_PAGINATE_BOTTOM);
+  pg->print_pos        = brf_paginate_position(cupsGetOption("PrintPageNumber", data->num_options, data->options), BRF_PAGINATE_TOP);
+  pg->separator        = brf_GetBoolOption("PageSeparator", true, data->num_options, data->options);
+  pg->separator_number = brf_GetBoolOption("PageSeparatorNumber", true, data->num_options, data->options);
+  pg->continue_pages   = brf_GetBoolOption("ContinuePages", true, data->num_options, data->options);
+  pg->braille_page     = 1;
+  pg->print_page       = 1;
+
+  // Page numbers take a line of their own...
+  pg->body_lines = pg->geometry.lines_per_page;
+  if (pg->braille_pos == BRF_PAGINATE_TOP || pg->print_pos == BRF_PAGINATE_TOP)
+    pg->body_lines --;
+  if (pg->braille_pos == BRF_PAGINATE_BOTTOM || pg->print_pos == BRF_PAGINATE_BOTTOM)
+    pg->body_lines --;
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_PaginateFilter: Formatting %s for %dx%d cells, %d text lines per page.", pg->ubrl ? "UBRL" : "BRF", pg->geometry.cells_per_line, pg->geometry.lines_per_page, pg->body_lines);
+
+  while ((bytes = read(inputfd, inbuf, sizeof(inbuf))) != 0)
+  {
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (log)
+        log(ld, CF_LOGLEVEL_ERROR, "brf_PaginateFilter: Unable to read input: %s", strerror(errno));
+      goto finish;
+    }
+
+    if (data->iscanceledfunc && (data->iscanceledfunc)(data->iscanceleddata))
+      goto finish;
+
+    for (i = 0; i < bytes; i ++)
+      brf_paginate_add(pg, inbuf[i]);
+
+    if (pg->error)
+      break;
+  }
+
+  if (pg->linelen > 0)
+    brf_paginate_end_line(pg);
+
+  if (pg->page_open)
+    brf_paginate_end_page(pg);
+
+  brf_paginate_flush(pg);
+
+  if (pg->error)
+  {
+    if (log)
+      log(ld, CF_LOGLEVEL_ERROR, "brf_PaginateFilter: Unable to write output: %s", strerror(errno));
+    goto finish;
+  }
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "brf_PaginateFilter: Wrote %d braille pages for %d print pages in %.3fs.", pg->braille_page - 1, pg->print_page, brf_GetTime() - start);
+
+  ret = 0;
+
+  finish:
+
+  free(pg);
+
+  return (ret);
+}
+
+// 'brf_PaginateFinish()' - Wait for the paginator of a job to finish.
+//
+// Closes the paginated document and the original one.  Output that was not
+// read is discarded, so the paginator never blocks on a full pipe.
+
+bool                                    // O - `true` if the whole document was paginated
+brf_PaginateFinish(
+    brf_paginator_t *paginator)         // I - Paginator
+{
+  char buffer[BRF_PAGINATE_BUFSIZE];    // Discarded output
+  ssize_t bytes;                        // Bytes read
+  int status;                           // Exit status of the paginator
+
+  atomic_store(&paginator->stop, true);
+
+  while ((bytes = read(paginator->pipefds[0], buffer, sizeof(buffer))) != 0)
+  {
+    if (bytes < 0 && errno != EINTR && errno != EAGAIN)
+      break;
+  }
+
+  pthread_join(paginator->thread, NULL);
+
+  status = paginator->status;
+
+  close(paginator->pipefds[0]);
+  close(paginator->inputfd);
+  cupsFreeOptions(paginator->data.num_options, paginator->options);
+  free(paginator);
+
+  return (status == 0);
+}
+
+// 'brf_PaginateStart()' - Start paginating the BRF document of a job.
+//
+// The pages are made in a thread and can be read from "pagedfd" as soon as
+// each one is finished, so the first page reaches the embosser while the rest
+// of the document is still laid out.  The paginator takes over "fd" unless
+// it fails to start.
+
+brf_paginator_t *                       // O - Paginator or `NULL` on error
+brf_PaginateStart(pappl_job_t *job,     // I - Job
+                  int fd,               // I - BRF document
+                  int *pagedfd)         // O - Paginated document
+{
+  brf_paginator_t *paginator;           // Paginator
+
+  if ((paginator = (brf_paginator_t *)calloc(1, sizeof(brf_paginator_t))) == NULL)
+    return (NULL);
+
+  if (pipe2(paginator->pipefds, O_CLOEXEC))
+  {
+    free(paginator);
+    return (NULL);
+  }
+
+  paginator->job     = job;
+  paginator->inputfd = fd;
+
+  paginator->data.printer        = (char *)papplPrinterGetName(papplJobGetPrinter(job));
+  paginator->data.job_id         = papplJobGetID(job);
+  paginator->data.num_options    = brf_GetJobOptions(job, 0, &paginator->options);
+  paginator->data.options        = paginator->options;
+  paginator->data.back_pipe[0]   = paginator->data.back_pipe[1] = -1;
+  paginator->data.side_pipe[0]   = paginator->data.side_pipe[1] = -1;
+  paginator->data.logfunc        = brf_paginate_log;
+  paginator->data.logdata        = job;
+  paginator->data.iscanceledfunc = brf_paginate_canceled;
+  paginator->data.iscanceleddata = paginator;
+
+  if (pthread_create(&paginator->thread, NULL, (void *(*)(void *))brf_paginate_run, paginator))
+  {
+    close(paginator->pipefds[0]);
+    close(paginator->pipefds[1]);
+    cupsFreeOptions(paginator->data.num_options, paginator->options);
+    free(paginator);
+    return (NULL);
+  }
+
+  *pagedfd = paginator->pipefds[0];
+
+  return (paginator);
+}
+
+// 'brf_paginate_add()' - Add a byte of input.
+//
+// UTF-8 continuation bytes stay with their cell, so a cell is never split
+// between two lines.
+
+static void
+brf_paginate_add(brf_paginate_t *pg,    // I - Paginator
+                 unsigned char ch)      // I - Input byte
+{
+  if (ch == '\n')
+  {
+    brf_paginate_end_line(pg);
+  }
+  else if (ch == '\f')
+  {
+    // Print page breaks take effect with the next line, so a document that
+    // ends with one gets no empty page...
+    if (pg->linelen > 0)
+      brf_paginate_end_line(pg);
+
+    pg->page_breaks ++;
+  }
+  else if (ch < ' ' || ch == 0x7f)
+  {
+    // Drop carriage returns and other control characters...
+    return;
+  }
+  else if (pg->ubrl && (ch & 0xc0) == 0x80)
+  {
+    if (pg->linelen < sizeof(pg->line))
+      pg->line[pg->linelen ++] = (char)ch;
+  }
+  else
+  {
+    if (pg->linecells >= pg->geometry.cells_per_line)
+    {
+      // Wrap the line at its last blank, or at the margin for long words...
+      char *ptr,                        // Pointer into line
+          *blank = NULL;                // Last blank
+      size_t len,                       // Length of cell
+          blanklen = 0;                 // Length of last blank
+      int cells = 0,                    // Cells before the pointer
+          blankcells = 0;               // Cells after the last blank
+
+      for (ptr = pg->line; ptr < pg->line + pg->linelen; ptr += len, cells ++)
+      {
+        for (len = 1; ptr + len < pg->line + pg->linelen && (ptr[len] & 0xc0) == 0x80 && pg->ubrl; len ++);
+
+        if (brf_paginate_is_blank(ptr, len))
+        {
+          blank      = ptr;
+          blanklen   = len;
+          blankcells = pg->linecells - cells - 1;
+        }
+      }
+
+      if (ch == ' ' || !blank)
+      {
+        brf_paginate_end_line(pg);
+      }
+      else
+      {
+        size_t offset = (size_t)(blank - pg->line);
+                                        // Offset of the last blank
+        size_t rest = pg->linelen - offset - blanklen;
+                                        // Bytes after the last blank
+
+        brf_paginate_write_line(pg, pg->line, offset);
+        memmove(pg->line, blank + blanklen, rest);
+        pg->linelen   = rest;
+        pg->linecells = blankcells;
+      }
+
+      if (ch == ' ')
+        return;
+    }
+
+    if (pg->linelen < sizeof(pg->line))
+    {
+      pg->line[pg->linelen ++] = (char)ch;
+      pg->linecells ++;
+    }
+  }
+}
+
+// 'brf_paginate_canceled()' - Check whether a paginator should stop.
+
+static int                              // O - 1 to stop, 0 to continue
+brf_paginate_canceled(void *data)       // I - Paginator
+{
+  brf_paginator_t *paginator = (brf_paginator_t *)data;
+                                        // Paginator
+
+  return (atomic_load(&paginator->stop) || brf_JobIsCanceled(paginator->job));
+}
+
+// 'brf_paginate_end_line()' - Write the current line.
+
+static void
+brf_paginate_end_line(brf_paginate_t *pg)// I - Paginator
+{
+  brf_paginate_write_line(pg, pg->line, pg->linelen);
+
+  pg->linelen   = 0;
+  pg->linecells = 0;
+}
+
+// 'brf_paginate_end_page()' - Finish the current braille page.
+
+static void
+brf_paginate_end_page(brf_paginate_t *pg)// I - Paginator
+{
+  cf_logfunc_t log = pg->data->logfunc; // Log function
+
+  if (pg->braille_pos == BRF_PAGINATE_BOTTOM || pg->print_pos == BRF_PAGINATE_BOTTOM)
+  {
+    for (; pg->page_lines < pg->body_lines; pg->page_lines ++)
+      brf_paginate_put(pg, "\n", 1);
+
+    brf_paginate_number_line(pg, BRF_PAGINATE_BOTTOM);
+  }
+
+  brf_paginate_put(pg, "\f", 1);
+  brf_paginate_flush(pg);
+
+  if (log)
+    log(pg->data->logdata, CF_LOGLEVEL_CONTROL, "PAGE: %d 1", pg->braille_page);
+
+  pg->page_open = false;
+  pg->braille_page ++;
+}
+
+// 'brf_paginate_flush()' - Write the output buffer.
+
+static void
+brf_paginate_flush(brf_paginate_t *pg)  // I - Paginator
+{
+  if (pg->outlen > 0 && !pg->error && brf_WriteAll(pg->outputfd, pg->output, pg->outlen) < 0)
+    pg->error = true;
+
+  pg->outlen = 0;
+}
+
+// 'brf_paginate_is_blank()' - Check whether a cell is blank.
+
+static bool                             // O - `true` if blank
+brf_paginate_is_blank(const char *cell, // I - Cell
+                      size_t len)       // I - Length of cell
+{
+  return ((len == 1 && *cell == ' ') || (len == 3 && !memcmp(cell, "\342\240\200", 3)));
+}
+
+// 'brf_paginate_log()' - Log a message of a paginator thread.
+//
+// "PAGE:" messages are dropped, the pages are counted as they are sent.
+
+static void
+brf_paginate_log(void *data,            // I - Job
+                 cf_loglevel_t level,   // I - Log level
+                 const char *message,   // I - Printf-style message
+                 ...)                   // I - Additional arguments as needed
+{
+  char buffer[1024];                    // Formatted message
+  va_list ap;                           // Argument pointer
+
+  if (level == CF_LOGLEVEL_CONTROL)
+    return;
+
+  va_start(ap, message);
+  vsnprintf(buffer, sizeof(buffer), message, ap);
+  va_end(ap);
+
+  papplLogJob((pappl_job_t *)data, (pappl_loglevel_t)level, "%s", buffer);
+}
+
+// 'brf_paginate_number()' - Format a page number as braille ASCII.
+//
+// The number sign is followed by the digits, written as the letters A to J.
+
+static int                              // O - Number of cells
+brf_paginate_number(char *buffer,       // O - Cells (at least 12)
+                    int number)         // I - Page number
+{
+  char digits[11];                      // Digits
+  int i, count;                         // Looping vars
+
+  count = snprintf(digits, sizeof(digits), "%d", number < 0 ? 0 : number);
+
+  buffer[0] = '#';
+  for (i = 0; i < count; i ++)
+    buffer[i + 1] = digits[i] == '0' ? 'J' : (char)('A' + digits[i] - '1');
+
+  return (count + 1);
+}
+
+// 'brf_paginate_number_line()' - Write the page number line at the top or bottom.
+//
+// Numbers are right-aligned, the print page number comes first when both
+// share the line.
+
+static void
+brf_paginate_number_line(
+    brf_paginate_t *pg,                 // I - Paginator
+    brf_paginate_pos_t pos)             // I - Line position
+{
+  char cells[32];                       // Number cells
+  int count = 0,                        // Number of cells
+      pad;                              // Blank cells before the numbers
+
+  if (pg->print_pos == pos)
+    count += brf_paginate_number(cells, pg->first_print_page);
+
+  if (pg->braille_pos == pos)
+  {
+    if (count > 0)
+      cells[count ++] = ' ';
+
+    count += brf_paginate_number(cells + count, pg->braille_page);
+  }
+
+  if ((pad = pg->geometry.left_margin + pg->geometry.cells_per_line - count) < pg->geometry.left_margin)
+    pad = pg->geometry.left_margin;
+
+  for (; pad > 0; pad --)
+    brf_paginate_put(pg, " ", 1);
+
+  brf_paginate_put_cells(pg, cells, count);
+  brf_paginate_put(pg, "\n", 1);
+}
+
+// 'brf_paginate_position()' - Get the position of a page number from an option.
+
+static brf_paginate_pos_t               // O - Position
+brf_paginate_position(
+    const char *value,                  // I - Option value or `NULL`
+    brf_paginate_pos_t defpos)          // I - Default position
+{
+  if (!value || !*value)
+    return (defpos);
+  else if (!strcasecmp(value, "TopMargin") || !strcasecmp(value, "top"))
+    return (BRF_PAGINATE_TOP);
+  else if (!strcasecmp(value, "BottomMargin") || !strcasecmp(value, "bottom"))
+    return (BRF_PAGINATE_BOTTOM);
+  else if (!strcasecmp(value, "None") || !strcasecmp(value, "no") || !strcasecmp(value, "false"))
+    return (BRF_PAGINATE_NONE);
+
+  return (defpos);
+}
+
+// 'brf_paginate_put()' - Add bytes to the output buffer.
+
+static void
+brf_paginate_put(brf_paginate_t *pg,    // I - Paginator
+                 const char *data,      // I - Bytes
+                 size_t len)            // I - Number of bytes
+{
+  if (pg->outlen + len > sizeof(pg->output))
+    brf_paginate_flush(pg);
+
+  memcpy(pg->output + pg->outlen, data, len);
+  pg->outlen += len;
+}
+
+// 'brf_paginate_put_cells()' - Add generated braille ASCII cells to the output.
+//
+// Page numbers and separators are generated as braille ASCII and converted to
+// Unicode braille patterns for UBRL.
+
+static void
+brf_paginate_put_cells(
+    brf_paginate_t *pg,                 // I - Paginator
+    const char *cells,                  // I - Cells ('#', '-', ' ' and 'A' to 'J')
+    int count)                          // I - Number of cells
+{
+  int i;                                // Looping var
+  unsigned pattern;                     // Dot pattern
+  char utf8[3];                         // UTF-8 of pattern
+
+  if (!pg->ubrl)
+  {
+    brf_paginate_put(pg, cells, (size_t)count);
+    return;
+  }
+
+  for (i = 0; i < count; i ++)
+  {
+    if (cells[i] == '#')
+      pattern = 0x3c;
+    else if (cells[i] == '-')
+      pattern = 0x24;
+    else if (cells[i] == 'J')
+      pattern = brf_paginate_digits[0];
+    else if (cells[i] >= 'A' && cells[i] <= 'I')
+      pattern = brf_paginate_digits[cells[i] - 'A' + 1];
+    else
+      pattern = 0;
+
+    utf8[0] = (char)0xe2;
+    utf8[1] = (char)(0xa0 | (pattern >> 6));
+    utf8[2] = (char)(0x80 | (pattern & 0x3f));
+
+    brf_paginate_put(pg, utf8, 3);
+  }
+}
+
+// 'brf_paginate_run()' - Paginate a document in a thread.
+
+static void *                           // O - Thread exit status (unused)
+brf_paginate_run(
+    brf_paginator_t *paginator)         // I - Paginator
+{
+  paginator->status = brf_PaginateFilter(paginator->inputfd, paginator->pipefds[1], 0, &paginator->data, NULL);
+
+  // End of the paginated document
+  close(paginator->pipefds[1]);
+
+  return (NULL);
+}
+
+// 'brf_paginate_separator()' - Mark a print page break inside a braille page.
+
+static void
+brf_paginate_separator(
+    brf_paginate_t *pg)                 // I - Paginator
+{
+  char cells[BRF_PAGINATE_MAX_CELLS];   // Separator cells
+  int i,                                // Looping var
+      count = pg->geometry.cells_per_line;
+                                        // Number of cells
+
+  memset(cells, '-', (size_t)count);
+
+  if (pg->separator_number)
+  {
+    char number[12];                    // Print page number
+    int numlen = brf_paginate_number(number, pg->print_page);
+                                        // Length of number
+
+    if (numlen < count)
+      memcpy(cells + count - numlen, number, (size_t)numlen);
+  }
+
+  for (i = 0; i < pg->geometry.left_margin; i ++)
+    brf_paginate_put(pg, " ", 1);
+
+  brf_paginate_put_cells(pg, cells, count);
+  brf_paginate_put(pg, "\n", 1);
+
+  pg->page_lines ++;
+}
+
+// 'brf_paginate_start_page()' - Start a new braille page.
+
+static void
+brf_paginate_start_page(
+    brf_paginate_t *pg)                 // I - Paginator
+{
+  int i;                                // Looping var
+
+  pg->page_open        = true;
+  pg->page_lines       = 0;
+  pg->first_print_page = pg->print_page;
+
+  for (i = 0; i < pg->geometry.top_margin; i ++)
+    brf_paginate_put(pg, "\n", 1);
+
+  if (pg->braille_pos == BRF_PAGINATE_TOP || pg->print_pos == BRF_PAGINATE_TOP)
+    brf_paginate_number_line(pg, BRF_PAGINATE_TOP);
+}
+
+// 'brf_paginate_write_line()' - Write a text line on the current braille page.
+//
+// Trailing blanks are not embossed.
+
+static void
+brf_paginate_write_line(
+    brf_paginate_t *pg,                 // I - Paginator
+    const char *line,                   // I - Line
+    size_t len)                         // I - Length of line
+{
+  int i;                                // Looping var
+
+  if (pg->page_breaks > 0)
+  {
+    pg->print_page  += pg->page_breaks;
+    pg->page_breaks = 0;
+
+    if (pg->page_open)
+    {
+      // The separator needs a line after it to be useful...
+      if (!pg->continue_pages || (pg->separator && pg->page_lines + 1 >= pg->body_lines))
+        brf_paginate_end_page(pg);
+      else if (pg->separator)
+        brf_paginate_separator(pg);
+    }
+  }
+
+  if (pg->page_open && pg->page_lines >= pg->body_lines)
+    brf_paginate_end_page(pg);
+
+  if (!pg->page_open)
+    brf_paginate_start_page(pg);
+
+  while (len > 0 && line[len - 1] == ' ')
+    len --;
+
+  if (len > 0)
+  {
+    for (i = 0; i < pg->geometry.left_margin; i ++)
+      brf_paginate_put(pg, " ", 1);
+
+    brf_paginate_put(pg, line, len);
+  }
+
+  brf_paginate_put(pg, "\n", 1);
+
+  pg->page_lines ++;
+}
@@ -0,0 +1,1057 @@
+//
+// Printer pools for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_POOL_DEVICE_URI "file:///dev/null"
+                                        // Device of a pool queue
+#define BRF_POOL_DELETED "deleted-pools"// Drivers whose pool queue was deleted
+#define BRF_POOL_INTERVAL 2             // Seconds between checks for new printers
+#define BRF_POOL_MAX 16                 // Maximum number of pools
+#define BRF_POOL_MAX_MEMBERS 64         // Maximum number of measured printers
+#define BRF_POOL_RATE 1024.0            // Assumed bytes/second before any
+                                        // printer of a pool was measured
+#define BRF_POOL_RESOURCE "/brf-pools"  // Pool page of the web interface
+#define BRF_POOL_SMOOTHING 0.3          // Weight of the latest job in the rate
+
+// Local types...
+
+typedef struct brf_pool_s               // Pool of printers with one driver
+{
+  char driver[64];                      // Driver name
+  int printer_id;                       // Pool queue
+  unsigned long forwarded;              // Jobs sent to members
+} brf_pool_t;
+
+typedef struct brf_pool_member_s        // Measured printer
+{
+  int printer_id;                       // Printer
+  double rate;                          // Smoothed bytes/second
+  unsigned long jobs,                   // Completed jobs
+      pool_jobs;                        // Jobs received from the pool
+} brf_pool_member_t;
+
+typedef struct brf_pool_load_s          // Load of one printer
+{
+  pappl_printer_t *printer;             // Printer
+  int jobs;                             // Active jobs
+  double backlog,                       // Bytes left in active jobs
+      rate,                             // Bytes/second
+      finish;                           // Seconds until the queue is empty
+} brf_pool_load_t;
+
+typedef struct brf_pool_volume_s        // Volume of a split job
+{
+  int first,                            // First page
+      last,                             // Last page
+      printer_id,                       // Member printing the volume
+      job_id;                           // Job on the member
+} brf_pool_volume_t;
+
+typedef struct brf_pool_scan_s          // Members of a pool
+{
+  brf_pool_t pool;                      // Pool
+  int num_loads;                        // Number of members
+  brf_pool_load_t loads[BRF_POOL_MAX_MEMBERS];
+                                        // Members
+} brf_pool_scan_t;
+
+// Local globals...
+
+static pthread_mutex_t brf_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+                                        // Mutex for pools and members
+static brf_pool_t brf_pool_pools[BRF_POOL_MAX];
+                                        // Pools
+static int brf_pool_num_pools = 0;      // Number of pools
+static brf_pool_member_t brf_pool_members[BRF_POOL_MAX_MEMBERS];
+                                        // Measured printers
+static int brf_pool_num_members = 0;    // Number of measured printers
+static char brf_pool_directory[1024] = "";
+                                        // Directory for forwarded documents
+static bool brf_pool_split = false;     // Can jobs be split into volumes?
+static bool brf_pool_changed = false;   // Were printers added or deleted?
+static char brf_pool_deleted[BRF_POOL_MAX][64];
+                                        // Drivers whose pool queue was deleted
+static int brf_pool_num_deleted = 0;    // Number of deleted pools
+
+// Local functions...
+
+static void brf_pool_backlog(pappl_job_t *job, void *data);
+static brf_pool_load_t *brf_pool_best(brf_pool_scan_t *scan, double size);
+static bool brf_pool_copy(const char *src, const char *dst);
+static void brf_pool_count(pappl_printer_t *printer, void *data);
+static brf_pool_t *brf_pool_find(int printer_id);
+static brf_pool_scan_t *brf_pool_get_scan(pappl_job_t *job);
+static void brf_pool_load_deleted(void);
+static brf_pool_member_t *brf_pool_member(int printer_id, bool create);
+static void brf_pool_save_deleted(void);
+static void brf_pool_scan(pappl_printer_t *printer, void *data);
+static void brf_pool_scan_pool(pappl_system_t *system, const brf_pool_t *pool, brf_pool_scan_t *scan);
+static pappl_job_t *brf_pool_submit(pappl_job_t *job, pappl_printer_t *printer, const char *format, const char *title, const char *filename);
+static bool brf_pool_timer(pappl_system_t *system, void *data);
+static void brf_pool_update(pappl_system_t *system);
+static bool brf_pool_web(pappl_client_t *client, void *data);
+
+// 'brf_PoolForward()' - Send a job of a pool queue to one of its printers.
+//
+// The job goes to the printer expected to empty its queue first, from the
+// bytes left in its active jobs and its measured throughput.  BRF documents
+// with a volume size are split into volumes instead.
+
+bool                                    // O - `true` on success
+brf_PoolForward(pappl_job_t *job)       // I - Job on a pool queue
+{
+  brf_pool_scan_t *scan;                // Members of pool
+  brf_pool_load_t *best;                // Member expected to finish first
+  pappl_job_t *member_job;              // Job on the member
+  const char *src = papplJobGetFilename(job),
+                                        // Job document
+      *ext;                             // Extension of document
+  char filename[1024];                  // Copy of the document
+  struct stat fileinfo;                 // Document information
+  bool ret = false;                     // Return value
+
+  if (brf_PoolGetVolumePages(job) > 0 && (!strcmp(papplJobGetFormat(job), "application/vnd.cups-brf") || !strcmp(papplJobGetFormat(job), BRF_PAGINATE_FORMAT)))
+  {
+    // Index the braille pages of the document like converted output
+    brf_spool_t *spool;                 // Spooled document
+    brf_paginator_t *paginator = NULL;  // Paginator of a raw document
+    int fd,                             // Document file
+        pagedfd;                        // Paginated document
+    char buffer[65536];                 // Copy buffer
+    ssize_t bytes;                      // Bytes read
+    bool spooled;                       // Was the document spooled?
+
+    if ((spool = brf_SpoolBegin(papplJobGetID(job), papplJobGetTimeCreated(job))) == NULL || (fd = open(src, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to spool the document for splitting: %s", strerror(errno));
+      if (spool)
+        brf_SpoolAbort(spool);
+      return (false);
+    }
+
+    if (!strcmp(papplJobGetFormat(job), BRF_PAGINATE_FORMAT))
+    {
+      spooled = brf_SpoolCopy(spool, fd);
+      close(fd);
+    }
+    else if ((paginator = brf_PaginateStart(job, fd, &pagedfd)) == NULL)
+    {
+      spooled = false;
+      close(fd);
+    }
+    else
+    {
+      // Volumes are cut at braille pages, so lay the document out first
+      spooled = true;
+
+      while ((bytes = read(pagedfd, buffer, sizeof(buffer))) != 0)
+      {
+        if (bytes < 0)
+        {
+          if (errno == EINTR || errno == EAGAIN)
+            continue;
+
+          spooled = false;
+          break;
+        }
+
+        if (!brf_SpoolWrite(spool, buffer, (size_t)bytes))
+        {
+          spooled = false;
+          break;
+        }
+      }
+
+      if (!brf_PaginateFinish(paginator))
+        spooled = false;
+    }
+
+    if (!spooled)
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to spool the document for splitting: %s", strerror(errno));
+      brf_SpoolAbort(spool);
+      return (false);
+    }
+
+    brf_SpoolFinish(spool);
+
+    return (brf_PoolSplit(job));
+  }
+
+  if ((scan = brf_pool_get_scan(job)) == NULL)
+    return (false);
+
+  if ((best = brf_pool_best(scan, (src && !stat(src, &fileinfo)) ? (double)fileinfo.st_size : 0.0)) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "No printer of pool '%s' accepts jobs.", papplPrinterGetName(papplJobGetPrinter(job)));
+    goto finish;
+  }
+
+  // PAPPL takes over the document of a new job, so hand it a copy
+  ext = src ? strrchr(src, '.') : NULL;
+  snprintf(filename, sizeof(filename), "%s/pool-%d%s", brf_pool_directory, papplJobGetID(job), ext ? ext : "");
+
+  if (!src || !brf_pool_copy(src, filename))
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to copy the document for '%s': %s", papplPrinterGetName(best->printer), strerror(errno));
+    goto finish;
+  }
+
+  if ((member_job = brf_pool_submit(job, best->printer, papplJobGetFormat(job), papplJobGetName(job), filename)) != NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Sent to '%s' as job %d, expected to finish in %.0fs (%d active jobs, %.0f bytes queued at %.0f bytes/s).", papplPrinterGetName(best->printer), papplJobGetID(member_job), best->finish, best->jobs, best->backlog, best->rate);
+    ret = true;
+  }
+
+  finish:
+
+  free(scan);
+
+  return (ret);
+}
+
+// 'brf_PoolGetVolumePages()' - Get the volume size of a job on a pool queue.
+
+int                                     // O - Pages per volume or 0 to not split
+brf_PoolGetVolumePages(pappl_job_t *job)// I - Job
+{
+  int num_options,                      // Number of job options
+      pages;                            // Pages per volume
+  cups_option_t *options = NULL;        // Job options
+  const char *val;                      // Option value
+
+  if (!brf_pool_split || !brf_PoolIsPool(papplJobGetPrinter(job)))
+    return (0);
+
+  num_options = brf_GetJobOptions(job, 0, &options);
+  pages       = (val = cupsGetOption("VolumePages", num_options, options)) != NULL ? atoi(val) : 0;
+
+  cupsFreeOptions(num_options, options);
+
+  return (pages > 0 ? pages : 0);
+}
+
+// 'brf_PoolInit()' - Create a pool queue for every driver with several printers.
+//
+// A pool queue "<driver>-pool" is created when two or more printers use the
+// same driver.  Jobs sent to it go to one of those printers.  Pools are
+// updated when printers are added or deleted later on, but a pool queue that
+// was deleted is not created again, also after a restart.  Splitting jobs
+// into volumes needs the page index of spooled job output.
+
+bool                                    // O - `true` on success
+brf_PoolInit(pappl_system_t *system,    // I - System
+             const char *spool_dir,     // I - Spool directory
+             bool split)                // I - Split jobs into volumes?
+{
+  papplCopyString(brf_pool_directory, spool_dir, sizeof(brf_pool_directory));
+  brf_pool_split = split;
+
+  brf_pool_load_deleted();
+  brf_pool_update(system);
+
+  papplSystemAddTimerCallback(system, 0, BRF_POOL_INTERVAL, brf_pool_timer, NULL);
+
+  papplSystemAddResourceCallback(system, BRF_POOL_RESOURCE, "text/html", brf_pool_web, system);
+  papplSystemAddLink(system, "Printer Pools", BRF_POOL_RESOURCE, PAPPL_LOPTIONS_NAVIGATION | PAPPL_LOPTIONS_STATUS);
+
+  return (true);
+}
+
+// 'brf_PoolIsPool()' - Is the printer a pool queue?
+
+bool                                    // O - `true` for a pool queue
+brf_PoolIsPool(pappl_printer_t *printer)// I - Printer
+{
+  bool ret;                             // Return value
+
+  pthread_mutex_lock(&brf_pool_mutex);
+  ret = brf_pool_find(papplPrinterGetID(printer)) != NULL;
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  return (ret);
+}
+
+// 'brf_PoolPrintersChanged()' - Note that printers were added or deleted.
+//
+// Called from the event callback, where PAPPL holds the system lock, so the
+// pools are updated later from a timer.
+
+void
+brf_PoolPrintersChanged(void)
+{
+  pthread_mutex_lock(&brf_pool_mutex);
+  brf_pool_changed = true;
+  pthread_mutex_unlock(&brf_pool_mutex);
+}
+
+// 'brf_PoolRecord()' - Record the throughput of a printer for a finished job.
+
+void
+brf_PoolRecord(pappl_printer_t *printer,// I - Printer
+               size_t bytes,            // I - Size of the job document
+               double seconds)          // I - Time to print the job
+{
+  brf_pool_member_t *member;            // Measured printer
+  double rate;                          // Throughput of this job
+
+  if (bytes == 0 || seconds <= 0.0)
+    return;
+
+  rate = (double)bytes / seconds;
+
+  pthread_mutex_lock(&brf_pool_mutex);
+
+  if (!brf_pool_find(papplPrinterGetID(printer)) && (member = brf_pool_member(papplPrinterGetID(printer), true)) != NULL)
+  {
+    member->rate = member->jobs ? member->rate + BRF_POOL_SMOOTHING * (rate - member->rate) : rate;
+    member->jobs ++;
+  }
+
+  pthread_mutex_unlock(&brf_pool_mutex);
+}
+
+// 'brf_PoolSplit()' - Print the spooled output of a job as volumes.
+//
+// The output is cut at page boundaries into volumes of the job's volume size,
+// and every volume goes to the printer of the pool expected to finish it
+// first, so the volumes print in parallel.  The job stays active until all
+// volumes are printed and shows their combined progress; canceling it cancels
+// the volumes, and a failed volume cancels the others.
+
+bool                                    // O - `true` on success
+brf_PoolSplit(pappl_job_t *job)         // I - Job on a pool queue
+{
+  pappl_system_t *system = papplPrinterGetSystem(papplJobGetPrinter(job));
+                                        // System
+  brf_pool_scan_t *scan = NULL;         // Members of pool
+  brf_pool_load_t *best;                // Member expected to finish first
+  brf_pool_volume_t *volumes = NULL;    // Volumes
+  pappl_job_t *member_job;              // Job on a member
+  pappl_printer_t *member;              // Member printer
+  int volume_pages = brf_PoolGetVolumePages(job),
+                                        // Pages per volume
+      num_pages,                        // Pages in the job
+      num_volumes = 0,                  // Number of volumes
+      done,                             // Printed volumes
+      pages_done,                       // Printed pages
+      completed = 0,                    // Pages reported as printed
+      i;                                // Looping var
+  char filename[1024],                  // Volume file
+      title[256],                       // Volume job name
+      message[1024];                    // Error message
+  struct stat fileinfo;                 // Volume file information
+  bool failed = false,                  // Did a volume fail?
+      ret = false;                      // Return value
+
+  if (volume_pages <= 0 || (num_pages = brf_SpoolGetPages(papplJobGetID(job), papplJobGetTimeCreated(job))) <= 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "No spooled output to split into volumes.");
+    return (false);
+  }
+
+  num_volumes = (num_pages + volume_pages - 1) / volume_pages;
+
+  if ((scan = brf_pool_get_scan(job)) == NULL || (volumes = (brf_pool_volume_t *)calloc((size_t)num_volumes, sizeof(brf_pool_volume_t))) == NULL)
+    goto finish;
+
+  papplJobSetImpressions(job, num_pages);
+
+  // Send the volumes, each to the member that would finish it first
+  for (i = 0; i < num_volumes; i ++)
+  {
+    volumes[i].first = i * volume_pages + 1;
+    volumes[i].last  = i == num_volumes - 1 ? num_pages : (i + 1) * volume_pages;
+
+    if (!brf_SpoolExtract(papplJobGetID(job), papplJobGetTimeCreated(job), volumes[i].first, volumes[i].last, filename, sizeof(filename), message, sizeof(message)))
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "%s", message);
+      failed = true;
+      break;
+    }
+
+    if ((best = brf_pool_best(scan, stat(filename, &fileinfo) ? 0.0 : (double)fileinfo.st_size)) == NULL)
+    {
+      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "No printer of pool '%s' accepts jobs.", papplPrinterGetName(papplJobGetPrinter(job)));
+      unlink(filename);
+      failed = true;
+      break;
+    }
+
+    snprintf(title, sizeof(title), "%s (volume %d of %d)", papplJobGetName(job), i + 1, num_volumes);
+
+    // Volumes are already laid out on braille pages, so the members print
+    // them as they are with the page numbers of the whole document
+    if ((member_job = brf_pool_submit(job, best->printer, BRF_PAGINATE_FORMAT, title, filename)) == NULL)
+    {
+      failed = true;
+      break;
+    }
+
+    // Later volumes queue behind this one
+    best->backlog += (double)fileinfo.st_size;
+    best->jobs ++;
+
+    volumes[i].printer_id = papplPrinterGetID(best->printer);
+    volumes[i].job_id     = papplJobGetID(member_job);
+
+    papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Volume %d of %d (pages %d-%d) sent to '%s' as job %d.", i + 1, num_volumes, volumes[i].first, volumes[i].last, papplPrinterGetName(best->printer), volumes[i].job_id);
+  }
+
+  // Follow the volumes until all are printed...
+  while (!failed)
+  {
+    for (i = 0, done = 0, pages_done = 0; i < num_volumes; i ++)
+    {
+      int pages = volumes[i].last - volumes[i].first + 1;
+                                        // Pages in volume
+
+      // Jobs leave the history after a while, those were printed
+      if ((member = papplSystemFindPrinter(system, NULL, volumes[i].printer_id, NULL)) == NULL || (member_job = papplPrinterFindJob(member, volumes[i].job_id)) == NULL || papplJobGetState(member_job) == IPP_JSTATE_COMPLETED)
+      {
+        done ++;
+        pages_done += pages;
+      }
+      else if (papplJobGetState(member_job) >= IPP_JSTATE_CANCELED)
+      {
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Volume %d of %d (job %d on '%s') did not print.", i + 1, num_volumes, volumes[i].job_id, papplPrinterGetName(member));
+        failed = true;
+      }
+      else
+        pages_done += papplJobGetImpressionsCompleted(member_job) < pages ? papplJobGetImpressionsCompleted(member_job) : pages;
+    }
+
+    if (pages_done > completed)
+    {
+      papplJobSetImpressionsCompleted(job, pages_done - completed);
+      completed = pages_done;
+    }
+
+    if (failed || papplJobIsCanceled(job))
+    {
+      failed = true;
+      break;
+    }
+
+    if (done == num_volumes)
+    {
+      ret = true;
+      break;
+    }
+
+    papplJobSetMessage(job, "%d of %d volumes printed.", done, num_volumes);
+    sleep(1);
+  }
+
+  // Cancel the volumes that are still waiting or printing
+  if (failed && volumes)
+  {
+    for (i = 0; i < num_volumes && volumes[i].job_id; i ++)
+    {
+      if ((member = papplSystemFindPrinter(system, NULL, volumes[i].printer_id, NULL)) != NULL && (member_job = papplPrinterFindJob(member, volumes[i].job_id)) != NULL && papplJobGetState(member_job) < IPP_JSTATE_CANCELED)
+        papplJobCancel(member_job);
+    }
+  }
+
+  finish:
+
+  free(volumes);
+  free(scan);
+
+  return (ret);
+}
+
+// 'brf_pool_backlog()' - Add the unprinted part of a job to the backlog.
+
+static void
+brf_pool_backlog(pappl_job_t *job,      // I - Active job
+                 void *data)            // I - Load of the printer
+{
+  brf_pool_load_t *load = (brf_pool_load_t *)data;
+                                        // Load of the printer
+  const char *filename = papplJobGetFilename(job);
+                                        // Job document
+  struct stat fileinfo;                 // Document information
+  double size;                          // Bytes left
+  int impressions = papplJobGetImpressions(job);
+                                        // Pages in the job, if known
+
+  load->jobs ++;
+
+  if (!filename || stat(filename, &fileinfo))
+    return;
+
+  size = (double)fileinfo.st_size;
+
+  if (impressions > 0)
+    size *= 1.0 - (double)papplJobGetImpressionsCompleted(job) / impressions;
+
+  if (size > 0.0)
+    load->backlog += size;
+}
+
+// 'brf_pool_best()' - Find the member expected to finish a document first.
+
+static brf_pool_load_t *                // O - Member or `NULL` if none
+brf_pool_best(brf_pool_scan_t *scan,    // I - Members of pool
+              double size)              // I - Size of document
+{
+  brf_pool_load_t *best = NULL;         // Member expected to finish first
+  int i;                                // Looping var
+
+  for (i = 0; i < scan->num_loads; i ++)
+  {
+    brf_pool_load_t *load = scan->loads + i;
+                                        // Member
+
+    // Time for the member to print its queue and then this document
+    load->finish = (load->backlog + size) / load->rate;
+
+    if (!best || load->finish < best->finish)
+      best = load;
+  }
+
+  return (best);
+}
+
+// 'brf_pool_copy()' - Copy a job document.
+
+static bool                             // O - `true` on success
+brf_pool_copy(const char *src,          // I - Document
+              const char *dst)          // I - Copy
+{
+  int srcfd,                            // Document
+      dstfd;                            // Copy
+  char buffer[65536];                   // Copy buffer
+  ssize_t bytes;                        // Bytes read
+  bool ret = true;                      // Return value
+
+  // The spool directory is usually on the same file system
+  if (!link(src, dst))
+    return (true);
+
+  if ((srcfd = open(src, O_RDONLY | O_CLOEXEC)) < 0)
+    return (false);
+
+  if ((dstfd = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    close(srcfd);
+    return (false);
+  }
+
+  while ((bytes = read(srcfd, buffer, sizeof(buffer))) > 0)
+  {
+    if (brf_WriteAll(dstfd, buffer, (size_t)bytes) < 0)
+    {
+      ret = false;
+      break;
+    }
+  }
+
+  if (bytes < 0)
+    ret = false;
+
+  close(srcfd);
+  if (close(dstfd))
+    ret = false;
+
+  if (!ret)
+    unlink(dst);
+
+  return (ret);
+}
+
+// 'brf_pool_count()' - Collect the printers of the system.
+
+static void
+brf_pool_count(pappl_printer_t *printer,// I - Printer
+               void *data)              // I - Printers
+{
+  brf_pool_scan_t *scan = (brf_pool_scan_t *)data;
+                                        // Printers
+
+  if (scan->num_loads < BRF_POOL_MAX_MEMBERS)
+    scan->loads[scan->num_loads ++].printer = printer;
+}
+
+// 'brf_pool_find()' - Find the pool of a pool queue.
+//
+// The caller holds the pool mutex.
+
+static brf_pool_t *                     // O - Pool or `NULL`
+brf_pool_find(int printer_id)           // I - Printer ID
+{
+  int i;                                // Looping var
+
+  for (i = 0; i < brf_pool_num_pools; i ++)
+  {
+    if (brf_pool_pools[i].printer_id == printer_id)
+      return (brf_pool_pools + i);
+  }
+
+  return (NULL);
+}
+
+// 'brf_pool_get_scan()' - Get the members of the pool of a job.
+
+static brf_pool_scan_t *                // O - Members or `NULL` on error
+brf_pool_get_scan(pappl_job_t *job)     // I - Job on a pool queue
+{
+  pappl_printer_t *printer = papplJobGetPrinter(job);
+                                        // Pool queue
+  brf_pool_t *pool,                     // Pool
+      copy;                             // Copy of pool
+  brf_pool_scan_t *scan;                // Members of pool
+
+  pthread_mutex_lock(&brf_pool_mutex);
+  if ((pool = brf_pool_find(papplPrinterGetID(printer))) != NULL)
+    copy = *pool;
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  if (!pool || (scan = (brf_pool_scan_t *)calloc(1, sizeof(brf_pool_scan_t))) == NULL)
+    return (NULL);
+
+  brf_pool_scan_pool(papplPrinterGetSystem(printer), &copy, scan);
+
+  return (scan);
+}
+
+// 'brf_pool_load_deleted()' - Load the drivers whose pool queue was deleted.
+
+static void
+brf_pool_load_deleted(void)
+{
+  FILE *fp;                             // Deleted pools file
+  char filename[1040],                  // Deleted pools file
+      line[256];                        // Line from file
+
+  snprintf(filename, sizeof(filename), "%s/%s", brf_pool_directory, BRF_POOL_DELETED);
+
+  if ((fp = fopen(filename, "r")) == NULL)
+    return;
+
+  pthread_mutex_lock(&brf_pool_mutex);
+
+  while (fgets(line, sizeof(line), fp) && brf_pool_num_deleted < BRF_POOL_MAX)
+  {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0])
+      papplCopyString(brf_pool_deleted[brf_pool_num_deleted ++], line, sizeof(brf_pool_deleted[0]));
+  }
+
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  fclose(fp);
+}
+
+// 'brf_pool_member()' - Find the measurements of a printer.
+//
+// The caller holds the pool mutex.
+
+static brf_pool_member_t *              // O - Measured printer or `NULL`
+brf_pool_member(int printer_id,         // I - Printer ID
+                bool create)            // I - Add the printer if missing?
+{
+  int i;                                // Looping var
+
+  for (i = 0; i < brf_pool_num_members; i ++)
+  {
+    if (brf_pool_members[i].printer_id == printer_id)
+      return (brf_pool_members + i);
+  }
+
+  if (!create || brf_pool_num_members >= BRF_POOL_MAX_MEMBERS)
+    return (NULL);
+
+  brf_pool_members[brf_pool_num_members].printer_id = printer_id;
+
+  return (brf_pool_members + brf_pool_num_members ++);
+}
+
+// 'brf_pool_save_deleted()' - Save the drivers whose pool queue was deleted.
+
+static void
+brf_pool_save_deleted(void)
+{
+  FILE *fp;                             // Deleted pools file
+  char filename[1040],                  // Deleted pools file
+      tmpname[1048];                    // Temporary file
+  int i;                                // Looping var
+
+  snprintf(filename, sizeof(filename), "%s/%s", brf_pool_directory, BRF_POOL_DELETED);
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+
+  if ((fp = fopen(tmpname, "w")) == NULL)
+    return;
+
+  pthread_mutex_lock(&brf_pool_mutex);
+  for (i = 0; i < brf_pool_num_deleted; i ++)
+    fprintf(fp, "%s\n", brf_pool_deleted[i]);
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  if (fclose(fp) || rename(tmpname, filename))
+    unlink(tmpname);
+}
+
+// 'brf_pool_scan()' - Add a printer of the pool's driver to the members.
+
+static void
+brf_pool_scan(pappl_printer_t *printer, // I - Printer
+              void *data)               // I - Members
+{
+  brf_pool_scan_t *scan = (brf_pool_scan_t *)data;
+                                        // Members
+  brf_pool_load_t *load;                // Load of the printer
+
+  if (scan->num_loads >= BRF_POOL_MAX_MEMBERS || papplPrinterGetID(printer) == scan->pool.printer_id || strcmp(papplPrinterGetDriverName(printer), scan->pool.driver) || !strcmp(papplPrinterGetDeviceURI(printer), BRF_POOL_DEVICE_URI) || papplPrinterGetState(printer) == IPP_PSTATE_STOPPED || !papplPrinterIsAcceptingJobs(printer))
+    return;
+
+  // The scan is reused for the next pool, so start from an empty load
+  load = scan->loads + scan->num_loads ++;
+
+  memset(load, 0, sizeof(brf_pool_load_t));
+  load->printer = printer;
+
+  papplPrinterIterateActiveJobs(printer, brf_pool_backlog, load, 1, 0);
+}
+
+// 'brf_pool_scan_pool()' - Get the load of the printers of a pool.
+//
+// Printers that were not measured yet are assumed as fast as the average of
+// the measured ones.
+
+static void
+brf_pool_scan_pool(
+    pappl_system_t *system,             // I - System
+    const brf_pool_t *pool,             // I - Pool
+    brf_pool_scan_t *scan)              // O - Members
+{
+  brf_pool_member_t *member;            // Measured printer
+  double total = 0.0;                   // Sum of measured rates
+  int i,                                // Looping var
+      measured = 0;                     // Number of measured members
+
+  scan->pool      = *pool;
+  scan->num_loads = 0;
+
+  papplSystemIteratePrinters(system, brf_pool_scan, scan);
+
+  pthread_mutex_lock(&brf_pool_mutex);
+
+  for (i = 0; i < scan->num_loads; i ++)
+  {
+    if ((member = brf_pool_member(papplPrinterGetID(scan->loads[i].printer), false)) != NULL && member->jobs > 0)
+    {
+      scan->loads[i].rate = member->rate;
+      total += member->rate;
+      measured ++;
+    }
+  }
+
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  for (i = 0; i < scan->num_loads; i ++)
+  {
+    if (scan->loads[i].rate <= 0.0)
+      scan->loads[i].rate = measured ? total / measured : BRF_POOL_RATE;
+
+    scan->loads[i].finish = scan->loads[i].backlog / scan->loads[i].rate;
+  }
+}
+
+// 'brf_pool_submit()' - Create a job on a member of a pool.
+
+static pappl_job_t *                    // O - New job or `NULL` on error
+brf_pool_submit(pappl_job_t *job,       // I - Job on the pool queue
+                pappl_printer_t *printer,
+                                        // I - Member
+                const char *format,     // I - Document format
+                const char *title,      // I - Job name
+                const char *filename)   // I - Document, taken over by PAPPL
+{
+  pappl_job_t *member_job;              // Job on the member
+  brf_pool_t *pool;                     // Pool
+  brf_pool_member_t *member;            // Measured member
+  int num_options;                      // Number of job options
+  cups_option_t *options = NULL;        // Job options
+
+  num_options = brf_GetJobOptions(job, 0, &options);
+  member_job  = papplJobCreateWithFile(printer, papplJobGetUsername(job), format, title, num_options, options, filename);
+  cupsFreeOptions(num_options, options);
+
+  if (!member_job)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to create a job on '%s'.", papplPrinterGetName(printer));
+    unlink(filename);
+    return (NULL);
+  }
+
+  pthread_mutex_lock(&brf_pool_mutex);
+  if ((pool = brf_pool_find(papplPrinterGetID(papplJobGetPrinter(job)))) != NULL)
+    pool->forwarded ++;
+  if ((member = brf_pool_member(papplPrinterGetID(printer), true)) != NULL)
+    member->pool_jobs ++;
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  return (member_job);
+}
+
+// 'brf_pool_timer()' - Update the pools if printers were added or deleted.
+
+static bool                             // O - `true` to keep the timer
+brf_pool_timer(pappl_system_t *system,  // I - System
+               void *data)              // I - Callback data (unused)
+{
+  bool changed;                         // Were printers added or deleted?
+
+  (void)data;
+
+  pthread_mutex_lock(&brf_pool_mutex);
+  changed          = brf_pool_changed;
+  brf_pool_changed = false;
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  if (changed)
+    brf_pool_update(system);
+
+  return (true);
+}
+
+// 'brf_pool_update()' - Create the missing pools and forget deleted ones.
+
+static void
+brf_pool_update(pappl_system_t *system) // I - System
+{
+  brf_pool_scan_t *scan;                // Printers per driver
+  pappl_printer_t *printer;             // Pool queue
+  char name[128];                       // Name of pool queue
+  int i, j,                             // Looping vars
+      count;                            // Printers with the driver
+  bool exists,                          // Does the driver have a pool?
+      deleted = false;                  // Was a pool queue deleted?
+
+  if ((scan = (brf_pool_scan_t *)calloc(1, sizeof(brf_pool_scan_t))) == NULL)
+    return;
+
+  papplSystemIteratePrinters(system, brf_pool_count, scan);
+
+  // Forget the pools whose queue was deleted...
+  pthread_mutex_lock(&brf_pool_mutex);
+
+  for (i = 0; i < brf_pool_num_pools;)
+  {
+    for (j = 0; j < scan->num_loads; j ++)
+    {
+      if (papplPrinterGetID(scan->loads[j].printer) == brf_pool_pools[i].printer_id)
+        break;
+    }
+
+    if (j < scan->num_loads)
+    {
+      i ++;
+      continue;
+    }
+
+    papplLog(system, PAPPL_LOGLEVEL_INFO, "Pool of driver '%s' was deleted.", brf_pool_pools[i].driver);
+
+    // Remember the deletion, so the pool does not come back
+    if (brf_pool_num_deleted < BRF_POOL_MAX)
+    {
+      papplCopyString(brf_pool_deleted[brf_pool_num_deleted ++], brf_pool_pools[i].driver, sizeof(brf_pool_deleted[0]));
+      deleted = true;
+    }
+
+    brf_pool_num_pools --;
+    memmove(brf_pool_pools + i, brf_pool_pools + i + 1, (size_t)(brf_pool_num_pools - i) * sizeof(brf_pool_t));
+  }
+
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  if (deleted)
+    brf_pool_save_deleted();
+
+  // Then create the pools of the drivers that now have several printers...
+  for (i = 0; i < scan->num_loads; i ++)
+  {
+    const char *driver = papplPrinterGetDriverName(scan->loads[i].printer);
+                                        // Driver of printer
+
+    if (!strcmp(papplPrinterGetDeviceURI(scan->loads[i].printer), BRF_POOL_DEVICE_URI))
+      continue;
+
+    // Count the printers of each driver once, at its first printer
+    for (j = 0; j < i; j ++)
+    {
+      if (strcmp(papplPrinterGetDeviceURI(scan->loads[j].printer), BRF_POOL_DEVICE_URI) && !strcmp(driver, papplPrinterGetDriverName(scan->loads[j].printer)))
+        break;
+    }
+
+    if (j < i)
+      continue;
+
+    for (count = 0, j = i; j < scan->num_loads; j ++)
+    {
+      if (strcmp(papplPrinterGetDeviceURI(scan->loads[j].printer), BRF_POOL_DEVICE_URI) && !strcmp(driver, papplPrinterGetDriverName(scan->loads[j].printer)))
+        count ++;
+    }
+
+    pthread_mutex_lock(&brf_pool_mutex);
+    for (exists = false, j = 0; j < brf_pool_num_pools && !exists; j ++)
+      exists = !strcmp(brf_pool_pools[j].driver, driver);
+    for (j = 0; j < brf_pool_num_deleted && !exists; j ++)
+      exists = !strcmp(brf_pool_deleted[j], driver);
+    pthread_mutex_unlock(&brf_pool_mutex);
+
+    if (exists || count < 2 || brf_pool_num_pools >= BRF_POOL_MAX)
+      continue;
+
+    // Reuse the pool queue from a saved state
+    snprintf(name, sizeof(name), "%s-pool", driver);
+
+    for (printer = NULL, j = 0; j < scan->num_loads; j ++)
+    {
+      if (!strcmp(papplPrinterGetName(scan->loads[j].printer), name))
+      {
+        printer = scan->loads[j].printer;
+        break;
+      }
+    }
+
+    if (!printer)
+      printer = papplPrinterCreate(system, 0, name, driver, NULL, BRF_POOL_DEVICE_URI);
+
+    if (!printer)
+    {
+      papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to create pool '%s'.", name);
+      continue;
+    }
+
+    pthread_mutex_lock(&brf_pool_mutex);
+    memset(brf_pool_pools + brf_pool_num_pools, 0, sizeof(brf_pool_t));
+    papplCopyString(brf_pool_pools[brf_pool_num_pools].driver, driver, sizeof(brf_pool_pools[0].driver));
+    brf_pool_pools[brf_pool_num_pools].printer_id = papplPrinterGetID(printer);
+    brf_pool_num_pools ++;
+    pthread_mutex_unlock(&brf_pool_mutex);
+
+    papplLog(system, PAPPL_LOGLEVEL_INFO, "Pool '%s' sends jobs to %d printers.", name, count);
+  }
+
+  free(scan);
+}
+
+// 'brf_pool_web()' - Show the pool page of the web interface.
+
+static bool                             // O - `true` if handled
+brf_pool_web(pappl_client_t *client,    // I - Client
+             void *data)                // I - System
+{
+  pappl_system_t *system = (pappl_system_t *)data;
+                                        // System
+  pappl_printer_t *printer;             // Pool queue
+  brf_pool_t pools[BRF_POOL_MAX];       // Copy of pools
+  brf_pool_member_t *member;            // Measured printer
+  brf_pool_scan_t *scan;                // Members of a pool
+  int i, j,                             // Looping vars
+      num_pools;                        // Number of pools
+
+  if (!papplClientHTMLAuthorize(client))
+    return (true);
+
+  if ((scan = (brf_pool_scan_t *)calloc(1, sizeof(brf_pool_scan_t))) == NULL)
+    return (false);
+
+  pthread_mutex_lock(&brf_pool_mutex);
+  num_pools = brf_pool_num_pools;
+  memcpy(pools, brf_pool_pools, sizeof(pools));
+  pthread_mutex_unlock(&brf_pool_mutex);
+
+  if (!papplClientRespond(client, HTTP_STATUS_OK, NULL, "text/html", 0, 0))
+  {
+    free(scan);
+    return (false);
+  }
+
+  papplClientHTMLHeader(client, "Printer Pools", 0);
+  papplClientHTMLPuts(client,
+                      "    <div class=\"content\">\n"
+                      "      <div class=\"row\">\n"
+                      "        <div class=\"col-12\">\n"
+                      "          <h1 class=\"title\">Printer Pools</h1>\n"
+                      "          <p>Jobs sent to a pool go to the printer expected to finish first.  A balanced pool has similar times to empty on all of its printers.</p>\n");
+
+  if (num_pools == 0)
+    papplClientHTMLPuts(client, "          <p>There are no pools.  A pool is created for every driver used by two or more printers.</p>\n");
+
+  for (i = 0; i < num_pools; i ++)
+  {
+    double min_finish = 0.0,            // Shortest time to empty
+        max_finish = 0.0;               // Longest time to empty
+
+    if ((printer = papplSystemFindPrinter(system, NULL, pools[i].printer_id, NULL)) == NULL)
+      continue;
+
+    brf_pool_scan_pool(system, pools + i, scan);
+
+    for (j = 0; j < scan->num_loads; j ++)
+    {
+      if (j == 0 || scan->loads[j].finish < min_finish)
+        min_finish = scan->loads[j].finish;
+      if (j == 0 || scan->loads[j].finish > max_finish)
+        max_finish = scan->loads[j].finish;
+    }
+
+    papplClientHTMLPrintf(client,
+                          "          <h2 class=\"title\">%s</h2>\n"
+                          "          <p>%lu jobs sent to %d available printers, queues empty within %.0fs of each other.</p>\n"
+                          "          <table class=\"list\">\n"
+                          "            <thead>\n"
+                          "              <tr><th>Printer</th><th>Active Jobs</th><th>Queued</th><th>Throughput</th><th>Time to Empty</th><th>Jobs from Pool</th></tr>\n"
+                          "            </thead>\n"
+                          "            <tbody>\n", papplPrinterGetName(printer), pools[i].forwarded, scan->num_loads, max_finish - min_finish);
+
+    for (j = 0; j < scan->num_loads; j ++)
+    {
+      brf_pool_load_t *load = scan->loads + j;
+                                        // Member
+      unsigned long pool_jobs = 0;      // Jobs received from the pool
+      bool measured = false;            // Was the printer measured?
+
+      pthread_mutex_lock(&brf_pool_mutex);
+      if ((member = brf_pool_member(papplPrinterGetID(load->printer), false)) != NULL)
+      {
+        pool_jobs = member->pool_jobs;
+        measured  = member->jobs > 0;
+      }
+      pthread_mutex_unlock(&brf_pool_mutex);
+
+      papplClientHTMLPrintf(client, "              <tr><td>%s</td><td>%d</td><td>%.0f KiB</td><td>%.1f KiB/s%s</td><td>%.0fs</td><td>%lu</td></tr>\n", papplPrinterGetName(load->printer), load->jobs, load->backlog / 1024.0, load->rate / 1024.0, measured ? "" : " (estimated)", load->finish, pool_jobs);
+    }
+
+    papplClientHTMLPuts(client,
+                        "            </tbody>\n"
+                        "          </table>\n");
+  }
+
+  papplClientHTMLPuts(client,
+                      "        </div>\n"
+                      "      </div>\n"
+                      "    </div>\n");
+  papplClientHTMLFooter(client);
+
+  free(scan);
+
+  return (true);
+}
@@ -11,11 +11,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/types.h>
 #include <pwd.h>
 #include <string.h>
 #include <cups/ipp.h>
-#include <magic.h>
+#include <time.h>
 
 #include "brf-printer.h"
 
@@ -29,9 +31,13 @@ extern char *strdup(const char *);
 static bool BRFTestFilterCB(pappl_job_t *job, pappl_device_t *device, void *cbdata);
 
 static int brf_print_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+static int brf_print_device_fd(brf_print_filter_function_data_t *params);
+static ssize_t brf_print_zero_copy(int inputfd, int devicefd);
 
 static const char *autoadd_cb(const char *device_info, const char *device_uri, const char *device_id, void *cbdata);
 
+static void event_cb(pappl_system_t *system, pappl_printer_t *printer, pappl_job_t *job, pappl_event_t event, void *data);
+
 static bool driver_cb(pappl_system_t *system, const char *driver_name, const char *device_uri, const char *device_id, pappl_pr_driver_data_t *data, ipp_t **attrs, void *cbdata);
 
 static int match_id(int num_did, cups_option_t *did, const char *match_id);
@@ -81,15 +87,19 @@ main(int argc,     // I - Number of command-line arguments
 
   global_data.config = &printer_app_config;
 
-  return (papplMainloop(argc, argv,
-                        "1.0",
-                        NULL,
-                        (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])),
-                        brf_drivers, autoadd_cb, driver_cb,
-                        /*subcmd_name*/ NULL, /*subcmd_cb*/ NULL,
-                        system_cb,
-                        /*usage_cb*/ NULL,
-                        /*data*/ &global_data));
+  int ret = papplMainloop(argc, argv,
+                          "1.0",
+                          NULL,
+                          (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])),
+                          brf_drivers, autoadd_cb, driver_cb,
+                          "resume", brf_SpoolResumeCommand,
+                          system_cb,
+                          /*usage_cb*/ NULL,
+                          /*data*/ &global_data);
+
+  brf_MimeShutdown();
+
+  return (ret);
 }
 
 // 'autoadd_cb()' - Determine the proper driver for a given printer.
@@ -228,8 +238,8 @@ driver_cb(
     }
   }
 
-  // Pages per minute
-  data->ppm = 1;
+  // Pages per minute, as measured on earlier jobs
+  data->ppm = brf_EtaGetPPM(device_uri);
 
   // Color values...
   data->color_supported = PAPPL_COLOR_MODE_AUTO | PAPPL_COLOR_MODE_MONOCHROME;
@@ -330,6 +340,10 @@ driver_cb(
   data->vendor[data->num_vendor++] = "Edge";
   ipp_attribute_t *edge = ippAddString(*attrs, IPP_TAG_PRINTER, IPP_TAG_TEXT, "Edge-default", NULL,"Canny");
 
+  // Pages per volume when a pool splits a job, 0 to print it on one printer
+  data->vendor[data->num_vendor++] = "VolumePages";
+  ipp_attribute_t *volumePages = ippAddInteger(*attrs, IPP_TAG_PRINTER, IPP_TAG_INTEGER, "VolumePages-default", 0);
+
   ipp_attribute_t *mirror = ippAddBoolean(*attrs, IPP_TAG_PRINTER, "mirror-default", 0);
 
   ipp_attribute_t *fitplot = ippAddBoolean(*attrs, IPP_TAG_PRINTER, "fitplot-default", 1);
@@ -372,21 +386,32 @@ void BRFSetup(pappl_system_t *system, brf_printer_app_global_data_t *global_data
 {
   brf_spooling_conversion_t *conversion;
 
-  // Track if the MIME filter was added successfully
-  bool filter_added = false;
+  // Build the conversion graph once, jobs look up their filter chain in it
+  if (!brf_GraphInit(system, converts, brf_TESTPAGE_MIMETYPE))
+  {
+    papplLog(system, PAPPL_LOGLEVEL_ERROR, "Unable to build the conversion graph.");
+    return;
+  }
 
   for (int i = 0; converts[i].srctype != NULL; i++)
   {
     conversion = &converts[i];
 
-   
+    // Only offer input formats that have a path to BRF
+    if (!brf_GraphCanConvert(conversion->srctype))
+    {
+      papplLog(system, PAPPL_LOGLEVEL_DEBUG, "No conversion from %s to %s.", conversion->srctype, brf_TESTPAGE_MIMETYPE);
+      continue;
+    }
+
     // papplSystemAddMIMEFilter(system, conversion->srctype, conversion->dsttype, BRFTestFilterCB, global_data);
     papplSystemAddMIMEFilter(system, conversion->srctype, brf_TESTPAGE_MIMETYPE, BRFTestFilterCB, global_data);
-
-    // Set filter_added to true after calling the function
-    filter_added = true;
   }
 
+  // Spooled output and volumes are already on braille pages, send them as
+  // they are
+  papplSystemAddMIMEFilter(system, BRF_PAGINATE_FORMAT, brf_TESTPAGE_MIMETYPE, brf_GenPrintPaged, NULL);
+
   printf("****************BRFSETUP IS CALLED**********************\n");
 }
 // 'mime_cb()' - MIME typing callback...
@@ -396,41 +421,10 @@ mime_cb(const unsigned char *header, // I - Header data
         size_t headersize,           // I - Size of header data
         void *cbdata)                // I - Callback data (not used)
 {
-  magic_t magic;
-  const char *mime_type = NULL;
+  (void)cbdata;
 
-  // Step 1: Open a magic_t object for MIME type detection
-  magic = magic_open(MAGIC_MIME_TYPE);
-  if (magic == NULL)
-  {
-    fprintf(stderr, "Failed to initialize libmagic.\n");
-    return NULL;
-  }
-
-  // Step 2: Load the magic database
-  if (magic_load(magic, NULL) != 0)
-  {
-    fprintf(stderr, "Failed to load magic database: %s\n", magic_error(magic));
-    magic_close(magic);
-    return NULL;
-  }
-
-  // Step 3: Use magic_buffer to determine MIME type from the header data
-  mime_type = magic_buffer(magic, header, headersize);
-  if (mime_type == NULL)
-  {
-    fprintf(stderr, "Failed to determine MIME type: %s\n", magic_error(magic));
-  }
-  else
-  {
-    // Duplicate the MIME type string, as magic_buffer may free it after magic_close
-    mime_type = strdup(mime_type);
-  }
-
-  // Step 4: Clean up
-  magic_close(magic);
-
-  return mime_type; // Return the MIME type (or NULL if undetected)
+  // The magic database is loaded once by brf_MimeInit() in system_cb()...
+  return (brf_MimeDetect(header, headersize));
 }
 
 // 'printer_cb()' - Try auto-adding printers.
@@ -488,6 +482,28 @@ printer_cb(const char *device_info, // I - Device information
   return (false);
 }
 
+// 'event_cb()' - Track changes to printers and jobs.
+
+static void
+event_cb(pappl_system_t *system,   // I - System
+         pappl_printer_t *printer, // I - Printer, if any
+         pappl_job_t *job,         // I - Job, if any
+         pappl_event_t event,      // I - Event
+         void *data)               // I - Callback data (global data)
+{
+  (void)system;
+  (void)job;
+  (void)data;
+
+  // New driver defaults are picked up by the next job
+  if (printer && (event & (PAPPL_EVENT_PRINTER_CONFIG_CHANGED | PAPPL_EVENT_PRINTER_DELETED)))
+    brf_InvalidateJobOptions(printer);
+
+  // Printers that were added or deleted may start or end a pool
+  if (event & (PAPPL_EVENT_PRINTER_CREATED | PAPPL_EVENT_PRINTER_DELETED))
+    brf_PoolPrintersChanged();
+}
+
 // 'system_cb()' - Setup the system object.
 
 static pappl_system_t * // O - System object
@@ -507,6 +523,7 @@ system_cb(
   int port = 0;              // Port number, if any
   pappl_soptions_t soptions = PAPPL_SOPTIONS_MULTI_QUEUE | PAPPL_SOPTIONS_WEB_INTERFACE | PAPPL_SOPTIONS_WEB_LOG | PAPPL_SOPTIONS_WEB_SECURITY;
   // System options
+  bool spooling = false;                // Is job output spooled?
   static pappl_version_t versions[1] = // Software versions
       {
           {"brf", "", 1.0, 1.0}};
@@ -581,12 +598,66 @@ system_cb(
   if ((system = papplSystemCreate(soptions, system_name ? system_name : "Braille printer app", port, "_print,_universal", cupsGetOption("spool-directory", num_options, options), logfile ? logfile : "-", loglevel, cupsGetOption("auth-service", num_options, options), /* tls_only */ false)) == NULL)
     return (NULL);
 
+  // Fork the external filter launchers while the server is still small
+  {
+    int launchers = 2,            // Number of filter launchers
+        limit = (int)sysconf(_SC_NPROCESSORS_ONLN);
+                                  // Filters of one program running at once
+
+    if ((val = cupsGetOption("brf-filter-launchers", num_options, options)) != NULL)
+      launchers = atoi(val);
+    if ((val = cupsGetOption("brf-filter-limit", num_options, options)) != NULL)
+      limit = atoi(val);
+
+    if (!brf_LauncherInit(system, converts, launchers, limit))
+      papplLog(system, PAPPL_LOGLEVEL_WARN, "External filters run without launchers.");
+  }
+
   papplSystemAddListeners(system, NULL);
   papplSystemSetHostName(system, hostname);
   // initialize_spooling_conversions();
 
+  global_data->system = system;
+
+  if (!brf_MimeInit(system, converts))
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "MIME type detection is unavailable.");
+
   papplSystemSetMIMECallback(system, mime_cb, NULL);
 
+  papplSystemSetEventCallback(system, event_cb, global_data);
+
+  brf_LouisInit();
+
+  // Spool directory for the translation result cache and spooled jobs...
+  brf_SpoolGetDirectory(num_options, options, global_data->spool_dir, sizeof(global_data->spool_dir));
+
+  if (mkdir(global_data->spool_dir, 0700) && errno != EEXIST)
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to create spool directory '%s': %s", global_data->spool_dir, strerror(errno));
+
+  // Keep the output of each job so it can be resumed after a paper jam, which
+  // writes every job once more and is only done when asked for
+  if (brf_GetBoolOption("brf-resume", false, num_options, options))
+    spooling = brf_SpoolInit(system, global_data->spool_dir);
+
+  {
+    char cache_dir[1024];         // Translation result cache directory
+    int cache_size = 256,         // Cache size in MiB
+        cache_memory = 16;        // Memory part of the cache in MiB
+
+    if ((val = cupsGetOption("brf-cache-size", num_options, options)) != NULL)
+      cache_size = atoi(val);
+    if ((val = cupsGetOption("brf-cache-memory", num_options, options)) != NULL)
+      cache_memory = atoi(val);
+
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", global_data->spool_dir);
+    brf_CacheInit(system, cache_dir, cache_size > 0 ? (size_t)cache_size * 1024 * 1024 : 0, cache_memory > 0 ? (size_t)cache_memory * 1024 * 1024 : 0);
+  }
+
+  // Measure the printers and publish when jobs are expected to finish, the
+  // driver callback reports the measured speed of the printers created below
+  if (!brf_EtaInit(system, global_data->spool_dir))
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Job estimates are unavailable.");
+
   BRFSetup(system, global_data);
 
   papplSystemSetPrinterDrivers(system, (int)(sizeof(brf_drivers) / sizeof(brf_drivers[0])), brf_drivers, autoadd_cb, /*create_cb*/ NULL, driver_cb, system);
@@ -607,6 +678,18 @@ system_cb(
 
   create_brf_printer(system);
 
+  // Serve stage latency histograms for Prometheus
+  if (brf_GetBoolOption("brf-metrics", true, num_options, options) && !brf_MetricsInit(system))
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Metrics are unavailable.");
+
+  // Group printers with the same driver into pools, splitting jobs into
+  // volumes uses the page index of the spooled output
+  if (brf_GetBoolOption("brf-pools", false, num_options, options))
+    brf_PoolInit(system, global_data->spool_dir, spooling);
+
+  // Compile the translation tables of every printer before the first job
+  brf_LouisPrewarm(system);
+
   return (system);
 }
 
@@ -691,18 +774,21 @@ BRFTestFilterCB(
   // brf_job_data_t * job_data;
   const char *informat;
   const char *filename;                  // Input filename
-  int fd;                                // Input file descriptor
-  brf_spooling_conversion_t *conversion; // Spooling conversion to use for pre-filtering
+  int fd = -1;                           // Input file descriptor
   cups_array_t *spooling_conversions;
   cf_filter_filter_in_chain_t *chain_filter, // Filter from PPD file
       *print;
   cf_filter_external_t *filter_data_ext;
   brf_print_filter_function_data_t *print_params;
   cf_filter_data_t *filter_data;
-  cups_array_t *chain;
-  int nullfd; // File descriptor for /dev/null
-  char paramstr[1024];
-  char buf[1024];
+  cups_array_t *chain = NULL;
+  int nullfd = -1; // File descriptor for /dev/null
+  brf_arena_t *arena;  // Memory for setting up the filter chain
+  char louis_tables[1024] = ""; // Translation tables used by the job
+  char cache_key[65] = "";      // Translation result cache key
+  int cachefd = -1;             // Cached result
+  void *cache_tee = NULL;       // Cache file being written
+  double start = brf_GetTime(); // Start of the job
 
   bool ret = false;    // Return value
   int num_options = 0; // Number of PPD print options
@@ -715,103 +801,63 @@ BRFTestFilterCB(
   pappl_pr_driver_data_t driver_data;
   pappl_printer_t *printer = papplJobGetPrinter(job);
   const char *device_uri = papplPrinterGetDeviceURI(printer);
+  struct stat fileinfo;         // Input file information
 
-  ipp_t *driver_attrs = papplPrinterGetDriverAttributes(printer);
-
-  paramstr[sizeof(paramstr) - 1] = 0;
-
-  // Define an array of option names
-  const char *option_names[] = {"PageSize","mirror","fitplot",
-                                  "SendFF", "SendSUB",
-                                 "LibLouis", "LibLouis2", "LibLouis3", "LibLouis4",
-                                "TextDotDistance", "TextDots", "LineSpacing", "TopMargin", "BottomMargin",
-                                "LeftMargin", "RightMargin", "BraillePageNumber", "PrintPageNumber",
-                                "PageSeparator", "PageSeparatorNumber", "ContinuePages", "GraphicDotDistance",
-                                "Rotate", "Edge", "Negate", "EdgeFactor", "CannyRadius", "CannySigma",
-                                "CannyLower", "CannyUpper", "page-left", "page-right", "page-top", "page-bottom"};
+  brf_MetricsObserve(BRF_METRIC_QUEUE_WAIT, papplPrinterGetName(printer), NULL, difftime(papplJobGetTimeProcessed(job), papplJobGetTimeCreated(job)));
 
-  // Loop through each option and process them
-  for (size_t i = 0; i < sizeof(option_names) / sizeof(option_names[0]); i++)
+  // Jobs sent to a pool are printed by the printer expected to finish first,
+  // unless they are converted here and split into volumes
+  if (brf_PoolIsPool(printer) && !brf_PoolGetVolumePages(job))
   {
-    const char *option_name = option_names[i];
-    ipp_attribute_t *attribute = papplJobGetAttribute(job, option_name);
-
-   // If attribute is not found, look for the default attribute
-    if (attribute == NULL) {
-        snprintf(buf, sizeof(buf), "%s-default", option_name);
-        attribute = ippFindAttribute(driver_attrs, buf, IPP_TAG_ZERO);
-        if (attribute != NULL) {
-            printf("Default attribute for %s: %s\n", option_name, ippGetName(attribute));
-        }
-    }
-
-    // Try to retrieve supported attribute as well
-    snprintf(buf, sizeof(buf), "%s-supported", option_name);
-    ipp_attribute_t *attr_support = ippFindAttribute(driver_attrs, buf, IPP_TAG_ZERO);
-    if (attr_support != NULL) {
-        printf("Supported attribute for %s: %s\n", option_name, ippGetName(attr_support));
-    }
+    papplJobDeletePrintOptions(job_options);
+    return (brf_PoolForward(job));
+  }
 
-    if (attribute != NULL)
-    {
-      ipp_tag_t tagcheck = ippGetValueTag(attribute);
+  // Add the job's filter options on top of the printer's driver defaults
+  job_options->num_vendor = brf_GetJobOptions(job, job_options->num_vendor, &job_options->vendor);
 
-      if (tagcheck == IPP_TAG_INTEGER)
-      {
-        int value = ippGetInteger(attribute, 0);
-        snprintf(paramstr, sizeof(paramstr) - 1, "%d", value);
-      }
-      else if (tagcheck == IPP_TAG_BOOLEAN)
-      {
-        bool boolean = ippGetBoolean(attribute, 0);
-        strcpy(paramstr, boolean ? "True" : "False");
-      }
-      else
-      {
-        const char *str = ippGetString(attribute, 0, NULL);
-        strncpy(paramstr, str, sizeof(paramstr) - 1);
-      }
-
-      // Add the option to job_options
-      job_options->num_vendor = cupsAddOption(option_name, paramstr, job_options->num_vendor, &(job_options->vendor));
-    }
+  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Entering BRFTestFilterCB()");
 
-    printf("****** Value for %s ****** %s\n", option_name, paramstr);
+  // Everything set up for the filter chain comes from one arena that is
+  // released when the job is done
+  if ((arena = brf_ArenaCreate(0)) == NULL)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for the filter chain");
+    papplJobDeletePrintOptions(job_options);
+    return false;
   }
 
-  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Entering BRFTestFilterCB()");
-
   // Prepare job data to be supplied to filter functions/CUPS filters called during job execution
-  filter_data = (cf_filter_data_t *)calloc(1, sizeof(cf_filter_data_t));
+  filter_data = (cf_filter_data_t *)brf_ArenaAlloc(arena, sizeof(cf_filter_data_t));
   if (!filter_data)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for filter_data");
-    return false;
+    goto finish;
   }
 
   papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Allocated memory for filter_data");
 
   // Initialize filter_data fields
-  filter_data->printer = strdup(papplPrinterGetName(printer));
+  filter_data->printer = brf_ArenaStrdup(arena, papplPrinterGetName(printer));
   if (!filter_data->printer)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for printer name");
-    return false;
+    goto finish;
   }
 
   filter_data->job_id = papplJobGetID(job);
-  filter_data->job_user = strdup(papplJobGetUsername(job));
+  filter_data->job_user = brf_ArenaStrdup(arena, papplJobGetUsername(job));
   if (!filter_data->job_user)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for job user");
-    return false;
+    goto finish;
   }
 
-  filter_data->job_title = strdup(papplJobGetName(job));
+  filter_data->job_title = brf_ArenaStrdup(arena, papplJobGetName(job));
   if (!filter_data->job_title)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for job title");
-    return false;
+    goto finish;
   }
 
   papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Job ID: %d, Job User: %s, Job Title: %s",
@@ -840,13 +886,12 @@ BRFTestFilterCB(
   papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Filter data initialized");
 
   // Initialize filter_data_ext for external filter
-  filter_data_ext = (cf_filter_external_t *)calloc(1, sizeof(cf_filter_external_t));
+  filter_data_ext = (cf_filter_external_t *)brf_ArenaAlloc(arena, sizeof(cf_filter_external_t));
 
   if (!filter_data_ext)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for filter_data_ext");
-    close(fd);
-    return false;
+    goto finish;
   }
 
   filter_data_ext->filter = texttobrf_filter.filter;
@@ -862,7 +907,7 @@ BRFTestFilterCB(
   if ((fd = open(filename, O_RDONLY)) < 0)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open input file '%s': %s", filename, strerror(errno));
-    return false;
+    goto finish;
   }
 
   papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Input file opened successfully");
@@ -875,8 +920,7 @@ BRFTestFilterCB(
     if (device_data == NULL)
     {
       papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to get device data");
-      close(fd);
-      return false;
+      goto finish;
     }
 
     // Connect the filter_data
@@ -891,61 +935,87 @@ BRFTestFilterCB(
   informat = papplJobGetFormat(job);
   papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Input file format: %s", informat);
 
-  const char *currentFormat = informat;
+  filter_data->content_type = brf_ArenaStrdup(arena, informat);
+  filter_data->final_content_type = brf_ArenaStrdup(arena, "application/vnd.cups-brf");
 
-  filter_data->content_type = strdup(currentFormat);
-  filter_data->final_content_type = strdup("application/vnd.cups-brf");
-
-  while (strcmp(currentFormat, "application/vnd.cups-brf") != 0)
+  // Reuse the result of an earlier job with the same document and options
+  if (strcmp(informat, "application/vnd.cups-brf") && brf_CacheKey(fd, informat, job_options->num_vendor, job_options->vendor, cache_key, sizeof(cache_key)))
   {
-    for (int i = 0; converts[i].srctype != NULL; i++)
+    if ((cachefd = brf_CacheOpen(cache_key)) >= 0)
     {
-      conversion = &converts[i];
-      // Compare source type with informat
-      if (strcmp(conversion->srctype, informat) == 0)
-      {
-        break; // Exit the loop when a match is found
-      }
-    }
-    printf("****************after if conversion_srctype*********%s***********\n", conversion->srctype);
+      brf_cache_stats_t cache_stats;
+
+      brf_CacheGetStats(&cache_stats);
+      papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Using cached result %s (%lu memory hits, %lu disk hits, %lu misses)", cache_key, cache_stats.memory_hits, cache_stats.disk_hits, cache_stats.misses);
 
-    if (conversion == NULL)
-    {
-      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "No pre-filter found for input format %s", informat);
       close(fd);
-      return false;
+      fd = cachefd;
     }
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Using spooling conversion from %s to %s", conversion->srctype, conversion->dsttype);
+  }
+
+  // Get the lowest-cost chain of filters from the conversion graph
+  if (cachefd < 0 && !brf_GraphPlan(informat, chain))
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "No pre-filter found for input format %s", informat);
+    goto finish;
+  }
+
+  for (cf_filter_filter_in_chain_t *stage = (cf_filter_filter_in_chain_t *)cupsArrayFirst(chain); stage; stage = (cf_filter_filter_in_chain_t *)cupsArrayNext(chain))
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Using filter %s", stage->name);
 
-    papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Converting input file to format: %s", conversion->dsttype);
+    // Compile the translation tables here so the forked filter inherits them
+    if (!strcmp(stage->name, BRF_LOUIS_FILTER_NAME) && !louis_tables[0])
+    {
+      brf_louis_stats_t louis_stats;
+
+      brf_LouisGetTables(job_options->num_vendor, job_options->vendor, louis_tables, sizeof(louis_tables));
 
-    cupsArrayAdd(chain, &(conversion->filters));
+      if (!brf_LouisAcquire(louis_tables))
+      {
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to compile translation tables '%s'", louis_tables);
+        louis_tables[0] = '\0';
+        goto finish;
+      }
 
-    currentFormat = conversion->dsttype;
+      brf_LouisGetStats(&louis_stats);
+      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Translation table cache: %d table list(s), %lu KiB, %lu hits, %lu misses", louis_stats.num_tables, (unsigned long)(louis_stats.bytes / 1024), louis_stats.hits, louis_stats.misses);
+    }
   }
 
   // Add print filter function at the end of the chain
-  print = (cf_filter_filter_in_chain_t *)calloc(1, sizeof(cf_filter_filter_in_chain_t));
+  print = (cf_filter_filter_in_chain_t *)brf_ArenaAlloc(arena, sizeof(cf_filter_filter_in_chain_t));
 
   if (!print)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for print filter");
-    close(fd);
-    return false;
+    goto finish;
   }
 
-  print_params = (brf_print_filter_function_data_t *)calloc(1, sizeof(brf_print_filter_function_data_t));
+  print_params = (brf_print_filter_function_data_t *)brf_ArenaAlloc(arena, sizeof(brf_print_filter_function_data_t));
   if (!print_params)
   {
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Failed to allocate memory for print_params");
-    close(fd);
-    return false;
+    goto finish;
+  }
+
+  // Copy the result into the cache while it is printed
+  if (cachefd < 0 && cache_key[0])
+  {
+    cf_filter_filter_in_chain_t *tee = (cf_filter_filter_in_chain_t *)brf_ArenaAlloc(arena, sizeof(cf_filter_filter_in_chain_t));
+
+    if (tee && brf_CacheBegin(cache_key, papplJobGetID(job), tee))
+    {
+      cache_tee = tee->parameters;
+      cupsArrayAdd(chain, tee);
+    }
   }
 
   print_params->device = device;
   print_params->device_uri = device_uri;
   print_params->job = job;
   print_params->global_data = global_data;
+  print_params->start = start;
   print->function = brf_print_filter_function;
   print->parameters = print_params;
   print->name = "Backend";
@@ -954,8 +1024,9 @@ BRFTestFilterCB(
 
   papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Filter chain set up");
 
-  // Fire up the filter functions
-  papplJobSetImpressions(job, 1);
+  // Fire up the filter functions, estimating the pages so clients can show
+  // the progress and the end of the job
+  papplJobSetImpressions(job, brf_EtaEstimatePages(job));
   nullfd = open("/dev/null", O_RDWR);
 
   if (cfFilterChain(fd, nullfd, 1, filter_data, chain) == 0)
@@ -968,13 +1039,127 @@ BRFTestFilterCB(
     papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "cfFilterChain() failed");
   }
 
+  // Fold the measured stage costs into the planned paths
+  brf_GraphUpdate();
+
+  // The throughput of the printer steers the jobs of its pool
+  if (ret && !fstat(fd, &fileinfo))
+    brf_PoolRecord(printer, (size_t)fileinfo.st_size, brf_GetTime() - start);
+
+  // Print the converted output of a pool job as volumes on its printers
+  if (ret && brf_PoolIsPool(printer))
+    ret = brf_PoolSplit(job);
+
+  if (cache_tee && ret)
+    brf_CacheCommit(cache_key, cache_tee);
+  else if (cache_tee)
+    brf_CacheAbort(cache_tee);
+
+  finish:
+
+  if (louis_tables[0])
+    brf_LouisRelease(louis_tables);
+
+  // The device outlives the job, don't leave it pointing into the arena
+  if (device_data)
+    device_data->filter_data = NULL;
+
+  cupsArrayDelete(chain);
+  brf_ArenaDelete(arena);
   papplJobDeletePrintOptions(job_options);
 
-  close(fd);
-  close(nullfd);
+  if (fd >= 0)
+    close(fd);
+  if (nullfd >= 0)
+    close(nullfd);
+
   return ret;
 }
 
+//
+// 'brf_print_device_fd()' - Get the file descriptor behind the output device.
+//
+// Only devices that hand out their descriptor can be written directly, which
+// currently is the pipe into a CUPS backend ("cups:" URIs).  PAPPL keeps the
+// descriptors of its own file, socket and USB devices private.
+//
+
+static int brf_print_device_fd(brf_print_filter_function_data_t *params)
+{
+  brf_cups_device_data_t *device_data;
+
+  if (!params->device_uri || strncmp(params->device_uri, "cups:", 5))
+    return (-1);
+
+  if ((device_data = (brf_cups_device_data_t *)papplDeviceGetData(params->device)) == NULL)
+    return (-1);
+
+  return (device_data->inputfd);
+}
+
+//
+// 'brf_print_zero_copy()' - Copy the job data to the device in the kernel.
+//
+// A spool or cache file goes out with copy_file_range() or sendfile(), a pipe
+// from the filter chain with splice().  Returns the number of bytes copied,
+// or -1 when nothing could be copied this way.  The input offset has advanced
+// by the bytes copied, so the caller can finish a partial copy with read()
+// and write().
+//
+
+static ssize_t brf_print_zero_copy(int inputfd, int devicefd)
+{
+  struct stat instat;
+  ssize_t bytes, total = 0;
+  bool use_range = true;
+
+  if (fstat(inputfd, &instat))
+    return (-1);
+
+  for (;;)
+  {
+    if (S_ISREG(instat.st_mode) && use_range)
+    {
+      if ((bytes = copy_file_range(inputfd, NULL, devicefd, NULL, 1 << 30, 0)) < 0 && errno != EINTR && errno != EAGAIN)
+      {
+        // Not a file on the other end, use sendfile() instead
+        use_range = false;
+        continue;
+      }
+    }
+    else if (S_ISREG(instat.st_mode))
+    {
+      if ((bytes = sendfile(devicefd, inputfd, NULL, 1 << 30)) < 0 && (errno == EINVAL || errno == ENOSYS))
+        break;
+    }
+    else if (S_ISFIFO(instat.st_mode))
+    {
+      if ((bytes = splice(inputfd, NULL, devicefd, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0 && (errno == EINVAL || errno == ENOSYS))
+        break;
+    }
+    else
+      break;
+
+    if (bytes < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      break;
+    }
+    else if (bytes == 0)
+      return (total);
+
+    total += bytes;
+  }
+
+  return (total > 0 ? total : -1);
+}
+
+//
+// 'brf_print_filter_function()' - Send the BRF data to the device.
+//
+
 int brf_print_filter_function(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters)
 {
   ssize_t bytes;
@@ -988,6 +1173,17 @@ int brf_print_filter_function(int inputfd, int outputfd, int inputseekable, cf_f
   brf_printer_app_global_data_t *global_data = params->global_data;
   char filename[2048];
   int debug_fd = -1;
+  int device_fd;
+  size_t total = 0;
+  bool zero_copy = false;
+  double start = brf_GetTime(), elapsed;
+  brf_spool_t *spool;
+  struct stat instat;
+  bool spool_copied = false;
+  int pages = 0;
+  brf_writer_t *writer = NULL;
+  brf_writer_stats_t writer_stats = {0};
+  bool failed = false;
 
   // if (papplSystemGetLogLevel(global_data->system) == PAPPL_LOGLEVEL_DEBUG) {
   //     printer = papplJobGetPrinter(job);
@@ -995,6 +1191,40 @@ int brf_print_filter_function(int inputfd, int outputfd, int inputseekable, cf_f
   //     debug_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
   // }
 
+  // Keep a copy of the output for resuming the job from a later page; a
+  // spool or cache file is copied up front so it can still go out zero-copy
+  if ((spool = brf_SpoolBegin(papplJobGetID(job), papplJobGetTimeCreated(job))) != NULL && !fstat(inputfd, &instat) && S_ISREG(instat.st_mode) && !(spool_copied = brf_SpoolCopy(spool, inputfd)))
+  {
+    brf_SpoolAbort(spool);
+    spool = NULL;
+  }
+
+  // Let the kernel move the data when the device exposes its descriptor, a
+  // pipe from the filter chain is spooled on the way
+  if (debug_fd < 0 && (device_fd = brf_print_device_fd(params)) >= 0)
+  {
+    double first_byte = brf_GetTime() - params->start;
+                                  // Time until the data starts moving
+
+    papplDeviceFlush(device);
+
+    if (spool && !spool_copied)
+      bytes = !fstat(inputfd, &instat) && S_ISFIFO(instat.st_mode) ? brf_SpoolSplice(spool, inputfd, device_fd) : -1;
+    else
+      bytes = brf_print_zero_copy(inputfd, device_fd);
+
+    if (bytes > 0)
+    {
+      total += (size_t)bytes;
+      zero_copy = true;
+      brf_MetricsObserve(BRF_METRIC_FIRST_BYTE, data->printer, NULL, first_byte);
+    }
+  }
+
+  // Keep reading from the filter chain while the device is busy
+  if (!zero_copy)
+    writer = brf_WriterCreate(device, params->start, false);
+
   while ((bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
   {
     if (debug_fd >= 0)
@@ -1007,20 +1237,126 @@ int brf_print_filter_function(int inputfd, int outputfd, int inputseekable, cf_f
       }
     }
 
-    if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
+    if (spool && !spool_copied && !brf_SpoolWrite(spool, buffer, (size_t)bytes))
+    {
+      brf_SpoolAbort(spool);
+      spool = NULL;
+    }
+
+    if (writer ? !brf_WriterWrite(writer, buffer, (size_t)bytes) : papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
     {
-      return 1;
+      failed = true;
+      break;
     }
+
+    total += (size_t)bytes;
+  }
+
+  if (writer)
+  {
+    if (!brf_WriterFinish(writer, &writer_stats))
+      failed = true;
+
+    total = writer_stats.bytes;
+
+    if (writer_stats.bytes > 0)
+      brf_MetricsObserve(BRF_METRIC_FIRST_BYTE, data->printer, NULL, writer_stats.first_dot);
+
+    if (!failed && log)
+      log(ld, CF_LOGLEVEL_INFO, "Time to first dot %.3fs, %d pages sent as they completed in %lu device writes at %.0f bytes/s, reader waited %.3fs for the device (%lu times).", writer_stats.first_dot, writer_stats.pages, writer_stats.writes, writer_stats.rate, writer_stats.stall_time, writer_stats.stalls);
+  }
+
+  if (failed)
+  {
+    // Spool the rest of the job so it can be resumed where it stopped
+    if (spool && !spool_copied)
+    {
+      while ((bytes = read(inputfd, buffer, sizeof(buffer))) > 0)
+      {
+        if (!brf_SpoolWrite(spool, buffer, (size_t)bytes))
+          break;
+      }
+    }
+
+    if (spool && (pages = brf_SpoolFinish(spool)) >= 0 && log)
+      log(ld, CF_LOGLEVEL_ERROR, "Device failed after %lu bytes, %d pages spooled for resuming job %d.", (unsigned long)total, pages, papplJobGetID(job));
+
+    return 1;
   }
 
   papplDeviceFlush(device);
 
+  if (spool && (pages = brf_SpoolFinish(spool)) >= 0 && log)
+    log(ld, CF_LOGLEVEL_DEBUG, "Spooled %d pages for resuming job %d.", pages, papplJobGetID(job));
+
+  // Learn the speed of the printer for the estimates of later jobs
+  brf_EtaRecord(job, params->device_uri, total, pages > 0 ? pages : writer_stats.pages, brf_GetTime() - params->start);
+
+  elapsed = brf_GetTime() - start;
+  if (elapsed > 0.0 && total > 0)
+    brf_MetricsObserve(BRF_METRIC_DEVICE_RATE, data->printer, NULL, total / elapsed);
+
+  if (log)
+    log(ld, CF_LOGLEVEL_DEBUG, "Sent %lu bytes to the device in %.3fs (%.1f MB/s, %s).", (unsigned long)total, elapsed, elapsed > 0.0 ? total / elapsed / 1048576.0 : 0.0, zero_copy ? "zero-copy" : "buffered");
+
   if (debug_fd >= 0)
     close(debug_fd);
   return 0;
 }
 
 
+//
+// 'brf_GetTime()' - Get the current monotonic time in seconds.
+//
+
+double brf_GetTime(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0);
+}
+
+//
+// 'brf_SharedAlloc()' - Allocate zeroed memory that is shared with the
+//                       filter processes forked by cfFilterChain().
+//
+
+void *brf_SharedAlloc(size_t size)
+{
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  return (ptr == MAP_FAILED ? NULL : ptr);
+}
+
+//
+// 'brf_WriteAll()' - Write a buffer to a file descriptor, retrying short and
+//                    interrupted writes.
+//
+
+ssize_t brf_WriteAll(int fd, const void *buffer, size_t bytes)
+{
+  const char *ptr = (const char *)buffer;
+  ssize_t written;
+
+  while (bytes > 0)
+  {
+    if ((written = write(fd, ptr, bytes)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      return (-1);
+    }
+
+    ptr += written;
+    bytes -= (size_t)written;
+  }
+
+  return ((ssize_t)(ptr - (const char *)buffer));
+}
+
 //
 // 'brf_JobIsCanceled()' - Return 1 if the job is canceled, which is
 //                        the case when papplJobIsCanceled() returns
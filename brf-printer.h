@@ -1,3 +1,5 @@
+#ifndef BRF_PRINTER_H
+#  define BRF_PRINTER_H
 #include <pappl/pappl.h>
 #include <cupsfilters/filter.h>
 #include <ppd/ppd-filter.h>
@@ -8,6 +10,12 @@ extern int brf_JobIsCanceled(void *data);
 
 void brf_JobLog(void *data,cf_loglevel_t level,const char *message,...);
 
+double brf_GetTime(void);
+
+void *brf_SharedAlloc(size_t size);
+
+ssize_t brf_WriteAll(int fd, const void *buffer, size_t bytes);
+
 typedef struct brf_spooling_conversion_s
 {
     char *srctype;                         // Input data type
@@ -16,6 +24,219 @@ typedef struct brf_spooling_conversion_s
                                            // parameters
 } brf_spooling_conversion_t;
 
+// MIME type detection (brf-mime.c)
+
+typedef struct brf_mime_stats_s
+{
+  unsigned long detections, // Number of documents typed
+      sniffed;              // Number typed by the built-in signatures
+  double last_time,         // Duration of the last detection (seconds)
+      total_time,           // Total detection time (seconds)
+      max_time;             // Slowest detection (seconds)
+  int num_handles;          // Number of loaded libmagic handles
+} brf_mime_stats_t;
+
+bool brf_MimeInit(pappl_system_t *system, brf_spooling_conversion_t *conversions);
+const char *brf_MimeSniff(const unsigned char *header, size_t headersize);
+const char *brf_MimeDetect(const unsigned char *header, size_t headersize);
+void brf_MimeGetStats(brf_mime_stats_t *stats);
+void brf_MimeShutdown(void);
+
+// Conversion graph (brf-graph.c)
+
+bool brf_GraphInit(pappl_system_t *system, brf_spooling_conversion_t *conversions, const char *target);
+bool brf_GraphCanConvert(const char *mime_type);
+bool brf_GraphPlan(const char *mime_type, cups_array_t *chain);
+void brf_GraphUpdate(void);
+
+// Job options (brf-options.c)
+
+typedef struct brf_geometry_s
+{
+  int cells_per_line,       // Cells per line inside the margins
+      lines_per_page;       // Lines per page inside the margins
+  int top_margin,           // Blank lines at the top of a page
+      bottom_margin,        // Blank lines at the bottom of a page
+      left_margin,          // Blank cells at the start of a line
+      right_margin;         // Blank cells at the end of a line
+  int dots;                 // Dots per cell (6 or 8)
+  int cell_width,           // Width of a cell (1/100mm)
+      line_height;          // Height of a line (1/100mm)
+} brf_geometry_t;
+
+bool brf_GetBoolOption(const char *name, bool defvalue, int num_options, cups_option_t *options);
+int brf_GetIntOption(const char *name, int defvalue, int num_options, cups_option_t *options);
+void brf_GetGeometry(int num_options, cups_option_t *options, brf_geometry_t *geometry);
+int brf_GetJobOptions(pappl_job_t *job, int num_options, cups_option_t **options);
+void brf_InvalidateJobOptions(pappl_printer_t *printer);
+
+// Image conversion (brf-image.c)
+
+#define BRF_IMAGE_FILTER_NAME "pixtobrf"
+#define BRF_IMAGE_UBRL "ubrl"
+
+int brf_ImageFilter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// Pagination (brf-paginate.c)
+
+#define BRF_PAGINATE_FILTER_NAME "brftopaged"
+#define BRF_PAGINATE_FORMAT "application/vnd.cups-paged-brf"
+#define BRF_PAGINATE_UBRL "ubrl"
+
+typedef struct brf_paginator_s brf_paginator_t;
+
+int brf_PaginateFilter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+bool brf_PaginateFinish(brf_paginator_t *paginator);
+brf_paginator_t *brf_PaginateStart(pappl_job_t *job, int fd, int *pagedfd);
+
+// Generic BRF driver (generic-brf.c)
+
+bool brf_GenPrintPaged(pappl_job_t *job, pappl_device_t *device, void *data);
+
+// liblouis translation (brf-louis.c)
+
+#define BRF_LOUIS_FILTER_NAME "louistobrf"
+
+typedef struct brf_louis_stats_s
+{
+  unsigned long hits,       // Jobs that found their tables compiled
+      misses;               // Jobs that had to compile their tables
+  int num_tables;           // Number of compiled table lists
+  size_t bytes;             // Memory used by the compiled tables
+} brf_louis_stats_t;
+
+bool brf_LouisAcquire(const char *tables);
+int brf_LouisFilter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+char *brf_LouisGetTables(int num_options, cups_option_t *options, char *buffer, size_t bufsize);
+void brf_LouisGetStats(brf_louis_stats_t *stats);
+void brf_LouisInit(void);
+void brf_LouisPrewarm(pappl_system_t *system);
+void brf_LouisRelease(const char *tables);
+
+// Translation result cache (brf-cache.c)
+
+typedef struct brf_cache_stats_s
+{
+  unsigned long memory_hits, // Results served from memory
+      disk_hits,             // Results served from the cache directory
+      misses,                // Documents that had to be converted
+      evictions;             // Results removed to stay within the budget
+  int num_entries;           // Number of cached results
+  size_t bytes,              // Size of all cached results
+      memory_bytes;          // Size of the results kept in memory
+} brf_cache_stats_t;
+
+void brf_CacheAbort(void *tee);
+bool brf_CacheBegin(const char *key, int job_id, cf_filter_filter_in_chain_t *filter);
+void brf_CacheCommit(const char *key, void *tee);
+void brf_CacheGetStats(brf_cache_stats_t *stats);
+bool brf_CacheInit(pappl_system_t *system, const char *directory, size_t max_bytes, size_t max_memory);
+bool brf_CacheKey(int fd, const char *format, int num_options, cups_option_t *options, char *key, size_t keysize);
+int brf_CacheOpen(const char *key);
+int brf_CacheTeeFilter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+
+// Spooled output and page resume (brf-spool.c)
+
+typedef struct brf_spool_s brf_spool_t;
+
+void brf_SpoolAbort(brf_spool_t *spool);
+brf_spool_t *brf_SpoolBegin(int job_id, time_t created);
+bool brf_SpoolCopy(brf_spool_t *spool, int fd);
+bool brf_SpoolExtract(int job_id, time_t created, int first, int last, char *filename, size_t filesize, char *message, size_t msgsize);
+int brf_SpoolFinish(brf_spool_t *spool);
+char *brf_SpoolGetDirectory(int num_options, cups_option_t *options, char *buffer, size_t bufsize);
+int brf_SpoolGetPages(int job_id, time_t created);
+bool brf_SpoolInit(pappl_system_t *system, const char *spool_dir);
+int brf_SpoolResumeCommand(const char *base_name, int num_options, cups_option_t *options, int num_files, char **files, void *data);
+ssize_t brf_SpoolSplice(brf_spool_t *spool, int inputfd, int devicefd);
+bool brf_SpoolWrite(brf_spool_t *spool, const void *buffer, size_t bytes);
+
+// Pipelined device output (brf-writer.c)
+
+typedef struct brf_writer_s brf_writer_t;
+
+typedef struct brf_writer_stats_s
+{
+  size_t bytes;             // Bytes sent to the device
+  int pages;                // Pages sent (form feeds, 0 for raw data)
+  unsigned long writes,     // Device writes after coalescing
+      stalls;               // Times the producer waited for the device
+  double first_dot,         // Seconds from the start of the job to the
+                            // first data reaching the device
+      stall_time,           // Seconds the producer waited for the device
+      device_time,          // Seconds spent in device writes
+      rate;                 // Bytes per second while the writer ran
+} brf_writer_stats_t;
+
+brf_writer_t *brf_WriterCreate(pappl_device_t *device, double start, bool raw);
+bool brf_WriterFinish(brf_writer_t *writer, brf_writer_stats_t *stats);
+void brf_WriterFlush(brf_writer_t *writer);
+bool brf_WriterPrintf(brf_writer_t *writer, const char *format, ...) __attribute__((format(printf, 2, 3)));
+bool brf_WriterPuts(brf_writer_t *writer, const char *s);
+bool brf_WriterWrite(brf_writer_t *writer, const void *buffer, size_t bytes);
+
+// Per-job memory arena (brf-arena.c)
+
+typedef struct brf_arena_s brf_arena_t;
+
+void *brf_ArenaAlloc(brf_arena_t *arena, size_t size);
+brf_arena_t *brf_ArenaCreate(size_t block_size);
+void brf_ArenaDelete(brf_arena_t *arena);
+char *brf_ArenaStrdup(brf_arena_t *arena, const char *s);
+
+// External filter launchers (brf-launcher.c)
+
+typedef struct brf_launcher_stats_s
+{
+  char name[64];            // Filter program
+  int limit,                // Filters of this program running at once
+      waiting,              // Filters waiting for a run slot
+      running,              // Filters running
+      max_waiting;          // Most filters waiting at once
+  unsigned long runs,       // Completed runs
+      failures;             // Runs with a non-zero exit status
+  double wait_time,         // Total seconds waiting for a run slot
+      max_wait,             // Longest wait
+      run_time,             // Total seconds running
+      max_run;              // Longest run
+} brf_launcher_stats_t;
+
+int brf_LauncherFilter(int inputfd, int outputfd, int inputseekable, cf_filter_data_t *data, void *parameters);
+double brf_LauncherGetCPUTime(void);
+int brf_LauncherGetStats(brf_launcher_stats_t *stats, int max_stats);
+bool brf_LauncherInit(pappl_system_t *system, brf_spooling_conversion_t *conversions, int num_launchers, int limit);
+
+// Printer pools (brf-pool.c)
+
+bool brf_PoolForward(pappl_job_t *job);
+int brf_PoolGetVolumePages(pappl_job_t *job);
+bool brf_PoolInit(pappl_system_t *system, const char *spool_dir, bool split);
+bool brf_PoolIsPool(pappl_printer_t *printer);
+void brf_PoolPrintersChanged(void);
+void brf_PoolRecord(pappl_printer_t *printer, size_t bytes, double seconds);
+bool brf_PoolSplit(pappl_job_t *job);
+
+// Job estimates (brf-eta.c)
+
+int brf_EtaEstimatePages(pappl_job_t *job);
+int brf_EtaGetPPM(const char *device_uri);
+bool brf_EtaInit(pappl_system_t *system, const char *spool_dir);
+void brf_EtaRecord(pappl_job_t *job, const char *device_uri, size_t chars, int pages, double seconds);
+
+// Stage latency metrics (brf-metrics.c)
+
+typedef enum brf_metric_e
+{
+  BRF_METRIC_QUEUE_WAIT,    // Seconds from job creation to processing
+  BRF_METRIC_DETECT,        // Seconds to detect the MIME type of a document
+  BRF_METRIC_FILTER,        // Seconds of one filter of the chain
+  BRF_METRIC_FIRST_BYTE,    // Seconds from job start to the first byte sent
+  BRF_METRIC_DEVICE_RATE    // Bytes/second of the device writes of a job
+} brf_metric_t;
+
+bool brf_MetricsInit(pappl_system_t *system);
+void brf_MetricsObserve(brf_metric_t metric, const char *printer, const char *stage, double value);
+
 typedef struct brf_printer_app_config_s
 {
   // Identification of the Printer Application
@@ -64,6 +285,7 @@ typedef struct brf_print_filter_function_data_s
   const char *device_uri;                     // Printer device URI
   pappl_job_t *job;                           // Job
   brf_printer_app_global_data_t *global_data; // Global data
+  double start;                               // Start of the job
 } brf_print_filter_function_data_t;
 
 typedef struct brf_cups_device_data_s
@@ -97,16 +319,6 @@ static cf_filter_external_t texttobrf_filter = {
 
 // pdf_to_brf comes in texttobrf_filter
 
-static cf_filter_external_t brftopagedbrf_filter = {
-
-    .filter = "/usr/lib/cups/filter/brftopagedbrf",
-    .envp =   (char *[]) {
-            "PPD=/dev/null", 
-            "CONTENT_TYPE=application/vnd.cups-brf",  
-            NULL
-        }
-};
-
 static cf_filter_external_t imagetobrf_filter = {
 
     .filter = "/usr/lib/cups/filter/imagetobrf",
@@ -217,133 +429,133 @@ static brf_spooling_conversion_t converts[] =
     {
         "text/plain",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter,"texttobrf"}
+            {brf_LouisFilter, NULL, BRF_LOUIS_FILTER_NAME}
     },
 
     {
         "text/html",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter,"texttobrf"}
+            {brf_LouisFilter, NULL, BRF_LOUIS_FILTER_NAME}
     },
     {
         "application/xhtml",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter,"texttobrf"}
+            {brf_LouisFilter, NULL, BRF_LOUIS_FILTER_NAME}
     },
     {
         "application/xml",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter,"texttobrf"}
+            {brf_LouisFilter, NULL, BRF_LOUIS_FILTER_NAME}
     },
     {
         "application/sgml",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter,"texttobrf"}
+            {brf_LouisFilter, NULL, BRF_LOUIS_FILTER_NAME}
     },
 
     {
         "application/vnd.cups-brf",
         "application/vnd.cups-paged-brf",
-            {cfFilterExternal, &brftopagedbrf_filter, "brftopagedbrf"}
+            {brf_PaginateFilter, NULL, BRF_PAGINATE_FILTER_NAME}
     },
     {
         "application/vnd.cups-ubrl",
         "application/vnd.cups-paged-ubrl",
-            {cfFilterExternal, &brftopagedbrf_filter, "brftopagedbrf"}
+            {brf_PaginateFilter, BRF_PAGINATE_UBRL, BRF_PAGINATE_FILTER_NAME}
     },
    
     {
         "application/msword",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
+            {brf_LauncherFilter, &texttobrf_filter, "texttobrf"}
     },
    {
         "text/rtf",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
+            {brf_LauncherFilter, &texttobrf_filter, "texttobrf"}
     },
     {
         "application/rtf",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
+            {brf_LauncherFilter, &texttobrf_filter, "texttobrf"}
     },
 
     {
         "application/pdf",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &texttobrf_filter, "texttobrf"}
+            {brf_LauncherFilter, &texttobrf_filter, "texttobrf"}
     },
 
 
     {
         "image/gif",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_LauncherFilter, &imagetobrf_filter, "imagetobrf"}
     },
     {
         "image/jpeg",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_ImageFilter, NULL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/pcx",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_LauncherFilter, &imagetobrf_filter, "imagetobrf"}
     },
     {
         "image/png",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_ImageFilter, NULL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/tiff",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_LauncherFilter, &imagetobrf_filter, "imagetobrf"}
     },
     {
         "image/vnd.microsoft.icon",
-        "application/vnd.cups-brff",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+        "application/vnd.cups-brf",
+            {brf_LauncherFilter, &imagetobrf_filter, "imagetobrf"}
     },
     {
         "image/x-ms-bmp",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_LauncherFilter, &imagetobrf_filter, "imagetobrf"}
     },
 {
         "image/x-portable-anymap",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_ImageFilter, NULL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/x-portable-bitmap",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_ImageFilter, NULL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/x-portable-graymap",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_ImageFilter, NULL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/x-portable-pixmap",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_ImageFilter, NULL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/x-xbitmap",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_LauncherFilter, &imagetobrf_filter, "imagetobrf"}
     },
     {
         "image/x-xpixmap",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_LauncherFilter, &imagetobrf_filter, "imagetobrf"}
     },
     {
         "image/x-xwindowdump",
         "application/vnd.cups-brf",
-            {cfFilterExternal, &imagetobrf_filter, "imagetobrf"}
+            {brf_LauncherFilter, &imagetobrf_filter, "imagetobrf"}
     },
 
     
@@ -351,148 +563,150 @@ static brf_spooling_conversion_t converts[] =
    {
         "image/gif",
         "application/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_LauncherFilter, &imagetoubrl_filter, "imagetoubrl"}
     },
     {
         "image/pcx",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_LauncherFilter, &imagetoubrl_filter, "imagetoubrl"}
     },
     {
         "image/png",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_ImageFilter, BRF_IMAGE_UBRL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/tiff",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_LauncherFilter, &imagetoubrl_filter, "imagetoubrl"}
     },
     {
         "image/jpeg",
         "application/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_ImageFilter, BRF_IMAGE_UBRL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/vnd.microsoft.icon",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_LauncherFilter, &imagetoubrl_filter, "imagetoubrl"}
     },
     {
         "image/x-ms-bmp",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetobrf"}
+            {brf_LauncherFilter, &imagetoubrl_filter, "imagetobrf"}
     },
     {
         "image/x-portable-anymap",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_ImageFilter, BRF_IMAGE_UBRL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/x-portable-bitmap",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_ImageFilter, BRF_IMAGE_UBRL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/x-portable-graymap",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_ImageFilter, BRF_IMAGE_UBRL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/x-portable-pixmap",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_ImageFilter, BRF_IMAGE_UBRL, BRF_IMAGE_FILTER_NAME}
     },
     {
         "image/x-xbitmap",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_LauncherFilter, &imagetoubrl_filter, "imagetoubrl"}
     },
     {
         "image/x-xpixmap",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_LauncherFilter, &imagetoubrl_filter, "imagetoubrl"}
     },
     {
         "image/x-xwindowdump",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &imagetoubrl_filter, "imagetoubrl"}
+            {brf_LauncherFilter, &imagetoubrl_filter, "imagetoubrl"}
     },
 
 
     {
         "image/svg",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &svgtopdf_filter, "svgtopdf"}
+            {brf_LauncherFilter, &svgtopdf_filter, "svgtopdf"}
     },
 
     {
         "image/svg+xml",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &svgtopdf_filter, "svgtopdf"}
+            {brf_LauncherFilter, &svgtopdf_filter, "svgtopdf"}
     },
 
     {
         "application/x-xfig",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &xfigtopdf_filter, "xfigtopdf"}
+            {brf_LauncherFilter, &xfigtopdf_filter, "xfigtopdf"}
     },
 
     {
         "image/wmf",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
+            {brf_LauncherFilter, &wmftopdf_filter, "wmftopdf"}
     },
 
     {
         "image/x-wmf",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
+            {brf_LauncherFilter, &wmftopdf_filter, "wmftopdf"}
     },
 
     {
         "windows/metafile",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
+            {brf_LauncherFilter, &wmftopdf_filter, "wmftopdf"}
     },
     {
         "application/x-msmetafile",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &wmftopdf_filter, "wmftopdf"}
+            {brf_LauncherFilter, &wmftopdf_filter, "wmftopdf"}
     },
     {
         "image/emf",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &emftopdf_filter, "emftopdf"}
+            {brf_LauncherFilter, &emftopdf_filter, "emftopdf"}
     },
     {
         "image/x-emf",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &emftopdf_filter, "emftopdf"}
+            {brf_LauncherFilter, &emftopdf_filter, "emftopdf"}
     },
     {
         "image/cgm",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &cgmtopdf_filter, "cgmtopdf"}
+            {brf_LauncherFilter, &cgmtopdf_filter, "cgmtopdf"}
     },
 
     {
         "image/x-cmx",
         "image/vnd.cups-pdf",
-            {cfFilterExternal, &cmxtopdf_filter, "cmxtopdf"}
+            {brf_LauncherFilter, &cmxtopdf_filter, "cmxtopdf"}
     },
 
     {
         "image/vnd.cups-pdf",
-        "image/vnd.cups-brf",
-            {cfFilterExternal, &vectortobrf_filter, "vectortobrf"}
+        "application/vnd.cups-brf",
+            {brf_LauncherFilter, &vectortobrf_filter, "vectortobrf"}
     },
     {
         "image/vnd.cups-pdf",
         "image/vnd.cups-ubrl",
-            {cfFilterExternal, &vectortoubrl_filter, "vectortoubrl"}
+            {brf_LauncherFilter, &vectortoubrl_filter, "vectortoubrl"}
     },
     {
     NULL
     }
 };
+
+#endif // !BRF_PRINTER_H
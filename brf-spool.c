@@ -0,0 +1,1052 @@
+//
+// Spooled output and page resume for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_SPOOL_MAGIC "BRFIDX1\n"     // Index file signature
+#define BRF_SPOOL_MAX_AGE (24 * 60 * 60)
+                                        // Seconds a spooled job is kept
+#define BRF_SPOOL_RESOURCE "/brf-resume"
+                                        // Resume page of the web interface
+#define BRF_SPOOL_SCAN_SIZE (1024 * 1024)
+                                        // Window for indexing spooled files
+#define BRF_SPOOL_SPLICE_SIZE (1024 * 1024)
+                                        // Maximum bytes in one splice()
+
+// Local types...
+
+struct brf_spool_s                      // Spooled output of a job
+{
+  int job_id;                           // Job ID
+  time_t created;                       // Creation time of the job
+  int fd;                               // Temporary output file
+  char filename[1024];                  // Temporary output filename
+  off_t offset;                         // Bytes spooled
+  off_t page_start;                     // Offset of the current page
+  unsigned char *index;                 // Page lengths (LEB128)
+  size_t index_used,                    // Bytes used in index
+      index_alloc;                      // Bytes allocated for index
+  int pages;                            // Completed pages
+  bool error;                           // Did spooling fail?
+};
+
+typedef struct brf_spool_job_s          // Spooled job for the web page
+{
+  int job_id;                           // Job ID
+  time_t created;                       // Creation time of the job
+  int pages;                            // Number of pages
+  off_t size;                           // Size of the output
+  time_t mtime;                         // Time it was spooled
+} brf_spool_job_t;
+
+// Local globals...
+
+static char brf_spool_directory[1024] = "";
+                                        // Directory for spooled jobs
+
+// Local functions...
+
+static bool brf_spool_add_page(brf_spool_t *spool, off_t end);
+static int brf_spool_compare_jobs(const void *a, const void *b);
+static void brf_spool_filename(int job_id, time_t created, const char *ext, char *filename, size_t filesize);
+static time_t brf_spool_find(int job_id, time_t created);
+static void brf_spool_index(brf_spool_t *spool, const unsigned char *data, size_t bytes);
+static int brf_spool_load(int job_id, time_t created, off_t **pages);
+static void brf_spool_prune(void);
+static bool brf_spool_splice(brf_spool_t *spool, int pipefd, size_t bytes);
+static bool brf_spool_web(pappl_client_t *client, void *data);
+static void brf_spool_web_printer(pappl_printer_t *printer, void *data);
+
+// 'brf_SpoolAbort()' - Discard a spool that was not completed.
+
+void
+brf_SpoolAbort(brf_spool_t *spool)      // I - Spool
+{
+  if (!spool)
+    return;
+
+  close(spool->fd);
+  unlink(spool->filename);
+  free(spool->index);
+  free(spool);
+}
+
+// 'brf_SpoolBegin()' - Start spooling the output of a job.
+//
+// The output is kept under the job ID and creation time of the job, as job
+// IDs may be used again after a restart.  Returns `NULL` when spooling is
+// disabled or the file cannot be created.
+
+brf_spool_t *                           // O - Spool or `NULL`
+brf_SpoolBegin(int job_id,              // I - Job ID
+               time_t created)          // I - Creation time of the job
+{
+  brf_spool_t *spool;                   // Spool
+
+  if (!brf_spool_directory[0])
+    return (NULL);
+
+  brf_spool_prune();
+
+  if ((spool = (brf_spool_t *)calloc(1, sizeof(brf_spool_t))) == NULL)
+    return (NULL);
+
+  spool->job_id  = job_id;
+  spool->created = created;
+
+  brf_spool_filename(job_id, created, "tmp", spool->filename, sizeof(spool->filename));
+
+  // Read access is needed to index spliced data
+  if ((spool->fd = open(spool->filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    free(spool);
+    return (NULL);
+  }
+
+  return (spool);
+}
+
+// 'brf_SpoolCopy()' - Spool a complete output file.
+//
+// The file is copied with copy_file_range() at explicit offsets, so the file
+// offset of `fd` is left alone for sending the same data to the device.  The
+// copy is then mapped in windows to find the page breaks.
+
+bool                                    // O - `true` on success
+brf_SpoolCopy(brf_spool_t *spool,       // I - Spool
+              int fd)                   // I - Regular file to spool
+{
+  struct stat fileinfo;                 // File information
+  loff_t inoffset = 0;                  // Input offset
+  ssize_t bytes;                        // Bytes copied
+  off_t offset;                         // Offset of the current window
+  size_t length;                        // Length of the current window
+  void *data;                           // Mapped window
+
+  if (fstat(fd, &fileinfo) || !S_ISREG(fileinfo.st_mode))
+    return (false);
+
+  while (inoffset < fileinfo.st_size)
+  {
+    if ((bytes = copy_file_range(fd, &inoffset, spool->fd, NULL, (size_t)(fileinfo.st_size - inoffset), 0)) > 0)
+      continue;
+
+    if (bytes < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+
+    if (bytes < 0 && errno != EXDEV && errno != EINVAL && errno != ENOSYS)
+      return (false);
+
+    // Different file systems or no support, fall back to reading
+    {
+      char buffer[65536];               // Copy buffer
+
+      while ((bytes = pread(fd, buffer, sizeof(buffer), inoffset)) > 0)
+      {
+        if (brf_WriteAll(spool->fd, buffer, (size_t)bytes) < 0)
+          return (false);
+
+        inoffset += bytes;
+      }
+
+      if (bytes < 0)
+        return (false);
+    }
+    break;
+  }
+
+  for (offset = 0; offset < inoffset; offset += (off_t)length)
+  {
+    length = (size_t)(inoffset - offset) > BRF_SPOOL_SCAN_SIZE ? BRF_SPOOL_SCAN_SIZE : (size_t)(inoffset - offset);
+
+    if ((data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, offset)) == MAP_FAILED)
+      return (false);
+
+    brf_spool_index(spool, (unsigned char *)data, length);
+    munmap(data, length);
+  }
+
+  return (true);
+}
+
+// 'brf_SpoolExtract()' - Extract a range of pages from the output of a job.
+//
+// The pages of the spooled job are copied to a new file in the spool
+// directory, ready to be printed as BRF_PAGINATE_FORMAT.  Without a creation
+// time the latest output spooled for the job ID is used.
+
+bool                                    // O - `true` on success
+brf_SpoolExtract(int job_id,            // I - Job ID
+                 time_t created,        // I - Creation time of the job or 0
+                 int first,             // I - First page to print (1-based)
+                 int last,              // I - Last page to print or 0 for the end
+                 char *filename,        // I - Filename buffer
+                 size_t filesize,       // I - Size of filename buffer
+                 char *message,         // I - Error message buffer
+                 size_t msgsize)        // I - Size of error message buffer
+{
+  char srcname[1024];                   // Spooled output
+  off_t *pages,                         // End offset of each page
+      offset,                           // Start of the first page
+      end;                              // End of the last page
+  int num_pages,                        // Number of pages
+      srcfd,                            // Spooled output file
+      dstfd;                            // Extracted pages
+  struct stat srcinfo;                  // Spooled output information
+  ssize_t bytes;                        // Bytes copied
+
+  if ((created = brf_spool_find(job_id, created)) == 0 || (num_pages = brf_spool_load(job_id, created, &pages)) < 0)
+  {
+    snprintf(message, msgsize, "Job %d has no spooled output.", job_id);
+    return (false);
+  }
+
+  if (first < 1 || first > num_pages || (last && (last < first || last > num_pages)))
+  {
+    snprintf(message, msgsize, "Job %d has %d pages, cannot print from page %d.", job_id, num_pages, first);
+    free(pages);
+    return (false);
+  }
+
+  offset = first > 1 ? pages[first - 2] : 0;
+  end    = last ? pages[last - 1] : -1;
+  free(pages);
+
+  brf_spool_filename(job_id, created, "brf", srcname, sizeof(srcname));
+
+  if ((srcfd = open(srcname, O_RDONLY | O_CLOEXEC)) < 0 || fstat(srcfd, &srcinfo))
+  {
+    snprintf(message, msgsize, "Unable to open '%s': %s", srcname, strerror(errno));
+    if (srcfd >= 0)
+      close(srcfd);
+    return (false);
+  }
+
+  if (end < 0 || end > srcinfo.st_size)
+    end = srcinfo.st_size;
+
+  if (last)
+    snprintf(filename, filesize, "%s/%d-%ld-%d-%d.brf", brf_spool_directory, job_id, (long)created, first, last);
+  else
+    snprintf(filename, filesize, "%s/%d-%ld-%d.brf", brf_spool_directory, job_id, (long)created, first);
+
+  if ((dstfd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    snprintf(message, msgsize, "Unable to create '%s': %s", filename, strerror(errno));
+    close(srcfd);
+    return (false);
+  }
+
+  while (offset < end)
+  {
+    if ((bytes = copy_file_range(srcfd, &offset, dstfd, NULL, (size_t)(end - offset), 0)) > 0)
+      continue;
+
+    if (bytes < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+
+    if (bytes < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS))
+    {
+      char buffer[65536];               // Copy buffer
+
+      while (offset < end && (bytes = pread(srcfd, buffer, (size_t)(end - offset) < sizeof(buffer) ? (size_t)(end - offset) : sizeof(buffer), offset)) > 0)
+      {
+        if (brf_WriteAll(dstfd, buffer, (size_t)bytes) < 0)
+          break;
+
+        offset += bytes;
+      }
+    }
+    break;
+  }
+
+  close(srcfd);
+
+  if (close(dstfd) || offset < end)
+  {
+    snprintf(message, msgsize, "Unable to write '%s': %s", filename, strerror(errno));
+    unlink(filename);
+    return (false);
+  }
+
+  return (true);
+}
+
+// 'brf_SpoolFinish()' - Keep the spooled output and its page index.
+//
+// Returns the number of pages in the output or -1 on error.
+
+int                                     // O - Number of pages or -1
+brf_SpoolFinish(brf_spool_t *spool)     // I - Spool
+{
+  char filename[1024],                  // Output filename
+      idxname[1024],                    // Index filename
+      tmpname[1024];                    // Temporary index filename
+  int fd,                               // Index file
+      pages;                            // Number of pages
+  bool ok;                              // Wrote the index?
+
+  if (spool->error)
+  {
+    brf_SpoolAbort(spool);
+    return (-1);
+  }
+
+  // Text after the last form feed is a page of its own
+  if (spool->offset > spool->page_start && !brf_spool_add_page(spool, spool->offset))
+  {
+    brf_SpoolAbort(spool);
+    return (-1);
+  }
+
+  brf_spool_filename(spool->job_id, spool->created, "brf", filename, sizeof(filename));
+  brf_spool_filename(spool->job_id, spool->created, "idx", idxname, sizeof(idxname));
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", idxname);
+
+  if ((fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+  {
+    brf_SpoolAbort(spool);
+    return (-1);
+  }
+
+  ok = brf_WriteAll(fd, BRF_SPOOL_MAGIC, sizeof(BRF_SPOOL_MAGIC) - 1) >= 0 && brf_WriteAll(fd, spool->index, spool->index_used) >= 0;
+  ok = !close(fd) && ok;
+  ok = !close(spool->fd) && ok;
+
+  if (!ok || rename(spool->filename, filename) || rename(tmpname, idxname))
+  {
+    unlink(tmpname);
+    unlink(spool->filename);
+    unlink(filename);
+    free(spool->index);
+    free(spool);
+    return (-1);
+  }
+
+  pages = spool->pages;
+
+  free(spool->index);
+  free(spool);
+
+  return (pages);
+}
+
+// 'brf_SpoolGetDirectory()' - Get the spool directory of the application.
+
+char *                                  // O - Directory
+brf_SpoolGetDirectory(
+    int num_options,                    // I - Number of options
+    cups_option_t *options,             // I - Options
+    char *buffer,                       // I - Directory buffer
+    size_t bufsize)                     // I - Size of directory buffer
+{
+  const char *val;                      // Option or environment value
+
+  if ((val = cupsGetOption("spool-directory", num_options, options)) != NULL || (val = getenv("SPOOL_DIR")) != NULL)
+    papplCopyString(buffer, val, bufsize);
+  else
+    snprintf(buffer, bufsize, "%s/brf", (val = getenv("TMPDIR")) != NULL ? val : "/tmp");
+
+  return (buffer);
+}
+
+// 'brf_SpoolGetPages()' - Get the number of pages spooled for a job.
+
+int                                     // O - Number of pages or -1 if none
+brf_SpoolGetPages(int job_id,           // I - Job ID
+                  time_t created)       // I - Creation time of the job or 0
+{
+  off_t *pages;                         // Page index
+  int num_pages = -1;                   // Number of pages
+
+  if ((created = brf_spool_find(job_id, created)) != 0 && (num_pages = brf_spool_load(job_id, created, &pages)) >= 0)
+    free(pages);
+
+  return (num_pages);
+}
+
+// 'brf_SpoolInit()' - Set up spooling of job output.
+//
+// Spooled jobs go to the "jobs" sub-directory of `spool_dir` and are kept
+// for BRF_SPOOL_MAX_AGE seconds, also across restarts.  With a system the
+// expired output is removed and the resume page is added to the web
+// interface; without a system only the directory is set, for the "resume"
+// sub-command.
+
+bool                                    // O - `true` on success
+brf_SpoolInit(pappl_system_t *system,   // I - System or `NULL`
+              const char *spool_dir)    // I - Spool directory
+{
+  snprintf(brf_spool_directory, sizeof(brf_spool_directory), "%s/jobs", spool_dir);
+
+  if (!system)
+    return (true);
+
+  if (mkdir(brf_spool_directory, 0700) && errno != EEXIST)
+  {
+    papplLog(system, PAPPL_LOGLEVEL_WARN, "Unable to create spooled job directory '%s': %s", brf_spool_directory, strerror(errno));
+    brf_spool_directory[0] = '\0';
+    return (false);
+  }
+
+  brf_spool_prune();
+
+  papplSystemAddResourceCallback(system, BRF_SPOOL_RESOURCE, "text/html", brf_spool_web, system);
+  papplSystemAddLink(system, "Resume Job", BRF_SPOOL_RESOURCE, PAPPL_LOPTIONS_NAVIGATION | PAPPL_LOPTIONS_JOB);
+
+  return (true);
+}
+
+// 'brf_SpoolResumeCommand()' - Resume a spooled job ("resume" sub-command).
+//
+// The remaining pages are sent to the running server as a new BRF job, which
+// goes straight to the device without being converted again.
+
+int                                     // O - Exit status
+brf_SpoolResumeCommand(
+    const char *base_name,              // I - Base name of the program
+    int num_options,                    // I - Number of options
+    cups_option_t *options,             // I - Options
+    int num_files,                      // I - Number of files (unused)
+    char **files,                       // I - Files (unused)
+    void *data)                         // I - Callback data (unused)
+{
+  const char *printer,                  // Printer name
+      *val;                             // Option value
+  char spool_dir[1024],                 // Spool directory
+      filename[1024],                   // Resume file
+      message[1024],                    // Error message
+      host[256],                        // Server hostname
+      uri[1024],                        // Printer URI
+      resource[1024],                   // Resource path
+      title[256],                       // Job name
+      scheme[32],                       // URI scheme
+      userpass[256],                    // URI username:password (unused)
+      *ptr;                             // Pointer into hostname
+  int job_id,                           // Job to resume
+      page,                             // First page to print
+      port;                             // Server port
+  http_t *http;                         // Connection to the server
+  ipp_t *request,                       // Print-Job request
+      *response;                        // Print-Job response
+  ipp_attribute_t *attr;                // job-id attribute
+
+  (void)num_files;
+  (void)files;
+  (void)data;
+
+  printer = cupsGetOption("printer-name", num_options, options);
+  job_id  = brf_GetIntOption("job-id", 0, num_options, options);
+  page    = brf_GetIntOption("page", 1, num_options, options);
+
+  if (job_id <= 0)
+  {
+    fprintf(stderr, "%s: Missing job ID (-j JOB-ID).\n", base_name);
+    return (1);
+  }
+
+  if (!printer && !cupsGetOption("printer-uri", num_options, options))
+  {
+    fprintf(stderr, "%s: Missing printer (-d PRINTER).\n", base_name);
+    return (1);
+  }
+
+  brf_SpoolInit(NULL, brf_SpoolGetDirectory(num_options, options, spool_dir, sizeof(spool_dir)));
+
+  if (!brf_SpoolExtract(job_id, 0, page, 0, filename, sizeof(filename), message, sizeof(message)))
+  {
+    fprintf(stderr, "%s: %s\n", base_name, message);
+    return (1);
+  }
+
+  // Find the printer on the running server...
+  if ((val = cupsGetOption("printer-uri", num_options, options)) != NULL)
+  {
+    papplCopyString(uri, val, sizeof(uri));
+
+    if (httpSeparateURI(HTTP_URI_CODING_ALL, uri, scheme, sizeof(scheme), userpass, sizeof(userpass), host, sizeof(host), &port, resource, sizeof(resource)) < HTTP_URI_STATUS_OK)
+    {
+      fprintf(stderr, "%s: Bad printer URI '%s'.\n", base_name, uri);
+      unlink(filename);
+      return (1);
+    }
+  }
+  else
+  {
+    papplCopyString(host, (val = cupsGetOption("server-hostname", num_options, options)) != NULL ? val : "localhost", sizeof(host));
+
+    port = brf_GetIntOption("server-port", 8000, num_options, options);
+
+    if ((ptr = strrchr(host, ':')) != NULL && !strchr(ptr, ']'))
+    {
+      *ptr++ = '\0';
+      port   = atoi(ptr);
+    }
+
+    httpAssembleURIf(HTTP_URI_CODING_ALL, uri, sizeof(uri), "ipp", NULL, host, port, "/ipp/print/%s", printer);
+    snprintf(resource, sizeof(resource), "/ipp/print/%s", printer);
+  }
+
+  if ((http = httpConnect2(host, port, NULL, AF_UNSPEC, HTTP_ENCRYPTION_IF_REQUESTED, 1, 30000, NULL)) == NULL)
+  {
+    fprintf(stderr, "%s: Unable to connect to server at %s:%d: %s\n", base_name, host, port, cupsLastErrorString());
+    unlink(filename);
+    return (1);
+  }
+
+  snprintf(title, sizeof(title), "Job %d from page %d", job_id, page);
+
+  request = ippNewRequest(IPP_OP_PRINT_JOB);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, uri);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name", NULL, title);
+  ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, BRF_PAGINATE_FORMAT);
+
+  response = cupsDoFileRequest(http, request, resource, filename);
+
+  unlink(filename);
+  httpClose(http);
+
+  if (cupsLastError() >= IPP_STATUS_ERROR_BAD_REQUEST)
+  {
+    fprintf(stderr, "%s: Unable to resume job %d: %s\n", base_name, job_id, cupsLastErrorString());
+    ippDelete(response);
+    return (1);
+  }
+
+  if ((attr = ippFindAttribute(response, "job-id", IPP_TAG_INTEGER)) != NULL)
+    printf("%d\n", ippGetInteger(attr, 0));
+
+  ippDelete(response);
+
+  return (0);
+}
+
+// 'brf_SpoolSplice()' - Spool a pipe while splicing it to a device.
+//
+// The data waiting in the pipe is duplicated with tee() and the copy is
+// spliced to the spool file, then the original is spliced to the device, so
+// neither passes through user space.  The pages are indexed from a mapping of
+// the spool file.  If spooling fails the rest goes to the device only.
+//
+// Returns the number of bytes sent to the device, or -1 if the pipe cannot be
+// spliced and nothing was read from it.  When the device fails, the data
+// that was spooled but not sent is read from the pipe, so the caller can
+// spool the rest with brf_SpoolWrite().
+
+ssize_t                                 // O - Bytes sent or -1
+brf_SpoolSplice(brf_spool_t *spool,     // I - Spool
+                int inputfd,            // I - Pipe with job output
+                int devicefd)           // I - Device
+{
+  int teepipe[2];                       // Pipe for the spooled copy
+  ssize_t bytes,                        // Bytes in pipe
+      moved,                            // Bytes spliced to the device
+      total = 0;                        // Bytes sent
+  size_t left;                          // Bytes left to send
+  char buffer[65536];                   // Buffer for dropping sent data
+
+  if (pipe2(teepipe, O_CLOEXEC))
+    return (-1);
+
+  for (;;)
+  {
+    if (spool->error)
+    {
+      bytes = BRF_SPOOL_SPLICE_SIZE;
+    }
+    else if ((bytes = tee(inputfd, teepipe[1], BRF_SPOOL_SPLICE_SIZE, 0)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (total == 0)
+        total = -1;
+      break;
+    }
+    else if (bytes == 0)
+      break;
+    else if (!brf_spool_splice(spool, teepipe[0], (size_t)bytes))
+    {
+      // Keep printing without the spool, the copy left in the tee pipe is
+      // discarded with it
+      spool->error = true;
+    }
+
+    for (left = (size_t)bytes; left > 0; left -= (size_t)moved)
+    {
+      if ((moved = splice(inputfd, NULL, devicefd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+        {
+          moved = 0;
+          continue;
+        }
+
+        // Skip what was spooled already, the caller spools the rest
+        while (!spool->error && left > 0 && (moved = read(inputfd, buffer, left < sizeof(buffer) ? left : sizeof(buffer))) > 0)
+          left -= (size_t)moved;
+
+        goto finish;
+      }
+      else if (moved == 0)
+        goto finish;
+
+      total += moved;
+    }
+  }
+
+  finish:
+
+  close(teepipe[0]);
+  close(teepipe[1]);
+
+  return (total);
+}
+
+// 'brf_SpoolWrite()' - Spool a buffer of job output.
+
+bool                                    // O - `true` on success
+brf_SpoolWrite(brf_spool_t *spool,      // I - Spool
+               const void *buffer,      // I - Output data
+               size_t bytes)            // I - Number of bytes
+{
+  if (brf_WriteAll(spool->fd, buffer, bytes) < 0)
+    return (false);
+
+  brf_spool_index(spool, (const unsigned char *)buffer, bytes);
+
+  return (true);
+}
+
+// 'brf_spool_add_page()' - Add a page that ends at `end` to the index.
+//
+// The index holds the length of each page as an unsigned LEB128 number, so
+// a typical page of a few hundred bytes takes two bytes.
+
+static bool                             // O - `true` on success
+brf_spool_add_page(brf_spool_t *spool,  // I - Spool
+                   off_t end)           // I - Offset after the page
+{
+  unsigned long long length = (unsigned long long)(end - spool->page_start);
+                                        // Length of the page
+
+  if (spool->index_used + 10 > spool->index_alloc)
+  {
+    size_t alloc = spool->index_alloc ? 2 * spool->index_alloc : 1024;
+                                        // New size of the index
+    unsigned char *index;               // New index
+
+    if ((index = (unsigned char *)realloc(spool->index, alloc)) == NULL)
+      return (false);
+
+    spool->index       = index;
+    spool->index_alloc = alloc;
+  }
+
+  do
+  {
+    spool->index[spool->index_used ++] = (unsigned char)((length & 0x7f) | (length > 0x7f ? 0x80 : 0));
+    length >>= 7;
+  }
+  while (length);
+
+  spool->page_start = end;
+  spool->pages ++;
+
+  return (true);
+}
+
+// 'brf_spool_compare_jobs()' - Compare spooled jobs, newest first.
+
+static int                              // O - Result of comparison
+brf_spool_compare_jobs(const void *a,   // I - First job
+                       const void *b)   // I - Second job
+{
+  const brf_spool_job_t *ja = (const brf_spool_job_t *)a,
+                                        // First job
+      *jb = (const brf_spool_job_t *)b; // Second job
+
+  if (ja->created != jb->created)
+    return (ja->created < jb->created ? 1 : -1);
+
+  return (jb->job_id - ja->job_id);
+}
+
+// 'brf_spool_filename()' - Make the filename of a spooled job.
+
+static void
+brf_spool_filename(int job_id,          // I - Job ID
+                   time_t created,      // I - Creation time of the job
+                   const char *ext,     // I - Extension
+                   char *filename,      // I - Filename buffer
+                   size_t filesize)     // I - Size of filename buffer
+{
+  snprintf(filename, filesize, "%s/%d-%ld.%s", brf_spool_directory, job_id, (long)created, ext);
+}
+
+// 'brf_spool_find()' - Find the spooled output of a job.
+//
+// Returns `created` when it is given, otherwise the creation time of the
+// latest output spooled for the job ID, or 0 if there is none.
+
+static time_t                           // O - Creation time or 0
+brf_spool_find(int job_id,              // I - Job ID
+               time_t created)          // I - Creation time of the job or 0
+{
+  DIR *dir;                             // Spooled job directory
+  struct dirent *dent;                  // Directory entry
+  int id;                               // Job ID of file
+  long t;                               // Creation time of file
+  char ext[8];                          // Extension of file
+  time_t latest = 0;                    // Latest creation time
+
+  if (created)
+    return (created);
+
+  if ((dir = opendir(brf_spool_directory)) == NULL)
+    return (0);
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    if (sscanf(dent->d_name, "%d-%ld.%7s", &id, &t, ext) == 3 && id == job_id && !strcmp(ext, "idx") && (time_t)t > latest)
+      latest = (time_t)t;
+  }
+
+  closedir(dir);
+
+  return (latest);
+}
+
+// 'brf_spool_index()' - Record the page breaks in spooled data.
+
+static void
+brf_spool_index(brf_spool_t *spool,     // I - Spool
+                const unsigned char *data, // I - Data
+                size_t bytes)           // I - Number of bytes
+{
+  const unsigned char *ptr = data,      // Pointer into data
+      *end = data + bytes,              // End of data
+      *ff;                              // Form feed
+
+  while (ptr < end && (ff = memchr(ptr, '\f', (size_t)(end - ptr))) != NULL)
+  {
+    brf_spool_add_page(spool, spool->offset + (ff - data) + 1);
+    ptr = ff + 1;
+  }
+
+  spool->offset += (off_t)bytes;
+}
+
+// 'brf_spool_load()' - Load the page index of a spooled job.
+//
+// Returns the number of pages with the end offset of each page in `pages`,
+// or -1 when the job has no valid index.
+
+static int                              // O - Number of pages or -1
+brf_spool_load(int job_id,              // I - Job ID
+               time_t created,          // I - Creation time of the job
+               off_t **pages)           // O - End offset of each page
+{
+  char filename[1024];                  // Index filename
+  int fd;                               // Index file
+  struct stat fileinfo;                 // Index file information
+  unsigned char *data = NULL,           // Index data
+      *ptr,                             // Pointer into index
+      *end;                             // End of index
+  int num_pages = 0;                    // Number of pages
+  off_t offset = 0;                     // End of the current page
+  unsigned long long length;            // Length of the current page
+  int shift;                            // Bit position in the length
+
+  *pages = NULL;
+
+  brf_spool_filename(job_id, created, "idx", filename, sizeof(filename));
+
+  if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+    return (-1);
+
+  if (fstat(fd, &fileinfo) || fileinfo.st_size < (off_t)sizeof(BRF_SPOOL_MAGIC) - 1 || (data = (unsigned char *)malloc((size_t)fileinfo.st_size)) == NULL || read(fd, data, (size_t)fileinfo.st_size) != (ssize_t)fileinfo.st_size || memcmp(data, BRF_SPOOL_MAGIC, sizeof(BRF_SPOOL_MAGIC) - 1))
+  {
+    close(fd);
+    free(data);
+    return (-1);
+  }
+
+  close(fd);
+
+  end = data + fileinfo.st_size;
+
+  // Every page takes at least one byte, so this is the most pages there are
+  if ((*pages = (off_t *)calloc((size_t)(end - data) + 1, sizeof(off_t))) == NULL)
+  {
+    free(data);
+    return (-1);
+  }
+
+  for (ptr = data + sizeof(BRF_SPOOL_MAGIC) - 1; ptr < end;)
+  {
+    for (length = 0, shift = 0; ptr < end && shift < 64; shift += 7)
+    {
+      length |= (unsigned long long)(*ptr & 0x7f) << shift;
+
+      if (!(*ptr++ & 0x80))
+        break;
+    }
+
+    offset += (off_t)length;
+    (*pages)[num_pages ++] = offset;
+  }
+
+  free(data);
+
+  return (num_pages);
+}
+
+// 'brf_spool_prune()' - Remove spooled jobs that are too old to resume.
+
+static void
+brf_spool_prune(void)
+{
+  DIR *dir;                             // Spooled job directory
+  struct dirent *dent;                  // Directory entry
+  char filename[1024];                  // Spooled file
+  struct stat fileinfo;                 // Spooled file information
+  time_t oldest = time(NULL) - BRF_SPOOL_MAX_AGE;
+                                        // Oldest file to keep
+
+  if ((dir = opendir(brf_spool_directory)) == NULL)
+    return;
+
+  while ((dent = readdir(dir)) != NULL)
+  {
+    if (dent->d_name[0] == '.')
+      continue;
+
+    snprintf(filename, sizeof(filename), "%s/%s", brf_spool_directory, dent->d_name);
+
+    if (!stat(filename, &fileinfo) && S_ISREG(fileinfo.st_mode) && fileinfo.st_mtime < oldest)
+      unlink(filename);
+  }
+
+  closedir(dir);
+}
+
+// 'brf_spool_splice()' - Move data from a pipe to the spool file.
+//
+// The data is indexed from a mapping of the spool file, which only touches
+// the page cache.
+
+static bool                             // O - `true` on success
+brf_spool_splice(brf_spool_t *spool,    // I - Spool
+                 int pipefd,            // I - Pipe with a copy of the data
+                 size_t bytes)          // I - Number of bytes
+{
+  size_t left,                          // Bytes left to move
+      length;                           // Length of mapping
+  ssize_t moved;                        // Bytes moved
+  off_t base;                           // Page-aligned start of mapping
+  void *data;                           // Mapped data
+
+  for (left = bytes; left > 0; left -= (size_t)moved)
+  {
+    if ((moved = splice(pipefd, NULL, spool->fd, NULL, left, SPLICE_F_MOVE)) <= 0)
+    {
+      if (moved < 0 && (errno == EINTR || errno == EAGAIN))
+      {
+        moved = 0;
+        continue;
+      }
+
+      return (false);
+    }
+  }
+
+  base   = spool->offset - spool->offset % sysconf(_SC_PAGESIZE);
+  length = (size_t)(spool->offset - base) + bytes;
+
+  if ((data = mmap(NULL, length, PROT_READ, MAP_SHARED, spool->fd, base)) == MAP_FAILED)
+    return (false);
+
+  brf_spool_index(spool, (unsigned char *)data + (length - bytes), bytes);
+  munmap(data, length);
+
+  return (true);
+}
+
+// 'brf_spool_web()' - Show the resume page of the web interface.
+
+static bool                             // O - `true` if handled
+brf_spool_web(pappl_client_t *client,   // I - Client
+              void *data)               // I - System
+{
+  pappl_system_t *system = (pappl_system_t *)data;
+                                        // System
+  pappl_printer_t *printer;             // Printer
+  pappl_job_t *job;                     // New job
+  int num_form = 0;                     // Number of form variables
+  cups_option_t *form = NULL;           // Form variables
+  char status[1024] = "",               // Status message
+      filename[1024],                   // Resume file
+      title[256];                       // Job name
+  int job_id,                           // Job to resume
+      page;                             // First page to print
+  DIR *dir;                             // Spooled job directory
+  struct dirent *dent;                  // Directory entry
+  brf_spool_job_t jobs[50];             // Spooled jobs
+  int num_jobs = 0,                     // Number of spooled jobs
+      i;                                // Looping var
+  char jobname[1024];                   // Spooled output filename
+  struct stat fileinfo;                 // Spooled output information
+  off_t *pages;                         // Page index
+
+  if (!papplClientHTMLAuthorize(client))
+    return (true);
+
+  if (papplClientGetMethod(client) == HTTP_STATE_POST)
+  {
+    num_form = papplClientGetForm(client, &form);
+
+    if (!papplClientIsValidForm(client, num_form, form))
+    {
+      papplCopyString(status, "Invalid form submission.", sizeof(status));
+    }
+    else if ((printer = papplSystemFindPrinter(system, NULL, brf_GetIntOption("printer", 0, num_form, form), NULL)) == NULL)
+    {
+      papplCopyString(status, "Unknown printer.", sizeof(status));
+    }
+    else
+    {
+      job_id = brf_GetIntOption("job-id", 0, num_form, form);
+      page   = brf_GetIntOption("page", 1, num_form, form);
+
+      if (brf_SpoolExtract(job_id, 0, page, 0, filename, sizeof(filename), status, sizeof(status)))
+      {
+        snprintf(title, sizeof(title), "Job %d from page %d", job_id, page);
+
+        if ((job = papplJobCreateWithFile(printer, papplClientGetUsername(client), BRF_PAGINATE_FORMAT, title, 0, NULL, filename)) != NULL)
+          snprintf(status, sizeof(status), "Resumed job %d from page %d as job %d.", job_id, page, papplJobGetID(job));
+        else
+          snprintf(status, sizeof(status), "Unable to create a job on '%s'.", papplPrinterGetName(printer));
+      }
+    }
+
+    cupsFreeOptions(num_form, form);
+  }
+
+  // List the jobs that can be resumed...
+  if ((dir = opendir(brf_spool_directory)) != NULL)
+  {
+    while ((dent = readdir(dir)) != NULL && num_jobs < (int)(sizeof(jobs) / sizeof(jobs[0])))
+    {
+      long created;                     // Creation time of the job
+      char ext[8];                      // Extension
+
+      if (sscanf(dent->d_name, "%d-%ld.%7s", &job_id, &created, ext) != 3 || job_id <= 0 || strcmp(ext, "idx"))
+        continue;
+
+      brf_spool_filename(job_id, (time_t)created, "brf", jobname, sizeof(jobname));
+
+      if (stat(jobname, &fileinfo) || (page = brf_spool_load(job_id, (time_t)created, &pages)) < 0)
+        continue;
+
+      free(pages);
+
+      jobs[num_jobs].job_id  = job_id;
+      jobs[num_jobs].created = (time_t)created;
+      jobs[num_jobs].pages  = page;
+      jobs[num_jobs].size   = fileinfo.st_size;
+      jobs[num_jobs].mtime  = fileinfo.st_mtime;
+      num_jobs ++;
+    }
+
+    closedir(dir);
+
+    qsort(jobs, (size_t)num_jobs, sizeof(brf_spool_job_t), brf_spool_compare_jobs);
+  }
+
+  if (!papplClientRespond(client, HTTP_STATUS_OK, NULL, "text/html", 0, 0))
+    return (false);
+
+  papplClientHTMLHeader(client, "Resume Job", 0);
+  papplClientHTMLPuts(client,
+                      "    <div class=\"content\">\n"
+                      "      <div class=\"row\">\n"
+                      "        <div class=\"col-12\">\n"
+                      "          <h1 class=\"title\">Resume Job</h1>\n");
+
+  if (status[0])
+    papplClientHTMLPrintf(client, "          <div class=\"banner\">%s</div>\n", status);
+
+  papplClientHTMLPuts(client, "          <p>Prints a job again from the given page, for example after a paper jam.  The remaining pages are sent without converting the document again.  When a job ID was used again after a restart, the latest job with that ID is resumed.</p>\n");
+
+  papplClientHTMLStartForm(client, BRF_SPOOL_RESOURCE, false);
+  papplClientHTMLPuts(client,
+                      "          <table class=\"form\">\n"
+                      "            <tbody>\n"
+                      "              <tr><th><label for=\"printer\">Printer:</label></th><td><select name=\"printer\" id=\"printer\">");
+  papplSystemIteratePrinters(system, brf_spool_web_printer, client);
+  papplClientHTMLPuts(client,
+                      "</select></td></tr>\n"
+                      "              <tr><th><label for=\"job-id\">Job:</label></th><td><input type=\"number\" name=\"job-id\" id=\"job-id\" min=\"1\" required></td></tr>\n"
+                      "              <tr><th><label for=\"page\">From Page:</label></th><td><input type=\"number\" name=\"page\" id=\"page\" min=\"1\" value=\"1\" required></td></tr>\n"
+                      "              <tr><th></th><td><input type=\"submit\" value=\"Resume Job\"></td></tr>\n"
+                      "            </tbody>\n"
+                      "          </table>\n"
+                      "          </form>\n");
+
+  if (num_jobs > 0)
+  {
+    papplClientHTMLPuts(client,
+                        "          <h2 class=\"title\">Spooled Jobs</h2>\n"
+                        "          <table class=\"list\">\n"
+                        "            <thead>\n"
+                        "              <tr><th>Job</th><th>Pages</th><th>Size</th><th>Spooled</th></tr>\n"
+                        "            </thead>\n"
+                        "            <tbody>\n");
+
+    for (i = 0; i < num_jobs; i ++)
+    {
+      char date[64];                    // Spool time
+      struct tm tmdate;                 // Spool time
+
+      strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime_r(&jobs[i].mtime, &tmdate));
+      papplClientHTMLPrintf(client, "              <tr><td>%d</td><td>%d</td><td>%ld bytes</td><td>%s</td></tr>\n", jobs[i].job_id, jobs[i].pages, (long)jobs[i].size, date);
+    }
+
+    papplClientHTMLPuts(client,
+                        "            </tbody>\n"
+                        "          </table>\n");
+  }
+
+  papplClientHTMLPuts(client,
+                      "        </div>\n"
+                      "      </div>\n"
+                      "    </div>\n");
+  papplClientHTMLFooter(client);
+
+  return (true);
+}
+
+// 'brf_spool_web_printer()' - Add a printer to the printer menu.
+
+static void
+brf_spool_web_printer(
+    pappl_printer_t *printer,           // I - Printer
+    void *data)                         // I - Client
+{
+  papplClientHTMLPrintf((pappl_client_t *)data, "<option value=\"%d\">%s</option>", papplPrinterGetID(printer), papplPrinterGetName(printer));
+}
@@ -0,0 +1,368 @@
+//
+// Pipelined device output for the Braille Printer Application.
+//
+// Copyright © 2024 Arun Patwa
+//
+// Licensed under Apache License v2.0.  See the file "LICENSE" for more
+// information.
+//
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+
+#include "brf-printer.h"
+
+// Local constants...
+
+#define BRF_WRITER_CHUNK (16 * 1024)    // Queued bytes that wake the writer
+#define BRF_WRITER_MAX (64 * 1024)      // Maximum bytes in one device write
+#define BRF_WRITER_SIZE (1024 * 1024)   // Size of the ring buffer
+
+// Local types...
+
+struct brf_writer_s                     // Device writer
+{
+  pappl_device_t *device;               // Output device
+  pthread_t thread;                     // Writer thread
+  unsigned char *buffer;                // Ring buffer
+  _Atomic size_t head,                  // Bytes added in total
+      tail,                             // Bytes sent in total
+      ready;                            // Bytes to send without waiting for more
+  atomic_bool done,                     // No more data will be added?
+      failed;                           // Device failed?
+  atomic_int reader_waiting,            // Is the producer waiting for room?
+      writer_waiting;                   // Is the writer thread waiting for data?
+  pthread_mutex_t mutex;                // Mutex for sleeping
+  pthread_cond_t not_empty,             // Data is ready to send
+      not_full;                         // Data was sent
+  bool raw;                             // Binary data without form feeds?
+  double start,                         // Start of the job
+      created;                          // Creation of the writer
+  brf_writer_stats_t stats;             // Statistics
+};
+
+// Local functions...
+
+static void brf_writer_ready(brf_writer_t *writer, size_t head);
+static void *brf_writer_run(brf_writer_t *writer);
+static void brf_writer_wake(brf_writer_t *writer, atomic_int *waiting, pthread_cond_t *cond);
+
+// 'brf_WriterCreate()' - Start a thread that sends data to the device.
+//
+// The producer hands the job data to brf_WriterWrite() and keeps converting
+// while the device is busy.  The queue between them is a single-producer,
+// single-consumer ring buffer: both sides only publish their position, and
+// only sleep when it is empty or full.  Small writes are collected until a
+// chunk, a form feed or brf_WriterFlush(), so the device gets few large
+// writes.  The writer sends every page as soon as it is complete, and
+// whatever is ready when it runs out of data, so the embosser starts on page
+// 1 while later pages are converted.
+//
+// Raw writers carry binary graphics, where a form feed byte is just data.
+// Pages are not looked for, the producer ends them with brf_WriterFlush().
+
+brf_writer_t *                          // O - Writer or `NULL` on error
+brf_WriterCreate(pappl_device_t *device,// I - Output device
+                 double start,          // I - Start of the job (brf_GetTime())
+                 bool raw)              // I - Raw data without form feeds?
+{
+  brf_writer_t *writer;                 // Writer
+
+  if ((writer = (brf_writer_t *)calloc(1, sizeof(brf_writer_t))) == NULL)
+    return (NULL);
+
+  if ((writer->buffer = (unsigned char *)malloc(BRF_WRITER_SIZE)) == NULL)
+  {
+    free(writer);
+    return (NULL);
+  }
+
+  writer->device  = device;
+  writer->raw     = raw;
+  writer->start   = start;
+  writer->created = brf_GetTime();
+
+  pthread_mutex_init(&writer->mutex, NULL);
+  pthread_cond_init(&writer->not_empty, NULL);
+  pthread_cond_init(&writer->not_full, NULL);
+
+  if (pthread_create(&writer->thread, NULL, (void *(*)(void *))brf_writer_run, writer))
+  {
+    pthread_cond_destroy(&writer->not_full);
+    pthread_cond_destroy(&writer->not_empty);
+    pthread_mutex_destroy(&writer->mutex);
+    free(writer->buffer);
+    free(writer);
+    return (NULL);
+  }
+
+  return (writer);
+}
+
+// 'brf_WriterFinish()' - Send the remaining data and stop the writer.
+
+bool                                    // O - `true` if all data was sent
+brf_WriterFinish(brf_writer_t *writer,  // I - Writer
+                 brf_writer_stats_t *stats) // O - Statistics or `NULL`
+{
+  bool ret;                             // Return value
+  double elapsed;                       // Life time of the writer
+
+  atomic_store(&writer->done, true);
+  brf_writer_wake(writer, &writer->writer_waiting, &writer->not_empty);
+
+  pthread_join(writer->thread, NULL);
+
+  ret     = !atomic_load(&writer->failed);
+  elapsed = brf_GetTime() - writer->created;
+
+  writer->stats.rate = elapsed > 0.0 ? writer->stats.bytes / elapsed : 0.0;
+
+  if (stats)
+    *stats = writer->stats;
+
+  pthread_cond_destroy(&writer->not_full);
+  pthread_cond_destroy(&writer->not_empty);
+  pthread_mutex_destroy(&writer->mutex);
+  free(writer->buffer);
+  free(writer);
+
+  return (ret);
+}
+
+// 'brf_WriterFlush()' - Send the queued data without waiting for more.
+//
+// Does not wait for the data to reach the device; the writer flushes the
+// device once it has sent everything queued.
+
+void
+brf_WriterFlush(brf_writer_t *writer)   // I - Writer
+{
+  brf_writer_ready(writer, atomic_load_explicit(&writer->head, memory_order_relaxed));
+}
+
+// 'brf_WriterPrintf()' - Queue formatted text for the device.
+
+bool                                    // O - `false` if the device failed
+brf_WriterPrintf(brf_writer_t *writer,  // I - Writer
+                 const char *format,    // I - Printf-style format string
+                 ...)                   // I - Additional arguments as needed
+{
+  char buffer[1024];                    // Formatted text
+  int bytes;                            // Length of text
+  va_list ap;                           // Argument pointer
+
+  va_start(ap, format);
+  bytes = vsnprintf(buffer, sizeof(buffer), format, ap);
+  va_end(ap);
+
+  if (bytes < 0)
+    return (false);
+  else if ((size_t)bytes >= sizeof(buffer))
+    bytes = (int)sizeof(buffer) - 1;
+
+  return (brf_WriterWrite(writer, buffer, (size_t)bytes));
+}
+
+// 'brf_WriterPuts()' - Queue a string for the device.
+
+bool                                    // O - `false` if the device failed
+brf_WriterPuts(brf_writer_t *writer,    // I - Writer
+               const char *s)           // I - String
+{
+  return (brf_WriterWrite(writer, s, strlen(s)));
+}
+
+// 'brf_WriterWrite()' - Queue data for the device.
+//
+// Blocks while the ring buffer is full, which holds back the producer when
+// the embosser is slower than the conversion.
+
+bool                                    // O - `false` if the device failed
+brf_WriterWrite(brf_writer_t *writer,   // I - Writer
+                const void *buffer,     // I - Data
+                size_t bytes)           // I - Number of bytes
+{
+  const unsigned char *ptr = (const unsigned char *)buffer;
+                                        // Pointer into data
+  size_t head = atomic_load_explicit(&writer->head, memory_order_relaxed),
+                                        // Bytes added in total
+      tail,                             // Bytes sent in total
+      offset,                           // Offset in the ring buffer
+      count;                            // Bytes to copy
+  bool page;                            // Did a page end?
+
+  while (bytes > 0)
+  {
+    if (atomic_load_explicit(&writer->failed, memory_order_relaxed))
+      return (false);
+
+    tail = atomic_load_explicit(&writer->tail, memory_order_acquire);
+
+    if (head - tail == BRF_WRITER_SIZE)
+    {
+      // Full, let the writer send what is queued and wait for room
+      double waited = brf_GetTime();    // Start of the wait
+
+      brf_writer_ready(writer, head);
+
+      writer->stats.stalls ++;
+
+      pthread_mutex_lock(&writer->mutex);
+      atomic_store(&writer->reader_waiting, 1);
+      while (head - atomic_load(&writer->tail) == BRF_WRITER_SIZE && !atomic_load(&writer->failed))
+        pthread_cond_wait(&writer->not_full, &writer->mutex);
+      atomic_store(&writer->reader_waiting, 0);
+      pthread_mutex_unlock(&writer->mutex);
+
+      writer->stats.stall_time += brf_GetTime() - waited;
+      continue;
+    }
+
+    offset = head % BRF_WRITER_SIZE;
+    count  = BRF_WRITER_SIZE - (head - tail);
+
+    if (count > BRF_WRITER_SIZE - offset)
+      count = BRF_WRITER_SIZE - offset;
+    if (count > bytes)
+      count = bytes;
+
+    memcpy(writer->buffer + offset, ptr, count);
+    page = !writer->raw && memchr(ptr, '\f', count) != NULL;
+
+    head  += count;
+    ptr   += count;
+    bytes -= count;
+
+    atomic_store_explicit(&writer->head, head, memory_order_release);
+
+    // Wake the writer for complete pages and full chunks only
+    if (page || head - atomic_load_explicit(&writer->ready, memory_order_relaxed) >= BRF_WRITER_CHUNK)
+      brf_writer_ready(writer, head);
+  }
+
+  return (true);
+}
+
+// 'brf_writer_ready()' - Mark the queued data as ready to send.
+
+static void
+brf_writer_ready(brf_writer_t *writer,  // I - Writer
+                 size_t head)           // I - End of the ready data
+{
+  atomic_store(&writer->ready, head);
+  brf_writer_wake(writer, &writer->writer_waiting, &writer->not_empty);
+}
+
+// 'brf_writer_run()' - Send queued data to the device.
+
+static void *                           // O - Thread exit status (unused)
+brf_writer_run(brf_writer_t *writer)    // I - Writer
+{
+  unsigned char *ptr,                   // Data to send
+      *ff;                              // Form feed in data
+  size_t tail = 0,                      // Bytes sent in total
+      ready,                            // End of the data to send
+      offset,                           // Offset in the ring buffer
+      count;                            // Bytes to send
+  bool flush = false;                   // Flush the device when idle?
+  double sent;                          // Start of the device write
+
+  for (;;)
+  {
+    if (atomic_load(&writer->done))
+      ready = atomic_load(&writer->head);
+    else
+      ready = atomic_load(&writer->ready);
+
+    if (tail == ready)
+    {
+      // Don't let a partial page wait in the device buffer for more data
+      if (flush)
+      {
+        papplDeviceFlush(writer->device);
+        flush = false;
+      }
+
+      if (atomic_load(&writer->done) && tail == atomic_load(&writer->head))
+        break;
+
+      pthread_mutex_lock(&writer->mutex);
+      atomic_store(&writer->writer_waiting, 1);
+      while (atomic_load(&writer->ready) == tail && !atomic_load(&writer->done))
+        pthread_cond_wait(&writer->not_empty, &writer->mutex);
+      atomic_store(&writer->writer_waiting, 0);
+      pthread_mutex_unlock(&writer->mutex);
+      continue;
+    }
+
+    offset = tail % BRF_WRITER_SIZE;
+    count  = ready - tail;
+
+    if (count > BRF_WRITER_SIZE - offset)
+      count = BRF_WRITER_SIZE - offset;
+    if (count > BRF_WRITER_MAX)
+      count = BRF_WRITER_MAX;
+
+    // Send up to and including the next form feed, then push the page out
+    ptr = writer->buffer + offset;
+
+    if (writer->raw)
+      ff = NULL;
+    else if ((ff = memchr(ptr, '\f', count)) != NULL)
+    {
+      count = (size_t)(ff - ptr) + 1;
+      writer->stats.pages ++;
+    }
+
+    sent = brf_GetTime();
+
+    if (papplDeviceWrite(writer->device, ptr, count) < 0)
+    {
+      atomic_store(&writer->failed, true);
+      brf_writer_wake(writer, &writer->reader_waiting, &writer->not_full);
+      break;
+    }
+
+    if (writer->stats.first_dot == 0.0)
+      writer->stats.first_dot = brf_GetTime() - writer->start;
+
+    writer->stats.device_time += brf_GetTime() - sent;
+    writer->stats.writes ++;
+    writer->stats.bytes += count;
+
+    tail += count;
+    atomic_store(&writer->tail, tail);
+    brf_writer_wake(writer, &writer->reader_waiting, &writer->not_full);
+
+    flush = true;
+
+    if (ff)
+    {
+      papplDeviceFlush(writer->device);
+      flush = false;
+    }
+  }
+
+  return (NULL);
+}
+
+// 'brf_writer_wake()' - Wake the other side if it sleeps.
+//
+// The sleeper sets its flag before checking the positions and the waker
+// updates the positions before checking the flag, so one of them always sees
+// the other and no wakeup is lost.
+
+static void
+brf_writer_wake(brf_writer_t *writer,   // I - Writer
+                atomic_int *waiting,    // I - Flag of the sleeper
+                pthread_cond_t *cond)   // I - Condition of the sleeper
+{
+  if (!atomic_load(waiting))
+    return;
+
+  pthread_mutex_lock(&writer->mutex);
+  pthread_cond_signal(cond);
+  pthread_mutex_unlock(&writer->mutex);
+}
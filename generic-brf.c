@@ -1,21 +1,68 @@
 
 // Include necessary headers...
 
-#include <pappl/pappl.h>
+#include "brf-printer.h"
 #include <math.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#  define BRF_GEN_X86 1
+#endif // __x86_64__ || __i386__
 
 #define brf_TESTPAGE_MIMETYPE "application/vnd.cups-brf";
 
+// Local constants...
+
+#define BRF_GEN_BUFSIZE 65536 // Size of the raw print buffer
+#define BRF_GEN_MAX_BLOCK 64  // Maximum lines in one GW command
+#define BRF_GEN_MAX_PAD 16    // Maximum padding to merge a narrower line
+
+// Local types...
+
+typedef struct brf_gen_job_s // Per-job raster data
+{
+  unsigned char *buffer;     // Inverted raster line
+  size_t bufsize;            // Size of line buffer
+  unsigned char *block;      // Lines of the pending GW command
+  unsigned block_x,          // First byte of the pending lines
+      block_y,               // First line of the pending lines
+      block_width,           // Bytes per pending line
+      block_lines;           // Number of pending lines
+  size_t page_raw,           // Bytes one GW command per line would take
+      page_sent;             // Bytes sent for the page
+  brf_writer_t *writer;      // Device writer or `NULL` to write directly
+  unsigned pages;            // Pages sent
+  double start;              // Start of the job
+  bool forwarded;            // Sent to a printer of its pool?
+} brf_gen_job_t;
+
+typedef bool (*brf_gen_invert_cb_t)(const unsigned char *line, unsigned char *buffer, size_t bytes);
+                             // Raster line kernel
+
 // Local functions...
 
+static bool brf_gen_flush(brf_gen_job_t *gen, pappl_device_t *device);
+static bool brf_gen_invert(const unsigned char *line, unsigned char *buffer, size_t bytes);
+#ifdef BRF_GEN_X86
+static bool brf_gen_invert_avx2(const unsigned char *line, unsigned char *buffer, size_t bytes);
+static bool brf_gen_invert_sse2(const unsigned char *line, unsigned char *buffer, size_t bytes);
+#endif // BRF_GEN_X86
 static bool brf_gen_printfile(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool brf_gen_rendjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool brf_gen_rendpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
 static bool brf_gen_rstartjob(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device);
 static bool brf_gen_rstartpage(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned page);
+static bool brf_gen_send(pappl_job_t *job, int fd, pappl_device_t *device);
 static bool brf_gen_status(pappl_printer_t *printer);
 static bool brf_gen_rwriteline(pappl_job_t *job, pappl_pr_options_t *options, pappl_device_t *device, unsigned y, const unsigned char *line);
 
+// Local globals...
+
+static brf_gen_invert_cb_t brf_gen_invert_cb = brf_gen_invert;
+                             // Raster line kernel for this CPU
+
 static const char *const brf_gen_media[] =
     { // Supported media sizes for Generic BRF printers
         "na_legal_8.5x14in",
@@ -49,6 +96,15 @@ brf_gen(
   driver_data->status_cb = brf_gen_status;
   driver_data->format = brf_TESTPAGE_MIMETYPE;
 
+  // Pick the fastest raster line kernel for this CPU...
+#ifdef BRF_GEN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    brf_gen_invert_cb = brf_gen_invert_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    brf_gen_invert_cb = brf_gen_invert_sse2;
+#endif // BRF_GEN_X86
+
   driver_data->num_resolution = 1;
   driver_data->x_resolution[0] = 200;
   driver_data->y_resolution[0] = 200;
@@ -94,7 +150,155 @@ brf_gen(
   return (true);
 }
 
+// 'brf_GenPrintPaged()' - Print a paginated BRF document.
+//
+// Spooled output that is resumed and volumes of split jobs are already laid
+// out on braille pages, they are sent as they are.
+
+bool                                    // O - `true` on success, `false` on failure
+brf_GenPrintPaged(pappl_job_t *job,     // I - Job
+                  pappl_device_t *device, // I - Output device
+                  void *data)           // I - Callback data (unused)
+{
+  int fd;                               // Input file
+  bool ret;                             // Return value
+
+  (void)data;
+
+  brf_MetricsObserve(BRF_METRIC_QUEUE_WAIT, papplPrinterGetName(papplJobGetPrinter(job)), NULL, difftime(papplJobGetTimeProcessed(job), papplJobGetTimeCreated(job)));
+
+  if (brf_PoolIsPool(papplJobGetPrinter(job)))
+    return (brf_PoolForward(job));
+
+  if ((fd = open(papplJobGetFilename(job), O_RDONLY)) < 0)
+  {
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to open print file '%s': %s", papplJobGetFilename(job), strerror(errno));
+    return (false);
+  }
+
+  ret = brf_gen_send(job, fd, device);
+
+  close(fd);
+
+  return (ret);
+}
+
+// 'brf_gen_flush()' - Send the pending lines as one GW command.
+
+static bool // O - `true` on success, `false` on failure
+brf_gen_flush(
+    brf_gen_job_t *gen,          // I - Raster data
+    pappl_device_t *device)      // I - Output device
+{
+  char header[64];               // GW command
+  size_t headerlen,              // Length of GW command
+      datalen;                   // Length of graphic data
+
+  if (gen->block_lines == 0)
+    return (true);
+
+  headerlen = (size_t)snprintf(header, sizeof(header), "GW%u,%u,%u,%u\n", gen->block_x * 8, gen->block_y, gen->block_width, gen->block_lines);
+  datalen   = (size_t)gen->block_width * gen->block_lines;
+
+  gen->page_sent += headerlen + datalen + 1;
+  gen->block_lines = 0;
+
+  if (gen->writer)
+    return (brf_WriterWrite(gen->writer, header, headerlen) && brf_WriterWrite(gen->writer, gen->block, datalen) && brf_WriterWrite(gen->writer, "\n", 1));
+
+  if (papplDeviceWrite(device, header, headerlen) < 0 || papplDeviceWrite(device, gen->block, datalen) < 0 || papplDeviceWrite(device, "\n", 1) < 0)
+    return (false);
+
+  return (true);
+}
+
+// 'brf_gen_invert()' - Invert a raster line and test whether it is blank.
+//
+// The embosser expects set bits for blank dots, so every byte is inverted
+// into "buffer".  Returns `true` if any dot of the line is set.
+
+static bool // O - `true` if the line has dots, `false` if it is blank
+brf_gen_invert(
+    const unsigned char *line, // I - Raster line
+    unsigned char *buffer,     // O - Inverted line
+    size_t bytes)              // I - Bytes in line
+{
+  unsigned char bits = 0;      // Set bits in line
+  uint64_t word,               // Current 64-bit word
+      bits64 = 0;              // Set bits in 64-bit words
+
+  for (; bytes >= 8; bytes -= 8, line += 8, buffer += 8)
+  {
+    memcpy(&word, line, 8);
+    bits64 |= word;
+    word = ~word;
+    memcpy(buffer, &word, 8);
+  }
+
+  for (; bytes > 0; bytes --)
+  {
+    bits |= *line;
+    *buffer++ = (unsigned char)~*line++;
+  }
+
+  return (bits64 != 0 || bits != 0);
+}
+
+#ifdef BRF_GEN_X86
+// 'brf_gen_invert_avx2()' - Invert and test a raster line 32 bytes at a time.
+
+__attribute__((target("avx2"))) static bool // O - `true` if the line has dots
+brf_gen_invert_avx2(
+    const unsigned char *line, // I - Raster line
+    unsigned char *buffer,     // O - Inverted line
+    size_t bytes)              // I - Bytes in line
+{
+  __m256i ones = _mm256_set1_epi8(-1),
+                               // All bits set
+      bits = _mm256_setzero_si256();
+                               // Set bits in line
+
+  for (; bytes >= 32; bytes -= 32, line += 32, buffer += 32)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)line);
+
+    bits = _mm256_or_si256(bits, v);
+    _mm256_storeu_si256((__m256i *)buffer, _mm256_xor_si256(v, ones));
+  }
+
+  return (!_mm256_testz_si256(bits, bits) | brf_gen_invert(line, buffer, bytes));
+}
+
+// 'brf_gen_invert_sse2()' - Invert and test a raster line 16 bytes at a time.
+
+__attribute__((target("sse2"))) static bool // O - `true` if the line has dots
+brf_gen_invert_sse2(
+    const unsigned char *line, // I - Raster line
+    unsigned char *buffer,     // O - Inverted line
+    size_t bytes)              // I - Bytes in line
+{
+  __m128i ones = _mm_set1_epi8(-1),
+                               // All bits set
+      bits = _mm_setzero_si128();
+                               // Set bits in line
+
+  for (; bytes >= 16; bytes -= 16, line += 16, buffer += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)line);
+
+    bits = _mm_or_si128(bits, v);
+    _mm_storeu_si128((__m128i *)buffer, _mm_xor_si128(v, ones));
+  }
+
+  return ((_mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128())) != 0xffff) | brf_gen_invert(line, buffer, bytes));
+}
+#endif // BRF_GEN_X86
+
 // 'Brf_generic_print()' - Print a file.
+//
+// The BRF document is laid out on braille pages of the job's page size by
+// brf_PaginateFilter(), like brftopagedbrf did for CUPS.  The paginator runs
+// in a thread and every page is sent as soon as it is made.
 
 static bool // O - `true` on success, `false` on failure
 brf_gen_printfile(
@@ -102,12 +306,18 @@ brf_gen_printfile(
     pappl_pr_options_t *options, // I - Job options
     pappl_device_t *device)      // I - Output device
 {
-  int fd;             // Input file
-  ssize_t bytes;      // Bytes read/written
-  char buffer[10000007]; // Read/write buffer
+  int fd,                   // Input file
+      pagedfd;              // Paginated document
+  brf_paginator_t *paginator; // Paginator
+  bool ret;                 // Return value
+
+  (void)options;
 
-  // Copy the raw file...
-  papplJobSetImpressions(job, 1);
+  brf_MetricsObserve(BRF_METRIC_QUEUE_WAIT, papplPrinterGetName(papplJobGetPrinter(job)), NULL, difftime(papplJobGetTimeProcessed(job), papplJobGetTimeCreated(job)));
+
+  // Jobs sent to a pool are printed by the printer expected to finish first
+  if (brf_PoolIsPool(papplJobGetPrinter(job)))
+    return (brf_PoolForward(job));
 
   if ((fd = open(papplJobGetFilename(job), O_RDONLY)) < 0)
   {
@@ -115,20 +325,19 @@ brf_gen_printfile(
     return (false);
   }
 
-  while ((bytes = read(fd, buffer, sizeof(buffer))) > 0)
+  if ((paginator = brf_PaginateStart(job, fd, &pagedfd)) == NULL)
   {
-    if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
-    {
-      papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
-      close(fd);
-      return (false);
-    }
+    papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to paginate print file: %s", strerror(errno));
+    close(fd);
+    return (false);
   }
-  close(fd);
 
-  papplJobSetImpressionsCompleted(job, 1);
+  ret = brf_gen_send(job, pagedfd, device);
 
-  return (true);
+  if (!brf_PaginateFinish(paginator))
+    ret = false;
+
+  return (ret);
 }
 
 // 'Brf_generic_rendjob()' - End a job.
@@ -139,11 +348,44 @@ brf_gen_rendjob(
     pappl_pr_options_t *options, // I - Job options
     pappl_device_t *device)      // I - Output device
 {
-  (void)job;
+  brf_gen_job_t *gen = (brf_gen_job_t *)papplJobGetData(job);
+                                 // Raster data
+  bool ret = true;               // Return value
+
   (void)options;
   (void)device;
 
-  return (true);
+  if (gen)
+  {
+    if (gen->writer)
+    {
+      brf_writer_stats_t stats;  // Device writer statistics
+
+      ret = brf_WriterFinish(gen->writer, &stats);
+
+      if (ret)
+      {
+        papplLogJob(job, PAPPL_LOGLEVEL_INFO, "Time to first dot %.3fs, %lu bytes sent in %lu device writes at %.0f bytes/s, job waited %.3fs for the device (%lu times).", stats.first_dot, (unsigned long)stats.bytes, stats.writes, stats.rate, stats.stall_time, stats.stalls);
+
+        // Graphics are not characters and emboss at their own speed, so
+        // raster jobs are kept out of the estimates
+        if (stats.bytes > 0)
+        {
+          brf_MetricsObserve(BRF_METRIC_FIRST_BYTE, papplPrinterGetName(papplJobGetPrinter(job)), NULL, stats.first_dot);
+          brf_MetricsObserve(BRF_METRIC_DEVICE_RATE, papplPrinterGetName(papplJobGetPrinter(job)), NULL, stats.rate);
+        }
+      }
+      else
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send the job to the printer.");
+    }
+
+    free(gen->buffer);
+    free(gen->block);
+    free(gen);
+    papplJobSetData(job, NULL);
+  }
+
+  return (ret);
 }
 
 // 'Brf_generic_rendpage()' - End a page.
@@ -155,10 +397,34 @@ brf_gen_rendpage(
     pappl_device_t *device,      // I - Output device
     unsigned page)               // I - Page number
 {
-  (void)job;
-  (void)page;
+  brf_gen_job_t *gen = (brf_gen_job_t *)papplJobGetData(job);
+                                 // Raster data
+
+  if (gen && gen->forwarded)
+    return (true);
+
+  if (gen)
+  {
+    if (!brf_gen_flush(gen, device))
+      return (false);
+
+    if (gen->page_raw > 0)
+      papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Page %u: sent %lu graphic bytes instead of %lu (%.1f%% saved).", page + 1, (unsigned long)gen->page_sent, (unsigned long)gen->page_raw, 100.0 * (double)(gen->page_raw - gen->page_sent) / (double)gen->page_raw);
+  }
+
+  if (gen)
+    gen->pages ++;
+
+  if (gen && gen->writer)
+  {
+    // Hand the finished page to the device without waiting for the next one
+    if (!brf_WriterPuts(gen->writer, "P1\n"))
+      return (false);
 
-  papplDevicePuts(device, "P1\n");
+    brf_WriterFlush(gen->writer);
+  }
+  else
+    papplDevicePuts(device, "P1\n");
 
   return (true);
 }
@@ -171,14 +437,60 @@ brf_gen_rstartjob(
     pappl_pr_options_t *options, // I - Job options
     pappl_device_t *device)      // I - Output device
 {
-  (void)job;
-  (void)options;
-  (void)device;
+  brf_gen_job_t *gen;            // Raster data
+
+  brf_MetricsObserve(BRF_METRIC_QUEUE_WAIT, papplPrinterGetName(papplJobGetPrinter(job)), NULL, difftime(papplJobGetTimeProcessed(job), papplJobGetTimeCreated(job)));
+
+  // Raster jobs sent to a pool are printed by the printer expected to finish
+  // first.  PAPPL has no way to end a raster job early, so the pool queue
+  // job is canceled to stop it from rasterizing every page for nothing...
+  if (brf_PoolIsPool(papplJobGetPrinter(job)))
+  {
+    if (!brf_PoolForward(job) || (gen = (brf_gen_job_t *)calloc(1, sizeof(brf_gen_job_t))) == NULL)
+      return (false);
+
+    gen->forwarded = true;
+    papplJobSetData(job, gen);
+
+    papplJobSetMessage(job, "Sent to a printer of the pool.");
+    papplJobCancel(job);
+
+    return (true);
+  }
+
+  // Allocate the line buffer once for the whole job...
+  if ((gen = (brf_gen_job_t *)calloc(1, sizeof(brf_gen_job_t))) == NULL)
+    return (false);
+
+  gen->bufsize = options->header.cupsBytesPerLine;
+  gen->buffer  = (unsigned char *)malloc(gen->bufsize > 0 ? gen->bufsize : 1);
+  gen->block   = (unsigned char *)malloc(gen->bufsize > 0 ? gen->bufsize * BRF_GEN_MAX_BLOCK : 1);
+
+  if (!gen->buffer || !gen->block)
+  {
+    free(gen->buffer);
+    free(gen->block);
+    free(gen);
+    return (false);
+  }
+
+  // Queue the small GW commands for a writer thread that sends them to the
+  // device in large chunks, so rasterizing never waits for the embosser...
+  if ((gen->writer = brf_WriterCreate(device, brf_GetTime(), true)) == NULL)
+    papplLogJob(job, PAPPL_LOGLEVEL_WARN, "Unable to start the device writer, writing directly.");
+
+  gen->start = brf_GetTime();
+
+  papplJobSetData(job, gen);
 
   return (true);
 }
 
 // 'brf_gen_rwriteline()' - Write a raster line.
+//
+// Blank bytes at both ends of a line are not sent, and consecutive lines
+// that fit in the same columns are merged into a single GW command, which
+// matters on slow serial and USB links.
 
 static bool // O - `true` on success, `false` on failure
 brf_gen_rwriteline(
@@ -188,21 +500,50 @@ brf_gen_rwriteline(
     unsigned y,                  // I - Line number
     const unsigned char *line)   // I - Line
 {
-  if (line[0] || memcmp(line, line + 1, options->header.cupsBytesPerLine - 1))
-  {
-    unsigned i;                   // Looping var
-    const unsigned char *lineptr; // Pointer into line
-    unsigned char buffer[10000007],
-        *bufptr; // Pointer into buffer
+  brf_gen_job_t *gen = (brf_gen_job_t *)papplJobGetData(job);
+                                 // Raster data
+  size_t bytes = options->header.cupsBytesPerLine;
+                                 // Bytes in line
+  unsigned first,                // First byte with dots
+      last,                      // Last byte with dots
+      width;                     // Bytes to send
+  unsigned char *blockptr;       // Line in pending block
+
+  if (gen && gen->forwarded)
+    return (true);
+
+  if (!gen || bytes > gen->bufsize)
+    return (false);
+
+  if (!(brf_gen_invert_cb)(line, gen->buffer, bytes))
+    return (true);
+
+  for (first = 0; !line[first]; first ++);
+  for (last = (unsigned)bytes - 1; !line[last]; last --);
+
+  width = last - first + 1;
 
-    for (i = options->header.cupsBytesPerLine, lineptr = line, bufptr = buffer; i > 0; i--)
-      *bufptr++ = ~*lineptr++;
+  // What the one command per line encoding would have sent...
+  gen->page_raw += (size_t)snprintf(NULL, 0, "GW0,%u,%u,1\n", y, (unsigned)bytes) + bytes + 1;
 
-    papplDevicePrintf(device, "GW0,%u,%u,1\n", y, options->header.cupsBytesPerLine);
-    papplDeviceWrite(device, buffer, options->header.cupsBytesPerLine);
-    papplDevicePuts(device, "\n");
+  // Start a new command unless the line continues the pending one...
+  if (gen->block_lines > 0 && (y != gen->block_y + gen->block_lines || gen->block_lines >= BRF_GEN_MAX_BLOCK || first < gen->block_x || last >= gen->block_x + gen->block_width || gen->block_width - width > BRF_GEN_MAX_PAD))
+  {
+    if (!brf_gen_flush(gen, device))
+      return (false);
+  }
+
+  if (gen->block_lines == 0)
+  {
+    gen->block_x     = first;
+    gen->block_y     = y;
+    gen->block_width = width;
   }
 
+  blockptr = gen->block + (size_t)gen->block_lines * gen->block_width;
+  memcpy(blockptr, gen->buffer + gen->block_x, gen->block_width);
+  gen->block_lines ++;
+
   return (true);
 }
 
@@ -216,15 +557,167 @@ brf_gen_rstartpage(
     unsigned page)               // I - Page number
 {
   int ips; // Inches per second
+  brf_gen_job_t *gen = (brf_gen_job_t *)papplJobGetData(job);
+           // Raster data
 
-  (void)job;
   (void)page;
 
+  if (gen && gen->forwarded)
+    return (true);
+
+  if (gen)
+  {
+    gen->block_lines = 0;
+    gen->page_raw    = 0;
+    gen->page_sent   = 0;
+  }
+
+  if (gen && gen->writer)
+    return (brf_WriterPuts(gen->writer, "\nN\n"));
+
   papplDevicePuts(device, "\nN\n");
 
   return (true);
 }
 
+// 'brf_gen_send()' - Send a paginated BRF document to the printer.
+//
+// Files are mapped and sent a page at a time, so no copy of the job is made
+// in memory whatever its size.  Pages are delimited by form feeds, which
+// gives the real number of impressions.  Pipes and files that cannot be
+// mapped are streamed through a small buffer instead.
+
+static bool // O - `true` on success, `false` on failure
+brf_gen_send(
+    pappl_job_t *job,            // I - Job
+    int fd,                      // I - Paginated document
+    pappl_device_t *device)      // I - Output device
+{
+  struct stat fileinfo;     // Input file information
+  const char *data = NULL,  // Mapped file
+      *dataptr,             // Start of current page
+      *dataend,             // End of file
+      *ffptr;               // Form feed ending the page
+  ssize_t bytes;            // Bytes read/written
+  size_t length,            // Bytes to write
+      total = 0;            // Bytes sent
+  char buffer[BRF_GEN_BUFSIZE]; // Read/write buffer
+  int pages = 0;            // Pages sent
+  double start = brf_GetTime(), // Start of the job
+      first_byte = 0.0;     // Time until the first byte was sent
+
+  if (!fstat(fd, &fileinfo) && S_ISREG(fileinfo.st_mode) && fileinfo.st_size > 0)
+  {
+    if ((data = mmap(NULL, (size_t)fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+      data = NULL;
+  }
+
+  if (data)
+  {
+    madvise((void *)data, (size_t)fileinfo.st_size, MADV_SEQUENTIAL);
+
+    // Count the pages first so the job shows its real size...
+    dataend = data + fileinfo.st_size;
+    for (dataptr = data; dataptr < dataend && (ffptr = memchr(dataptr, '\f', (size_t)(dataend - dataptr))) != NULL; dataptr = ffptr + 1)
+      pages ++;
+    if (dataptr < dataend)
+      pages ++;
+
+    papplJobSetImpressions(job, pages);
+
+    // Then send them one by one...
+    for (dataptr = data, pages = 0; dataptr < dataend && !papplJobIsCanceled(job); dataptr += length)
+    {
+      if ((ffptr = memchr(dataptr, '\f', (size_t)(dataend - dataptr))) != NULL)
+        length = (size_t)(ffptr - dataptr) + 1;
+      else
+        length = (size_t)(dataend - dataptr);
+
+      if (papplDeviceWrite(device, dataptr, length) < 0)
+      {
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %lu bytes to printer.", (unsigned long)length);
+        munmap((void *)data, (size_t)fileinfo.st_size);
+        return (false);
+      }
+
+      if (pages == 0)
+        first_byte = brf_GetTime() - start;
+
+      papplJobSetImpressionsCompleted(job, 1);
+      pages ++;
+      total += length;
+    }
+
+    munmap((void *)data, (size_t)fileinfo.st_size);
+  }
+  else
+  {
+    bool in_page = false;   // Data after the last form feed?
+
+    while ((bytes = read(fd, buffer, sizeof(buffer))) != 0 && !papplJobIsCanceled(job))
+    {
+      if (bytes < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to read print file: %s", strerror(errno));
+        return (false);
+      }
+
+      if (papplDeviceWrite(device, buffer, (size_t)bytes) < 0)
+      {
+        papplLogJob(job, PAPPL_LOGLEVEL_ERROR, "Unable to send %d bytes to printer.", (int)bytes);
+        return (false);
+      }
+
+      if (first_byte == 0.0)
+        first_byte = brf_GetTime() - start;
+
+      total += (size_t)bytes;
+
+      for (dataptr = buffer, dataend = buffer + bytes; dataptr < dataend; dataptr = ffptr + 1)
+      {
+        if ((ffptr = memchr(dataptr, '\f', (size_t)(dataend - dataptr))) == NULL)
+        {
+          in_page = true;
+          break;
+        }
+
+        papplJobSetImpressionsCompleted(job, 1);
+        pages ++;
+        in_page = false;
+      }
+    }
+
+    if (in_page)
+    {
+      papplJobSetImpressionsCompleted(job, 1);
+      pages ++;
+    }
+
+    papplJobSetImpressions(job, pages);
+  }
+
+  // The throughput of the printer steers the jobs of its pool and the
+  // estimates of later jobs
+  if (!papplJobIsCanceled(job))
+  {
+    brf_PoolRecord(papplJobGetPrinter(job), total, brf_GetTime() - start);
+    brf_EtaRecord(job, papplPrinterGetDeviceURI(papplJobGetPrinter(job)), total, pages, brf_GetTime() - start);
+
+    if (total > 0)
+    {
+      brf_MetricsObserve(BRF_METRIC_FIRST_BYTE, papplPrinterGetName(papplJobGetPrinter(job)), NULL, first_byte);
+      brf_MetricsObserve(BRF_METRIC_DEVICE_RATE, papplPrinterGetName(papplJobGetPrinter(job)), NULL, (double)total / (brf_GetTime() - start));
+    }
+  }
+
+  papplLogJob(job, PAPPL_LOGLEVEL_DEBUG, "Sent %d page(s) to the printer.", pages);
+
+  return (true);
+}
+
 // 'Brf_generic_status()' - Get current printer status.
 
 static bool // O - `true` on success, `false` on failure